@@ -0,0 +1,126 @@
+ /** @file imrt_link_bench.c
+ *  @brief Benchmark of the IMRT link parsers
+ *
+ *  Compares the byte-at-a-time parser (on_imrt_link_byte_arrive(), used by the
+ *  bridge before imrt_link_parse()) with the buffer parser, on a stream of
+ *  event-sized messages read in chunks of different sizes.
+ *
+ *  Build with -DBUILD_BENCHMARKS=ON and run: ./imrt_link_bench [frames] [payload size]
+ *
+ *  @date July, 2019
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "imrt_link.h"
+#include "bufpool.h"
+
+#define DEFAULT_FRAMES 200000
+#define DEFAULT_PAYLOAD_SIZE 120
+
+static unsigned long g_frames_seen;
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* build a stream of n messages with payloads of (about) payload_size bytes */
+static char *make_stream(int n, int payload_size, int *stream_len)
+{
+    char *stream, *p;
+    uint16_t type_n = htons(1);
+    uint32_t size_n;
+    int i, size;
+
+    stream = malloc((size_t) n * (IMRT_LINK_HDR_LEN + payload_size + 8));
+    if (stream == NULL) return NULL;
+
+    for (i = 0, p = stream; i < n; i++) {
+        size = payload_size + (i % 8); /* vary sizes so frames do not align with reads */
+        size_n = htonl(size);
+        memcpy(p, leading, 2);
+        memcpy(p + 2, &type_n, 2);
+        memcpy(p + 4, &size_n, 4);
+        memset(p + IMRT_LINK_HDR_LEN, 'a' + i % 26, size);
+        p += IMRT_LINK_HDR_LEN + size;
+    }
+    *stream_len = p - stream;
+    return stream;
+}
+
+static void on_frame(imrt_link_message_t *message, void *arg)
+{
+    g_frames_seen++;
+}
+
+/* byte parser; counts every frame (the old bridge returned at the first frame of each read) */
+static void bench_byte_parser(const char *stream, int stream_len, int chunk, int n)
+{
+    imrt_link_recv_context_t ctx;
+    unsigned long frames = 0, first_only = 0;
+    double t;
+    int off, len, i, got;
+
+    memset(&ctx, 0, sizeof(ctx));
+    t = now_s();
+    for (off = 0; off < stream_len; off += chunk) {
+        len = stream_len - off < chunk ? stream_len - off : chunk;
+        got = 0;
+        for (i = 0; i < len; i++) {
+            if (on_imrt_link_byte_arrive((unsigned char) stream[off + i], &ctx) == 0) {
+                frames++;
+                if (got++ == 0) first_only++;
+            }
+        }
+    }
+    t = now_s() - t;
+    if (ctx.message.payload) free(ctx.message.payload);
+
+    printf("byte parser,  %6d byte reads: %10.0f frames/s (%lu/%d frames; only %lu delivered by the old read loop)\n",
+           chunk, frames / t, frames, n, first_only);
+}
+
+static void bench_span_parser(const char *stream, int stream_len, int chunk, int n)
+{
+    imrt_link_recv_context_t ctx;
+    double t;
+    int off, len;
+
+    memset(&ctx, 0, sizeof(ctx));
+    g_frames_seen = 0;
+    t = now_s();
+    for (off = 0; off < stream_len; off += chunk) {
+        len = stream_len - off < chunk ? stream_len - off : chunk;
+        imrt_link_parse(&ctx, stream + off, len, on_frame, NULL);
+    }
+    t = now_s() - t;
+    imrt_link_recv_ctx_reset(&ctx);
+
+    printf("span parser,  %6d byte reads: %10.0f frames/s (%lu/%d frames)\n", chunk, g_frames_seen / t, g_frames_seen, n);
+}
+
+int main(int argc, char *argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : DEFAULT_FRAMES;
+    int payload_size = argc > 2 ? atoi(argv[2]) : DEFAULT_PAYLOAD_SIZE;
+    int stream_len;
+    char *stream;
+
+    if ((stream = make_stream(n, payload_size, &stream_len)) == NULL) return -1;
+
+    bufpool_init(64 * 1024 * 1024);
+
+    printf("%d frames, %d bytes\n", n, stream_len);
+    bench_byte_parser(stream, stream_len, 1024, n);
+    bench_span_parser(stream, stream_len, 1024, n);
+    bench_span_parser(stream, stream_len, 64 * 1024, n);
+
+    free(stream);
+    return 0;
+}
@@ -0,0 +1,218 @@
+ /** @file link_arq_bench.c
+ *  @brief Goodput of the reliable uart link layer over a pseudo terminal
+ *
+ *  Runs the two ends of a runtime link (the bridge on the master side of an
+ *  openpty() pair, the runtime on the slave side), each in a thread, sending
+ *  a stream to the other. Each end is the link layer alone (link_arq.c, as
+ *  the bridge and the runtime use it), not the bridge or runtime process. Writes are paced to the baud rate given (a pty has
+ *  none) and bits are flipped at the error rate given, in both directions.
+ *  Reports the goodput (bytes of the stream delivered in order and intact,
+ *  per second) against the line rate, and the frames sent again and dropped.
+ *
+ *  Build with -DBUILD_BENCHMARKS=ON and run:
+ *  ./link_arq_bench [-b baud] [-e bit error rate] [-n bytes] [-w window] [-m mtu]
+ *
+ *  @date July, 2019
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <pty.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "link_arq.h"
+
+#define DEFAULT_BAUD 115200
+#define DEFAULT_BYTES (256 * 1024)
+
+/* bytes a uart takes at once (its fifo) */
+#define LINE_FIFO 64
+
+typedef struct {
+    const char *name;
+    int fd;
+    link_arq_t arq;
+    uint32_t seed;
+
+    /* line emulation: bytes that can be written now, and when they were counted */
+    double credit;
+    uint64_t credit_us;
+    uint64_t rng;
+
+    uint32_t sent;
+    uint32_t received;
+    uint32_t corrupt;
+} bench_end_t;
+
+static int g_baud = DEFAULT_BAUD;
+static double g_ber;
+static uint32_t g_bytes = DEFAULT_BYTES;
+static volatile int g_done;
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* byte at a position of the stream sent by an end */
+static unsigned char stream_byte(uint32_t seed, uint32_t pos)
+{
+    return (unsigned char) ((pos * 2654435761U ^ seed) >> 11);
+}
+
+static double rng_next(bench_end_t *end)
+{
+    end->rng ^= end->rng << 13;
+    end->rng ^= end->rng >> 7;
+    end->rng ^= end->rng << 17;
+    return (end->rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* write to the pty as a uart at g_baud would (10 bits per byte), flipping bits at g_ber */
+static int line_write(void *arg, const char *buf, uint32_t len)
+{
+    bench_end_t *end = (bench_end_t *) arg;
+    char line[LINE_FIFO];
+    uint64_t now = now_us();
+    uint32_t n, i;
+    int bit, w;
+
+    end->credit += (now - end->credit_us) * (g_baud / 10.0) / 1e6;
+    end->credit_us = now;
+    if (end->credit > LINE_FIFO) end->credit = LINE_FIFO;
+
+    n = len < (uint32_t) end->credit ? len : (uint32_t) end->credit;
+    if (n == 0) return 0;
+
+    memcpy(line, buf, n);
+    if (g_ber > 0) {
+        for (i = 0; i < n; i++)
+            for (bit = 0; bit < 8; bit++)
+                if (rng_next(end) < g_ber) line[i] ^= 1 << bit;
+    }
+
+    if ((w = write(end->fd, line, n)) < 0) return errno == EAGAIN ? 0 : -1;
+    end->credit -= w;
+    return w;
+}
+
+static void *bench_end_run(void *arg)
+{
+    bench_end_t *end = (bench_end_t *) arg;
+    char buf[4096];
+    struct pollfd pfd = { end->fd, POLLIN, 0 };
+    uint32_t n, i, timeout;
+    int r;
+
+    while (!g_done) {
+        /* keep the window full */
+        while (end->sent < g_bytes && link_arq_writable(&end->arq)) {
+            n = g_bytes - end->sent < sizeof(buf) ? g_bytes - end->sent : sizeof(buf);
+            for (i = 0; i < n; i++) buf[i] = stream_byte(end->seed, end->sent + i);
+            end->sent += link_arq_send(&end->arq, buf, n);
+        }
+        if (link_arq_flush(&end->arq, now_us() / 1000) < 0) break;
+
+        /* the line is polled every ms while frames wait for it */
+        timeout = end->arq.out_len > 0 ? 1 : link_arq_timeout(&end->arq, now_us() / 1000);
+        r = poll(&pfd, 1, timeout > 100 ? 100 : (int) timeout);
+        if (r <= 0) continue;
+
+        while ((r = read(end->fd, buf, sizeof(buf))) > 0) {
+            link_arq_input(&end->arq, buf, r, now_us() / 1000);
+            /* the peer's stream, as given to the imrt link parser */
+            while ((n = link_arq_read(&end->arq, buf, sizeof(buf))) > 0) {
+                for (i = 0; i < n; i++)
+                    if ((unsigned char) buf[i] != stream_byte(end->seed ^ 1, end->received + i)) end->corrupt++;
+                end->received += n;
+            }
+        }
+        if (link_arq_peer_reset(&end->arq)) printf("%s: peer reset\n", end->name);
+    }
+    return NULL;
+}
+
+static int open_line(int *master, int *slave)
+{
+    struct termios term;
+
+    if (openpty(master, slave, NULL, NULL, NULL) != 0) return -1;
+
+    /* no line discipline: bytes pass as they are */
+    tcgetattr(*slave, &term);
+    cfmakeraw(&term);
+    tcsetattr(*slave, TCSANOW, &term);
+
+    fcntl(*master, F_SETFL, fcntl(*master, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(*slave, F_SETFL, fcntl(*slave, F_GETFL, 0) | O_NONBLOCK);
+    return 0;
+}
+
+static void print_end(bench_end_t *end, double elapsed)
+{
+    printf("%-8s received %u bytes (%u corrupt) in %.2fs: %.0f B/s (%.0f%% of the line); frames sent %u, resent %u, dropped %u\n",
+           end->name, end->received, end->corrupt, elapsed, end->received / elapsed,
+           100.0 * end->received / elapsed / (g_baud / 10.0),
+           end->arq.stats.frames_sent, end->arq.stats.frames_resent, end->arq.stats.frames_dropped);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_end_t ends[2] = { { .name = "bridge", .seed = 0x5eed0 }, { .name = "runtime", .seed = 0x5eed1 } };
+    int window = LINK_ARQ_DEFAULT_WINDOW, mtu = LINK_ARQ_DEFAULT_MTU, c, i;
+    pthread_t threads[2];
+    uint64_t start;
+    double elapsed;
+
+    while ((c = getopt(argc, argv, "b:e:n:w:m:")) != -1) {
+        switch (c) {
+            case 'b': g_baud = atoi(optarg); break;
+            case 'e': g_ber = atof(optarg); break;
+            case 'n': g_bytes = strtoul(optarg, NULL, 10); break;
+            case 'w': window = atoi(optarg); break;
+            case 'm': mtu = atoi(optarg); break;
+            default:
+                printf("usage: %s [-b baud] [-e bit error rate] [-n bytes] [-w window] [-m mtu]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (open_line(&ends[0].fd, &ends[1].fd) != 0) {
+        perror("openpty");
+        return 1;
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (link_arq_init(&ends[i].arq, window, mtu, link_arq_rto(g_baud, window, mtu), line_write, &ends[i]) != 0) {
+            printf("Invalid window or mtu.\n");
+            return 1;
+        }
+        ends[i].rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+        ends[i].credit_us = now_us();
+    }
+
+    printf("%u bytes each way at %d baud, bit error rate %g, window %d, mtu %d\n", g_bytes, g_baud, g_ber, window, mtu);
+
+    start = now_us();
+    for (i = 0; i < 2; i++) pthread_create(&threads[i], NULL, bench_end_run, &ends[i]);
+
+    while (ends[0].received < g_bytes || ends[1].received < g_bytes) usleep(10000);
+    elapsed = (now_us() - start) / 1e6;
+    g_done = 1;
+
+    for (i = 0; i < 2; i++) pthread_join(threads[i], NULL);
+    for (i = 0; i < 2; i++) {
+        print_end(&ends[i], elapsed);
+        link_arq_destroy(&ends[i].arq);
+        close(ends[i].fd);
+    }
+    return ends[0].corrupt + ends[1].corrupt > 0;
+}
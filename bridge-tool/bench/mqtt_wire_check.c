@@ -0,0 +1,265 @@
+ /** @file mqtt_wire_check.c
+ *  @brief Checks of the MQTT packets exchanged with the broker
+ *
+ *  Runs mqtt_wire.c on a mongoose connection (one end of a socketpair, never
+ *  polled) and checks the packets it queues in the send buffer, and the
+ *  events it delivers for packets put in the receive buffer, for MQTT 5
+ *  (CONNECT and CONNACK properties, topic aliases both ways, message expiry,
+ *  receive maximum, maximum QoS and packet size, malformed packets) and
+ *  MQTT 3.1.1 (left to mongoose). No broker is needed.
+ *
+ *  Build with -DBUILD_BENCHMARKS=ON and run: ./mqtt_wire_check
+ *  Exits with 1 if a check fails.
+ *
+ *  @date July, 2019
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "mongoose.h"
+#include "mqtt_wire.h"
+
+#define CHECK(cond) do { \
+        g_checks++; \
+        if (!(cond)) { \
+            printf("FAILED (line %d): %s\n", __LINE__, #cond); \
+            g_failed++; \
+        } \
+    } while (0)
+
+static int g_checks, g_failed;
+
+/* last MQTT event delivered to the connection handler */
+static struct {
+    int ev;
+    int count;
+    uint16_t message_id;
+    uint8_t connack_ret_code;
+    char topic[64];
+    char payload[64];
+} g_last;
+
+/* a packet sent, split at the end of the fixed header */
+typedef struct {
+    uint8_t first;
+    uint32_t len;
+    uint8_t body[512];
+} packet_t;
+
+static void handler(struct mg_connection *nc, int ev, void *ev_data)
+{
+    struct mg_mqtt_message *mm = (struct mg_mqtt_message *) ev_data;
+
+    if (ev < MG_EV_MQTT_CONNECT || ev > MG_EV_MQTT_DISCONNECT) return;
+    g_last.ev = ev;
+    g_last.count++;
+    g_last.message_id = mm->message_id;
+    g_last.connack_ret_code = mm->connack_ret_code;
+    snprintf(g_last.topic, sizeof(g_last.topic), "%.*s", (int) mm->topic.len, mm->topic.p);
+    snprintf(g_last.payload, sizeof(g_last.payload), "%.*s", (int) mm->payload.len, mm->payload.p);
+}
+
+/* take the first packet of the send buffer; returns 0 if there is none */
+static int take_sent(struct mg_connection *nc, packet_t *pkt)
+{
+    struct mbuf *b = &nc->send_mbuf;
+    uint32_t shift = 0, n = 1;
+
+    memset(pkt, 0, sizeof(*pkt));
+    if (b->len < 2) return 0;
+    pkt->first = b->buf[0];
+    do {
+        pkt->len |= (uint32_t) (b->buf[n] & 0x7f) << shift;
+        shift += 7;
+    } while (b->buf[n++] & 0x80);
+    if (pkt->len > sizeof(pkt->body) || b->len < n + pkt->len) return 0;
+    memcpy(pkt->body, b->buf + n, pkt->len);
+    mbuf_remove(b, n + pkt->len);
+    return 1;
+}
+
+/* give bytes to the connection as if received from the broker */
+static void feed(struct mg_connection *nc, const void *bytes, int len)
+{
+    mbuf_append(&nc->recv_mbuf, bytes, len);
+    nc->proto_handler(nc, MG_EV_RECV, &len);
+}
+
+static struct mg_connection *new_conn(struct mg_mgr *mgr, int fds[2])
+{
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return NULL;
+    return mg_add_sock(mgr, fds[0], handler);
+}
+
+static void check_v5(struct mg_mgr *mgr)
+{
+    mqtt_wire_opts_t opts = { MQTT_WIRE_V5, 8, 60 };
+    struct mg_send_mqtt_handshake_opts hs;
+    struct mg_connection *nc;
+    packet_t pkt;
+    int fds[2];
+    char big[300];
+
+    static const uint8_t connack[] = {
+        0x20, 16, 0x00, 0x00, 13,
+        0x21, 0x00, 0x03,               /* receive maximum 3 */
+        0x22, 0x00, 0x04,               /* topic alias maximum 4 */
+        0x24, 0x01,                     /* maximum QoS 1 */
+        0x27, 0x00, 0x00, 0x00, 0xc8    /* maximum packet size 200 */
+    };
+    static const uint8_t publish_alias[] = {
+        0x32, 16, 0x00, 0x03, 'x', '/', 'y', 0x00, 0x09, 3, 0x23, 0x00, 0x02, 'h', 'e', 'l', 'l', 'o'
+    };
+    static const uint8_t publish_by_alias[] = {
+        0x30, 11, 0x00, 0x00, 3, 0x23, 0x00, 0x02, 'a', 'g', 'a', 'i', 'n'
+    };
+    static const uint8_t puback[] = { 0x40, 0x02, 0x00, 0x07 };
+    static const uint8_t pubrec[] = { 0x50, 0x02, 0x00, 0x08 };
+    static const uint8_t pubrel[] = { 0x62, 0x02, 0x00, 0x0a };
+    static const uint8_t unknown_alias[] = { 0x30, 6, 0x00, 0x00, 3, 0x23, 0x00, 0x03 };
+
+    printf("MQTT 5\n");
+    mqtt_wire_init(&opts);
+    if ((nc = new_conn(mgr, fds)) == NULL) {
+        CHECK(nc != NULL);
+        return;
+    }
+
+    /* CONNECT: protocol level 5, our topic alias maximum */
+    memset(&hs, 0, sizeof(hs));
+    hs.flags = MG_MQTT_CLEAN_SESSION;
+    hs.keep_alive = 30;
+    mqtt_wire_connect(nc, "bridge", hs);
+    CHECK(take_sent(nc, &pkt));
+    CHECK(pkt.first == 0x10);
+    CHECK(memcmp(pkt.body, "\x00\x04MQTT\x05", 7) == 0);
+    CHECK(pkt.body[7] == 0x02);
+    CHECK(pkt.body[8] == 0 && pkt.body[9] == 30);
+    CHECK(pkt.body[10] == 3 && memcmp(pkt.body + 11, "\x22\x00\x08", 3) == 0);
+    CHECK(memcmp(pkt.body + 14, "\x00\x06" "bridge", 8) == 0);
+    CHECK(mqtt_wire_receive_maximum() == 65535);
+
+    /* CONNACK: the broker's limits are reported */
+    feed(nc, connack, sizeof(connack));
+    CHECK(g_last.ev == MG_EV_MQTT_CONNACK && g_last.connack_ret_code == 0);
+    CHECK(mqtt_wire_receive_maximum() == 3);
+    CHECK(mqtt_wire_maximum_qos() == 1);
+
+    /* first publish to a topic: topic, message expiry and a new alias */
+    CHECK(mqtt_wire_publish(nc, "a/b", 7, MG_MQTT_QOS(1), "hi", 2) == 0);
+    CHECK(take_sent(nc, &pkt));
+    CHECK(pkt.first == 0x32);
+    CHECK(pkt.len == 5 + 2 + 1 + 8 + 2);
+    CHECK(memcmp(pkt.body, "\x00\x03" "a/b" "\x00\x07", 7) == 0);
+    CHECK(pkt.body[7] == 8 && memcmp(pkt.body + 8, "\x02\x00\x00\x00\x3c" "\x23\x00\x01", 8) == 0);
+    CHECK(memcmp(pkt.body + 16, "hi", 2) == 0);
+
+    /* again: the topic is sent empty */
+    CHECK(mqtt_wire_publish(nc, "a/b", 0, MG_MQTT_QOS(0), "hi", 2) == 0);
+    CHECK(take_sent(nc, &pkt));
+    CHECK(pkt.first == 0x30);
+    CHECK(memcmp(pkt.body, "\x00\x00", 2) == 0);
+    CHECK(pkt.body[2] == 8 && memcmp(pkt.body + 8, "\x23\x00\x01", 3) == 0);
+
+    /* the broker allows 4 aliases: the fifth topic is sent in full, without alias */
+    mqtt_wire_publish(nc, "t/1", 0, MG_MQTT_QOS(0), "", 0);
+    mqtt_wire_publish(nc, "t/2", 0, MG_MQTT_QOS(0), "", 0);
+    mqtt_wire_publish(nc, "t/3", 0, MG_MQTT_QOS(0), "", 0);
+    while (take_sent(nc, &pkt))
+        ;
+    CHECK(mqtt_wire_publish(nc, "t/4", 0, MG_MQTT_QOS(0), "x", 1) == 0);
+    CHECK(take_sent(nc, &pkt));
+    CHECK(memcmp(pkt.body, "\x00\x03" "t/4", 5) == 0);
+    CHECK(pkt.body[5] == 5 && pkt.body[6] == 0x02);
+
+    /* larger than the broker's maximum packet size: not sent */
+    memset(big, 'x', sizeof(big));
+    CHECK(mqtt_wire_publish_fits("a/b", 1, 100));
+    CHECK(!mqtt_wire_publish_fits("a/b", 1, sizeof(big)));
+    CHECK(mqtt_wire_publish(nc, "a/b", 8, MG_MQTT_QOS(1), big, sizeof(big)) == -1);
+    CHECK(nc->send_mbuf.len == 0);
+
+    /* publishes from the broker: an alias is defined, then used; QoS 1 is acknowledged */
+    feed(nc, publish_alias, sizeof(publish_alias));
+    CHECK(g_last.ev == MG_EV_MQTT_PUBLISH && strcmp(g_last.topic, "x/y") == 0 && strcmp(g_last.payload, "hello") == 0);
+    CHECK(g_last.message_id == 9);
+    CHECK(take_sent(nc, &pkt) && pkt.first == 0x40 && pkt.len == 2 && pkt.body[1] == 9);
+    feed(nc, publish_by_alias, sizeof(publish_by_alias));
+    CHECK(g_last.ev == MG_EV_MQTT_PUBLISH && strcmp(g_last.topic, "x/y") == 0 && strcmp(g_last.payload, "again") == 0);
+
+    /* acknowledgements */
+    feed(nc, puback, sizeof(puback));
+    CHECK(g_last.ev == MG_EV_MQTT_PUBACK && g_last.message_id == 7);
+    feed(nc, pubrec, sizeof(pubrec));
+    CHECK(g_last.ev == MG_EV_MQTT_PUBREC && g_last.message_id == 8);
+    feed(nc, pubrel, sizeof(pubrel));
+    CHECK(g_last.ev == MG_EV_MQTT_PUBREL && g_last.message_id == 10);
+    CHECK(take_sent(nc, &pkt) && pkt.first == 0x70 && pkt.body[1] == 10);
+
+    /* an alias the broker never defined: DISCONNECT with a protocol error */
+    g_last.count = 0;
+    feed(nc, unknown_alias, sizeof(unknown_alias));
+    CHECK(g_last.count == 0);
+    CHECK(take_sent(nc, &pkt) && pkt.first == 0xe0 && pkt.len == 1 && pkt.body[0] == 0x82);
+    CHECK(nc->flags & MG_F_SEND_AND_CLOSE);
+
+    close(fds[1]);
+}
+
+static void check_v311(struct mg_mgr *mgr)
+{
+    mqtt_wire_opts_t opts = { MQTT_WIRE_V311, 8, 60 };
+    struct mg_send_mqtt_handshake_opts hs;
+    struct mg_connection *nc;
+    packet_t pkt;
+    int fds[2];
+
+    static const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    static const uint8_t publish[] = { 0x30, 7, 0x00, 0x03, 'x', '/', 'y', 'h', 'i' };
+
+    printf("MQTT 3.1.1\n");
+    mqtt_wire_init(&opts);
+    if ((nc = new_conn(mgr, fds)) == NULL) {
+        CHECK(nc != NULL);
+        return;
+    }
+
+    memset(&hs, 0, sizeof(hs));
+    mqtt_wire_connect(nc, "bridge", hs);
+    CHECK(take_sent(nc, &pkt));
+    CHECK(pkt.first == 0x10 && memcmp(pkt.body, "\x00\x04MQTT\x04", 7) == 0);
+
+    feed(nc, connack, sizeof(connack));
+    CHECK(g_last.ev == MG_EV_MQTT_CONNACK && g_last.connack_ret_code == 0);
+    CHECK(mqtt_wire_receive_maximum() == 65535);
+    CHECK(mqtt_wire_maximum_qos() == 2);
+
+    /* no properties, the topic always in full */
+    CHECK(mqtt_wire_publish(nc, "a/b", 5, MG_MQTT_QOS(1), "hi", 2) == 0);
+    CHECK(take_sent(nc, &pkt));
+    CHECK(pkt.first == 0x32 && pkt.len == 9 && memcmp(pkt.body, "\x00\x03" "a/b" "\x00\x05" "hi", 9) == 0);
+    CHECK(mqtt_wire_publish(nc, "a/b", 6, MG_MQTT_QOS(1), "hi", 2) == 0);
+    CHECK(take_sent(nc, &pkt) && memcmp(pkt.body, "\x00\x03" "a/b", 5) == 0);
+    CHECK(mqtt_wire_publish_fits("a/b", 1, 100000));
+
+    feed(nc, publish, sizeof(publish));
+    CHECK(g_last.ev == MG_EV_MQTT_PUBLISH && strcmp(g_last.topic, "x/y") == 0 && strcmp(g_last.payload, "hi") == 0);
+
+    close(fds[1]);
+}
+
+int main(int argc, char *argv[])
+{
+    struct mg_mgr mgr;
+
+    mg_mgr_init(&mgr, NULL);
+    check_v5(&mgr);
+    check_v311(&mgr);
+    mg_mgr_free(&mgr);
+
+    printf("%d checks, %d failed\n", g_checks, g_failed);
+    return g_failed > 0;
+}
@@ -0,0 +1,110 @@
+/** @file aot.c
+ *  @brief Ahead-of-time compilation of modules
+ *
+ *  The compiler is run by a shell, detached from the caller (its parent exits
+ *  right away, so there is nothing to wait for), with the file names as
+ *  positional parameters.
+ *
+ *  @date July, 2019
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aot.h"
+
+#define AOT_FILE_EXT ".aot"
+#define WASM_FILE_EXT ".wasm"
+
+/* $1: compiler, $2: target, $3: temporary image, $4: wasm file, $5: image */
+static const char g_compile_script[] =
+    "\"$1\" --target=\"$2\" -o \"$3\" \"$4\" > /dev/null 2>&1"
+    " && mv -f \"$3\" \"$5\" && rm -f \"$5.failed\""
+    " || { rm -f \"$3\"; touch \"$5.failed\"; }";
+
+int aot_image_path(const char *src, const char *target, char *buf, size_t size)
+{
+    size_t len = strlen(src);
+    int n;
+
+    if (len > strlen(WASM_FILE_EXT) && strcmp(src + len - strlen(WASM_FILE_EXT), WASM_FILE_EXT) == 0)
+        len -= strlen(WASM_FILE_EXT);
+
+    n = snprintf(buf, size, "%.*s.%s%s", (int) len, src, target, AOT_FILE_EXT);
+    return n < 0 || (size_t) n >= size ? -1 : 0;
+}
+
+/* 1 if path exists and was modified after src (or at the same time) */
+static int aot_newer(const char *path, struct stat *src_st)
+{
+    struct stat st;
+
+    return stat(path, &st) == 0 && st.st_mtime >= src_st->st_mtime;
+}
+
+int aot_image_is_current(const char *src, const char *image)
+{
+    struct stat src_st;
+
+    return stat(src, &src_st) == 0 && aot_newer(image, &src_st);
+}
+
+/* close the descriptors inherited from the caller (sockets, mapped modules), except stdio */
+static void aot_close_fds()
+{
+    long fd, max;
+
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, 3, ~0U, 0) == 0) return;
+#endif
+    max = sysconf(_SC_OPEN_MAX);
+    for (fd = 3; fd < (max > 0 ? max : 1024); fd++)
+        close(fd);
+}
+
+int aot_compile(const char *compiler, const char *src, const char *target)
+{
+    char image[512], tmp[520], failed[520];
+    struct stat src_st, st;
+    pid_t pid;
+    int fd;
+
+    if (stat(src, &src_st) != 0 || aot_image_path(src, target, image, sizeof(image)) != 0) return -1;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", image);
+    snprintf(failed, sizeof(failed), "%s.failed", image);
+
+    if (aot_newer(image, &src_st) || aot_newer(failed, &src_st)) return 0;
+
+    /* the temporary image marks a compilation running */
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0) {
+        if (stat(tmp, &st) != 0 || time(NULL) - st.st_mtime < AOT_COMPILE_TIMEOUT_S) return 0;
+        unlink(tmp);
+        if ((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0) return 0;
+    }
+    close(fd);
+
+    printf("Compiling %s for %s.\n", src, target);
+
+    if ((pid = fork()) < 0) {
+        perror("aot compile");
+        unlink(tmp);
+        return -1;
+    }
+    if (pid == 0) {
+        /* the compilation runs in a grandchild, reparented to init when the child exits */
+        if (fork() == 0) {
+            aot_close_fds();
+            execl("/bin/sh", "sh", "-c", g_compile_script, "aot", compiler, target, tmp, src, image, (char *) NULL);
+            _exit(127);
+        }
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    return 1;
+}
@@ -0,0 +1,53 @@
+ /** @file aot.h
+ *  @brief Definitions for ahead-of-time compilation of modules
+ *
+ *  Definitions for compiling wasm files to AoT images with an external
+ *  compiler (WAMR's wamrc: <compiler> --target=<target> -o <image> <file>).
+ *  The image of <file>.wasm for a target is <file>.<target>.aot, next to it.
+ *  Compilation runs in the background: the image is written to
+ *  <image>.tmp (which also marks the compilation as running) and renamed when
+ *  done; if it fails, <image>.failed is created, so the same file is not
+ *  compiled again until it changes. Both the bridge and the upload utility use
+ *  this file; it only depends on libc.
+ *
+ *  @date July, 2019
+ */
+#ifndef AOT_H_
+#define AOT_H_
+
+#include <stddef.h>
+
+/* a compilation running longer is considered dead, and started again */
+#define AOT_COMPILE_TIMEOUT_S 600
+
+/**
+ * Get the path of the AoT image of a wasm file
+ *
+ * @param src the wasm file
+ * @param target the target of the image (e.g. x86_64, i386, thumbv7em)
+ * @param buf where to store the path
+ * @param size size of buf
+ * @return returns 0 (success), -1 (path too long)
+ */
+int aot_image_path(const char *src, const char *target, char *buf, size_t size);
+
+/**
+ * Check if an AoT image is up to date (not older than its wasm file)
+ *
+ * @param src the wasm file
+ * @param image the image
+ * @return 1 if up to date, 0 if not (missing or older)
+ */
+int aot_image_is_current(const char *src, const char *image);
+
+/**
+ * Start compiling a wasm file, unless its image is up to date, being compiled, or failed to compile
+ *
+ * @param compiler the compiler
+ * @param src the wasm file
+ * @param target the target of the image
+ * @return returns 1 if started, 0 if not needed, -1 on error
+ */
+int aot_compile(const char *compiler, const char *src, const char *target);
+
+#endif
@@ -0,0 +1,836 @@
+/** @file attr_json.c
+ *  @brief Transcoding between JSON text and attribute containers
+ *
+ *  The JSON text is scanned once and the attributes are written straight into
+ *  a buffer sized from the text length. The container header is copied from an
+ *  empty container made by attr_container_create(), so the layout stays the one
+ *  of the attr_container library.
+ *
+ *  @date July, 2019
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "attr_json.h"
+#include "bridge_tool_utils.h"
+#include "bufpool.h"
+#include "cJSON.h"
+
+/* nesting depth accepted in skipped values */
+#define ATTR_JSON_MAX_DEPTH 64
+
+/* longest number text converted (as cJSON) */
+#define ATTR_JSON_MAX_NUMBER_LEN 63
+
+/* zeroed bytes after the container, covering serialize length vs. buffer layout differences */
+#define ATTR_JSON_PAD 8
+
+extern char *attr_container_get_attr_begin(const attr_container_t *attr_cont, uint32_t *p_total_length, uint16_t *p_attr_num);
+
+/* result of parsing the text */
+enum {
+    ATTR_JSON_OK = 0,     /* object converted */
+    ATTR_JSON_INVALID,    /* not valid JSON; may be stored as raw_str */
+    ATTR_JSON_REJECTED,   /* valid JSON, but rejected by json2attr() */
+    ATTR_JSON_DUP_KEY     /* repeated key; converted through cJSON */
+};
+
+/* layout of an empty container, taken from attr_container_create("") */
+static struct {
+    char hdr[64];
+    uint32_t hdr_len;       /* bytes up to (and including) the attribute count */
+    uint32_t attr_num_off;  /* offset of the attribute count */
+    uint32_t buf_off;       /* offset of the total length field (attr_container_t.buf) */
+    uint32_t ser_extra;     /* serialized length minus total length */
+    char *empty;            /* the empty container, serialized */
+    uint32_t empty_len;
+    int ok;
+} g_tmpl;
+
+static pthread_once_t g_tmpl_once = PTHREAD_ONCE_INIT;
+
+typedef struct {
+    const char *p;
+    const char *end;
+} json_in_t;
+
+static void attr_json_init_template(void)
+{
+    attr_container_t *cont;
+    uint32_t total_len;
+    uint16_t attr_num;
+    char *begin;
+
+    if ((cont = attr_container_create("")) == NULL) return;
+
+    begin = attr_container_get_attr_begin(cont, &total_len, &attr_num);
+    g_tmpl.empty_len = attr_container_get_serialize_length(cont);
+    if (begin != NULL && (uint32_t) (begin - (char *) cont) <= sizeof(g_tmpl.hdr)
+            && (g_tmpl.empty = malloc(g_tmpl.empty_len)) != NULL) {
+        g_tmpl.hdr_len = begin - (char *) cont;
+        g_tmpl.attr_num_off = g_tmpl.hdr_len - sizeof(uint16_t);
+        g_tmpl.buf_off = offsetof(attr_container_t, buf);
+        g_tmpl.ser_extra = g_tmpl.empty_len - total_len;
+        memcpy(g_tmpl.hdr, cont, g_tmpl.hdr_len);
+        memcpy(g_tmpl.empty, cont, g_tmpl.empty_len);
+        g_tmpl.ok = 1;
+    }
+    attr_container_destroy(cont);
+}
+
+static void json_skip_ws(json_in_t *in)
+{
+    while (in->p < in->end && (*in->p == ' ' || *in->p == '\t' || *in->p == '\n' || *in->p == '\r'))
+        in->p++;
+}
+
+static int json_hex4(const char *p, uint32_t *cp)
+{
+    int i;
+
+    *cp = 0;
+    for (i = 0; i < 4; i++, p++) {
+        *cp <<= 4;
+        if (*p >= '0' && *p <= '9') *cp |= *p - '0';
+        else if (*p >= 'a' && *p <= 'f') *cp |= *p - 'a' + 10;
+        else if (*p >= 'A' && *p <= 'F') *cp |= *p - 'A' + 10;
+        else return -1;
+    }
+    return 0;
+}
+
+static int utf8_encode(uint32_t cp, char *out)
+{
+    if (cp < 0x80) {
+        if (out) out[0] = cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        if (out) {
+            out[0] = 0xC0 | (cp >> 6);
+            out[1] = 0x80 | (cp & 0x3F);
+        }
+        return 2;
+    }
+    if (cp < 0x10000) {
+        if (out) {
+            out[0] = 0xE0 | (cp >> 12);
+            out[1] = 0x80 | ((cp >> 6) & 0x3F);
+            out[2] = 0x80 | (cp & 0x3F);
+        }
+        return 3;
+    }
+    if (out) {
+        out[0] = 0xF0 | (cp >> 18);
+        out[1] = 0x80 | ((cp >> 12) & 0x3F);
+        out[2] = 0x80 | ((cp >> 6) & 0x3F);
+        out[3] = 0x80 | (cp & 0x3F);
+    }
+    return 4;
+}
+
+/**
+ * Parse a string, unescaping it; the unescaped string is never longer than the text
+ *
+ * @param in input, at the opening quote; moved past the closing quote
+ * @param out where to write the unescaped string (may be NULL to only skip it)
+ *
+ * @return returns the length of the unescaped string, -1 if invalid
+ */
+static int json_parse_string(json_in_t *in, char *out)
+{
+    const char *p = in->p + 1, *run;
+    uint32_t cp, lo;
+    int n = 0;
+    char c;
+
+    if (in->p >= in->end || *in->p != '"') return -1;
+
+    while (p < in->end && *p != '"') {
+        if (*p != '\\') {
+            run = p;
+            while (p < in->end && *p != '"' && *p != '\\') p++;
+            if (out) memcpy(out + n, run, p - run);
+            n += p - run;
+            continue;
+        }
+
+        if (++p >= in->end) return -1;
+        switch (*p) {
+        case '"': case '\\': case '/': c = *p; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'u':
+            if (p + 4 >= in->end || json_hex4(p + 1, &cp) != 0) return -1;
+            p += 4;
+            if (cp >= 0xD800 && cp <= 0xDBFF) {
+                /* surrogate pair */
+                if (p + 6 >= in->end || p[1] != '\\' || p[2] != 'u' || json_hex4(p + 3, &lo) != 0
+                        || lo < 0xDC00 || lo > 0xDFFF)
+                    return -1;
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                p += 6;
+            } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                return -1;
+            }
+            n += utf8_encode(cp, out ? out + n : NULL);
+            p++;
+            continue;
+        default:
+            return -1;
+        }
+        if (out) out[n] = c;
+        n++;
+        p++;
+    }
+    if (p >= in->end) return -1;
+
+    in->p = p + 1;
+    return n;
+}
+
+static int json_parse_number(json_in_t *in, double *value)
+{
+    char tmp[ATTR_JSON_MAX_NUMBER_LEN + 1], *end;
+    const char *p = in->p;
+    int n = 0;
+
+    while (p < in->end && n < ATTR_JSON_MAX_NUMBER_LEN
+           && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E'))
+        tmp[n++] = *p++;
+    if (n == 0) return -1;
+    tmp[n] = '\0';
+
+    *value = strtod(tmp, &end);
+    if (end == tmp) return -1;
+
+    in->p += end - tmp;
+    return 0;
+}
+
+static int json_parse_literal(json_in_t *in, const char *literal)
+{
+    size_t n = strlen(literal);
+
+    if ((size_t) (in->end - in->p) < n || memcmp(in->p, literal, n) != 0) return -1;
+    in->p += n;
+    return 0;
+}
+
+/**
+ * Skip (and validate) any value
+ *
+ * @param in input, at the value; moved past it
+ * @param depth nesting depth of the value
+ *
+ * @return returns 0 on success, -1 if invalid
+ */
+static int json_skip_value(json_in_t *in, int depth)
+{
+    double d;
+    char close;
+
+    if (in->p >= in->end || depth > ATTR_JSON_MAX_DEPTH) return -1;
+
+    switch (*in->p) {
+    case '"':
+        return json_parse_string(in, NULL) < 0 ? -1 : 0;
+    case 't':
+        return json_parse_literal(in, "true");
+    case 'f':
+        return json_parse_literal(in, "false");
+    case 'n':
+        return json_parse_literal(in, "null");
+    case '{':
+    case '[':
+        close = *in->p == '{' ? '}' : ']';
+        in->p++;
+        json_skip_ws(in);
+        if (in->p < in->end && *in->p == close) {
+            in->p++;
+            return 0;
+        }
+        for (;;) {
+            if (close == '}') {
+                if (json_parse_string(in, NULL) < 0) return -1;
+                json_skip_ws(in);
+                if (in->p >= in->end || *in->p != ':') return -1;
+                in->p++;
+                json_skip_ws(in);
+            }
+            if (json_skip_value(in, depth + 1) != 0) return -1;
+            json_skip_ws(in);
+            if (in->p >= in->end) return -1;
+            if (*in->p == close) {
+                in->p++;
+                return 0;
+            }
+            if (*in->p != ',') return -1;
+            in->p++;
+            json_skip_ws(in);
+        }
+    default:
+        return json_parse_number(in, &d);
+    }
+}
+
+/* size of the value of an attribute of the given type */
+static uint32_t attr_value_size(char type, const char *value)
+{
+    uint16_t len16;
+    uint32_t len32;
+
+    switch (type) {
+    case ATTR_TYPE_DOUBLE:
+        return sizeof(double);
+    case ATTR_TYPE_BOOLEAN:
+        return 1;
+    case ATTR_TYPE_STRING:
+        memcpy(&len16, value, sizeof(len16));
+        return sizeof(len16) + len16;
+    case ATTR_TYPE_BYTEARRAY:
+        memcpy(&len32, value, sizeof(len32));
+        return sizeof(len32) + len32;
+    default:
+        return 0;
+    }
+}
+
+/* check if the key at key_p (length and key) was already written between attrs and key_p */
+static int attr_key_exists(const char *attrs, const char *key_p)
+{
+    const char *p = attrs;
+    uint16_t key_len, len;
+
+    memcpy(&key_len, key_p, sizeof(key_len));
+    while (p < key_p) {
+        memcpy(&len, p, sizeof(len));
+        if (len == key_len && memcmp(p + sizeof(len), key_p + sizeof(key_len), len) == 0) return 1;
+        p += sizeof(len) + len;
+        p += 1 + attr_value_size(*p, p + 1);
+    }
+    return 0;
+}
+
+/**
+ * Convert the members of the top-level object to attributes
+ *
+ * @param in input text
+ * @param attrs where to write the attributes; large enough for any text of this length
+ * @param attrs_end where to store the end of the attributes
+ * @param attr_num where to store the number of attributes
+ *
+ * @return returns one of ATTR_JSON_OK, ATTR_JSON_INVALID, ATTR_JSON_REJECTED, ATTR_JSON_DUP_KEY
+ */
+static int json_object2attrs(json_in_t *in, char *attrs, char **attrs_end, uint16_t *attr_num)
+{
+    char *out = attrs, *attr, *value;
+    uint16_t len16;
+    uint32_t len32;
+    double d;
+    int n, count, too_long, ret = ATTR_JSON_OK;
+
+    *attr_num = 0;
+
+    json_skip_ws(in);
+    if (in->p >= in->end) return ATTR_JSON_INVALID;
+    if (*in->p != '{') return json_skip_value(in, 0) == 0 ? ATTR_JSON_REJECTED : ATTR_JSON_INVALID;
+    in->p++;
+
+    json_skip_ws(in);
+    if (in->p < in->end && *in->p == '}') {
+        *attrs_end = out;
+        return ATTR_JSON_OK;
+    }
+
+    for (;;) {
+        /* key (with its terminating NUL) */
+        attr = out;
+        if ((n = json_parse_string(in, attr + sizeof(len16))) < 0) return ATTR_JSON_INVALID;
+        /* attributes with strings too long for their 16-bit length are dropped, as json2attr() does */
+        too_long = n + 1 > UINT16_MAX;
+        attr[sizeof(len16) + n] = '\0';
+        len16 = n + 1;
+        memcpy(attr, &len16, sizeof(len16));
+        value = attr + sizeof(len16) + n + 1;
+
+        json_skip_ws(in);
+        if (in->p >= in->end || *in->p != ':') return ATTR_JSON_INVALID;
+        in->p++;
+        json_skip_ws(in);
+        if (in->p >= in->end) return ATTR_JSON_INVALID;
+
+        /* value; out is only moved past the attribute if it is kept */
+        switch (*in->p) {
+        case '"':
+            *value = ATTR_TYPE_STRING;
+            if ((n = json_parse_string(in, value + 1 + sizeof(len16))) < 0) return ATTR_JSON_INVALID;
+            too_long |= n + 1 > UINT16_MAX;
+            value[1 + sizeof(len16) + n] = '\0';
+            len16 = n + 1;
+            memcpy(value + 1, &len16, sizeof(len16));
+            out = value + 1 + sizeof(len16) + len16;
+            break;
+        case 't':
+        case 'f':
+            *value = ATTR_TYPE_BOOLEAN;
+            value[1] = *in->p == 't';
+            if (json_parse_literal(in, *in->p == 't' ? "true" : "false") != 0) return ATTR_JSON_INVALID;
+            out = value + 2;
+            break;
+        case '[':
+            /* leading numbers become a byte array; the rest is only validated */
+            *value = ATTR_TYPE_BYTEARRAY;
+            in->p++;
+            json_skip_ws(in);
+            len32 = 0;
+            count = 0;
+            while (in->p < in->end && *in->p != ']') {
+                if (count > 0) {
+                    if (*in->p != ',') return ATTR_JSON_INVALID;
+                    in->p++;
+                    json_skip_ws(in);
+                }
+                if (in->p < in->end && len32 == (uint32_t) count && *in->p != '"' && *in->p != '{'
+                        && *in->p != '[' && *in->p != 't' && *in->p != 'f' && *in->p != 'n') {
+                    if (json_parse_number(in, &d) != 0) return ATTR_JSON_INVALID;
+                    value[1 + sizeof(len32) + len32++] = (int8_t) d;
+                } else if (json_skip_value(in, 1) != 0) {
+                    return ATTR_JSON_INVALID;
+                }
+                count++;
+                json_skip_ws(in);
+            }
+            if (in->p >= in->end) return ATTR_JSON_INVALID;
+            in->p++;
+            /* json2attr() fails on empty arrays */
+            if (count == 0) ret = ATTR_JSON_REJECTED;
+            if (len32 > 0) {
+                memcpy(value + 1, &len32, sizeof(len32));
+                out = value + 1 + sizeof(len32) + len32;
+            }
+            break;
+        case '{':
+        case 'n':
+            /* objects and nulls are ignored */
+            if (json_skip_value(in, 0) != 0) return ATTR_JSON_INVALID;
+            break;
+        default:
+            *value = ATTR_TYPE_DOUBLE;
+            if (json_parse_number(in, &d) != 0) return ATTR_JSON_INVALID;
+            memcpy(value + 1, &d, sizeof(d));
+            out = value + 1 + sizeof(d);
+            break;
+        }
+
+        if (too_long) out = attr;
+        if (out != attr) {
+            if (attr_key_exists(attrs, attr)) ret = ret == ATTR_JSON_OK ? ATTR_JSON_DUP_KEY : ret;
+            (*attr_num)++;
+        }
+
+        json_skip_ws(in);
+        if (in->p >= in->end) return ATTR_JSON_INVALID;
+        if (*in->p == '}') break;
+        if (*in->p != ',') return ATTR_JSON_INVALID;
+        in->p++;
+        json_skip_ws(in);
+    }
+
+    *attrs_end = out;
+    return ret;
+}
+
+/**
+ * Finish a container whose attributes were written after the template header
+ *
+ * @param buf the buffer holding the container
+ * @param attrs_end end of the attributes
+ * @param attr_num number of attributes
+ *
+ * @return returns the serialized length of the container
+ */
+static uint32_t attr_json_finish(char *buf, char *attrs_end, uint16_t attr_num)
+{
+    uint32_t total_len = attrs_end - (buf + g_tmpl.buf_off);
+
+    memcpy(buf + g_tmpl.attr_num_off, &attr_num, sizeof(attr_num));
+    memcpy(buf + g_tmpl.buf_off, &total_len, sizeof(total_len));
+    memset(attrs_end, 0, ATTR_JSON_PAD);
+    return g_tmpl.ser_extra + total_len;
+}
+
+/* copy a container made by the attr_container library to a pooled buffer */
+static attr_container_t *attr_json_copy(const attr_container_t *cont, uint32_t *attr_len)
+{
+    uint32_t len = attr_container_get_serialize_length(cont);
+    char *buf;
+
+    if ((buf = bufpool_alloc(len)) == NULL) return NULL;
+    memcpy(buf, cont, len);
+    *attr_len = len;
+    return (attr_container_t *) buf;
+}
+
+/* convert through cJSON and json2attr(); used for the rare texts the one-pass conversion does not handle */
+static attr_container_t *json_text2attr_dom(const char *json, uint32_t len, uint32_t *attr_len)
+{
+    attr_container_t *cont, *ret = NULL;
+    cJSON *root;
+    char *text;
+
+    if ((text = malloc(len + 1)) == NULL) return NULL;
+    memcpy(text, json, len);
+    text[len] = '\0';
+
+    root = cJSON_Parse(text);
+    free(text);
+    if (root == NULL) return NULL;
+
+    if ((cont = json2attr(root)) != NULL) {
+        ret = attr_json_copy(cont, attr_len);
+        attr_container_destroy(cont);
+    }
+    cJSON_Delete(root);
+    return ret;
+}
+
+attr_container_t *json_text2attr(const char *json, uint32_t len, uint32_t *attr_len, bool raw_str)
+{
+    json_in_t in = { json, json + len };
+    char *buf, *attrs_end;
+    uint16_t attr_num, len16;
+    uint32_t size;
+    int ret;
+
+    pthread_once(&g_tmpl_once, attr_json_init_template);
+    if (!g_tmpl.ok) return NULL;
+
+    /* each attribute takes at most 3 times its text (e.g. "":1 is 4 bytes of text and 12 of attribute) */
+    size = g_tmpl.hdr_len + 3 * len + ATTR_JSON_PAD;
+    if ((buf = bufpool_alloc(size)) == NULL) return NULL;
+    memcpy(buf, g_tmpl.hdr, g_tmpl.hdr_len);
+
+    ret = json_object2attrs(&in, buf + g_tmpl.hdr_len, &attrs_end, &attr_num);
+
+    if (ret == ATTR_JSON_OK) {
+        if (attr_num == 0) {
+            /* keep the spare room of an empty container, as its readers expect it */
+            bufpool_free(buf);
+            if ((buf = bufpool_alloc(g_tmpl.empty_len)) == NULL) return NULL;
+            memcpy(buf, g_tmpl.empty, g_tmpl.empty_len);
+            *attr_len = g_tmpl.empty_len;
+            return (attr_container_t *) buf;
+        }
+        *attr_len = attr_json_finish(buf, attrs_end, attr_num);
+        return (attr_container_t *) buf;
+    }
+
+    if (ret == ATTR_JSON_INVALID && raw_str) {
+        /* not JSON: pass the text as a single string attribute */
+        if (len + 1 > UINT16_MAX) {
+            printf("Message of %u bytes too long for a raw_str attribute.\n", len);
+            bufpool_free(buf);
+            return NULL;
+        }
+        if (size < g_tmpl.hdr_len + sizeof(ATTR_JSON_RAW_STR_KEY) + len + 16) {
+            bufpool_free(buf);
+            if ((buf = bufpool_alloc(g_tmpl.hdr_len + sizeof(ATTR_JSON_RAW_STR_KEY) + len + 16)) == NULL) return NULL;
+            memcpy(buf, g_tmpl.hdr, g_tmpl.hdr_len);
+        }
+        attrs_end = buf + g_tmpl.hdr_len;
+        len16 = sizeof(ATTR_JSON_RAW_STR_KEY);
+        memcpy(attrs_end, &len16, sizeof(len16));
+        memcpy(attrs_end + sizeof(len16), ATTR_JSON_RAW_STR_KEY, len16);
+        attrs_end += sizeof(len16) + len16;
+        *attrs_end++ = ATTR_TYPE_STRING;
+        len16 = len + 1;
+        memcpy(attrs_end, &len16, sizeof(len16));
+        memcpy(attrs_end + sizeof(len16), json, len);
+        attrs_end[sizeof(len16) + len] = '\0';
+        attrs_end += sizeof(len16) + len16;
+        *attr_len = attr_json_finish(buf, attrs_end, 1);
+        return (attr_container_t *) buf;
+    }
+
+    bufpool_free(buf);
+    if (ret == ATTR_JSON_DUP_KEY) return json_text2attr_dom(json, len, attr_len);
+    return NULL;
+}
+
+/* initial size of output buffers */
+#define ATTR_JSON_BUF_MIN_SIZE 256
+
+/* an attribute of a container */
+typedef struct {
+    const char *key;
+    char type;
+    /* the value; for strings and byte arrays, their contents */
+    const char *value;
+    uint32_t value_len;
+} attr_json_item_t;
+
+/**
+ * Read an attribute, checking it is inside the container
+ *
+ * @param p start of the attribute
+ * @param end end of the container
+ * @param item where to store the attribute
+ *
+ * @return returns the start of the next attribute, NULL if malformed
+ */
+static const char *attr_json_next(const char *p, const char *end, attr_json_item_t *item)
+{
+    uint16_t len16;
+    uint32_t len32, size;
+
+    if (end - p < (int) sizeof(len16)) return NULL;
+    memcpy(&len16, p, sizeof(len16));
+    p += sizeof(len16);
+    if (len16 == 0 || end - p < (int) len16 + 1 || p[len16 - 1] != '\0') return NULL;
+    item->key = p;
+    p += len16;
+    item->type = *p++;
+
+    switch (item->type) {
+    case ATTR_TYPE_BYTE:
+    case ATTR_TYPE_BOOLEAN:
+        size = 1;
+        break;
+    case ATTR_TYPE_SHORT:
+    case ATTR_TYPE_UINT16:
+        size = 2;
+        break;
+    case ATTR_TYPE_INT:
+    case ATTR_TYPE_FLOAT:
+        size = 4;
+        break;
+    case ATTR_TYPE_INT64:
+    case ATTR_TYPE_DOUBLE:
+        size = 8;
+        break;
+    case ATTR_TYPE_STRING:
+        if (end - p < (int) sizeof(len16)) return NULL;
+        memcpy(&len16, p, sizeof(len16));
+        p += sizeof(len16);
+        if (len16 == 0 || (uint32_t) (end - p) < len16) return NULL;
+        item->value = p;
+        item->value_len = strnlen(p, len16);
+        return p + len16;
+    case ATTR_TYPE_BYTEARRAY:
+        if (end - p < (int) sizeof(len32)) return NULL;
+        memcpy(&len32, p, sizeof(len32));
+        p += sizeof(len32);
+        if ((uint32_t) (end - p) < len32) return NULL;
+        item->value = p;
+        item->value_len = len32;
+        return p + len32;
+    default:
+        return NULL;
+    }
+
+    if ((uint32_t) (end - p) < size) return NULL;
+    item->value = p;
+    item->value_len = size;
+    return p + size;
+}
+
+/* make room for n more bytes */
+static int attr_json_reserve(attr_json_buf_t *buf, uint32_t n)
+{
+    uint32_t size = buf->size > 0 ? buf->size : ATTR_JSON_BUF_MIN_SIZE;
+    char *data;
+
+    if (buf->len + n <= buf->size) return 0;
+
+    while (size < buf->len + n) size *= 2;
+    if ((data = realloc(buf->data, size)) == NULL) return -1;
+    buf->data = data;
+    buf->size = size;
+    return 0;
+}
+
+/* write a number as cJSON_Print() does */
+static int attr_json_put_number(attr_json_buf_t *buf, double d)
+{
+    int n;
+
+    if (attr_json_reserve(buf, 32) != 0) return -1;
+
+    if (d != d || d - d != 0) {
+        /* NaN and infinity */
+        memcpy(buf->data + buf->len, "null", 4);
+        n = 4;
+    } else if (d >= INT32_MIN && d <= INT32_MAX && d == (double) (int32_t) d) {
+        n = snprintf(buf->data + buf->len, 32, "%d", (int) (int32_t) d);
+    } else {
+        n = snprintf(buf->data + buf->len, 32, "%1.15g", d);
+        if (strtod(buf->data + buf->len, NULL) != d)
+            n = snprintf(buf->data + buf->len, 32, "%1.17g", d);
+    }
+    buf->len += n;
+    return 0;
+}
+
+/* write a quoted, escaped string */
+static int attr_json_put_string(attr_json_buf_t *buf, const char *s, uint32_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *run;
+    unsigned char c;
+    char *out;
+
+    /* worst case: every byte escaped as \u00XX */
+    if (attr_json_reserve(buf, 6 * len + 2) != 0) return -1;
+    out = buf->data + buf->len;
+
+    *out++ = '"';
+    while (len > 0) {
+        run = s;
+        while (len > 0 && (unsigned char) *s >= 0x20 && *s != '"' && *s != '\\') {
+            s++;
+            len--;
+        }
+        memcpy(out, run, s - run);
+        out += s - run;
+        if (len == 0) break;
+
+        c = *s++;
+        len--;
+        *out++ = '\\';
+        switch (c) {
+        case '"': *out++ = '"'; break;
+        case '\\': *out++ = '\\'; break;
+        case '\b': *out++ = 'b'; break;
+        case '\f': *out++ = 'f'; break;
+        case '\n': *out++ = 'n'; break;
+        case '\r': *out++ = 'r'; break;
+        case '\t': *out++ = 't'; break;
+        default:
+            *out++ = 'u';
+            *out++ = '0';
+            *out++ = '0';
+            *out++ = hex[c >> 4];
+            *out++ = hex[c & 0xF];
+        }
+    }
+    *out++ = '"';
+
+    buf->len = out - buf->data;
+    return 0;
+}
+
+static int attr_json_put(attr_json_buf_t *buf, const char *s, uint32_t len)
+{
+    if (attr_json_reserve(buf, len) != 0) return -1;
+    memcpy(buf->data + buf->len, s, len);
+    buf->len += len;
+    return 0;
+}
+
+int attr2json_text(const attr_container_t *attr, uint32_t attr_len, attr_json_buf_t *out)
+{
+    const char *p, *end = (const char *) attr + attr_len;
+    attr_json_item_t item;
+    uint32_t total_len, j;
+    uint16_t attr_num, i;
+    int16_t s;
+    uint16_t u16;
+    int32_t i32;
+    int64_t i64;
+    float f;
+    double d;
+
+    out->len = 0;
+    if ((p = attr_container_get_attr_begin(attr, &total_len, &attr_num)) == NULL || p > end) return -1;
+    if (attr_json_put(out, "{", 1) != 0) return -1;
+
+    for (i = 0; i < attr_num; i++) {
+        if ((p = attr_json_next(p, end, &item)) == NULL) return -1;
+
+        if ((i > 0 && attr_json_put(out, ",", 1) != 0)
+                || attr_json_put_string(out, item.key, strlen(item.key)) != 0
+                || attr_json_put(out, ":", 1) != 0)
+            return -1;
+
+        switch (item.type) {
+        case ATTR_TYPE_SHORT:
+            memcpy(&s, item.value, sizeof(s));
+            d = s;
+            break;
+        case ATTR_TYPE_UINT16:
+            memcpy(&u16, item.value, sizeof(u16));
+            d = u16;
+            break;
+        case ATTR_TYPE_INT:
+            memcpy(&i32, item.value, sizeof(i32));
+            d = i32;
+            break;
+        case ATTR_TYPE_INT64:
+            memcpy(&i64, item.value, sizeof(i64));
+            d = i64;
+            break;
+        case ATTR_TYPE_BYTE:
+            d = (int8_t) *item.value;
+            break;
+        case ATTR_TYPE_FLOAT:
+            memcpy(&f, item.value, sizeof(f));
+            d = f;
+            break;
+        case ATTR_TYPE_DOUBLE:
+            memcpy(&d, item.value, sizeof(d));
+            break;
+        case ATTR_TYPE_BOOLEAN:
+            if (attr_json_put(out, *item.value ? "true" : "false", *item.value ? 4 : 5) != 0) return -1;
+            continue;
+        case ATTR_TYPE_STRING:
+            if (attr_json_put_string(out, item.value, item.value_len) != 0) return -1;
+            continue;
+        case ATTR_TYPE_BYTEARRAY:
+            if (attr_json_put(out, "[", 1) != 0) return -1;
+            for (j = 0; j < item.value_len; j++) {
+                if ((j > 0 && attr_json_put(out, ",", 1) != 0)
+                        || attr_json_put_number(out, (char) item.value[j]) != 0)
+                    return -1;
+            }
+            if (attr_json_put(out, "]", 1) != 0) return -1;
+            continue;
+        }
+
+        if (attr_json_put_number(out, d) != 0) return -1;
+    }
+
+    return attr_json_put(out, "}", 1);
+}
+
+const char *attr_json_get_raw_str(const attr_container_t *attr, uint32_t attr_len, uint32_t *str_len)
+{
+    const char *p, *end = (const char *) attr + attr_len;
+    attr_json_item_t item;
+    uint32_t total_len;
+    uint16_t attr_num, i;
+
+    if ((p = attr_container_get_attr_begin(attr, &total_len, &attr_num)) == NULL || p > end) return NULL;
+
+    for (i = 0; i < attr_num; i++) {
+        if ((p = attr_json_next(p, end, &item)) == NULL) return NULL;
+        if (item.type == ATTR_TYPE_STRING && strcmp(item.key, ATTR_JSON_RAW_STR_KEY) == 0) {
+            *str_len = item.value_len;
+            return item.value;
+        }
+    }
+    return NULL;
+}
+
+void attr_json_buf_free(attr_json_buf_t *buf)
+{
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->size = 0;
+}
@@ -0,0 +1,77 @@
+ /** @file attr_json.h
+ *  @brief Definitions for transcoding between JSON text and attribute containers
+ *
+ *  Definitions for converting JSON text directly to attribute containers (and
+ *  back), without building a cJSON tree. The type mapping is the same as
+ *  json2attr() in bridge_tool_utils.h.
+ *
+ *  @date July, 2019
+ */
+#ifndef ATTR_JSON_H_
+#define ATTR_JSON_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "attr_container.h"
+
+/* key of the string attribute holding payloads that are not valid JSON */
+#define ATTR_JSON_RAW_STR_KEY "raw_str"
+
+/**
+ * Growable output buffer, reused across conversions
+ */
+typedef struct {
+    char *data;
+    uint32_t len;
+    uint32_t size;
+} attr_json_buf_t;
+
+/**
+ * @brief Convert JSON text to an attribute container in one pass. Members of the
+ * top-level object are mapped as json2attr() does: numbers to doubles, booleans
+ * to bools, strings to strings and number arrays to byte arrays; other members
+ * are ignored.
+ *
+ * @param json the JSON text (does not need to be NUL-terminated)
+ * @param len length of the JSON text
+ * @param attr_len where to store the serialized length of the container
+ * @param raw_str if true, text that is not valid JSON is stored as a "raw_str" string attribute
+ *
+ * @return the attribute container, in a buffer from the buffer pool (release it
+ * with bufpool_free()); NULL if the text is not an object that json2attr()
+ * accepts (and not stored as raw_str), or no memory is available
+ */
+attr_container_t *json_text2attr(const char *json, uint32_t len, uint32_t *attr_len, bool raw_str);
+
+/**
+ * @brief Convert an attribute container to compact JSON text in one pass,
+ * with the same values as attr2json() (the tag is ignored)
+ *
+ * @param attr the attribute container
+ * @param attr_len serialized length of the container; attributes past it are rejected
+ * @param out buffer where the text is written (replacing its contents; not NUL-terminated), grown as needed
+ *
+ * @return returns 0 on success, -1 if the container is malformed or no memory is available
+ */
+int attr2json_text(const attr_container_t *attr, uint32_t attr_len, attr_json_buf_t *out);
+
+/**
+ * @brief Find the "raw_str" string attribute of a container, as made by json_text2attr() for text that is not JSON
+ *
+ * @param attr the attribute container
+ * @param attr_len serialized length of the container
+ * @param str_len where to store the length of the string
+ *
+ * @return returns the string inside the container, NULL if there is no such attribute
+ */
+const char *attr_json_get_raw_str(const attr_container_t *attr, uint32_t attr_len, uint32_t *str_len);
+
+/**
+ * @brief Release the memory of an output buffer
+ *
+ * @param buf the buffer
+ */
+void attr_json_buf_free(attr_json_buf_t *buf);
+
+#endif
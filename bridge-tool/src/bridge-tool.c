@@ -39,145 +39,88 @@
 #include "http.h"
 #include "mqtt.h"
 #include "config.h"
+#include "reactor.h"
+#include "bufpool.h"
+#include "mqtt_outbox.h"
+#include "mqtt_subs.h"
+#include "mqtt_wire.h"
+#include "module_cache.h"
 
-#define RECONNECT_ATTEMPTS 3
+#define RECONNECT_INTERVAL_MS 1000
+
+static reactor_t *g_reactor;
+
+/* periodic mqtt keepalive */
+static void mqtt_keepalive_timer(void *arg)
+{
+    mqtt_ping();
+}
+
+/* reconnect to the mqtt server if needed (runtimes are reconnected by their worker threads) */
+static void reconnect_timer(void *arg)
+{
+    struct mg_connection *mqtt_mg_conn=NULL;
+
+    if (!mqtt_is_connected()) mqtt_init(g_reactor, &mqtt_mg_conn);
+}
 
 int main(int argc, char *argv[])
 {
-    int ret, result, runtime_conn_fd, n, reply_type = -1, rconn=0;
-    int mid, op_type;
-    char buffer[BUF_SIZE] = { 0 };
-    fd_set readfds;
-    struct timeval tv;
+    int ret;
     struct mg_connection *http_mg_conn=NULL;    
     struct mg_connection *mqtt_mg_conn=NULL;
-    uint32_t last_check, total_elapsed_ms = 0;
-    imrt_link_recv_context_t recv_ctx = { 0 };
+    reactor_stats_t stats;
+    bufpool_stats_t pool_stats;
+    mqtt_outbox_stats_t outbox_stats;
+    mqtt_wire_opts_t wire_opts;
 
     if (read_config() != 0) return -1;
 
-    bh_get_elpased_ms(&last_check);
-
-    if (runtime_conn_init(&runtime_conn_fd) != 0) return -1;
-
-    if (http_init(&http_mg_conn) != 0 ) return -1;
-
-    if (mqtt_init(&mqtt_mg_conn) != 0 ) return -1;
-    
-    while (1) {
-        total_elapsed_ms += bh_get_elpased_ms(&last_check);
-
-        if (total_elapsed_ms >= g_bt_config.mqtt_keepalive_ms) {
-            mg_mqtt_ping(mqtt_mg_conn);
-            mqtt_pool_requests(); // process mqtt requests
-            total_elapsed_ms = 0;
-        }
-        
-        if (rconn > g_bt_config.rt_reconnect_attempts) {
-            printf("Error: too many reconnection attempts.\n");
-            exit(-1);
-        }
-
-        if (runtime_conn_fd == -1) {
-            rconn++;
-            if (runtime_conn_init(&runtime_conn_fd) != 0) {
-                sleep(1);
-                continue;
-            } else rconn = 0;
-        }
-
-        if (mqtt_mg_conn->sock == -1) {
-            if (mqtt_init(&mqtt_mg_conn) != 0 ) {
-                sleep(1);
-                continue;
-            }
-        }
-
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
-        
-        // initialize the set of active sockets (readfds is changed at each select() call)
-        FD_ZERO (&readfds);
-        FD_SET (runtime_conn_fd, &readfds);
-        FD_SET (mqtt_mg_conn->sock, &readfds);
-
-        result = select(FD_SETSIZE, &readfds, NULL, NULL, &tv);
-
-        if (result < 0) {
-            if (errno != EINTR) {
-                printf("Error in select, errno: 0x%x\n", errno);
-                continue;
-            }
-        } else if (result == 0) { /* select timeout */
-        } else if (result > 0) {
-            if (FD_ISSET(mqtt_mg_conn->sock, &readfds)) {
-                mqtt_pool_requests(); // process mqtt requests
-            } else if (FD_ISSET(runtime_conn_fd, &readfds)) {
-                n = read(runtime_conn_fd, buffer, BUF_SIZE);
-                if (n <= 0) {
-                    runtime_conn_fd = -1;
-                    printf("error!\n");
-                    continue;
-                }
-
-                reply_type = process_rcvd_data((char *) buffer, n, &recv_ctx);
-
-                if (reply_type == REPLY_TYPE_RESPONSE) {
-                    response_t response[1] = { 0 };
-                    int mod_id;
-                    char mod_name[50];                    
-                    parse_response_from_imrtlink(&recv_ctx.message, response);
-
-                    ret = response->status;
-
-                    get_pending_request_info(&mid, &op_type);
-
-                    //printf("%d == %d; status=%d\n", response->mid, mid, ret);
-
-                    if (response->mid != mid) {
-                        //ignore invalid response 
-                        printf("Unexpected response!\n");
-                        output_response(response);
-                        http_printf(http_mg_conn, "%s", "HTTP/1.1 412 Precondition Failed\r\n\r\n");
-                        return -1;
-                    }
-
-                    if (ret == CREATED_2_01 || ret == DELETED_2_02 || ret == CONTENT_2_05) {
-                        if (op_type == INSTALL) {
-                            install_response_get_module_id_and_name(response, &mod_id, mod_name, sizeof(mod_name));
-                            module_list_add(mod_id, mod_name);
-                            mqtt_notify_module_event(EVENT_MOD_INST, mod_id, mod_name);
-                        } else if (op_type == UNINSTALL) {
-                            install_response_get_module_id_and_name(response, &mod_id, mod_name, 0);
-                            module_list_del_by_id(mod_id);
-                            mqtt_notify_module_event(EVENT_MOD_UNINST, mod_id, mod_name);
-                        }
-                    }
-
-                    http_output_runtime_response(http_mg_conn, response);
-
-                    rt_conn_response_received();
-
-                } else if (reply_type == REPLY_TYPE_EVENT) {
-                    request_t event[1] = { 0 };
-
-                    parse_event_from_imrtlink(&recv_ctx.message, event);
-
-                    //if (op.type == REGISTER || op.type == UNREGISTER) {
-                        //printf("op=%d\n", op.type);
-                        //output_event(event);
-                    //}
-                    //mqtt_process_runtime_event(mqtt_mg_conn, event);
-                    mqtt_process_runtime_event(event);
-                } else {
-                    printf("received  type:%d\n", reply_type);
-                }
-
-            }
-        }
-    } /* end of while(1) */
-
-    runtime_conn_close();
+    bufpool_init(g_bt_config.rt_buffer_pool_limit);
+
+    if (mqtt_outbox_init(g_bt_config.mqtt_max_inflight, g_bt_config.mqtt_max_queued, g_bt_config.mqtt_spool_file) != 0) return -1;
+
+    wire_opts.version = g_bt_config.mqtt_version == 5 ? MQTT_WIRE_V5 : MQTT_WIRE_V311;
+    wire_opts.topic_alias_max = g_bt_config.mqtt_topic_alias_max > MQTT_WIRE_MAX_TOPIC_ALIAS ? MQTT_WIRE_MAX_TOPIC_ALIAS : g_bt_config.mqtt_topic_alias_max;
+    wire_opts.message_expiry = g_bt_config.mqtt_message_expiry;
+    mqtt_wire_init(&wire_opts);
+
+    if ((g_reactor = reactor_create()) == NULL) return -1;
+
+    if (http_init(g_reactor, &http_mg_conn) != 0 ) return -1;
+
+    if (mqtt_init(g_reactor, &mqtt_mg_conn) != 0 ) return -1;
+
+    if (runtime_conn_init(g_reactor) != 0) return -1;
+
+    if (g_bt_config.mqtt_keepalive_ms > 0)
+        reactor_add_timer(g_reactor, g_bt_config.mqtt_keepalive_ms, g_bt_config.mqtt_keepalive_ms, mqtt_keepalive_timer, NULL);
+
+    reactor_add_timer(g_reactor, RECONNECT_INTERVAL_MS, RECONNECT_INTERVAL_MS, reconnect_timer, NULL);
+
+    ret = reactor_run(g_reactor);
+
+    reactor_get_stats(g_reactor, &stats);
+    printf("Event loop: %llu iterations, %llu events, avg latency %llu us, max latency %u us\n",
+           (unsigned long long) stats.iterations, (unsigned long long) stats.events,
+           (unsigned long long) (stats.iterations ? stats.total_latency_us / stats.iterations : 0),
+           stats.max_latency_us);
+
+    bufpool_get_stats(&pool_stats);
+    printf("Buffer pool: %llu hits, %llu misses, %llu failures, %u bytes cached\n",
+           (unsigned long long) pool_stats.hits, (unsigned long long) pool_stats.misses,
+           (unsigned long long) pool_stats.failures, pool_stats.bytes_cached);
+
+    mqtt_outbox_get_stats(&outbox_stats);
+    printf("MQTT outbox: %llu acknowledged, %llu retransmitted, %llu dropped, %u unacknowledged\n",
+           (unsigned long long) outbox_stats.acked, (unsigned long long) outbox_stats.retransmitted,
+           (unsigned long long) outbox_stats.dropped, outbox_stats.inflight + outbox_stats.queued);
+
+    runtime_conn_destroy();
+    module_cache_destroy();
+    mqtt_outbox_close();
+    mqtt_subs_destroy();
+    reactor_destroy(g_reactor);
 
     return ret;
 }
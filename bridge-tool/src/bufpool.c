@@ -0,0 +1,158 @@
+/** @file bufpool.c
+ *  @brief Pool of payload buffers
+ *
+ *  Size-classed buffer pool with a memory limit. Each buffer is preceded by
+ *  a small header recording its class, so it can be returned to the right
+ *  free list.
+ *
+ *  @date July, 2019
+ */
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "bufpool.h"
+#include "queue.h"
+
+/* class of buffers larger than the largest size class */
+#define BUFPOOL_OVERSIZE_CLASS BUFPOOL_NUM_CLASSES
+
+/* header placed before each buffer; sized to keep the buffer 8-byte aligned */
+struct bufpool_hdr {
+    union {
+        struct {
+            uint32_t class_idx;
+            uint32_t size;
+        } info;
+        SLIST_ENTRY(bufpool_hdr) next;
+        uint64_t align;
+    } u;
+};
+
+struct bufpool_class {
+    SLIST_HEAD(bufpool_free_list, bufpool_hdr) free_list;
+    uint32_t size;
+    uint32_t free_count;
+    uint32_t max_free;
+};
+
+static struct bufpool_class g_classes[BUFPOOL_NUM_CLASSES];
+static bufpool_stats_t g_stats;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void bufpool_init(uint32_t mem_limit)
+{
+    uint32_t size = BUFPOOL_MIN_CLASS_SIZE;
+    int i;
+
+    for (i = 0; i < BUFPOOL_NUM_CLASSES; i++, size *= 4) {
+        SLIST_INIT(&g_classes[i].free_list);
+        g_classes[i].size = size;
+        g_classes[i].free_count = 0;
+        g_classes[i].max_free = BUFPOOL_MAX_CACHED_BYTES / size;
+        if (g_classes[i].max_free < 2) g_classes[i].max_free = 2;
+    }
+    g_stats.mem_limit = mem_limit;
+}
+
+/* release cached buffers, largest first, until needed bytes fit the limit; caller holds g_lock */
+static int bufpool_make_room(uint32_t needed)
+{
+    struct bufpool_hdr *hdr;
+    int i;
+
+    for (i = BUFPOOL_NUM_CLASSES - 1; i >= 0; i--) {
+        while (g_stats.bytes_in_use + g_stats.bytes_cached + needed > g_stats.mem_limit
+               && (hdr = SLIST_FIRST(&g_classes[i].free_list)) != NULL) {
+            SLIST_REMOVE_HEAD(&g_classes[i].free_list, u.next);
+            g_classes[i].free_count--;
+            g_stats.bytes_cached -= g_classes[i].size;
+            free(hdr);
+        }
+    }
+    return g_stats.bytes_in_use + g_stats.bytes_cached + needed <= g_stats.mem_limit ? 0 : -1;
+}
+
+char *bufpool_alloc(uint32_t size)
+{
+    struct bufpool_hdr *hdr;
+    uint32_t class_idx = 0, class_size = BUFPOOL_MIN_CLASS_SIZE;
+
+    while (class_idx < BUFPOOL_NUM_CLASSES && class_size < size) {
+        class_idx++;
+        class_size *= 4;
+    }
+    if (class_idx == BUFPOOL_OVERSIZE_CLASS) class_size = size;
+
+    pthread_mutex_lock(&g_lock);
+
+    if (class_idx < BUFPOOL_NUM_CLASSES && (hdr = SLIST_FIRST(&g_classes[class_idx].free_list)) != NULL) {
+        SLIST_REMOVE_HEAD(&g_classes[class_idx].free_list, u.next);
+        g_classes[class_idx].free_count--;
+        g_stats.bytes_cached -= class_size;
+        g_stats.bytes_in_use += class_size;
+        g_stats.hits++;
+        pthread_mutex_unlock(&g_lock);
+        hdr->u.info.class_idx = class_idx;
+        hdr->u.info.size = class_size;
+        return (char *) (hdr + 1);
+    }
+
+    g_stats.misses++;
+    if (bufpool_make_room(class_size) != 0) {
+        g_stats.failures++;
+        pthread_mutex_unlock(&g_lock);
+        return NULL;
+    }
+    /* account before allocating so concurrent allocations respect the limit */
+    g_stats.bytes_in_use += class_size;
+    pthread_mutex_unlock(&g_lock);
+
+    if ((hdr = malloc(sizeof(struct bufpool_hdr) + class_size)) == NULL) {
+        pthread_mutex_lock(&g_lock);
+        g_stats.bytes_in_use -= class_size;
+        g_stats.failures++;
+        pthread_mutex_unlock(&g_lock);
+        return NULL;
+    }
+
+    hdr->u.info.class_idx = class_idx;
+    hdr->u.info.size = class_size;
+    return (char *) (hdr + 1);
+}
+
+void bufpool_free(void *buf)
+{
+    struct bufpool_hdr *hdr;
+    struct bufpool_class *c;
+    uint32_t class_idx, size;
+
+    if (buf == NULL) return;
+
+    hdr = (struct bufpool_hdr *) buf - 1;
+    class_idx = hdr->u.info.class_idx;
+    size = hdr->u.info.size;
+
+    pthread_mutex_lock(&g_lock);
+    g_stats.bytes_in_use -= size;
+
+    if (class_idx < BUFPOOL_NUM_CLASSES) {
+        c = &g_classes[class_idx];
+        if (c->free_count < c->max_free) {
+            SLIST_INSERT_HEAD(&c->free_list, hdr, u.next);
+            c->free_count++;
+            g_stats.bytes_cached += size;
+            pthread_mutex_unlock(&g_lock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    free(hdr);
+}
+
+void bufpool_get_stats(bufpool_stats_t *stats)
+{
+    pthread_mutex_lock(&g_lock);
+    *stats = g_stats;
+    pthread_mutex_unlock(&g_lock);
+}
@@ -0,0 +1,68 @@
+ /** @file bufpool.h
+ *  @brief Definitions for a pool of payload buffers
+ *
+ *  Definitions for a thread-safe pool of buffers in power-of-4 size classes,
+ *  used for the messages exchanged with the runtimes. Released buffers are
+ *  kept for reuse, and the memory held by the pool (buffers in use and
+ *  cached) is bounded by a limit.
+ *
+ *  @date July, 2019
+ */
+#ifndef BUFPOOL_H_
+#define BUFPOOL_H_
+
+#include <stdint.h>
+
+/* size classes: 256 bytes, 1 KiB, ..., 1 MiB */
+#define BUFPOOL_MIN_CLASS_SIZE 256
+#define BUFPOOL_NUM_CLASSES 7
+
+/* bytes of released buffers kept per size class (at least 2 buffers are kept) */
+#define BUFPOOL_MAX_CACHED_BYTES (1024 * 1024)
+
+/**
+ * Pool counters
+ */
+typedef struct {
+    /* allocations served from cached buffers */
+    uint64_t hits;
+    /* allocations that needed a new buffer (including oversize ones) */
+    uint64_t misses;
+    /* allocations refused because of the memory limit */
+    uint64_t failures;
+
+    uint32_t bytes_in_use;
+    uint32_t bytes_cached;
+    uint32_t mem_limit;
+} bufpool_stats_t;
+
+/**
+ * Init the pool
+ *
+ * @param mem_limit maximum bytes held by the pool (buffers in use and cached)
+ */
+void bufpool_init(uint32_t mem_limit);
+
+/**
+ * Get a buffer; sizes above the largest class are allocated directly, but still count towards the limit
+ *
+ * @param size minimum size of the buffer
+ * @return returns the buffer, NULL if the memory limit would be exceeded
+ */
+char *bufpool_alloc(uint32_t size);
+
+/**
+ * Return a buffer to the pool
+ *
+ * @param buf a buffer returned by bufpool_alloc() (may be NULL)
+ */
+void bufpool_free(void *buf);
+
+/**
+ * Get pool counters
+ *
+ * @param stats where to copy the counters to
+ */
+void bufpool_get_stats(bufpool_stats_t *stats);
+
+#endif
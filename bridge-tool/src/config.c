@@ -12,18 +12,108 @@
 
 #include "runtime_conn.h"
 #include "config.h"
+#include "link_compress.h"
+#include "link_arq.h"
 
 bt_config_t g_bt_config;
 
 static const char g_config_file_path[] = "config.ini";
 
+#define DEFAULT_WORKER_THREADS 2
+#define DEFAULT_OUTQ_HIGH_WATERMARK (2 * 1024 * 1024)
+#define DEFAULT_OUTQ_LOW_WATERMARK (512 * 1024)
+#define DEFAULT_RECV_BUFFER_SIZE (64 * 1024)
+#define MIN_RECV_BUFFER_SIZE 1024
+#define DEFAULT_BUFFER_POOL_LIMIT (64 * 1024 * 1024)
+#define DEFAULT_MQTT_MAX_INFLIGHT 32
+#define DEFAULT_MQTT_MAX_QUEUED 4096
+#define DEFAULT_MQTT_VERSION 3
+#define DEFAULT_MQTT_TOPIC_ALIAS_MAX 64
+#define DEFAULT_INSTALL_CHUNK_SIZE (16 * 1024)
+#define MAX_INSTALL_CHUNK_SIZE (32 * 1024) /* runtimes buffer requests up to 64KB */
+#define DEFAULT_COMPRESS_THRESHOLD UINT32_MAX /* compress over uart only */
+
+/* get (or add) the runtime described by a [runtime:<uuid>] section */
+static bt_runtime_config_t *runtime_section_config(bt_config_t* pconfig, const char* section)
+{
+    const char *uuid = section + strlen(RUNTIME_SECTION_PREFIX);
+    bt_runtime_config_t *rt;
+    uint32_t i;
+
+    /* entry 0 is the [runtime] section */
+    for (i = 1; i < pconfig->rt_count; i++) {
+        if (strcmp(pconfig->runtimes[i].uuid, uuid) == 0) return &pconfig->runtimes[i];
+    }
+
+    if (pconfig->rt_count >= MAX_RUNTIMES) {
+        printf("Too many runtimes (max %d); ignoring [%s]\n", MAX_RUNTIMES, section);
+        return NULL;
+    }
+
+    rt = &pconfig->runtimes[pconfig->rt_count++];
+    memset(rt, 0, sizeof(bt_runtime_config_t));
+    strncpy(rt->uuid, uuid, sizeof(rt->uuid) - 1);
+    strncpy(rt->address, "127.0.0.1", sizeof(rt->address) - 1);
+    rt->port = 8888;
+    rt->connection_mode = CONNECTION_MODE_TCP;
+    rt->uart_baudrate = 115200;
+    rt->compress_threshold = DEFAULT_COMPRESS_THRESHOLD;
+    rt->link_mtu = LINK_ARQ_DEFAULT_MTU;
+    return rt;
+}
+
+static int runtime_section_handler(bt_config_t* pconfig, const char* section, const char* name,
+                   const char* value)
+{
+    bt_runtime_config_t *rt = runtime_section_config(pconfig, section);
+
+    if (rt == NULL) return 1;
+
+    if (strcmp(name, "address") == 0) {
+        strncpy(rt->address, value, sizeof(rt->address) - 1);
+    } else if (strcmp(name, "port") == 0) {
+        rt->port = atol(value);
+    } else if (strcmp(name, "connection-mode") == 0) {
+        rt->connection_mode = CONNECTION_MODE_TCP;
+        if (strncmp(value, "CONNECTION_MODE_UART", strlen("CONNECTION_MODE_UART")) == 0) rt->connection_mode = CONNECTION_MODE_UART;
+    } else if (strcmp(name, "uart-dev") == 0) {
+        strncpy(rt->uart_dev, value, sizeof(rt->uart_dev) - 1);
+    } else if (strcmp(name, "uart-baudrate") == 0) {
+        rt->uart_baudrate = atol(value);
+    } else if (strcmp(name, "aot-target") == 0) {
+        strncpy(rt->aot_target, value, sizeof(rt->aot_target) - 1);
+    } else if (strcmp(name, "compress-threshold") == 0) {
+        rt->compress_threshold = atol(value);
+    } else if (strcmp(name, "link-window") == 0) {
+        rt->link_window = atol(value);
+    } else if (strcmp(name, "link-mtu") == 0) {
+        rt->link_mtu = atol(value);
+    } else {
+        return 0;  /* unknown name, error */
+    }
+    printf("%s.%s = %s\n", rt->uuid, name, value);
+    return 1;
+}
+
 static int conf_handler(void* user, const char* section, const char* name,
                    const char* value)
 {
     bt_config_t* pconfig = (bt_config_t*)user;
 
     #define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
-    if (MATCH("mqtt", "server_address")) {
+    if (strncmp(section, RUNTIME_SECTION_PREFIX, strlen(RUNTIME_SECTION_PREFIX)) == 0) {
+        return runtime_section_handler(pconfig, section, name, value);
+    } else if (strcmp(section, "mqtt-qos") == 0) {
+        bt_mqtt_qos_rule_t *rule;
+        if (pconfig->mqtt_qos_rule_count >= MAX_MQTT_QOS_RULES) {
+            printf("Too many [mqtt-qos] entries (max %d); ignoring '%s'\n", MAX_MQTT_QOS_RULES, name);
+            return 1;
+        }
+        rule = &pconfig->mqtt_qos_rules[pconfig->mqtt_qos_rule_count++];
+        strncpy(rule->topic_filter, name, sizeof(rule->topic_filter) - 1);
+        rule->qos = atol(value);
+        printf("mqtt_qos[%s] = %u\n", rule->topic_filter, rule->qos);
+    } else if (MATCH("mqtt", "server_address")) {
         strncpy(pconfig->mqtt_server_address, value, sizeof(pconfig->mqtt_server_address));
         printf("mqtt_server_address = %s\n", pconfig->mqtt_server_address);
     } else if (MATCH("mqtt", "keepalive_ms")) {
@@ -35,6 +125,27 @@ static int conf_handler(void* user, const char* section, const char* name,
     } else if (MATCH("mqtt", "password")) {
         strncpy(pconfig->mqtt_password, value, sizeof(pconfig->mqtt_password));
         printf("mqtt_password = %s\n", pconfig->mqtt_password);
+    } else if (MATCH("mqtt", "qos")) {
+        pconfig->mqtt_qos = atol(value);
+        printf("mqtt_qos = %u\n", pconfig->mqtt_qos);
+    } else if (MATCH("mqtt", "max-inflight")) {
+        pconfig->mqtt_max_inflight = atol(value);
+        printf("mqtt_max_inflight = %u\n", pconfig->mqtt_max_inflight);
+    } else if (MATCH("mqtt", "max-queued")) {
+        pconfig->mqtt_max_queued = atol(value);
+        printf("mqtt_max_queued = %u\n", pconfig->mqtt_max_queued);
+    } else if (MATCH("mqtt", "spool-file")) {
+        strncpy(pconfig->mqtt_spool_file, value, sizeof(pconfig->mqtt_spool_file) - 1);
+        printf("mqtt_spool_file = %s\n", pconfig->mqtt_spool_file);
+    } else if (MATCH("mqtt", "version")) {
+        pconfig->mqtt_version = atol(value);
+        printf("mqtt_version = %u\n", pconfig->mqtt_version);
+    } else if (MATCH("mqtt", "topic-alias-max")) {
+        pconfig->mqtt_topic_alias_max = atol(value);
+        printf("mqtt_topic_alias_max = %u\n", pconfig->mqtt_topic_alias_max);
+    } else if (MATCH("mqtt", "message-expiry")) {
+        pconfig->mqtt_message_expiry = atol(value);
+        printf("mqtt_message_expiry = %u\n", pconfig->mqtt_message_expiry);
     } else if (MATCH("http", "port")) {
         strncpy(pconfig->http_port, value, sizeof(pconfig->http_port));
         printf("http_port = %s\n", pconfig->http_port);    
@@ -72,6 +183,39 @@ static int conf_handler(void* user, const char* section, const char* name,
     } else if (MATCH("runtime", "uuid")) {
         strncpy(pconfig->rt_uuid, value, sizeof(pconfig->rt_uuid));
         printf("rt_uuid = %s\n", pconfig->rt_uuid);
+    } else if (MATCH("runtime", "worker-threads")) {
+        pconfig->rt_worker_threads = atol(value);
+        printf("rt_worker_threads = %u\n", pconfig->rt_worker_threads);
+    } else if (MATCH("runtime", "outq-high-watermark")) {
+        pconfig->rt_outq_high_watermark = atol(value);
+        printf("rt_outq_high_watermark = %u\n", pconfig->rt_outq_high_watermark);
+    } else if (MATCH("runtime", "outq-low-watermark")) {
+        pconfig->rt_outq_low_watermark = atol(value);
+        printf("rt_outq_low_watermark = %u\n", pconfig->rt_outq_low_watermark);
+    } else if (MATCH("runtime", "recv-buffer-size")) {
+        pconfig->rt_recv_buffer_size = atol(value);
+        printf("rt_recv_buffer_size = %u\n", pconfig->rt_recv_buffer_size);
+    } else if (MATCH("runtime", "buffer-pool-limit")) {
+        pconfig->rt_buffer_pool_limit = atol(value);
+        printf("rt_buffer_pool_limit = %u\n", pconfig->rt_buffer_pool_limit);
+    } else if (MATCH("runtime", "install-chunk-size")) {
+        pconfig->rt_install_chunk_size = atol(value);
+        printf("rt_install_chunk_size = %u\n", pconfig->rt_install_chunk_size);
+    } else if (MATCH("runtime", "compress-threshold")) {
+        pconfig->rt_compress_threshold = atol(value);
+        printf("rt_compress_threshold = %u\n", pconfig->rt_compress_threshold);
+    } else if (MATCH("runtime", "link-window")) {
+        pconfig->rt_link_window = atol(value);
+        printf("rt_link_window = %u\n", pconfig->rt_link_window);
+    } else if (MATCH("runtime", "link-mtu")) {
+        pconfig->rt_link_mtu = atol(value);
+        printf("rt_link_mtu = %u\n", pconfig->rt_link_mtu);
+    } else if (MATCH("runtime", "aot-compiler")) {
+        strncpy(pconfig->rt_aot_compiler, value, sizeof(pconfig->rt_aot_compiler) - 1);
+        printf("rt_aot_compiler = %s\n", pconfig->rt_aot_compiler);
+    } else if (MATCH("runtime", "aot-target")) {
+        strncpy(pconfig->rt_aot_target, value, sizeof(pconfig->rt_aot_target) - 1);
+        printf("rt_aot_target = %s\n", pconfig->rt_aot_target);
     } else {
         return 0;  /* unknown section/name, error */
     }
@@ -79,9 +223,54 @@ static int conf_handler(void* user, const char* section, const char* name,
 }
 
 int read_config() {
+    bt_runtime_config_t *rt = &g_bt_config.runtimes[0];
+    uint32_t i;
+
+    g_bt_config.rt_count = 1; /* [runtime] */
+    g_bt_config.rt_worker_threads = DEFAULT_WORKER_THREADS;
+    g_bt_config.rt_outq_high_watermark = DEFAULT_OUTQ_HIGH_WATERMARK;
+    g_bt_config.rt_outq_low_watermark = DEFAULT_OUTQ_LOW_WATERMARK;
+    g_bt_config.rt_recv_buffer_size = DEFAULT_RECV_BUFFER_SIZE;
+    g_bt_config.rt_buffer_pool_limit = DEFAULT_BUFFER_POOL_LIMIT;
+    g_bt_config.rt_install_chunk_size = DEFAULT_INSTALL_CHUNK_SIZE;
+    g_bt_config.rt_compress_threshold = DEFAULT_COMPRESS_THRESHOLD;
+    g_bt_config.rt_link_mtu = LINK_ARQ_DEFAULT_MTU;
+    g_bt_config.mqtt_max_inflight = DEFAULT_MQTT_MAX_INFLIGHT;
+    g_bt_config.mqtt_max_queued = DEFAULT_MQTT_MAX_QUEUED;
+    g_bt_config.mqtt_version = DEFAULT_MQTT_VERSION;
+    g_bt_config.mqtt_topic_alias_max = DEFAULT_MQTT_TOPIC_ALIAS_MAX;
+
     if (ini_parse(g_config_file_path, conf_handler, &g_bt_config) < 0) {
         printf("Can't load 'config.ini'\n");
         return -1;
     }   
+
+    /* the [runtime] section describes the first runtime */
+    strncpy(rt->uuid, g_bt_config.rt_uuid, sizeof(rt->uuid) - 1);
+    strncpy(rt->address, g_bt_config.rt_address, sizeof(rt->address) - 1);
+    rt->port = g_bt_config.rt_port;
+    rt->connection_mode = g_bt_config.rt_connection_mode;
+    strncpy(rt->uart_dev, g_bt_config.rt_uart_dev, sizeof(rt->uart_dev) - 1);
+    rt->uart_baudrate = g_bt_config.rt_uart_baudrate;
+    strncpy(rt->aot_target, g_bt_config.rt_aot_target, sizeof(rt->aot_target) - 1);
+    rt->compress_threshold = g_bt_config.rt_compress_threshold;
+    rt->link_window = g_bt_config.rt_link_window;
+    rt->link_mtu = g_bt_config.rt_link_mtu;
+
+    /* messages are compressed over uart, unless configured; the reliable link layer is only for uart */
+    for (i = 0; i < g_bt_config.rt_count; i++) {
+        rt = &g_bt_config.runtimes[i];
+        if (rt->compress_threshold == DEFAULT_COMPRESS_THRESHOLD)
+            rt->compress_threshold = rt->connection_mode == CONNECTION_MODE_UART ? LINK_COMPRESS_DEFAULT_THRESHOLD : 0;
+        if (rt->connection_mode != CONNECTION_MODE_UART) rt->link_window = 0;
+        if (rt->link_window > LINK_ARQ_MAX_WINDOW) rt->link_window = LINK_ARQ_MAX_WINDOW;
+        if (rt->link_mtu == 0 || rt->link_mtu > LINK_ARQ_MAX_MTU) rt->link_mtu = LINK_ARQ_DEFAULT_MTU;
+    }
+
+    if (g_bt_config.rt_recv_buffer_size < MIN_RECV_BUFFER_SIZE) g_bt_config.rt_recv_buffer_size = MIN_RECV_BUFFER_SIZE;
+    if (g_bt_config.rt_worker_threads == 0) g_bt_config.rt_worker_threads = 1;
+    if (g_bt_config.rt_install_chunk_size > MAX_INSTALL_CHUNK_SIZE) g_bt_config.rt_install_chunk_size = MAX_INSTALL_CHUNK_SIZE;
+    if (g_bt_config.rt_worker_threads > g_bt_config.rt_count) g_bt_config.rt_worker_threads = g_bt_config.rt_count;
+
     return 0;
 }
\ No newline at end of file
@@ -14,12 +14,58 @@
 
 #define STR_MAXLEN 100
 
+/* maximum number of runtimes served by one bridge */
+#define MAX_RUNTIMES 64
+
+/* runtime sections besides [runtime] are named [runtime:<uuid>] */
+#define RUNTIME_SECTION_PREFIX "runtime:"
+
+/* maximum number of entries in the [mqtt-qos] section */
+#define MAX_MQTT_QOS_RULES 32
+
+/**
+ * QoS of the publishes to topics matching a topic filter (may have + and # wildcards)
+ */
+typedef struct
+{
+    char topic_filter[STR_MAXLEN];
+    uint32_t qos;
+} bt_mqtt_qos_rule_t;
+
+/**
+ * Connection settings of one runtime
+ */
+typedef struct
+{
+    char uuid[STR_MAXLEN];
+    char address[STR_MAXLEN];
+    uint32_t port;
+    uint32_t connection_mode;
+    char uart_dev[STR_MAXLEN];
+    uint32_t uart_baudrate;
+    char aot_target[STR_MAXLEN]; /* AoT target the runtime runs; empty if it only runs bytecode */
+    uint32_t compress_threshold; /* messages of this size or larger are compressed (see link_compress.h); 0 disables */
+    uint32_t link_window; /* frames in flight of the reliable uart link layer (see link_arq.h); 0 disables */
+    uint32_t link_mtu; /* payload of the frames of the reliable uart link layer */
+} bt_runtime_config_t;
+
 typedef struct
 {
     char mqtt_server_address[STR_MAXLEN];
     uint32_t mqtt_keepalive_ms;
     char mqtt_user_name[STR_MAXLEN];
     char mqtt_password[STR_MAXLEN];
+    uint32_t mqtt_qos;
+    uint32_t mqtt_max_inflight;
+    uint32_t mqtt_max_queued;
+    char mqtt_spool_file[STR_MAXLEN];
+    uint32_t mqtt_version;
+    uint32_t mqtt_topic_alias_max;
+    uint32_t mqtt_message_expiry;
+
+    /* per-topic QoS, from the [mqtt-qos] section; the first matching filter applies */
+    bt_mqtt_qos_rule_t mqtt_qos_rules[MAX_MQTT_QOS_RULES];
+    uint32_t mqtt_qos_rule_count;
 
     char http_port[STR_MAXLEN];
     char http_doc_root[STR_MAXLEN];
@@ -34,6 +80,21 @@ typedef struct
     char rt_wasm_files_folder[STR_MAXLEN];
     char rt_topic_prefix[STR_MAXLEN];
     char rt_uuid[STR_MAXLEN];
+    uint32_t rt_worker_threads;
+    uint32_t rt_outq_high_watermark;
+    uint32_t rt_outq_low_watermark;
+    uint32_t rt_recv_buffer_size;
+    uint32_t rt_buffer_pool_limit;
+    uint32_t rt_install_chunk_size;
+    uint32_t rt_compress_threshold;
+    uint32_t rt_link_window;
+    uint32_t rt_link_mtu;
+    char rt_aot_compiler[STR_MAXLEN];
+    char rt_aot_target[STR_MAXLEN];
+
+    /* runtimes served; the first is the one described by the [runtime] section */
+    bt_runtime_config_t runtimes[MAX_RUNTIMES];
+    uint32_t rt_count;
 } bt_config_t;
 
 extern bt_config_t g_bt_config;
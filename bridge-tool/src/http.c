@@ -7,7 +7,6 @@
  *  @date July, 2019
  */
 #include <stdlib.h>
-#include <pthread.h> 
 #include "mongoose.h"
 #include "coap_ext.h"
 #include "http.h"
@@ -18,34 +17,49 @@
 #include "bridge_tool_utils.h"
 #include "config.h"
 #include "http_mqtt_req.h"
+#include "reactor.h"
 
 static struct mg_serve_http_opts s_http_server_opts;
 
 static struct mg_mgr g_http_mgr;
 
-static void *http_pool_requests(void *arg);
 static void http_printf_with_status(struct mg_connection *nc, int http_status, const char *content_type_header, const char *fmt, ...);
 static int coap_to_http_status(int coap_status);
-static void http_handle_modules(struct mg_connection *nc, struct http_message *hm);
-static int http_handle_module_install(struct mg_connection *nc, struct http_message *hm);
-static int http_handle_module_uninstall(struct mg_connection *nc, struct http_message *hm);
+/* a rest request waiting for the runtime response */
+typedef struct {
+    /* the client connection; NULL if the client went away (see MG_EV_CLOSE) */
+    struct mg_connection *nc;
+
+    char *response_str;
+    int response_status;
+} http_pending_t;
+
+static reactor_t *s_reactor; // event loop driving g_http_mgr
+
+static void http_handle_modules(struct mg_connection *nc, struct http_message *hm, runtime_conn_t *conn);
+static int http_handle_module_install(struct mg_connection *nc, struct http_message *hm, runtime_conn_t *conn, http_pending_t *pending);
+static int http_handle_module_uninstall(struct mg_connection *nc, struct http_message *hm, runtime_conn_t *conn, http_pending_t *pending);
+static void http_on_runtime_response(struct runtime_conn *conn, response_t *response, void *arg);
 static char *http_attr_container_to_str(attr_container_t *payload, int format, int payload_len);
+static runtime_conn_t *http_runtime_from_uri(struct mg_str *uri);
 
-char *last_response_str=NULL;
-int last_response_status;
+#define URI_MODULES "/cwasm/v1/modules"
+#define URI_RUNTIMES_PREFIX "/cwasm/v1/runtimes/"
+#define URI_MODULES_SUFFIX "/modules"
 
 /**
  * Init http server
  * 
+ * @param r the reactor that will drive the http server
  * @param http_mg_conn the http connection
  * @return returns -1 on error, 0 on success
  */
-int http_init(struct mg_connection **http_mg_conn)
+int http_init(reactor_t *r, struct mg_connection **http_mg_conn)
 {
-    pthread_t thread_id;        
     s_http_server_opts.document_root = g_bt_config.http_doc_root;
     s_http_server_opts.enable_directory_listing = g_bt_config.http_enable_directory_listing;
 
+    s_reactor = r;
     mg_mgr_init(&g_http_mgr, NULL);
     *http_mg_conn = mg_bind(&g_http_mgr, g_bt_config.http_port, http_ev_handler);
     if (*http_mg_conn == NULL) {
@@ -54,29 +68,14 @@ int http_init(struct mg_connection **http_mg_conn)
     }
     mg_set_protocol_http_websocket(*http_mg_conn);
 
-    /* starts a new thread to pool for http requests */
-	if (pthread_create( &thread_id , (const pthread_attr_t *)NULL , http_pool_requests , NULL))
-	{
-		printf("Could not create thread.\n");
-		return -1;
-	}
-    return 0;
-}
-
-/**
- * Poll http requests
- * 
- */
-void *http_pool_requests(void *arg)
-{
-  printf("Started RESTful server on port %s.\n", g_bt_config.http_port);
-
-  for (;;) {
-   mg_mgr_poll(&g_http_mgr, 10);
-  }
+    /* requests are polled by the event loop */
+    if (reactor_add_mg_mgr(r, &g_http_mgr) != 0) {
+        printf("Could not add http server to event loop.\n");
+        return -1;
+    }
 
-  mg_mgr_free(&g_http_mgr);
-  return NULL;
+    printf("Started RESTful server on port %s.\n", g_bt_config.http_port);
+    return 0;
 }
 
 /**
@@ -88,19 +87,46 @@ void *http_pool_requests(void *arg)
  */
 void http_ev_handler(struct mg_connection *nc, int ev, void *ev_data) {
   struct http_message *hm = (struct http_message *) ev_data;
+  runtime_conn_t *conn;
 
   switch (ev) {
     case MG_EV_HTTP_REQUEST:
-      if (mg_vcmp(&hm->uri, "/cwasm/v1/modules") == 0) {
-          http_handle_modules(nc, hm);
+      if (nc->user_data != NULL) {
+          /* one rest request at a time per client connection */
+          http_printf_with_status(nc, HTTP_SERVICE_UNAVAILABLE_503, CT_HEADER_JSON, FMT_STR_JSON_ERROR_MSG, "Previous request still pending.");
+      } else if (mg_vcmp(&hm->uri, URI_MODULES) == 0) {
+          http_handle_modules(nc, hm, runtime_conn_get(0)); /* first runtime */
+      } else if ((conn = http_runtime_from_uri(&hm->uri)) != NULL) {
+          http_handle_modules(nc, hm, conn);
       } else {
         mg_serve_http(nc, hm, s_http_server_opts); /* Serve static content */
       }
       break;
+    case MG_EV_CLOSE:
+      /* the reply to a pending request is discarded */
+      if (nc->user_data != NULL) ((http_pending_t *) nc->user_data)->nc = NULL;
+      break;
   }
 }
 
-static int http_handle_module_uninstall(struct mg_connection *nc, struct http_message *hm) {
+/**
+ * Get the runtime addressed by a /cwasm/v1/runtimes/<uuid>/modules uri
+ * 
+ * @param uri the request uri
+ * @return the runtime connection, NULL if the uri does not match
+ */
+static runtime_conn_t *http_runtime_from_uri(struct mg_str *uri)
+{
+    size_t prefix_len = strlen(URI_RUNTIMES_PREFIX), suffix_len = strlen(URI_MODULES_SUFFIX);
+
+    if (uri->len <= prefix_len + suffix_len) return NULL;
+    if (strncmp(uri->p, URI_RUNTIMES_PREFIX, prefix_len) != 0) return NULL;
+    if (strncmp(uri->p + uri->len - suffix_len, URI_MODULES_SUFFIX, suffix_len) != 0) return NULL;
+
+    return runtime_conn_get_by_uuid(uri->p + prefix_len, uri->len - prefix_len - suffix_len);
+}
+
+static int http_handle_module_uninstall(struct mg_connection *nc, struct http_message *hm, runtime_conn_t *conn, http_pending_t *pending) {
     char str_module_name[50]="";
 
     struct mg_str *hdr = mg_get_http_header(hm, "Content-Type");
@@ -137,14 +163,14 @@ static int http_handle_module_uninstall(struct mg_connection *nc, struct http_me
             return -1;
         }
     printf("uninstalling module: %s\n", str_module_name);
-    if (rt_req_uninstall(str_module_name, NULL) < 0) {
+    if (rt_req_uninstall(conn, str_module_name, NULL, http_on_runtime_response, pending) < 0) {
         http_printf_with_status(nc, HTTP_BAD_REQUEST_400, CT_HEADER_JSON, FMT_STR_JSON_ERROR_MSG, "Error installing (wasm file not found?).");
         return -1;
     }
     return 0;
 }
 
-static int http_handle_module_install(struct mg_connection *nc, struct http_message *hm) {
+static int http_handle_module_install(struct mg_connection *nc, struct http_message *hm, runtime_conn_t *conn, http_pending_t *pending) {
     char str_filepath[100]="", str_module_name[50]="", str_wasm_file[50]=""; 
 
         struct mg_str *hdr = mg_get_http_header(hm, "Content-Type");
@@ -198,34 +224,110 @@ static int http_handle_module_install(struct mg_connection *nc, struct http_mess
         }
 
     printf("installing from file: %s\n", str_filepath);
-    if (rt_req_install(str_filepath, NULL, 0, str_module_name, NULL, 0, 0, 0) < 0) {
+    if (rt_req_install(conn, str_filepath, NULL, 0, str_module_name, NULL, 0, 0, 0, http_on_runtime_response, pending) < 0) {
         http_printf_with_status(nc, HTTP_BAD_REQUEST_400, CT_HEADER_JSON, FMT_STR_JSON_ERROR_MSG, "Error installing (wasm file not found?).");
         return -1;
     }
     return 0;
 }
 
-static void http_handle_modules(struct mg_connection *nc, struct http_message *hm) 
+/**
+ * Write the reply to a rest request; runs in the event loop thread
+ * 
+ * @param arg the http_pending_t of the request
+ */
+static void http_reply_job(void *arg)
 {
+    http_pending_t *pending = (http_pending_t *) arg;
+    struct mg_connection *nc = pending->nc;
+
+    if (nc != NULL) {
+        nc->user_data = NULL;
+        if (pending->response_str != NULL) {
+            //printf("Sending response to http client: %s\n", pending->response_str);
+            http_printf_with_status(nc, pending->response_status, CT_HEADER_JSON, "%s", pending->response_str);
+        } else if (pending->response_status == HTTP_GATEWAY_TIMEOUT_504) {
+            http_printf_with_status(nc, HTTP_GATEWAY_TIMEOUT_504, CT_HEADER_JSON, FMT_STR_JSON_ERROR_MSG, "No response from runtime.");
+        } else {
+            http_printf(nc, "%s", "HTTP/1.1 500 Internal Server Error\r\n\r\n");
+        }
+        reactor_flush_mg_mgr(s_reactor, &g_http_mgr);
+    }
+
+    if (pending->response_str != NULL) free(pending->response_str);
+    free(pending);
+}
+
+/**
+ * Called (from the runtime worker thread) with the response to a rest request;
+ * the reply is written by the event loop thread
+ * 
+ * @param conn the runtime connection
+ * @param response the response; NULL on timeout
+ * @param arg the http_pending_t of the request
+ */
+static void http_on_runtime_response(struct runtime_conn *conn, response_t *response, void *arg)
+{
+    http_pending_t *pending = (http_pending_t *) arg;
+
+    if (response != NULL) {
+        // NULL makes the reply an internal server error
+        pending->response_str = http_attr_container_to_str(response->payload, response->fmt, response->payload_len);
+        // COAP status to HTTP status
+        pending->response_status = coap_to_http_status(response->status);  
+    } else {
+        pending->response_status = HTTP_GATEWAY_TIMEOUT_504;
+    }
+
+    if (reactor_post(s_reactor, http_reply_job, pending) != 0) {
+        if (pending->response_str != NULL) free(pending->response_str);
+        free(pending);
+    }
+}
+
+/**
+ * Handle a request to the modules endpoint; the request is sent to the runtime and the 
+ * reply is written when the response arrives, without blocking the event loop
+ * 
+ * @param nc the client connection 
+ * @param hm the http request
+ * @param conn the runtime addressed
+ */
+static void http_handle_modules(struct mg_connection *nc, struct http_message *hm, runtime_conn_t *conn) 
+{
+    http_pending_t *pending;
+    int ret = 0;
+
+    if (!runtime_conn_is_connected(conn)) {
+        http_printf_with_status(nc, HTTP_SERVICE_UNAVAILABLE_503, CT_HEADER_JSON, FMT_STR_JSON_ERROR_MSG, "Runtime not connected.");
+        return;
+    }
+
+    if ((pending = calloc(1, sizeof(http_pending_t))) == NULL) {
+        http_printf(nc, "%s", "HTTP/1.1 500 Internal Server Error\r\n\r\n");
+        return;
+    }
+    pending->nc = nc;
+
+    /* attach before sending; the reply job runs in this thread, so it cannot run before we return */
+    nc->user_data = pending;
+
     if (mg_vcmp(&hm->method, "POST") == 0) {
-        http_handle_module_install(nc, hm);
-        
+        ret = http_handle_module_install(nc, hm, conn, pending);
     } else if (mg_vcmp(&hm->method, "DELETE") == 0) {
-        http_handle_module_uninstall(nc, hm);
+        ret = http_handle_module_uninstall(nc, hm, conn, pending);
     } else if (mg_vcmp(&hm->method, "GET") == 0) {
-        if (rt_req_query(NULL) >= 0);
+        if ((ret = rt_req_query(conn, NULL, http_on_runtime_response, pending)) < 0)
+            http_printf_with_status(nc, HTTP_SERVICE_UNAVAILABLE_503, CT_HEADER_JSON, FMT_STR_JSON_ERROR_MSG, "Error sending query to runtime.");
     } else { 
         http_printf_with_status(nc, HTTP_METHOD_NOT_ALLOWED_405, CT_HEADER_JSON, FMT_STR_JSON_ERROR_MSG, "Method not supported.");
-        return;
+        ret = -1;
     }
-    rt_conn_wait_pending_response();
-    if (last_response_str != NULL) {
-        //printf("Sending response to http client: %s\n", last_response_str);
-        http_printf_with_status(nc, last_response_status, CT_HEADER_JSON, "%s", last_response_str);
-        free(last_response_str);
-        last_response_str=NULL;
-    } else {
-        http_printf(nc, "%s", "HTTP/1.1 500 Internal Server Error\r\n\r\n");
+
+    if (ret < 0) {
+        /* no request was sent (and an error reply was written); the callback will not be called */
+        nc->user_data = NULL;
+        free(pending);
     }
 }
 
@@ -280,19 +382,6 @@ static void http_printf_with_status(struct mg_connection *nc, int http_status, c
     mg_printf(nc, "%s", buffer);
 }
 
-void http_output_runtime_response(struct mg_connection *nc, response_t *obj)
-{
-    // COAP status to HTTP status
-    last_response_status = coap_to_http_status(obj->status);  
-
-    last_response_str = http_attr_container_to_str(obj->payload, obj->fmt, obj->payload_len);
-
-    if (last_response_str == NULL) {
-        http_printf(nc, "%s", "HTTP/1.1 500 Internal Server Error\r\n\r\n");
-        return;
-    }
-}
-
 static char *http_attr_container_to_str(attr_container_t *payload, int format, int payload_len)
 {
     cJSON *json = NULL;
@@ -11,6 +11,8 @@
 
 #include "mongoose.h"
 #include "attr_container.h"
+#include "reactor.h"
+#include "runtime_conn.h"
 
 #define HTTP_CONTINUE_100 100
 #define HTTP_OK_200 200
@@ -40,9 +42,11 @@
 /**
  * Init http server
  * 
+ * @param r the reactor that will drive the http server
+ * @param http_mg_conn the http (listening) connection
  * @return returns -1 on error, 0 on success
  */
-int http_init(struct mg_connection **http_mg_conn);
+int http_init(reactor_t *r, struct mg_connection **http_mg_conn);
 
 /**
  * Default http event handler
@@ -60,12 +64,4 @@ void http_ev_handler(struct mg_connection *nc, int ev, void *ev_data);
  */
 void http_printf(struct mg_connection *nc, const char *fmt, ...);
 
-/**
- * Output http response given a response object from the runtime
- * 
- * @param nc the connection to rest client 
- * @param obj response object received from runtime
- */
-void http_output_runtime_response(struct mg_connection *nc, response_t *obj);
-
 #endif
\ No newline at end of file
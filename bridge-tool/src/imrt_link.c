@@ -0,0 +1,211 @@
+ /** @file imrt_link.c
+ *  @brief IMRT link framing
+ *
+ *  Parsers for the IMRT link messages received from WAMR. on_imrt_link_byte_arrive()
+ *  is the byte-at-a-time parser of the WAMR host tool (original copyright bellow);
+ *  imrt_link_parse() works on whole buffers.
+ *
+ *  @date July, 2019
+ */
+
+/*
+ * Copyright (C) 2019 Intel Corporation.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "imrt_link.h"
+#include "bufpool.h"
+
+unsigned char leading[2] = { 0x12, 0x34 };
+
+#define SET_RECV_PHASE(ctx, new_phase) {ctx->phase = new_phase; ctx->size_in_phase = 0;}
+
+/*
+ * input:    1 byte from remote
+ * output:   parse result
+ * return:   -1 invalid sync byte
+ *           1 byte added to buffer, waiting more for complete packet
+ *           0 completed packet
+ *           2 in receiving payload
+ */
+int on_imrt_link_byte_arrive(unsigned char ch, imrt_link_recv_context_t *ctx)
+{
+    if (ctx->phase == Phase_Non_Start) {
+        if (ctx->message.payload) {
+            free(ctx->message.payload);
+            ctx->message.payload = NULL;
+            ctx->message.payload_size = 0;
+        }
+
+        if (leading[0] == ch) {
+            ctx->phase = Phase_Leading;
+        } else {
+            return -1;
+        }
+    } else if (ctx->phase == Phase_Leading) {
+        if (leading[1] == ch) {
+            SET_RECV_PHASE(ctx, Phase_Type);
+        } else {
+            ctx->phase = Phase_Non_Start;
+            return -1;
+        }
+    } else if (ctx->phase == Phase_Type) {
+        unsigned char *p = (unsigned char *) &ctx->message.message_type;
+        p[ctx->size_in_phase++] = ch;
+
+        if (ctx->size_in_phase == sizeof(ctx->message.message_type)) {
+            ctx->message.message_type = ntohs(ctx->message.message_type);
+            SET_RECV_PHASE(ctx, Phase_Size);
+        }
+    } else if (ctx->phase == Phase_Size) {
+        unsigned char * p = (unsigned char *) &ctx->message.payload_size;
+        p[ctx->size_in_phase++] = ch;
+
+        if (ctx->size_in_phase == sizeof(ctx->message.payload_size)) {
+            ctx->message.payload_size = ntohl(ctx->message.payload_size);
+            SET_RECV_PHASE(ctx, Phase_Payload);
+
+            if (ctx->message.payload) {
+                free(ctx->message.payload);
+                ctx->message.payload = NULL;
+            }
+
+            /* no payload */
+            if (ctx->message.payload_size == 0) {
+                SET_RECV_PHASE(ctx, Phase_Non_Start);
+                return 0;
+            }
+
+            if (ctx->message.payload_size > IMRT_LINK_MAX_PAYLOAD) {
+                SET_RECV_PHASE(ctx, Phase_Non_Start);
+                return -1;
+            }
+
+            ctx->message.payload = (char *) malloc(ctx->message.payload_size);
+            SET_RECV_PHASE(ctx, Phase_Payload);
+        }
+    } else if (ctx->phase == Phase_Payload) {
+        ctx->message.payload[ctx->size_in_phase++] = ch;
+
+        if (ctx->size_in_phase == ctx->message.payload_size) {
+            SET_RECV_PHASE(ctx, Phase_Non_Start);
+            return 0;
+        }
+
+        return 2;
+    }
+
+    return 1;
+}
+
+int imrt_link_parse(imrt_link_recv_context_t *ctx, const char *buf, int len, imrt_link_frame_cb_t cb, void *arg)
+{
+    imrt_link_message_t message;
+    const char *p;
+    uint16_t type_n;
+    uint32_t size_n, n;
+    int frames = 0;
+
+    while (len > 0) {
+        /* header: find the leading bytes, then copy the rest in one go */
+        if (ctx->hdr_len == 0) {
+            if ((p = memchr(buf, leading[0], len)) == NULL) break;
+            len -= p + 1 - buf;
+            buf = p + 1;
+            ctx->hdr[ctx->hdr_len++] = leading[0];
+            continue;
+        }
+        if (ctx->hdr_len == 1) {
+            /* not a sync sequence; rescan this byte as a possible first leading byte */
+            if ((unsigned char) *buf != leading[1]) {
+                ctx->hdr_len = 0;
+                continue;
+            }
+            ctx->hdr[ctx->hdr_len++] = leading[1];
+            buf++;
+            len--;
+            continue;
+        }
+        if (ctx->hdr_len < IMRT_LINK_HDR_LEN) {
+            n = IMRT_LINK_HDR_LEN - ctx->hdr_len;
+            if (n > (uint32_t) len) n = len;
+            memcpy(ctx->hdr + ctx->hdr_len, buf, n);
+            ctx->hdr_len += n;
+            buf += n;
+            len -= n;
+            if (ctx->hdr_len < IMRT_LINK_HDR_LEN) break;
+
+            memcpy(&type_n, ctx->hdr + 2, sizeof(type_n));
+            memcpy(&size_n, ctx->hdr + 4, sizeof(size_n));
+            ctx->message.message_type = ntohs(type_n);
+            ctx->message.payload_size = ntohl(size_n);
+            ctx->payload_rcvd = 0;
+
+            if (ctx->message.payload_size > IMRT_LINK_MAX_PAYLOAD) {
+                printf("Dropping message with invalid size (%u).\n", ctx->message.payload_size);
+                ctx->hdr_len = 0;
+                continue;
+            }
+
+            /* no payload, or payload entirely in this buffer: hand it out in place */
+            if (ctx->message.payload_size <= (uint32_t) len) {
+                message.message_type = ctx->message.message_type;
+                message.payload_size = ctx->message.payload_size;
+                message.payload = message.payload_size > 0 ? (char *) buf : NULL;
+                buf += message.payload_size;
+                len -= message.payload_size;
+                ctx->hdr_len = 0;
+                frames++;
+                cb(&message, arg);
+                continue;
+            }
+
+            /* payload split across reads: accumulate it in a pooled buffer */
+            ctx->message.payload = bufpool_alloc(ctx->message.payload_size);
+            if (ctx->message.payload == NULL) {
+                printf("Buffer pool limit reached; dropping message of %u bytes.\n", ctx->message.payload_size);
+                ctx->hdr_len = 0;
+                continue;
+            }
+        }
+
+        /* payload continuation */
+        n = ctx->message.payload_size - ctx->payload_rcvd;
+        if (n > (uint32_t) len) n = len;
+        memcpy(ctx->message.payload + ctx->payload_rcvd, buf, n);
+        ctx->payload_rcvd += n;
+        buf += n;
+        len -= n;
+
+        if (ctx->payload_rcvd == ctx->message.payload_size) {
+            frames++;
+            cb(&ctx->message, arg);
+            bufpool_free(ctx->message.payload);
+            ctx->message.payload = NULL;
+            ctx->hdr_len = 0;
+        }
+    }
+
+    return frames;
+}
+
+void imrt_link_recv_ctx_reset(imrt_link_recv_context_t *ctx)
+{
+    if (ctx->message.payload != NULL) bufpool_free(ctx->message.payload);
+    memset(ctx, 0, sizeof(imrt_link_recv_context_t));
+}
@@ -0,0 +1,94 @@
+ /** @file imrt_link.h
+ *  @brief Definitions for IMRT link framing
+ *
+ *  Definitions for parsing the IMRT link messages exchanged with WAMR:
+ *  leading bytes (0x12 0x34), message type (2 bytes), payload size (4 bytes),
+ *  all in network byte order, followed by the payload.
+ *
+ *  @date July, 2019
+ */
+#ifndef IMRT_LINK_H_
+#define IMRT_LINK_H_
+
+#include <stdint.h>
+
+/* size of the message header: leading bytes, type and payload size */
+#define IMRT_LINK_HDR_LEN 8
+
+/* larger payloads are considered corrupt and dropped */
+#define IMRT_LINK_MAX_PAYLOAD (1024 * 1024)
+
+extern unsigned char leading[2];
+
+/* IMRT link message between host and WAMR */
+typedef struct {
+    unsigned short message_type;
+    uint32_t payload_size;
+    char *payload;
+} imrt_link_message_t;
+
+/* The receive phase of IMRT link message */
+typedef enum {
+    Phase_Non_Start, Phase_Leading, Phase_Type, Phase_Size, Phase_Payload
+} recv_phase_t;
+
+/* The receive context of IMRT link message */
+typedef struct {
+    /* state of on_imrt_link_byte_arrive() */
+    recv_phase_t phase;
+    uint32_t size_in_phase;
+
+    imrt_link_message_t message;
+
+    /* state of imrt_link_parse(): partial header and payload bytes received */
+    unsigned char hdr[IMRT_LINK_HDR_LEN];
+    int hdr_len;
+    uint32_t payload_rcvd;
+} imrt_link_recv_context_t;
+
+/**
+ * Callback invoked for each complete message
+ *
+ * @param message the message; its payload is only valid during the call (it
+ * may point into the buffer given to imrt_link_parse())
+ * @param arg user argument given to imrt_link_parse()
+ */
+typedef void (*imrt_link_frame_cb_t)(imrt_link_message_t *message, void *arg);
+
+/**
+ * @brief Handle one byte of IMRT link message
+ *
+ * @param ch the one byte from WAMR to be handled
+ * @param ctx the receive context
+ *
+ * @return -1 invalid sync byte
+ *          1 byte added to buffer, waiting more for complete packet
+ *          0 completed packet
+ *          2 in receiving payload
+ */
+int on_imrt_link_byte_arrive(unsigned char ch, imrt_link_recv_context_t *ctx);
+
+/**
+ * @brief Parse a buffer of bytes received from WAMR, calling cb for every
+ * complete message in it; partial messages are kept in ctx for the next call.
+ * Payloads entirely inside buf are not copied; others are accumulated in a
+ * buffer from the buffer pool (see bufpool.h).
+ *
+ * @param ctx the receive context
+ * @param buf bytes received
+ * @param len number of bytes received
+ * @param cb function called for each complete message
+ * @param arg argument passed to cb
+ *
+ * @return the number of complete messages found
+ */
+int imrt_link_parse(imrt_link_recv_context_t *ctx, const char *buf, int len, imrt_link_frame_cb_t cb, void *arg);
+
+/**
+ * @brief Release a partial message kept in a receive context by imrt_link_parse() and reset it
+ *
+ * @param ctx the receive context
+ */
+void imrt_link_recv_ctx_reset(imrt_link_recv_context_t *ctx);
+
+#endif
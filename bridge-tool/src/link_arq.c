@@ -0,0 +1,564 @@
+/** @file link_arq.c
+ *  @brief Reliable link layer of uart runtime links
+ *
+ *  Selective repeat: the sender keeps the frames of its window until they
+ *  are acknowledged, and sends again the ones sent before a frame
+ *  acknowledged (the line keeps the order, so they were lost), or not
+ *  acknowledged after the timeout. Bytes given while the last frame is not
+ *  sent yet are added to it.
+ *
+ *  @date July, 2019
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "link_arq.h"
+
+#define ARQ_SYNC0 0xa5
+#define ARQ_SYNC1 0x5a
+
+/* frame types */
+#define ARQ_DATA 1
+#define ARQ_ACK 2
+#define ARQ_RESET 3
+#define ARQ_RESET_ACK 4
+
+/* states of a slot */
+#define SLOT_FREE 0
+#define SLOT_FILLING 1 /* sender: not sent yet, bytes may be added; receiver: received */
+#define SLOT_SENT 2
+#define SLOT_ACKED 3 /* acknowledged by the bitmap, not yet by the next frame expected */
+
+/* CRC-16/CCITT (poly 0x1021, init 0xffff) and CRC-32 (poly 0xedb88320, reflected), 4 bits at a time */
+static const uint16_t g_crc16_table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+};
+
+static const uint32_t g_crc32_table[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+static uint16_t arq_crc16(const unsigned char *p, uint32_t len)
+{
+    uint16_t crc = 0xffff;
+
+    while (len-- > 0) {
+        crc = (crc << 4) ^ g_crc16_table[(crc >> 12) ^ (*p >> 4)];
+        crc = (crc << 4) ^ g_crc16_table[(crc >> 12) ^ (*p++ & 0x0f)];
+    }
+    return crc;
+}
+
+static uint32_t arq_crc32(const unsigned char *p, uint32_t len)
+{
+    uint32_t crc = 0xffffffff;
+
+    while (len-- > 0) {
+        crc = (crc >> 4) ^ g_crc32_table[(crc ^ *p) & 0x0f];
+        crc = (crc >> 4) ^ g_crc32_table[(crc ^ (*p++ >> 4)) & 0x0f];
+    }
+    return ~crc;
+}
+
+static uint16_t arq_get16(const unsigned char *p)
+{
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static uint32_t arq_get32(const unsigned char *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static void arq_put16(unsigned char *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+static void arq_put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+}
+
+/* a different nonce on each run, and on each init of a run */
+static uint32_t arq_new_nonce()
+{
+    static uint32_t count;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint32_t) ts.tv_nsec ^ (uint32_t) ts.tv_sec * 2654435761U ^ (uint32_t) getpid() << 16)
+           + ++count * 0x9e3779b9U;
+}
+
+/* forget the frames of both directions */
+static void arq_reset_windows(link_arq_t *arq)
+{
+    int i;
+
+    for (i = 0; i < LINK_ARQ_MAX_WINDOW; i++) {
+        arq->tx[i].state = SLOT_FREE;
+        arq->rx[i].state = SLOT_FREE;
+    }
+    arq->tx_base = arq->tx_next = 0;
+    arq->rx_base = 0;
+    arq->ack_pending = 0;
+    arq->timer_ms = 0;
+}
+
+int link_arq_init(link_arq_t *arq, uint8_t window, uint16_t mtu, uint32_t rto_ms, link_arq_write_fn write, void *arg)
+{
+    if (window == 0 || window > LINK_ARQ_MAX_WINDOW || mtu == 0 || mtu > LINK_ARQ_MAX_MTU) return -1;
+
+    memset(arq, 0, sizeof(link_arq_t));
+    arq->window = window;
+    arq->mtu = mtu;
+    arq->rto_ms = arq->base_rto_ms = rto_ms;
+    arq->write = write;
+    arq->write_arg = arg;
+    arq->nonce = arq_new_nonce();
+    return 0;
+}
+
+void link_arq_destroy(link_arq_t *arq)
+{
+    int i;
+
+    for (i = 0; i < LINK_ARQ_MAX_WINDOW; i++) {
+        free(arq->tx[i].data);
+        free(arq->rx[i].data);
+        arq->tx[i].data = arq->rx[i].data = NULL;
+    }
+}
+
+uint32_t link_arq_rto(int baud, uint8_t window, uint16_t mtu)
+{
+    /* 10 bits per byte on the line; a frame may wait for the window sent before it (e.g. in the
+       uart driver), and its acknowledgement for a frame of the peer */
+    uint64_t bytes = (uint64_t) (window + 2) * (LINK_ARQ_HDR_LEN + mtu + LINK_ARQ_CRC_LEN);
+
+    if (baud <= 0) baud = 115200;
+    return (uint32_t) (bytes * 10 * 1000 / baud) + 20;
+}
+
+uint32_t link_arq_send(link_arq_t *arq, const char *buf, uint32_t len)
+{
+    struct link_arq_slot *slot;
+    uint32_t taken = 0, n;
+
+    while (len > 0) {
+        slot = &arq->tx[(uint8_t) (arq->tx_next - 1) % LINK_ARQ_MAX_WINDOW];
+        if (arq->tx_next == arq->tx_base || slot->state != SLOT_FILLING || slot->len == arq->mtu) {
+            /* a new frame */
+            if ((uint8_t) (arq->tx_next - arq->tx_base) >= arq->window) break;
+            slot = &arq->tx[arq->tx_next % LINK_ARQ_MAX_WINDOW];
+            if (slot->data == NULL && (slot->data = malloc(arq->mtu)) == NULL) break;
+            slot->state = SLOT_FILLING;
+            slot->len = 0;
+            slot->resend = slot->resent = 0;
+            arq->tx_next++;
+        }
+
+        n = (uint32_t) (arq->mtu - slot->len) < len ? (uint32_t) (arq->mtu - slot->len) : len;
+        memcpy(slot->data + slot->len, buf, n);
+        slot->len += n;
+        buf += n;
+        len -= n;
+        taken += n;
+    }
+    return taken;
+}
+
+int link_arq_writable(link_arq_t *arq)
+{
+    struct link_arq_slot *slot = &arq->tx[(uint8_t) (arq->tx_next - 1) % LINK_ARQ_MAX_WINDOW];
+
+    return (uint8_t) (arq->tx_next - arq->tx_base) < arq->window
+           || (slot->state == SLOT_FILLING && slot->len < arq->mtu);
+}
+
+/* the next frame expected; frames received and not read count as received */
+static uint8_t arq_rx_ack(link_arq_t *arq, uint32_t *bitmap)
+{
+    uint8_t ack = arq->rx_base, d;
+    int i;
+
+    while ((uint8_t) (ack - arq->rx_base) < LINK_ARQ_MAX_WINDOW && arq->rx[ack % LINK_ARQ_MAX_WINDOW].state != SLOT_FREE)
+        ack++;
+
+    *bitmap = 0;
+    for (i = 0; i < 32; i++) {
+        d = (uint8_t) (ack + 1 + i - arq->rx_base);
+        if (d < LINK_ARQ_MAX_WINDOW && arq->rx[(uint8_t) (ack + 1 + i) % LINK_ARQ_MAX_WINDOW].state != SLOT_FREE)
+            *bitmap |= 1U << i;
+    }
+    return ack;
+}
+
+/* number of frames of the window sent; the ones not sent yet are the last ones */
+static uint8_t arq_tx_sent(link_arq_t *arq)
+{
+    uint8_t seq = arq->tx_base;
+
+    while (seq != arq->tx_next && arq->tx[seq % LINK_ARQ_MAX_WINDOW].state != SLOT_FILLING) seq++;
+    return seq - arq->tx_base;
+}
+
+/* update the timeout with the time a frame took to be acknowledged (frames sent again are not
+   measured: the acknowledgement may be of either copy) */
+static void arq_rtt_sample(link_arq_t *arq, struct link_arq_slot *slot, uint64_t now_ms)
+{
+    uint32_t rtt, delta;
+
+    if (slot->resent || now_ms < slot->sent_ms) return;
+    rtt = (uint32_t) (now_ms - slot->sent_ms);
+
+    if (arq->srtt_ms == 0) {
+        arq->srtt_ms = rtt > 0 ? rtt : 1;
+        arq->rttvar_ms = rtt / 2;
+    } else {
+        delta = rtt > arq->srtt_ms ? rtt - arq->srtt_ms : arq->srtt_ms - rtt;
+        arq->rttvar_ms = (3 * arq->rttvar_ms + delta) / 4;
+        arq->srtt_ms = (7 * arq->srtt_ms + rtt) / 8;
+    }
+    arq->base_rto_ms = arq->srtt_ms + 4 * arq->rttvar_ms;
+    if (arq->base_rto_ms < LINK_ARQ_MIN_RTO_MS) arq->base_rto_ms = LINK_ARQ_MIN_RTO_MS;
+}
+
+/* free the frames acknowledged, and mark the ones lost to be sent again */
+static void arq_tx_acked(link_arq_t *arq, uint8_t ack, uint32_t bitmap, uint64_t now_ms)
+{
+    uint8_t sent = arq_tx_sent(arq), seq;
+    uint32_t last = 0, n;
+    struct link_arq_slot *slot;
+    int i, progress = 0, waiting;
+
+    /* the line works again: the timeout is no longer backed off */
+    arq->rto_ms = arq->base_rto_ms;
+    if ((uint8_t) (ack - arq->tx_base) > sent) return;
+
+    /* the last frame sent among the ones received, so far */
+    while (arq->tx_base != ack) {
+        slot = &arq->tx[arq->tx_base % LINK_ARQ_MAX_WINDOW];
+        if (slot->state == SLOT_SENT) arq_rtt_sample(arq, slot, now_ms);
+        progress = 1;
+        if (last == 0 || (int32_t) (slot->order - last) > 0) last = slot->order;
+        slot->state = SLOT_FREE;
+        arq->tx_base++;
+    }
+    sent = arq_tx_sent(arq);
+
+    for (i = 0; i < 32; i++) {
+        seq = ack + 1 + i;
+        if ((uint8_t) (seq - arq->tx_base) >= sent) break;
+        slot = &arq->tx[seq % LINK_ARQ_MAX_WINDOW];
+        if ((bitmap & (1U << i)) && slot->state == SLOT_SENT) {
+            arq_rtt_sample(arq, slot, now_ms);
+            slot->state = SLOT_ACKED;
+            progress = 1;
+        }
+        if (slot->state == SLOT_ACKED && (last == 0 || (int32_t) (slot->order - last) > 0)) last = slot->order;
+    }
+
+    /* frames sent before one received were lost (the line keeps the order) */
+    for (n = 0, waiting = 0; n < sent; n++) {
+        slot = &arq->tx[(uint8_t) (arq->tx_base + n) % LINK_ARQ_MAX_WINDOW];
+        if (slot->state != SLOT_SENT) continue;
+        if (last != 0 && (int32_t) (last - slot->order) > 0) slot->resend = 1;
+        waiting = 1;
+    }
+
+    /* the timeout runs from the last progress */
+    if (!waiting) arq->timer_ms = 0;
+    else if (progress) arq->timer_ms = now_ms;
+}
+
+/* keep a data frame received */
+static void arq_rx_data(link_arq_t *arq, uint8_t seq, const unsigned char *payload, uint16_t len)
+{
+    struct link_arq_slot *slot = &arq->rx[seq % LINK_ARQ_MAX_WINDOW];
+
+    /* acknowledged even if a duplicate or out of the window, in case the acknowledgement was lost */
+    arq->ack_pending = 1;
+    if ((uint8_t) (seq - arq->rx_base) >= LINK_ARQ_MAX_WINDOW || slot->state != SLOT_FREE) return;
+
+    if (slot->data == NULL && (slot->data = malloc(LINK_ARQ_MAX_MTU)) == NULL) return;
+    memcpy(slot->data, payload, len);
+    slot->len = len;
+    slot->off = 0;
+    slot->state = SLOT_FILLING;
+}
+
+/* handle a frame received, with valid CRCs */
+static void arq_rx_frame(link_arq_t *arq, const unsigned char *hdr, const unsigned char *payload, uint16_t len, uint64_t now_ms)
+{
+    uint32_t value = arq_get32(hdr + 8);
+
+    switch (hdr[2]) {
+        case ARQ_RESET:
+            if (!arq->peer_known) {
+                /* nothing was sent or received yet: frames waiting for the reset are kept */
+                arq->peer_known = 1;
+                arq->peer_nonce = value;
+            } else if (value != arq->peer_nonce) {
+                /* a new run of the peer: it starts from seq 0 both ways, and needs our nonce again */
+                arq->peer_reset = 1;
+                arq->peer_nonce = value;
+                arq->synced = 0;
+                arq->reset_sent_ms = 0;
+                arq_reset_windows(arq);
+            }
+            arq->reset_ack_pending = 1;
+            return;
+        case ARQ_RESET_ACK:
+            if (value == arq->nonce) arq->synced = 1;
+            return;
+        case ARQ_DATA:
+        case ARQ_ACK:
+            /* sent to a previous run of this side, or before the peer knew about it */
+            if (hdr[3] != (arq->nonce & 0xff) || !arq->peer_known) {
+                arq->stats.frames_dropped++;
+                return;
+            }
+            /* the peer has our nonce, even if its acknowledgement of the reset was lost */
+            arq->synced = 1;
+            arq_tx_acked(arq, hdr[5], value, now_ms);
+            if (hdr[2] == ARQ_DATA && len > 0) arq_rx_data(arq, hdr[4], payload, len);
+            return;
+        default:
+            arq->stats.frames_dropped++;
+    }
+}
+
+/* drop the first byte buffered, and the ones up to the next sync byte */
+static void arq_rx_resync(link_arq_t *arq)
+{
+    unsigned char *p = memchr(arq->in + 1, ARQ_SYNC0, arq->in_len - 1);
+    uint32_t skip = p != NULL ? (uint32_t) (p - arq->in) : arq->in_len;
+
+    memmove(arq->in, arq->in + skip, arq->in_len - skip);
+    arq->in_len -= skip;
+}
+
+/* handle the frame at the start of the buffer; 0 if it is not complete */
+static int arq_rx_step(link_arq_t *arq, uint64_t now_ms)
+{
+    uint32_t len, total;
+
+    if (arq->in_len < LINK_ARQ_HDR_LEN) return 0;
+
+    len = arq_get16(arq->in + 6);
+    if (arq->in[1] != ARQ_SYNC1 || len > LINK_ARQ_MAX_MTU
+        || arq_crc16(arq->in + 2, LINK_ARQ_HDR_LEN - 4) != arq_get16(arq->in + LINK_ARQ_HDR_LEN - 2)) {
+        /* a corrupted header, or sync bytes in the payload of a frame lost */
+        arq->stats.frames_dropped++;
+        arq_rx_resync(arq);
+        return 1;
+    }
+
+    total = LINK_ARQ_HDR_LEN + (len > 0 ? len + LINK_ARQ_CRC_LEN : 0);
+    if (arq->in_len < total) return 0;
+
+    if (len > 0 && arq_crc32(arq->in + LINK_ARQ_HDR_LEN, len) != arq_get32(arq->in + LINK_ARQ_HDR_LEN + len)) {
+        /* the header is valid: the frame ends here */
+        arq->stats.frames_dropped++;
+    } else {
+        arq_rx_frame(arq, arq->in, arq->in + LINK_ARQ_HDR_LEN, len, now_ms);
+    }
+
+    memmove(arq->in, arq->in + total, arq->in_len - total);
+    arq->in_len -= total;
+    return 1;
+}
+
+void link_arq_input(link_arq_t *arq, const char *buf, uint32_t len, uint64_t now_ms)
+{
+    const char *p;
+    uint32_t n;
+
+    while (len > 0) {
+        if (arq->in_len == 0) {
+            /* skip to the start of a frame */
+            if ((p = memchr(buf, ARQ_SYNC0, len)) == NULL) return;
+            len -= p - buf;
+            buf = p;
+        }
+
+        n = sizeof(arq->in) - arq->in_len < len ? sizeof(arq->in) - arq->in_len : len;
+        memcpy(arq->in + arq->in_len, buf, n);
+        arq->in_len += n;
+        buf += n;
+        len -= n;
+
+        while (arq->in_len > 0) {
+            if (arq->in[0] != ARQ_SYNC0) {
+                arq_rx_resync(arq);
+                continue;
+            }
+            if (!arq_rx_step(arq, now_ms)) break;
+        }
+    }
+}
+
+uint32_t link_arq_read(link_arq_t *arq, char *buf, uint32_t size)
+{
+    struct link_arq_slot *slot;
+    uint32_t n = 0, c;
+
+    while (n < size) {
+        slot = &arq->rx[arq->rx_base % LINK_ARQ_MAX_WINDOW];
+        if (slot->state == SLOT_FREE) break;
+
+        c = (uint32_t) (slot->len - slot->off) < size - n ? (uint32_t) (slot->len - slot->off) : size - n;
+        memcpy(buf + n, slot->data + slot->off, c);
+        slot->off += c;
+        n += c;
+        if (slot->off == slot->len) {
+            slot->state = SLOT_FREE;
+            arq->rx_base++;
+        }
+    }
+    arq->stats.bytes_delivered += n;
+    return n;
+}
+
+/* add a frame to the output buffer */
+static void arq_out_frame(link_arq_t *arq, uint8_t type, uint8_t seq, uint32_t value, const char *payload, uint16_t len)
+{
+    unsigned char *hdr = (unsigned char *) arq->out + arq->out_len;
+    uint32_t bitmap;
+
+    hdr[0] = ARQ_SYNC0;
+    hdr[1] = ARQ_SYNC1;
+    hdr[2] = type;
+    hdr[3] = arq->peer_nonce & 0xff;
+    hdr[4] = seq;
+    hdr[5] = 0;
+    if (type == ARQ_DATA || type == ARQ_ACK) {
+        /* every frame acknowledges the data received */
+        hdr[5] = arq_rx_ack(arq, &bitmap);
+        value = bitmap;
+        arq->ack_pending = 0;
+    }
+    arq_put16(hdr + 6, len);
+    arq_put32(hdr + 8, value);
+    arq_put16(hdr + LINK_ARQ_HDR_LEN - 2, arq_crc16(hdr + 2, LINK_ARQ_HDR_LEN - 4));
+    arq->out_len += LINK_ARQ_HDR_LEN;
+
+    if (len > 0) {
+        memcpy(arq->out + arq->out_len, payload, len);
+        arq_put32((unsigned char *) arq->out + arq->out_len + len, arq_crc32((unsigned char *) payload, len));
+        arq->out_len += len + LINK_ARQ_CRC_LEN;
+    }
+    arq->stats.frames_sent++;
+}
+
+/* add the next frame due to the output buffer; 0 if none is */
+static int arq_next_frame(link_arq_t *arq, uint64_t now_ms)
+{
+    struct link_arq_slot *slot;
+    uint8_t seq;
+
+    if (arq->reset_ack_pending) {
+        arq->reset_ack_pending = 0;
+        arq_out_frame(arq, ARQ_RESET_ACK, 0, arq->peer_nonce, NULL, 0);
+        return 1;
+    }
+    if (!arq->synced && (arq->reset_sent_ms == 0 || now_ms - arq->reset_sent_ms >= arq->rto_ms)) {
+        arq->reset_sent_ms = now_ms > 0 ? now_ms : 1;
+        arq_out_frame(arq, ARQ_RESET, 0, arq->nonce, NULL, 0);
+        return 1;
+    }
+    if (!arq->synced || !arq->peer_known) return 0;
+
+    /* nothing acknowledged for a timeout: all the frames not acknowledged are sent again (on a
+       noisy line, several of them are lost), and the timeout doubles until an ack arrives */
+    if (arq->timer_ms != 0 && now_ms - arq->timer_ms >= arq->rto_ms) {
+        arq->timer_ms = 0;
+        for (seq = arq->tx_base; seq != arq->tx_next; seq++) {
+            slot = &arq->tx[seq % LINK_ARQ_MAX_WINDOW];
+            if (slot->state == SLOT_SENT) slot->resend = 1;
+        }
+        arq->rto_ms = 2 * arq->rto_ms < LINK_ARQ_MAX_RTO_MS ? 2 * arq->rto_ms : LINK_ARQ_MAX_RTO_MS;
+    }
+
+    /* frames lost first, in order, then the new one */
+    for (seq = arq->tx_base; seq != arq->tx_next; seq++) {
+        slot = &arq->tx[seq % LINK_ARQ_MAX_WINDOW];
+        if (slot->state == SLOT_SENT && slot->resend) {
+            slot->resend = 0;
+            slot->resent = 1;
+            slot->sent_ms = now_ms;
+            slot->order = ++arq->order;
+            if (arq->timer_ms == 0) arq->timer_ms = now_ms;
+            arq->stats.frames_resent++;
+            arq_out_frame(arq, ARQ_DATA, seq, 0, slot->data, slot->len);
+            return 1;
+        }
+        if (slot->state == SLOT_FILLING) {
+            slot->state = SLOT_SENT;
+            slot->sent_ms = now_ms;
+            slot->order = ++arq->order;
+            if (arq->timer_ms == 0) arq->timer_ms = now_ms;
+            arq_out_frame(arq, ARQ_DATA, seq, 0, slot->data, slot->len);
+            return 1;
+        }
+    }
+
+    if (arq->ack_pending) {
+        arq_out_frame(arq, ARQ_ACK, 0, 0, NULL, 0);
+        return 1;
+    }
+    return 0;
+}
+
+int link_arq_flush(link_arq_t *arq, uint64_t now_ms)
+{
+    int n, more = 1;
+
+    while (more || arq->out_len > 0) {
+        /* several small frames are written at once */
+        while (more && sizeof(arq->out) - arq->out_len >= LINK_ARQ_MAX_FRAME)
+            more = arq_next_frame(arq, now_ms);
+
+        if (arq->out_len == 0) break;
+        if ((n = arq->write(arq->write_arg, arq->out, arq->out_len)) < 0) return -1;
+        if (n == 0) break;
+        memmove(arq->out, arq->out + n, arq->out_len - n);
+        arq->out_len -= n;
+        if (arq->out_len > 0) break;
+    }
+    return 0;
+}
+
+uint32_t link_arq_timeout(link_arq_t *arq, uint64_t now_ms)
+{
+    uint64_t due = UINT64_MAX;
+
+    if (arq->reset_ack_pending || arq->ack_pending || (!arq->synced && arq->reset_sent_ms == 0)) {
+        return 0;
+    } else if (!arq->synced) {
+        due = arq->reset_sent_ms + arq->rto_ms;
+    } else if (arq->timer_ms != 0) {
+        due = arq->timer_ms + arq->rto_ms;
+    }
+
+    if (due == UINT64_MAX) return UINT32_MAX;
+    return due <= now_ms ? 0 : (uint32_t) (due - now_ms);
+}
+
+int link_arq_peer_reset(link_arq_t *arq)
+{
+    int reset = arq->peer_reset;
+
+    arq->peer_reset = 0;
+    return reset;
+}
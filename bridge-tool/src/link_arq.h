@@ -0,0 +1,229 @@
+ /** @file link_arq.h
+ *  @brief Definitions for the reliable link layer of uart runtime links
+ *
+ *  Definitions for carrying the IMRT link byte stream over a noisy serial
+ *  line. The stream is cut in numbered frames (8-bit sequence numbers), with
+ *  a header checked by a CRC-16 and a payload checked by a CRC-32, so
+ *  corrupted frames are dropped instead of desynchronizing the IMRT framing.
+ *  Up to a window of frames are sent before being acknowledged, and the
+ *  receiver keeps the frames received out of order. Every frame acknowledges
+ *  the data received (the next frame expected, and a bitmap of the 32 frames
+ *  after it), so only the frames lost are sent again: as soon as a frame sent
+ *  after them is acknowledged, or after a timeout (adapted to the round trip
+ *  times measured).
+ *
+ *  Frame: sync bytes (0xa5 0x5a), type, epoch, seq, ack, payload length (2
+ *  bytes), ack bitmap or nonce (4 bytes), CRC-16 of the previous 10 bytes (2
+ *  bytes); then, if the length is not 0, the payload and its CRC-32 (4 bytes).
+ *  Multi-byte fields are in network byte order.
+ *
+ *  Each side starts by sending a reset frame with a random nonce, until the
+ *  peer acknowledges it; data is only sent once the peer acknowledged the
+ *  reset, and its frames carry the low byte of the peer's nonce (the epoch),
+ *  so frames sent to a previous run of the peer are ignored. A reset with a
+ *  new nonce from a known peer means it restarted: the stream is lost in both
+ *  directions, and link_arq_peer_reset() reports it.
+ *
+ *  Both the bridge and the runtime use this file; it only depends on libc.
+ *  It is not thread-safe; callers serialize access.
+ *
+ *  @date July, 2019
+ */
+#ifndef LINK_ARQ_H_
+#define LINK_ARQ_H_
+
+#include <stdint.h>
+
+#define LINK_ARQ_HDR_LEN 14
+#define LINK_ARQ_CRC_LEN 4
+
+/* limits of the window (frames in flight) and of the payload of a frame */
+#define LINK_ARQ_MAX_WINDOW 32
+#define LINK_ARQ_MAX_MTU 1024
+
+#define LINK_ARQ_DEFAULT_WINDOW 16
+#define LINK_ARQ_DEFAULT_MTU 256
+
+/* bounds of the retransmission timeout, once measured or backed off */
+#define LINK_ARQ_MIN_RTO_MS 20
+#define LINK_ARQ_MAX_RTO_MS 5000
+
+/* period of the retransmission check, for callers polling with a timer */
+#define LINK_ARQ_TICK_MS 10
+
+#define LINK_ARQ_MAX_FRAME (LINK_ARQ_HDR_LEN + LINK_ARQ_MAX_MTU + LINK_ARQ_CRC_LEN)
+
+/**
+ * Write bytes to the line
+ *
+ * @param arg user argument given to link_arq_init()
+ * @param buf the bytes
+ * @param len number of bytes
+ * @return returns the number of bytes written, 0 if the line does not take bytes now, -1 on error
+ */
+typedef int (*link_arq_write_fn)(void *arg, const char *buf, uint32_t len);
+
+typedef struct {
+    uint32_t frames_sent;
+    uint32_t frames_resent;
+    /* corrupted, or sent to another run */
+    uint32_t frames_dropped;
+    uint64_t bytes_delivered;
+} link_arq_stats_t;
+
+/* a frame of the window; data is allocated on first use */
+struct link_arq_slot {
+    char *data;
+    uint16_t len;
+    uint16_t off;
+    uint8_t state;
+    uint8_t resend;
+    uint8_t resent;
+    /* order in which it was last sent */
+    uint32_t order;
+    uint64_t sent_ms;
+};
+
+typedef struct {
+    uint8_t window;
+    uint16_t mtu;
+
+    /* retransmission timeout (backed off while nothing is acknowledged), from the round trip times
+       measured (smoothed, and their variation) */
+    uint32_t rto_ms;
+    uint32_t base_rto_ms;
+    uint32_t srtt_ms;
+    uint32_t rttvar_ms;
+    /* start of the timeout of the oldest frame not acknowledged; 0 if none waits */
+    uint64_t timer_ms;
+    link_arq_write_fn write;
+    void *write_arg;
+
+    /* nonce of this side (its low byte is the epoch of the frames received), and of the peer */
+    uint32_t nonce;
+    uint32_t peer_nonce;
+    int peer_known;
+    /* the peer acknowledged our reset */
+    int synced;
+    int reset_ack_pending;
+    uint64_t reset_sent_ms;
+    int peer_reset;
+
+    /* frames sent, from the oldest not acknowledged to the one being filled */
+    struct link_arq_slot tx[LINK_ARQ_MAX_WINDOW];
+    uint8_t tx_base;
+    uint8_t tx_next;
+    uint32_t order;
+
+    /* frames received, from the next one read */
+    struct link_arq_slot rx[LINK_ARQ_MAX_WINDOW];
+    uint8_t rx_base;
+    int ack_pending;
+
+    /* bytes of the frames being received */
+    unsigned char in[LINK_ARQ_MAX_FRAME];
+    uint32_t in_len;
+
+    /* frames waiting for the line */
+    char out[2 * LINK_ARQ_MAX_FRAME];
+    uint32_t out_len;
+
+    link_arq_stats_t stats;
+} link_arq_t;
+
+/**
+ * Init the link layer of a line just opened; a reset is sent on the first link_arq_flush()
+ *
+ * @param arq the link layer
+ * @param window frames sent before waiting for acknowledgement (up to LINK_ARQ_MAX_WINDOW)
+ * @param mtu maximum payload of a frame (up to LINK_ARQ_MAX_MTU)
+ * @param rto_ms time after which a frame not acknowledged is sent again (see link_arq_rto()), until round trips are measured
+ * @param write function writing to the line
+ * @param arg argument passed to write
+ * @return returns 0 (success), -1 (invalid window or mtu)
+ */
+int link_arq_init(link_arq_t *arq, uint8_t window, uint16_t mtu, uint32_t rto_ms, link_arq_write_fn write, void *arg);
+
+/**
+ * Release the frames of a link layer
+ *
+ * @param arq the link layer
+ */
+void link_arq_destroy(link_arq_t *arq);
+
+/**
+ * Compute a retransmission timeout: the time to send a window of frames and the frames buffered, and a margin
+ *
+ * @param baud bits per second of the line
+ * @param window frames sent before waiting for acknowledgement
+ * @param mtu maximum payload of a frame
+ * @return returns the timeout, in ms
+ */
+uint32_t link_arq_rto(int baud, uint8_t window, uint16_t mtu);
+
+/**
+ * Add bytes of the stream to the window; they are framed and sent by link_arq_flush()
+ *
+ * @param arq the link layer
+ * @param buf the bytes
+ * @param len number of bytes
+ * @return returns the number of bytes taken; less than len if the window is full
+ */
+uint32_t link_arq_send(link_arq_t *arq, const char *buf, uint32_t len);
+
+/**
+ * Handle bytes read from the line: acknowledgements free the window, and data
+ * is kept until link_arq_read()
+ *
+ * @param arq the link layer
+ * @param buf the bytes
+ * @param len number of bytes
+ * @param now_ms monotonic time, in ms
+ */
+void link_arq_input(link_arq_t *arq, const char *buf, uint32_t len, uint64_t now_ms);
+
+/**
+ * Take the bytes of the stream received in order
+ *
+ * @param arq the link layer
+ * @param buf where to copy them
+ * @param size size of buf
+ * @return returns the number of bytes copied; 0 if none
+ */
+uint32_t link_arq_read(link_arq_t *arq, char *buf, uint32_t size);
+
+/**
+ * Write to the line the frames due: resets, acknowledgements, frames lost and new frames
+ *
+ * @param arq the link layer
+ * @param now_ms monotonic time, in ms
+ * @return returns -1 on a write error, 0 otherwise
+ */
+int link_arq_flush(link_arq_t *arq, uint64_t now_ms);
+
+/**
+ * Time until a frame is due to be sent again, to poll the line with a timeout
+ *
+ * @param arq the link layer
+ * @param now_ms monotonic time, in ms
+ * @return returns the time in ms; UINT32_MAX if nothing waits for acknowledgement
+ */
+uint32_t link_arq_timeout(link_arq_t *arq, uint64_t now_ms);
+
+/**
+ * Check if the peer restarted since the last call; the stream was lost in both directions
+ *
+ * @param arq the link layer
+ * @return returns 1 if it did, 0 otherwise
+ */
+int link_arq_peer_reset(link_arq_t *arq);
+
+/**
+ * Check if the window has room for more bytes
+ *
+ * @param arq the link layer
+ * @return returns 1 if link_arq_send() takes bytes, 0 otherwise
+ */
+int link_arq_writable(link_arq_t *arq);
+
+#endif
@@ -0,0 +1,162 @@
+/** @file link_compress.c
+ *  @brief Compressed messages on the runtime link
+ *
+ *  LZ4 block format: sequences of a token (literal length and match length
+ *  - 4, 4 bits each; 15 continues in the next bytes), the literals, and the
+ *  match offset (2 bytes, little endian). The last sequence has only
+ *  literals; the last 5 bytes are always literals, and no match starts in the
+ *  last 12 bytes. The encoder is greedy, with a table of the last position of
+ *  each hash of 4 bytes.
+ *
+ *  @date July, 2019
+ */
+#include <string.h>
+
+#include "link_compress.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT 12
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+#define LZ_NO_POS INT32_MIN
+
+/* strings common on the link: urls, wasm headers and install responses;
+   changing it requires a new LINK_COMPRESS_CODEC */
+static const char g_dict[] =
+    "\0asm\1\0\0\0\1\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
+    "memory\0__heap_base\0__data_end\0_start\0on_init\0on_destroy\0on_request\0on_response\0"
+    "on_sensor_event\0on_timer_callback\0on_interrupt\0env\0"
+    "/module-chunk?hash=&size=&offset=/module-cache/link-compress"
+    "{\"id\":\"\",\"name\":\"\"}data\0/applet?name=&type=wasm&heap=&timers=&wd=&hash=";
+
+#define DICT_LEN ((int32_t) sizeof(g_dict) - 1)
+
+/* byte at a position of the payload; negative positions are in the dictionary, before it */
+static inline unsigned char lz_at(const char *src, int32_t pos)
+{
+    return (unsigned char) (pos < 0 ? g_dict[DICT_LEN + pos] : src[pos]);
+}
+
+static inline uint32_t lz_read4(const char *src, int32_t pos)
+{
+    return (uint32_t) lz_at(src, pos) | (uint32_t) lz_at(src, pos + 1) << 8
+        | (uint32_t) lz_at(src, pos + 2) << 16 | (uint32_t) lz_at(src, pos + 3) << 24;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/* write a length continued after a token field of 15 */
+static void lz_put_len(char *dst, uint32_t *op, uint32_t len)
+{
+    for (; len >= 255; len -= 255) dst[(*op)++] = (char) 255;
+    dst[(*op)++] = (char) len;
+}
+
+/* write a sequence: literals, then a match (none if match_len is 0); -1 if it does not fit */
+static int lz_put_seq(char *dst, uint32_t dst_size, uint32_t *op, const char *lit, uint32_t lit_len, uint32_t offset, uint32_t match_len)
+{
+    uint32_t need = 1 + lit_len + lit_len / 255 + 1 + (match_len > 0 ? 2 + match_len / 255 + 1 : 0);
+    uint32_t token = *op, ml = match_len - LZ_MIN_MATCH;
+
+    if (need > dst_size - *op) return -1;
+
+    (*op)++;
+    dst[token] = (char) ((lit_len >= 15 ? 15 : lit_len) << 4);
+    if (lit_len >= 15) lz_put_len(dst, op, lit_len - 15);
+    memcpy(dst + *op, lit, lit_len);
+    *op += lit_len;
+
+    if (match_len > 0) {
+        dst[(*op)++] = (char) (offset & 0xff);
+        dst[(*op)++] = (char) (offset >> 8);
+        dst[token] |= (char) (ml >= 15 ? 15 : ml);
+        if (ml >= 15) lz_put_len(dst, op, ml - 15);
+    }
+    return 0;
+}
+
+uint32_t link_compress(const char *src, uint32_t len, char *dst, uint32_t dst_size)
+{
+    int32_t table[1 << LZ_HASH_BITS];
+    uint32_t anchor = 0, op = 0, h, match_len;
+    int32_t ip = 0, ref, i;
+
+    for (i = 0; i < (1 << LZ_HASH_BITS); i++) table[i] = LZ_NO_POS;
+    for (i = -DICT_LEN; i + LZ_MIN_MATCH <= 0; i++) table[lz_hash(lz_read4(src, i))] = i;
+
+    while (len >= LZ_MF_LIMIT && (uint32_t) ip <= len - LZ_MF_LIMIT) {
+        h = lz_hash(lz_read4(src, ip));
+        ref = table[h];
+        table[h] = ip;
+
+        if (ref == LZ_NO_POS || ip - ref > LZ_MAX_OFFSET || lz_read4(src, ref) != lz_read4(src, ip)) {
+            ip++;
+            continue;
+        }
+
+        match_len = LZ_MIN_MATCH;
+        while (ip + match_len < len - LZ_LAST_LITERALS && lz_at(src, ref + match_len) == (unsigned char) src[ip + match_len])
+            match_len++;
+
+        if (lz_put_seq(dst, dst_size, &op, src + anchor, ip - anchor, ip - ref, match_len) != 0) return 0;
+        ip += match_len;
+        anchor = ip;
+    }
+
+    if (lz_put_seq(dst, dst_size, &op, src + anchor, len - anchor, 0, 0) != 0) return 0;
+    return op;
+}
+
+/* read a length continued after a token field of 15; -1 if past the end */
+static int lz_get_len(const char *src, uint32_t len, uint32_t *ip, uint32_t *n)
+{
+    unsigned char b;
+
+    do {
+        if (*ip >= len) return -1;
+        b = (unsigned char) src[(*ip)++];
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+int link_decompress(const char *src, uint32_t len, char *dst, uint32_t size)
+{
+    uint32_t ip = 0, op = 0, lit_len, match_len, offset;
+    unsigned char token;
+    int64_t pos;
+
+    while (ip < len) {
+        token = (unsigned char) src[ip++];
+
+        lit_len = token >> 4;
+        if (lit_len == 15 && lz_get_len(src, len, &ip, &lit_len) != 0) return -1;
+        if (lit_len > len - ip || lit_len > size - op) return -1;
+        memcpy(dst + op, src + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        /* the last sequence has no match */
+        if (ip == len) break;
+
+        if (len - ip < 2) return -1;
+        offset = (unsigned char) src[ip] | (uint32_t) (unsigned char) src[ip + 1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > op + DICT_LEN) return -1;
+
+        match_len = token & 15;
+        if (match_len == 15 && lz_get_len(src, len, &ip, &match_len) != 0) return -1;
+        match_len += LZ_MIN_MATCH;
+        if (match_len > size - op) return -1;
+
+        /* byte by byte: matches may overlap what they write, or start in the dictionary */
+        for (pos = (int64_t) op - offset; match_len > 0; match_len--, pos++)
+            dst[op++] = pos < 0 ? g_dict[DICT_LEN + pos] : dst[pos];
+    }
+
+    return op == size ? 0 : -1;
+}
@@ -0,0 +1,59 @@
+ /** @file link_compress.h
+ *  @brief Definitions for compressed messages on the runtime link
+ *
+ *  Definitions for compressing link messages, for slow links (e.g. UART).
+ *  A compressed message has type LINK_COMPRESSED_PACKET, and its payload is
+ *  the type (2 bytes) and payload size (4 bytes, network byte order) of the
+ *  original message, followed by its payload compressed as an LZ4 block.
+ *  Matches may refer to a dictionary of strings common on the link, as if it
+ *  preceded the payload, so small messages (e.g. events) also compress.
+ *
+ *  Each side announces it reads compressed messages by sending a request
+ *  with url LINK_COMPRESS_HELLO_URL (payload: LINK_COMPRESS_CODEC) after
+ *  each hello (see topic_alias.h); messages are only compressed after the
+ *  peer did. Both the bridge and the runtime use this file; it only depends
+ *  on libc.
+ *
+ *  @date July, 2019
+ */
+#ifndef LINK_COMPRESS_H_
+#define LINK_COMPRESS_H_
+
+#include <stdint.h>
+
+/* link message type of compressed messages */
+#define LINK_COMPRESSED_PACKET 0x4c5a
+
+/* original type and payload size, before the compressed payload */
+#define LINK_COMPRESS_HDR_LEN 6
+
+/* url of the request announcing compressed messages are read, and its payload (codec and dictionary version) */
+#define LINK_COMPRESS_HELLO_URL "/link-compress"
+#define LINK_COMPRESS_CODEC "lz4-d1"
+
+/* default size of the messages compressed, over uart */
+#define LINK_COMPRESS_DEFAULT_THRESHOLD 128
+
+/**
+ * Compress a payload
+ *
+ * @param src the payload
+ * @param len length of the payload
+ * @param dst where to store the compressed payload
+ * @param dst_size size of dst; compression stops if it would not be smaller than this
+ * @return returns the length of the compressed payload, 0 if it does not fit in dst_size
+ */
+uint32_t link_compress(const char *src, uint32_t len, char *dst, uint32_t dst_size);
+
+/**
+ * Decompress a payload
+ *
+ * @param src the compressed payload
+ * @param len length of the compressed payload
+ * @param dst where to store the payload
+ * @param size length of the payload (from the header of the compressed message)
+ * @return returns 0 (success), -1 (malformed, or not of this length)
+ */
+int link_decompress(const char *src, uint32_t len, char *dst, uint32_t size);
+
+#endif
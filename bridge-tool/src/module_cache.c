@@ -0,0 +1,241 @@
+/** @file module_cache.c
+ *  @brief Module binary cache
+ *
+ *  Entries are kept in a list, most recently used first. A file is mapped
+ *  again when its inode, size or modification time changes; the previous
+ *  mapping is released once no install uses it.
+ *
+ *  @date July, 2019
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "module_cache.h"
+#include "module_hash.h"
+
+TAILQ_HEAD(module_cache_list, module_cache_entry);
+
+static struct module_cache_list g_entries = TAILQ_HEAD_INITIALIZER(g_entries);
+static uint32_t g_entry_count;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void module_cache_free(module_cache_entry_t *e)
+{
+    munmap((void *) e->data, e->size);
+    free(e->path);
+    free(e);
+}
+
+/* drop an entry from the list; it is freed now, or when its last user releases it */
+static void module_cache_drop(module_cache_entry_t *e)
+{
+    TAILQ_REMOVE(&g_entries, e, next);
+    g_entry_count--;
+    e->stale = 1;
+    if (e->refs == 0) module_cache_free(e);
+}
+
+/* map a file; NULL on error */
+static module_cache_entry_t *module_cache_map(const char *path, int fd, struct stat *st)
+{
+    module_cache_entry_t *e;
+    void *data;
+
+    if (st->st_size <= 0 || st->st_size > UINT32_MAX) {
+        printf("Module file '%s' is empty or too large.\n", path);
+        return NULL;
+    }
+
+    if ((data = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        perror("module cache mmap");
+        return NULL;
+    }
+
+    if ((e = calloc(1, sizeof(module_cache_entry_t))) == NULL || (e->path = strdup(path)) == NULL) {
+        free(e);
+        munmap(data, st->st_size);
+        return NULL;
+    }
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->mtime = st->st_mtim;
+    e->data = data;
+    e->size = st->st_size;
+    e->hash = module_hash(data, e->size);
+    return e;
+}
+
+module_cache_entry_t *module_cache_get(const char *path)
+{
+    module_cache_entry_t *e, *prev;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        printf("Error opening module file '%s'.\n", path);
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_lock);
+
+    TAILQ_FOREACH(e, &g_entries, next) {
+        if (strcmp(e->path, path) == 0) break;
+    }
+
+    if (e != NULL && (e->dev != st.st_dev || e->ino != st.st_ino || e->size != (uint32_t) st.st_size || e->mtime.tv_sec != st.st_mtim.tv_sec || e->mtime.tv_nsec != st.st_mtim.tv_nsec)) {
+        /* the file changed since it was mapped */
+        module_cache_drop(e);
+        e = NULL;
+    }
+
+    if (e != NULL) {
+        TAILQ_REMOVE(&g_entries, e, next);
+    } else {
+        if ((e = module_cache_map(path, fd, &st)) == NULL) {
+            pthread_mutex_unlock(&g_lock);
+            close(fd);
+            return NULL;
+        }
+        g_entry_count++;
+
+        /* unmap the least recently used files not in use */
+        for (prev = TAILQ_LAST(&g_entries, module_cache_list); prev != NULL && g_entry_count > MODULE_CACHE_MAX_FILES; prev = TAILQ_PREV(prev, module_cache_list, next)) {
+            if (prev->refs == 0) {
+                module_cache_drop(prev);
+                break;
+            }
+        }
+    }
+    TAILQ_INSERT_HEAD(&g_entries, e, next);
+    e->refs++;
+
+    pthread_mutex_unlock(&g_lock);
+    close(fd);
+    return e;
+}
+
+void module_cache_release(module_cache_entry_t *e)
+{
+    pthread_mutex_lock(&g_lock);
+    if (--e->refs == 0 && e->stale) module_cache_free(e);
+    pthread_mutex_unlock(&g_lock);
+}
+
+void module_cache_destroy()
+{
+    module_cache_entry_t *e;
+
+    pthread_mutex_lock(&g_lock);
+    while ((e = TAILQ_FIRST(&g_entries)) != NULL) module_cache_drop(e);
+    pthread_mutex_unlock(&g_lock);
+}
+
+void module_hash_set_init(module_hash_set_t *set)
+{
+    memset(set, 0, sizeof(module_hash_set_t));
+}
+
+void module_hash_set_clear(module_hash_set_t *set)
+{
+    if (set->slots != NULL) memset(set->slots, 0, set->size * sizeof(uint64_t));
+    set->count = 0;
+}
+
+void module_hash_set_destroy(module_hash_set_t *set)
+{
+    free(set->slots);
+    module_hash_set_init(set);
+}
+
+/* slot of a hash, or of the empty slot where it goes (slots are never all used) */
+static uint32_t module_hash_set_slot(module_hash_set_t *set, uint64_t hash)
+{
+    uint32_t i;
+
+    for (i = (uint32_t) hash & (set->size - 1); set->slots[i] != 0 && set->slots[i] != hash; i = (i + 1) & (set->size - 1))
+        ;
+    return i;
+}
+
+int module_hash_set_add(module_hash_set_t *set, uint64_t hash)
+{
+    uint64_t *old_slots = set->slots;
+    uint32_t old_size = set->size, i;
+
+    /* 0 marks empty slots */
+    if (hash == 0) return -1;
+
+    /* keep the set at most half full */
+    if (2 * (set->count + 1) > set->size) {
+        set->size = set->size > 0 ? 2 * set->size : 64;
+        if ((set->slots = calloc(set->size, sizeof(uint64_t))) == NULL) {
+            set->slots = old_slots;
+            set->size = old_size;
+            return -1;
+        }
+        for (i = 0; i < old_size; i++) {
+            if (old_slots[i] != 0) set->slots[module_hash_set_slot(set, old_slots[i])] = old_slots[i];
+        }
+        free(old_slots);
+    }
+
+    i = module_hash_set_slot(set, hash);
+    if (set->slots[i] == 0) {
+        set->slots[i] = hash;
+        set->count++;
+    }
+    return 0;
+}
+
+void module_hash_set_del(module_hash_set_t *set, uint64_t hash)
+{
+    uint32_t i, j, home;
+
+    if (set->count == 0 || hash == 0) return;
+
+    i = module_hash_set_slot(set, hash);
+    if (set->slots[i] == 0) return;
+    set->slots[i] = 0;
+    set->count--;
+
+    /* move back the entries after it that would not be found across the hole */
+    for (j = (i + 1) & (set->size - 1); set->slots[j] != 0; j = (j + 1) & (set->size - 1)) {
+        home = (uint32_t) set->slots[j] & (set->size - 1);
+        if (((j - home) & (set->size - 1)) >= ((j - i) & (set->size - 1))) {
+            set->slots[i] = set->slots[j];
+            set->slots[j] = 0;
+            i = j;
+        }
+    }
+}
+
+int module_hash_set_has(module_hash_set_t *set, uint64_t hash)
+{
+    if (set->count == 0 || hash == 0) return 0;
+    return set->slots[module_hash_set_slot(set, hash)] == hash;
+}
+
+int module_hash_set_load(module_hash_set_t *set, const char *report, uint32_t len)
+{
+    uint64_t hash;
+    uint32_t i;
+
+    module_hash_set_clear(set);
+    for (i = 0; i + MODULE_HASH_HEX_LEN <= len; i += MODULE_HASH_HEX_LEN + 1) {
+        if (module_hash_parse(report + i, &hash) != 0) return -1;
+        if (module_hash_set_add(set, hash) != 0) return -1;
+        if (i + MODULE_HASH_HEX_LEN == len || report[i + MODULE_HASH_HEX_LEN] == '\0') break;
+        if (report[i + MODULE_HASH_HEX_LEN] != ',') return -1;
+    }
+    return set->count;
+}
@@ -0,0 +1,137 @@
+ /** @file module_cache.h
+ *  @brief Definitions for the module binary cache
+ *
+ *  Definitions for a cache of the module binaries installed: files are mapped
+ *  read-only and hashed once (see module_hash.h), and stay mapped until they
+ *  change on disk, so installing a module again does not read it again. Also
+ *  defines the set of hashes a runtime reports holding.
+ *
+ *  Thread-safe.
+ *
+ *  @date July, 2019
+ */
+#ifndef MODULE_CACHE_H_
+#define MODULE_CACHE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "queue.h"
+
+/* files kept mapped; the least recently used one not in use is unmapped beyond this */
+#define MODULE_CACHE_MAX_FILES 1024
+
+/**
+ * A mapped module binary
+ */
+typedef struct module_cache_entry {
+    TAILQ_ENTRY(module_cache_entry) next;
+
+    /* path and identity of the file mapped */
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+
+    /* the binary (read-only) and its hash */
+    const char *data;
+    uint32_t size;
+    uint64_t hash;
+
+    /* users of the entry; an entry replaced (file changed) is unmapped when they are done */
+    uint32_t refs;
+    int stale;
+} module_cache_entry_t;
+
+/**
+ * Set of module hashes (open addressing, linear probing)
+ */
+typedef struct {
+    uint64_t *slots;
+
+    /* number of slots (a power of 2, or 0) */
+    uint32_t size;
+
+    /* hashes in the set */
+    uint32_t count;
+} module_hash_set_t;
+
+/**
+ * Get a module binary, mapping the file if it is not mapped or changed since
+ *
+ * @param path the file
+ * @return returns the entry (release with module_cache_release()), NULL on error
+ */
+module_cache_entry_t *module_cache_get(const char *path);
+
+/**
+ * Release an entry returned by module_cache_get()
+ *
+ * @param e the entry
+ */
+void module_cache_release(module_cache_entry_t *e);
+
+/**
+ * Unmap all files; entries in use are unmapped when released
+ */
+void module_cache_destroy();
+
+/**
+ * Init a hash set
+ *
+ * @param set the set
+ */
+void module_hash_set_init(module_hash_set_t *set);
+
+/**
+ * Remove all hashes from a set
+ *
+ * @param set the set
+ */
+void module_hash_set_clear(module_hash_set_t *set);
+
+/**
+ * Remove all hashes *and* release resources
+ *
+ * @param set the set
+ */
+void module_hash_set_destroy(module_hash_set_t *set);
+
+/**
+ * Add a hash to a set
+ *
+ * @param set the set
+ * @param hash the hash
+ * @return returns 0 (success), -1 (failure)
+ */
+int module_hash_set_add(module_hash_set_t *set, uint64_t hash);
+
+/**
+ * Remove a hash from a set
+ *
+ * @param set the set
+ * @param hash the hash
+ */
+void module_hash_set_del(module_hash_set_t *set, uint64_t hash);
+
+/**
+ * Check if a hash is in a set
+ *
+ * @param set the set
+ * @param hash the hash
+ * @return 1 if found, 0 if not
+ */
+int module_hash_set_has(module_hash_set_t *set, uint64_t hash);
+
+/**
+ * Replace the hashes of a set by the ones in a MODULE_HASH_REPORT_URL payload
+ *
+ * @param set the set
+ * @param report the payload
+ * @param len length of the payload
+ * @return returns the number of hashes loaded, -1 if malformed
+ */
+int module_hash_set_load(module_hash_set_t *set, const char *report, uint32_t len);
+
+#endif
@@ -0,0 +1,44 @@
+/** @file module_hash.c
+ *  @brief Content hashes of module binaries
+ *
+ *  @date July, 2019
+ */
+#include "module_hash.h"
+
+uint64_t module_hash(const void *data, uint32_t len)
+{
+    const unsigned char *p = data;
+    uint64_t h = 14695981039346656037ull;
+
+    while (len-- > 0) {
+        h ^= *p++;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+void module_hash_format(uint64_t hash, char *buf)
+{
+    static const char digits[] = "0123456789abcdef";
+    int i;
+
+    for (i = MODULE_HASH_HEX_LEN - 1; i >= 0; i--) {
+        buf[i] = digits[hash & 0xf];
+        hash >>= 4;
+    }
+    buf[MODULE_HASH_HEX_LEN] = '\0';
+}
+
+int module_hash_parse(const char *s, uint64_t *hash)
+{
+    uint64_t h = 0;
+    int i;
+
+    for (i = 0; i < MODULE_HASH_HEX_LEN; i++) {
+        if (s[i] >= '0' && s[i] <= '9') h = (h << 4) | (s[i] - '0');
+        else if (s[i] >= 'a' && s[i] <= 'f') h = (h << 4) | (s[i] - 'a' + 10);
+        else return -1;
+    }
+    *hash = h;
+    return 0;
+}
@@ -0,0 +1,78 @@
+ /** @file module_hash.h
+ *  @brief Definitions for content hashes of module binaries
+ *
+ *  Definitions for naming module binaries by a hash of their bytes, so a
+ *  binary the runtime already holds is not sent again. The runtime keeps the
+ *  binaries installed, by hash, and reports the hashes it holds after each
+ *  hello (see topic_alias.h) in a request with url MODULE_HASH_REPORT_URL
+ *  (payload: the hashes, MODULE_HASH_HEX_LEN hex digits each, separated by
+ *  ','). An install request whose url has MODULE_HASH_URL_KEY and no payload
+ *  installs the binary with that hash; the runtime answers NOT_FOUND_4_04 if
+ *  it no longer holds it.
+ *
+ *  Large binaries are sent in chunks, before such an install: requests with
+ *  url MODULE_CHUNK_URL_FMT (hash, size of the binary, offset of the chunk)
+ *  and the chunk as payload, each answered CHANGED_2_04 before the next one
+ *  is sent. The runtime checks the hash once all the chunks are received
+ *  (NOT_ACCEPTABLE_4_06 if it does not match), and answers
+ *  PRECONDITION_FAILED_4_12 to a chunk that does not follow the ones it has.
+ *  After each hello, the runtime reports the binary it was receiving in a
+ *  request with url MODULE_CHUNK_PROGRESS_URL (payload: MODULE_CHUNK_PROGRESS_FMT
+ *  with its hash and the bytes received; empty if none), so an interrupted
+ *  transfer resumes from there. Both the bridge and the runtime use this
+ *  file; it only depends on libc.
+ *
+ *  @date July, 2019
+ */
+#ifndef MODULE_HASH_H_
+#define MODULE_HASH_H_
+
+#include <stdint.h>
+
+/* url of the request listing the binaries held by the runtime */
+#define MODULE_HASH_REPORT_URL "/module-cache"
+
+/* url parameter of an install request naming the binary by its hash */
+#define MODULE_HASH_URL_KEY "&hash="
+
+/* hex digits of a hash */
+#define MODULE_HASH_HEX_LEN 16
+
+/* url of the requests with a chunk of a binary: hash, size of the binary, offset of the chunk
+   (the _SCAN formats read what the others write) */
+#define MODULE_CHUNK_URL "/module-chunk"
+#define MODULE_CHUNK_URL_FMT MODULE_CHUNK_URL "?hash=%s&size=%u&offset=%u"
+#define MODULE_CHUNK_URL_SCAN MODULE_CHUNK_URL "?hash=%16[0-9a-f]&size=%u&offset=%u"
+
+/* url of the request reporting the binary being received: hash, bytes received */
+#define MODULE_CHUNK_PROGRESS_URL "/module-chunk-progress"
+#define MODULE_CHUNK_PROGRESS_FMT "%s,%u"
+#define MODULE_CHUNK_PROGRESS_SCAN "%16[0-9a-f],%u"
+
+/**
+ * Hash the bytes of a module binary (64-bit FNV-1a)
+ *
+ * @param data the binary
+ * @param len length of the binary
+ * @return returns the hash
+ */
+uint64_t module_hash(const void *data, uint32_t len);
+
+/**
+ * Format a hash in hex
+ *
+ * @param hash the hash
+ * @param buf buffer of MODULE_HASH_HEX_LEN + 1 bytes
+ */
+void module_hash_format(uint64_t hash, char *buf);
+
+/**
+ * Parse a hash formatted by module_hash_format()
+ *
+ * @param s the hex digits (only the first MODULE_HASH_HEX_LEN are read)
+ * @param hash where to store the hash
+ * @return returns 0 (success), -1 (failure)
+ */
+int module_hash_parse(const char *s, uint64_t *hash);
+
+#endif
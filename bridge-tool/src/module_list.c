@@ -1,9 +1,9 @@
 /** @file Module_list.c
  *  @brief Implementation of a module list.
  *
- *  Implementation for a module list, using BSD 
- *  singly-linked list (queue.h)
- *
+ *  Implementation for a module list, using open-addressing hash tables with
+ *  linear probing. Deleted entries leave a tombstone, cleared when the table
+ *  is rebuilt (grown, or rehashed at the same size).
  *
  *  @author Nuno Pereira
  *  @date July, 2019
@@ -12,40 +12,265 @@
 #include <string.h>
 #include <stdio.h>
 #include "module_list.h"
-#include "queue.h"
 
-/* Declare variable to hold the singly-linked list head for the modules */
-SLIST_HEAD(slisthead_modules, module_descriptor) modules;
+/* initial number of slots of a table */
+#define ML_TABLE_MIN_SIZE 16
+
+static char ml_tombstone;
+#define ML_TOMBSTONE ((void *)&ml_tombstone)
+
+/* a string looked up in a table */
+typedef struct {
+    uint32_t hash;
+    const char *str;
+} ml_str_key_t;
+
+typedef uint32_t (*ml_hash_f)(const void *entry);
+typedef int (*ml_match_f)(const void *entry, const void *key);
+
+/* FNV-1a */
+static uint32_t ml_hash_str(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t ml_hash_int(int i)
+{
+    uint32_t h = (uint32_t) i * 2654435761u;
+
+    return h ^ (h >> 16);
+}
+
+static uint32_t ml_mod_id_hash(const void *entry)
+{
+    return ml_hash_int(((const struct module_descriptor *) entry)->id);
+}
+
+static int ml_mod_id_match(const void *entry, const void *key)
+{
+    return ((const struct module_descriptor *) entry)->id == *(const int *) key;
+}
+
+static uint32_t ml_mod_name_hash(const void *entry)
+{
+    return ((const struct module_descriptor *) entry)->name_hash;
+}
+
+static int ml_mod_name_match(const void *entry, const void *key)
+{
+    const struct module_descriptor *mod = entry;
+    const ml_str_key_t *k = key;
+
+    return mod->name_hash == k->hash && strcmp(mod->name, k->str) == 0;
+}
+
+static uint32_t ml_str_hash(const void *entry)
+{
+    return ((const struct interned_str *) entry)->hash;
+}
+
+static int ml_str_match(const void *entry, const void *key)
+{
+    const struct interned_str *s = entry;
+    const ml_str_key_t *k = key;
+
+    return s->hash == k->hash && strcmp(s->str, k->str) == 0;
+}
+
+static int ml_ptr_match(const void *entry, const void *key)
+{
+    return entry == key;
+}
+
+/**
+ * Find an entry in a table
+ *
+ * @param t the table
+ * @param hash hash of the key
+ * @param match returns non-zero if an entry matches the key
+ * @param key the key
+ * @return returns the slot of the entry, NULL if not found
+ */
+static void **ml_table_find(ml_table_t *t, uint32_t hash, ml_match_f match, const void *key)
+{
+    uint32_t i, mask = t->size - 1;
+    void *entry;
+
+    if (t->size == 0) return NULL;
+
+    /* the load factor is kept below 3/4, so there is always an empty slot */
+    for (i = hash & mask; (entry = t->slots[i]) != NULL; i = (i + 1) & mask) {
+        if (entry != ML_TOMBSTONE && match(entry, key)) return &t->slots[i];
+    }
+    return NULL;
+}
+
+/* place an entry in the first free slot; there must be one */
+static void ml_table_place(ml_table_t *t, void *entry, uint32_t hash)
+{
+    uint32_t i, mask = t->size - 1;
+
+    for (i = hash & mask; t->slots[i] != NULL && t->slots[i] != ML_TOMBSTONE; i = (i + 1) & mask);
+    if (t->slots[i] == NULL) t->used++;
+    t->slots[i] = entry;
+    t->count++;
+}
+
+/* rebuild a table without tombstones, with room for at least twice its entries */
+static int ml_table_rebuild(ml_table_t *t, ml_hash_f hash)
+{
+    ml_table_t old = *t;
+    uint32_t i, size = ML_TABLE_MIN_SIZE;
+
+    while (size < (t->count + 1) * 2) size *= 2;
+    if ((t->slots = calloc(size, sizeof(void *))) == NULL) {
+        *t = old;
+        return -1;
+    }
+    t->size = size;
+    t->count = t->used = 0;
+
+    for (i = 0; i < old.size; i++) {
+        if (old.slots[i] != NULL && old.slots[i] != ML_TOMBSTONE) ml_table_place(t, old.slots[i], hash(old.slots[i]));
+    }
+    free(old.slots);
+    return 0;
+}
+
+/**
+ * Add an entry to a table
+ *
+ * @param t the table
+ * @param entry the entry
+ * @param hash function returning the hash of an entry
+ * @return returns 0 (success), -1 (failure)
+ */
+static int ml_table_insert(ml_table_t *t, void *entry, ml_hash_f hash)
+{
+    if ((t->used + 1) * 4 > t->size * 3 && ml_table_rebuild(t, hash) != 0) return -1;
+    ml_table_place(t, entry, hash(entry));
+    return 0;
+}
+
+/* remove the entry in a slot returned by ml_table_find() */
+static void ml_table_remove(ml_table_t *t, void **slot)
+{
+    *slot = ML_TOMBSTONE;
+    if (--t->count == 0) {
+        memset(t->slots, 0, t->size * sizeof(void *));
+        t->used = 0;
+    }
+}
+
+static void ml_table_free(ml_table_t *t)
+{
+    free(t->slots);
+    memset(t, 0, sizeof(ml_table_t));
+}
+
+/* get an interned copy of a string, adding a reference to it */
+static struct interned_str *ml_intern(module_list_t *ml, const ml_str_key_t *key)
+{
+    void **slot = ml_table_find(&ml->strings, key->hash, ml_str_match, key);
+    struct interned_str *s;
+    size_t len;
+
+    if (slot != NULL) {
+        s = *slot;
+        s->refs++;
+        return s;
+    }
+
+    len = strlen(key->str);
+    if ((s = malloc(sizeof(struct interned_str) + len + 1)) == NULL) return NULL;
+    s->hash = key->hash;
+    s->refs = 1;
+    memcpy(s->str, key->str, len + 1);
+    if (ml_table_insert(&ml->strings, s, ml_str_hash) != 0) {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
 
-int module_list_init()
+/* remove a reference to an interned string; released with the last one */
+static void ml_unintern(module_list_t *ml, struct interned_str *s)
 {
-    SLIST_INIT(&modules);
+    if (--s->refs > 0) return;
+    ml_table_remove(&ml->strings, ml_table_find(&ml->strings, s->hash, ml_ptr_match, s));
+    free(s);
+}
+
+/* release a module, already removed from the indexes */
+static void ml_module_free(module_list_t *ml, struct module_descriptor *mod)
+{
+    uint32_t i;
+
+    for (i = 0; i < mod->topics.size; i++) {
+        if (mod->topics.slots[i] != NULL && mod->topics.slots[i] != ML_TOMBSTONE) ml_unintern(ml, mod->topics.slots[i]);
+    }
+    ml_table_free(&mod->topics);
+    if (mod->name != NULL) free(mod->name);
+    free(mod);
+}
+
+int module_list_init(module_list_t *ml)
+{
+    memset(ml, 0, sizeof(module_list_t));
     return 0;
 }
 
+void module_list_destroy(module_list_t *ml)
+{
+    uint32_t i;
+
+    for (i = 0; i < ml->by_id.size; i++) {
+        if (ml->by_id.slots[i] != NULL && ml->by_id.slots[i] != ML_TOMBSTONE) ml_module_free(ml, ml->by_id.slots[i]);
+    }
+    ml_table_free(&ml->by_id);
+    ml_table_free(&ml->by_name);
+    ml_table_free(&ml->strings);
+}
+
 /**
- * Add a module to the list
- * 
+ * Add a module to the list; a module with the same id is replaced
+ *
+ * @param ml the module list
  * @param mod_id module id
  * @param mod_name module name
  * @return returns 0 (success), -1 (failure)
  */
-int module_list_add(int mod_id, char *mod_name)
+int module_list_add(module_list_t *ml, int mod_id, char *mod_name)
 {
     int len=strlen(mod_name);
-    struct module_descriptor *new_mod = malloc(sizeof(struct module_descriptor));
+    struct module_descriptor *new_mod = calloc(1, sizeof(struct module_descriptor));
 
     if (new_mod == NULL ) return(-1);
 
     new_mod->name = malloc(len+1);
-    if (new_mod->name != NULL) {
-        strncpy(new_mod->name, mod_name, len); /* strncpy does not guarantee a '\0'-terminated string */
-        new_mod->name[len]='\0';
-        new_mod->id = mod_id;
-        SLIST_INIT(&new_mod->topics);
-        SLIST_INSERT_HEAD(&modules, new_mod, next_mod);
-    } else {
-        if (new_mod->name != NULL) free(new_mod->name);
+    if (new_mod->name == NULL) {
+        free(new_mod);
+        return -1;
+    }
+    memcpy(new_mod->name, mod_name, len+1);
+    new_mod->id = mod_id;
+    new_mod->name_hash = ml_hash_str(new_mod->name);
+
+    module_list_del_by_id(ml, mod_id);
+
+    if (ml_table_insert(&ml->by_id, new_mod, ml_mod_id_hash) != 0) {
+        ml_module_free(ml, new_mod);
+        return -1;
+    }
+    if (ml_table_insert(&ml->by_name, new_mod, ml_mod_name_hash) != 0) {
+        ml_table_remove(&ml->by_id, ml_table_find(&ml->by_id, ml_hash_int(mod_id), ml_ptr_match, new_mod));
+        ml_module_free(ml, new_mod);
         return -1;
     }
 
@@ -53,156 +278,139 @@ int module_list_add(int mod_id, char *mod_name)
 }
 
 /**
- * Remove a module from the list *and* release resources 
- * 
+ * Remove a module from the list *and* release resources
+ *
+ * @param ml the module list
  * @param mod_id id of the module to delete
  * @return returns 0 (success), -1 (failure)
  */
-int module_list_del_by_id(int mod_id) 
+int module_list_del_by_id(module_list_t *ml, int mod_id)
 {
+    void **slot = ml_table_find(&ml->by_id, ml_hash_int(mod_id), ml_mod_id_match, &mod_id);
     struct module_descriptor *mod;
 
-    /* find module */
-    SLIST_FOREACH(mod, &modules, next_mod) {
-        if (mod->id==mod_id) {
-            if (mod->name != NULL) free(mod->name);
-            topic_list_del_all(&mod->topics);
-            SLIST_REMOVE(&modules, mod, module_descriptor, next_mod);
-            free(mod);
-            return 0;
-        }
-    }
+    if (slot == NULL) return -1;
+    mod = *slot;
+    ml_table_remove(&ml->by_id, slot);
+
+    /* several modules may have the same name: look for this one */
+    ml_table_remove(&ml->by_name, ml_table_find(&ml->by_name, mod->name_hash, ml_ptr_match, mod));
+    ml_module_free(ml, mod);
 
-    return -1; 
+    return 0;
 }
 
 /**
- * Get the module topics list from a module id
- * 
+ * Get a module from its id
+ *
+ * @param ml the module list
  * @param mod_id the module id to search
- * @return returns the module name (success), NULL (failure)
+ * @return returns the module (success), NULL (failure)
  */
-struct slisthead_topics *module_list_get_topic_list_by_id(int mod_id)
+struct module_descriptor *module_list_get_by_id(module_list_t *ml, int mod_id)
 {
-    struct module_descriptor *mod;
+    void **slot = ml_table_find(&ml->by_id, ml_hash_int(mod_id), ml_mod_id_match, &mod_id);
 
-    SLIST_FOREACH(mod, &modules, next_mod) {
-        if (mod->id==mod_id) return &mod->topics;
-    }
+    return slot != NULL ? *slot : NULL;
+}
 
-    return NULL;
+/**
+ * Get a module from its name
+ *
+ * @param ml the module list
+ * @param mod_name the module name to search
+ * @return returns the module (success), NULL (failure)
+ */
+struct module_descriptor *module_list_get_by_name(module_list_t *ml, const char *mod_name)
+{
+    ml_str_key_t key = { ml_hash_str(mod_name), mod_name };
+    void **slot = ml_table_find(&ml->by_name, key.hash, ml_mod_name_match, &key);
+
+    return slot != NULL ? *slot : NULL;
 }
 
 /**
  * Get the module name from a module id
- * 
+ *
+ * @param ml the module list
  * @param mod_id the module id to search
  * @return returns the module name (success), NULL (failure)
  */
-char *module_list_get_name_by_id(int mod_id)
+char *module_list_get_name_by_id(module_list_t *ml, int mod_id)
 {
-    struct module_descriptor *mod;
-
-    SLIST_FOREACH(mod, &modules, next_mod) {
-        if (mod->id==mod_id) return mod->name;
-    }
+    struct module_descriptor *mod = module_list_get_by_id(ml, mod_id);
 
-    return NULL;
+    return mod != NULL ? mod->name : NULL;
 }
 
 /**
- * Add a topic to the list
- * 
+ * Add a topic to the topics of a module
+ *
+ * @param ml the module list
  * @param topic topic name
- * @param topics the list of topics
+ * @param mod_id the module publishing the topic
  * @return returns 0 if not inserted (already in list), 1 if inserted (not in list), -1 (failure)
  */
-int topic_list_check_and_add(char *topic, int mod_id)
+int topic_list_check_and_add(module_list_t *ml, char *topic, int mod_id)
 {
-    int len=strlen(topic);
+    struct module_descriptor *mod = module_list_get_by_id(ml, mod_id);
+    ml_str_key_t key = { ml_hash_str(topic), topic };
+    struct interned_str *s;
 
-    struct slisthead_topics *topics = module_list_get_topic_list_by_id(mod_id);
-    if (topics == NULL) return -1;
+    if (mod == NULL) return -1;
 
-    if (topic_list_is_in_list(topic, topics) == 1) return 0; // already in list
+    if (ml_table_find(&mod->topics, key.hash, ml_str_match, &key) != NULL) return 0; // already in list
 
-    struct topic_descriptor *new_topic = malloc(sizeof(struct topic_descriptor));
-    if (new_topic == NULL ) return -1;
-    new_topic->topic = malloc(len+1);
-    if (new_topic->topic != NULL) {
-        strncpy(new_topic->topic, topic, len); /* strncpy does not guarantee a '\0'-terminated string */
-        new_topic->topic[len]='\0';
-        SLIST_INSERT_HEAD(topics, new_topic, next_topic);
-        return 1;
-    } else {
-        if (new_topic->topic != NULL) free(new_topic->topic);
+    if ((s = ml_intern(ml, &key)) == NULL) return -1;
+    if (ml_table_insert(&mod->topics, s, ml_str_hash) != 0) {
+        ml_unintern(ml, s);
         return -1;
     }
+    return 1;
 }
 
 /**
- * Remove a all topics from the list *and* release resources 
- * 
- * @param topics topic list 
- * @return returns 0 (success), -1 (failure)
- */
-int topic_list_del_all(struct slisthead_topics *topics) 
-{
-    struct topic_descriptor *t;
-
-    SLIST_FOREACH(t, topics, next_topic) {
-        if (t->topic != NULL) free(t->topic);
-        SLIST_REMOVE(topics, t, topic_descriptor, next_topic);
-        free(t);
-    }
-
-    return -1; 
-}
-
-/**
- * Remove a topic from the list *and* release resources 
- * 
+ * Remove a topic from the topics of a module *and* release resources
+ *
+ * @param ml the module list
  * @param topic topic to delete
- * @param mod_id the module publishing the topic 
+ * @param mod_id the module publishing the topic
  * @return returns 0 (success), -1 (failure)
  */
-int topic_list_del(char *topic, int mod_id) 
+int topic_list_del(module_list_t *ml, char *topic, int mod_id)
 {
-    struct topic_descriptor *t;
+    struct module_descriptor *mod = module_list_get_by_id(ml, mod_id);
+    ml_str_key_t key = { ml_hash_str(topic), topic };
+    void **slot;
+    struct interned_str *s;
 
-    struct slisthead_topics *topics = module_list_get_topic_list_by_id(mod_id);
-    if (topics == NULL) {
+    if (mod == NULL) {
         printf("Could not find module id %d\n", mod_id);
         return -1;
     }
 
-    /* find topic */
-    SLIST_FOREACH(t, topics, next_topic) {
-        if (strcmp(t->topic, topic) == 0) {
-            if (t->topic != NULL) free(t->topic);
-            SLIST_REMOVE(topics, t, topic_descriptor, next_topic);
-            free(t);
-            return 0;
-        }
-    }
+    if ((slot = ml_table_find(&mod->topics, key.hash, ml_str_match, &key)) == NULL) return -1;
+    s = *slot;
+    ml_table_remove(&mod->topics, slot);
+    ml_unintern(ml, s);
 
-    return -1; 
+    return 0;
 }
 
 /**
- * Find a topic given the topic list
- * 
+ * Find a topic in the topics of a module
+ *
+ * @param ml the module list
  * @param topic the topic to search
- * @param topics points to the list of topics
+ * @param mod_id the module publishing the topic
  * @return 1 if found, 0 if not
  */
-int topic_list_is_in_list(char *topic, struct slisthead_topics *topics)
+int topic_list_is_in_list(module_list_t *ml, char *topic, int mod_id)
 {
-    struct topic_descriptor *t;
+    struct module_descriptor *mod = module_list_get_by_id(ml, mod_id);
+    ml_str_key_t key = { ml_hash_str(topic), topic };
 
-    SLIST_FOREACH(t, topics, next_topic) {
-        if (strcmp(t->topic, topic) == 0) return 1;
-    }
+    if (mod == NULL) return 0;
 
-    return 0;
-}
\ No newline at end of file
+    return ml_table_find(&mod->topics, key.hash, ml_str_match, &key) != NULL;
+}
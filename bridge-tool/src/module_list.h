@@ -1,17 +1,48 @@
  /** @file module_list.h
  *  @brief Definitions for a module list.
  *
- *  Definitions for a module list, implemented using BSD 
- *  implementation of a singly-linked list (queue.h)
+ *  Definitions for a module list, indexed by module id and by module name
+ *  with open-addressing hash tables. The topics published by each module are
+ *  kept in a hash set of strings interned in the list, with precomputed hashes
  *
  *  @author Nuno Pereira
  *  @date July, 2019
  */
- 
-#ifndef HTTP_MODULE_LIST_H 
-#define HTTP_MODULE_LIST_H 
 
-#include "queue.h"
+#ifndef HTTP_MODULE_LIST_H
+#define HTTP_MODULE_LIST_H
+
+#include <stdint.h>
+
+/**
+ * Open-addressing hash table (linear probing); entries are pointers
+ */
+typedef struct {
+    void **slots;
+
+    /* number of slots (a power of 2, or 0) */
+    uint32_t size;
+
+    /* entries in the table */
+    uint32_t count;
+
+    /* entries and deleted slots (tombstones) */
+    uint32_t used;
+} ml_table_t;
+
+/**
+ * A string interned in the module list; shared by all the modules with that topic
+ */
+struct interned_str
+{
+    /* hash of the string */
+    uint32_t hash;
+
+    /* number of modules using the string */
+    uint32_t refs;
+
+    char str[];
+};
 
 /**
  * Entry we generate for each module
@@ -20,99 +51,119 @@ struct module_descriptor
 {
     /* module id */
 	int id;
-	
+
 	/* module name */
 	char *name;
 
-    /* list head for the publish topics of this module */
-    SLIST_HEAD(slisthead_topics, topic_descriptor) topics;
+    /* hash of the module name */
+    uint32_t name_hash;
 
-    SLIST_ENTRY(module_descriptor) next_mod;
+    /* the publish topics of this module (struct interned_str entries) */
+    ml_table_t topics;
 };
 
 /**
- * Entry we generate for each topic
+ * List of modules (one per runtime)
  */
-struct topic_descriptor
-{
-	/* topic string*/
-	char *topic;
+typedef struct {
+    /* module_descriptor entries, by id */
+    ml_table_t by_id;
 
-    SLIST_ENTRY(topic_descriptor) next_topic;
-};
+    /* module_descriptor entries, by name */
+    ml_table_t by_name;
 
+    /* interned_str entries: the topics of all modules */
+    ml_table_t strings;
+} module_list_t;
 
 /**
  * Init the list
+ *
+ * @param ml the module list
+ */
+int module_list_init(module_list_t *ml);
+
+/**
+ * Remove all modules from the list *and* release resources
+ *
+ * @param ml the module list
  */
-int module_list_init();
+void module_list_destroy(module_list_t *ml);
 
 /**
  * Add a module to the list
- * 
+ *
+ * @param ml the module list
  * @param mod_id module id
  * @param mod_name module name
  * @return returns 0 (success), -1 (failure)
  */
-int module_list_add(int mod_id, char *mod_name);
+int module_list_add(module_list_t *ml, int mod_id, char *mod_name);
 
 /**
- * Remove a module from the list *and* release resources 
- * 
+ * Remove a module from the list *and* release resources
+ *
+ * @param ml the module list
  * @param mod_id id of the module to delete
  * @return returns 0 (success), -1 (failure)
  */
-int module_list_del_by_id(int mod_id);
+int module_list_del_by_id(module_list_t *ml, int mod_id);
 
 /**
- * Get the module topics list from a module id
- * 
+ * Get a module from its id
+ *
+ * @param ml the module list
  * @param mod_id the module id to search
- * @return returns the module name (success), NULL (failure)
+ * @return returns the module (success), NULL (failure)
  */
-struct slisthead_topics *module_list_get_topic_list_by_id(int mod_id);
+struct module_descriptor *module_list_get_by_id(module_list_t *ml, int mod_id);
+
+/**
+ * Get a module from its name
+ *
+ * @param ml the module list
+ * @param mod_name the module name to search
+ * @return returns the module (success), NULL (failure)
+ */
+struct module_descriptor *module_list_get_by_name(module_list_t *ml, const char *mod_name);
 
 /**
  * Get the module name from a module id
- * 
+ *
+ * @param ml the module list
  * @param mod_id the module id to search
  * @return returns the module name (success), NULL (failure)
  */
-char *module_list_get_name_by_id(int mod_id);
+char *module_list_get_name_by_id(module_list_t *ml, int mod_id);
 
 /**
- * Add a topic to the list
- * 
+ * Add a topic to the topics of a module
+ *
+ * @param ml the module list
  * @param topic topic name
- * @param topics the list of topics
+ * @param mod_id the module publishing the topic
  * @return returns 0 if not inserted (already in list), 1 if inserted (not in list), -1 (failure)
  */
-int topic_list_check_and_add(char *topic, int mod_id);
+int topic_list_check_and_add(module_list_t *ml, char *topic, int mod_id);
 
 /**
- * Remove a all topics from the list *and* release resources 
- * 
- * @param topics topic list 
- * @return returns 0 (success), -1 (failure)
- */
-int topic_list_del_all(struct slisthead_topics *topics);
-
-/**
- * Remove a topic from the list *and* release resources 
- * 
+ * Remove a topic from the topics of a module *and* release resources
+ *
+ * @param ml the module list
  * @param topic topic to delete
- * @param mod_id the module publishing the topic 
+ * @param mod_id the module publishing the topic
  * @return returns 0 (success), -1 (failure)
  */
-int topic_list_del(char *topic, int mod_id);
+int topic_list_del(module_list_t *ml, char *topic, int mod_id);
 
 /**
- * Find a topic given the topic list
- * 
+ * Find a topic in the topics of a module
+ *
+ * @param ml the module list
  * @param topic the topic to search
- * @param topics points to the list of topics
+ * @param mod_id the module publishing the topic
  * @return 1 if found, 0 if not
  */
-int topic_list_is_in_list(char *topic, struct slisthead_topics *topics);
+int topic_list_is_in_list(module_list_t *ml, char *topic, int mod_id);
 
-#endif
\ No newline at end of file
+#endif
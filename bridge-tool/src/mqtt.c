@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include "mqtt.h"
 #include "attr_container.h"
+#include "attr_json.h"
 #include "bridge_tool_utils.h"
 #include "cJSON.h"
 #include "coap_ext.h"
@@ -19,9 +20,16 @@
 #include "runtime_request.h"
 #include "http_mqtt_req.h"
 #include "module_list.h"
+#include "reactor.h"
+#include "bufpool.h"
+#include "mqtt_outbox.h"
+#include "mqtt_subs.h"
+#include "mqtt_wire.h"
 
 static struct mg_mgr g_mqtt_mgr;
 
+static reactor_t *s_reactor; // event loop driving g_mqtt_mgr
+
 static void mqtt_ev_handler(struct mg_connection *nc, int ev, void *p);
 
 static char s_rt_last_will_msg[200];
@@ -29,15 +37,48 @@ static char s_rt_topic[200];  // runtime topic, to where events are sent
 
 // needed for event notification :(
 static struct mg_connection *s_mqtt_mg_conn;
+static int s_mqtt_accepted; // connection accepted by the broker (CONNACK received)
+
+static int s_subs_flush_posted; // a flush of the subscription table is posted
+
+/* mqtt operation deferred to the event loop thread */
+typedef enum { MQTT_JOB_PUBLISH, MQTT_JOB_SUBSCRIBE, MQTT_JOB_UNSUBSCRIBE, MQTT_JOB_RELEASE_MODULE } mqtt_job_type_t;
+
+/* topic and msg are stored right after the job, in the same allocation */
+typedef struct {
+  mqtt_job_type_t type;
+  char *topic;
+  char *msg;
+  int msg_len;
+  // module (un)subscribing: index of its runtime connection and module id
+  int rt_idx;
+  int mod_id;
+} mqtt_job_t;
+
+static void mqtt_run_job(void *arg);
+static void mqtt_subs_flush_job(void *arg);
+static void mqtt_dispatch_job(mqtt_job_t *job);
+static void mqtt_post_job(mqtt_job_type_t type, const char *topic, const char *msg, int msg_len);
+static void mqtt_post_module_job(mqtt_job_type_t type, runtime_conn_t *conn, int mod_id, const char *topic);
 
 /**
  * Init mqttc connection
  *
+ * @param r the reactor that will drive the mqtt connection
  * @param mqtt_mg_conn the mqtt connection
  * @return returns -1 on error, 0 on success
  */
-int mqtt_init(struct mg_connection **mqtt_mg_conn) {
-  mg_mgr_init(&g_mqtt_mgr, NULL);
+int mqtt_init(reactor_t *r, struct mg_connection **mqtt_mg_conn) {
+  if (s_reactor == NULL) {
+    mg_mgr_init(&g_mqtt_mgr, NULL);
+    if (reactor_add_mg_mgr(r, &g_mqtt_mgr) != 0) {
+      printf("Could not add mqtt client to event loop.\n");
+      return -1;
+    }
+    s_reactor = r;
+  }
+
+  // the connection is established by the event loop (see MG_EV_CONNECT)
   *mqtt_mg_conn = s_mqtt_mg_conn =
       mg_connect(&g_mqtt_mgr, g_bt_config.mqtt_server_address, mqtt_ev_handler);
   if (*mqtt_mg_conn == NULL) {
@@ -46,18 +87,36 @@ int mqtt_init(struct mg_connection **mqtt_mg_conn) {
     return -1;
   }
 
-  while (mg_mgr_poll(&g_mqtt_mgr, 100) > 0); // establish the connection
-
-  printf("Connected to MQTT server: %s.\n", g_bt_config.mqtt_server_address);
+  mqtt_pool_requests();
   return 0;
 }
 
 /**
- * Poll mqtt requests
+ * Check if the mqtt connection is up (or being established)
+ *
+ * @return returns 1 if connected, 0 if not
+ */
+int mqtt_is_connected() {
+  return s_mqtt_mg_conn != NULL;
+}
+
+/**
+ * Send a keepalive ping to the mqtt server
+ *
+ */
+void mqtt_ping() {
+  if (s_mqtt_mg_conn == NULL) return;
+  mqtt_wire_ping(s_mqtt_mg_conn);
+  mqtt_pool_requests();
+}
+
+/**
+ * Request the event loop to send queued mqtt data; the actual poll happens
+ * at the end of the current loop iteration
  *
  */
 void mqtt_pool_requests() {
-  while (mg_mgr_poll(&g_mqtt_mgr, 1) > 0); // drive mg mgr state machine
+  if (s_reactor != NULL) reactor_flush_mg_mgr(s_reactor, &g_mqtt_mgr);
 }
 
 /**
@@ -70,11 +129,15 @@ void mqtt_pool_requests() {
 static void mqtt_ev_handler(struct mg_connection *nc, int ev, void *p) {
   struct mg_mqtt_message *msg = (struct mg_mqtt_message *)p;
   (void)nc;
-  char started_msg[200], topic_str[200];
+  runtime_conn_t *conn;
+  int i;
 
-  cJSON *json = NULL;
-  char *str_json = NULL, *payload = NULL, *req_url = NULL;
+  attr_container_t *payload = NULL;
+  uint32_t payload_len;
+  char *req_url = NULL;
   int max_len;
+  mqtt_sub_t *subs[MQTT_SUBS_MAX_MATCH];
+  int nsubs, j;
 
   switch (ev) {
   case MG_EV_CONNECT: {
@@ -92,28 +155,33 @@ static void mqtt_ev_handler(struct mg_connection *nc, int ev, void *p) {
     opts.will_topic = s_rt_topic;
     opts.will_message = s_rt_last_will_msg;
 
-    mg_set_protocol_mqtt(nc);
-    mg_send_mqtt_handshake_opt(nc, g_bt_config.rt_uuid, opts);
+    mqtt_wire_connect(nc, g_bt_config.rt_uuid, opts);
     break;
   }
   case MG_EV_MQTT_CONNACK:
     if (msg->connack_ret_code != MG_EV_MQTT_CONNACK_ACCEPTED) {
       printf("Got mqtt connection error: %d\n", msg->connack_ret_code);
+    } else {
+      printf("Connected to MQTT server: %s.\n", g_bt_config.mqtt_server_address);
+      // send again what was not acknowledged before the connection was lost
+      s_mqtt_accepted = 1;
+      mqtt_outbox_connected(nc, mqtt_wire_receive_maximum());
+      mqtt_subs_resubscribe_all();
+      mqtt_subs_flush(nc, mqtt_outbox_next_id);
+      mqtt_pool_requests();
     }
 
-    // init start message 
-    snprintf(started_msg, sizeof(started_msg), FMTSTR_EVENT_RT_START_JSON,
-            g_bt_config.rt_uuid, g_bt_config.rt_uuid, EVENT_RT_START);
-    snprintf(topic_str, sizeof(topic_str), "%s%s", g_bt_config.rt_topic_prefix,
-            g_bt_config.rt_uuid);
-
-    // publish start msg
-    mg_mqtt_publish(nc, g_bt_config.rt_topic_prefix, 65, MG_MQTT_QOS(0), started_msg,
-                    strlen(started_msg));
-
+    // publish start msg of the runtimes already connected
+    for (i = 0; i < runtime_conn_count(); i++) {
+      conn = runtime_conn_get(i);
+      if (runtime_conn_is_connected(conn)) mqtt_notify_runtime_event(conn, EVENT_RT_START);
+    }
     break;
   case MG_EV_MQTT_PUBACK:
-    printf("Message publishing acknowledged (msg_id: %d)\n", msg->message_id);
+  case MG_EV_MQTT_PUBREC:
+  case MG_EV_MQTT_PUBCOMP:
+    mqtt_outbox_ack(nc, ev, msg->message_id);
+    mqtt_pool_requests();
     break;
   case MG_EV_MQTT_SUBACK:
     //printf("Subscription acknowledged.\n");
@@ -123,59 +191,219 @@ static void mqtt_ev_handler(struct mg_connection *nc, int ev, void *p) {
 
     // ignore messages to self...
     if (mg_vcmp(&msg->topic, s_rt_topic) == 0) return;
-
-    payload = malloc(msg->payload.len + 1);
-    memcpy(payload, msg->payload.p, msg->payload.len);
-    payload[msg->payload.len] = '\0';
-
-    if (NULL == (json = cJSON_Parse(
-                     payload))) { // did not receive valid json; create it
-      const char fmt_str_payload[] = "{ \"raw_str\": \"%.*s\"}";
-      int max_len = msg->payload.len + strlen(fmt_str_payload) + 1;
-      str_json = malloc(max_len);
-      snprintf(str_json, max_len, fmt_str_payload, msg->payload.len,
-               msg->payload.p);
-      json = cJSON_Parse(str_json);
+    for (i = 0; i < runtime_conn_count(); i++) {
+      if (mg_vcmp(&msg->topic, runtime_conn_get(i)->topic) == 0) return;
     }
 
-    max_len = msg->topic.len + strlen("/event/") + 1;
-    req_url = malloc(max_len);
-    snprintf(req_url, max_len, "/event/%.*s", msg->topic.len, msg->topic.p);
-
-    rt_req_request(req_url, COAP_EVENT_PUB, json);
+    // the subscriptions (topic filters) of the modules matching the topic; nothing to deliver if none
+    nsubs = mqtt_subs_match(msg->topic.p, msg->topic.len, subs, MQTT_SUBS_MAX_MATCH);
+    if (nsubs == 0) break;
+
+    // json objects are converted once for all runtimes; anything else is delivered as the bytes received
+    payload = json_text2attr(msg->payload.p, msg->payload.len, &payload_len, false);
+
+    // the event of each subscription is sent to the runtimes with modules having it; the runtime delivers
+    // events to the modules subscribed to that exact topic, so the event is named after the filter
+    for (j = 0; j < nsubs; j++) {
+      max_len = strlen(mqtt_subs_topic(subs[j])) + strlen("/event/") + 1;
+      req_url = malloc(max_len);
+      if (req_url == NULL) break;
+      snprintf(req_url, max_len, "/event/%s", mqtt_subs_topic(subs[j]));
+
+      for (i = 0; i < runtime_conn_count(); i++) {
+        conn = runtime_conn_get(i);
+        if (!runtime_conn_is_connected(conn) || !mqtt_subs_has_runtime(subs[j], i)) continue;
+        if (payload != NULL)
+          rt_req_request_payload(conn, req_url, COAP_EVENT_PUB, FMT_ATTR_CONTAINER, payload, payload_len, NULL, NULL);
+        else
+          rt_req_request_payload(conn, req_url, COAP_EVENT_PUB, FMT_APP_RAW_BINARY, (void *)msg->payload.p, msg->payload.len, NULL, NULL);
+      }
+      free(req_url);
+    }
 
-    free(req_url);
-    free(payload);
-    if (str_json != NULL)
-      free(str_json);
-    cJSON_Delete(json);
+    bufpool_free(payload);
 
     break;
   }
   case MG_EV_CLOSE:
     printf("MQTT Connection closed\n");
+    if (nc == s_mqtt_mg_conn) {
+      s_mqtt_mg_conn = NULL; // reconnected by the bridge main loop
+      s_mqtt_accepted = 0;
+    }
   }
 }
 
-void mqtt_process_runtime_event(request_t *event) {
-  struct mg_mqtt_topic_expression topic_expr = {NULL, 0};
+/**
+ * Get the QoS of publishes to a topic, from the [mqtt-qos] config section
+ *
+ * @param topic the topic
+ * @return returns the QoS of the first matching topic filter, or the default QoS, up to the broker's maximum
+ */
+static int mqtt_topic_qos(const char *topic) {
+  int qos = g_bt_config.mqtt_qos;
+  uint32_t i;
+
+  for (i = 0; i < g_bt_config.mqtt_qos_rule_count; i++) {
+    if (mg_mqtt_vmatch_topic_expression(g_bt_config.mqtt_qos_rules[i].topic_filter, mg_mk_str(topic))) {
+      qos = g_bt_config.mqtt_qos_rules[i].qos;
+      break;
+    }
+  }
+  return qos < mqtt_wire_maximum_qos() ? qos : mqtt_wire_maximum_qos();
+}
+
+/**
+ * Run an mqtt operation posted by mqtt_post_job(); called from the event loop thread
+ *
+ * @param arg the mqtt_job_t describing the operation
+ */
+static void mqtt_run_job(void *arg) {
+  mqtt_job_t *job = (mqtt_job_t *)arg;
+  int changed = 0;
+
+  if (job->type == MQTT_JOB_PUBLISH) {
+    // QoS 1/2 publishes are kept until acknowledged, even while disconnected
+    if (mqtt_outbox_publish(s_mqtt_accepted ? s_mqtt_mg_conn : NULL, job->topic, mqtt_topic_qos(job->topic),
+                            job->msg, job->msg_len) != 0)
+      printf("MQTT not connected (or message too large); dropping message to '%s'.\n", job->topic);
+    mqtt_pool_requests();
+  } else {
+    // broker subscriptions are shared by the modules, and changed in batches (see mqtt_subs_flush_job())
+    if (job->type == MQTT_JOB_SUBSCRIBE)
+      changed = mqtt_subs_add(job->rt_idx, job->mod_id, job->topic) == 1;
+    else if (job->type == MQTT_JOB_UNSUBSCRIBE)
+      changed = mqtt_subs_del(job->rt_idx, job->mod_id, job->topic) == 1;
+    else if (job->type == MQTT_JOB_RELEASE_MODULE)
+      changed = mqtt_subs_del_module(job->rt_idx, job->mod_id) > 0;
+
+    if (changed && !s_subs_flush_posted) {
+      // runs after the jobs already posted, so their changes go in the same packets
+      if (reactor_post(s_reactor, mqtt_subs_flush_job, NULL) == 0)
+        s_subs_flush_posted = 1;
+    }
+  }
+
+  free(job);
+}
+
+/**
+ * Send the subscription changes made by the jobs run so far; called from the event loop thread
+ *
+ * @param arg unused
+ */
+static void mqtt_subs_flush_job(void *arg) {
+  (void)arg;
+  s_subs_flush_posted = 0;
+  if (mqtt_subs_flush(s_mqtt_accepted ? s_mqtt_mg_conn : NULL, mqtt_outbox_next_id) > 0)
+    mqtt_pool_requests();
+}
+
+/**
+ * Perform an mqtt operation from any thread; the mqtt connection is only
+ * touched by the event loop thread, so the arguments are copied and the
+ * operation is posted to it when called from another thread (e.g. a runtime worker)
+ *
+ * @param type publish, subscribe or unsubscribe
+ * @param topic the topic
+ * @param msg message to publish (NULL if not a publish)
+ * @param msg_len length of the message
+ */
+static void mqtt_post_job(mqtt_job_type_t type, const char *topic, const char *msg, int msg_len) {
+  mqtt_job_t *job;
+  size_t topic_len;
+
+  if (s_reactor == NULL) return;
+
+  // one allocation holds the job, the topic and the message
+  topic_len = strlen(topic) + 1;
+  job = malloc(sizeof(mqtt_job_t) + topic_len + (msg != NULL ? msg_len : 0));
+  if (job == NULL) {
+    printf("Out of memory; dropping mqtt message.\n");
+    return;
+  }
+  job->type = type;
+  job->topic = (char *)(job + 1);
+  memcpy(job->topic, topic, topic_len);
+  job->msg = NULL;
+  job->msg_len = 0;
+  if (msg != NULL) {
+    job->msg = job->topic + topic_len;
+    memcpy(job->msg, msg, msg_len);
+    job->msg_len = msg_len;
+  }
+  job->rt_idx = -1;
+  job->mod_id = -1;
+
+  mqtt_dispatch_job(job);
+}
+
+/**
+ * Post a subscription change of a module to the event loop thread
+ *
+ * @param type MQTT_JOB_SUBSCRIBE, MQTT_JOB_UNSUBSCRIBE or MQTT_JOB_RELEASE_MODULE
+ * @param conn the runtime connection of the module
+ * @param mod_id the module id
+ * @param topic the topic (ignored for MQTT_JOB_RELEASE_MODULE)
+ */
+static void mqtt_post_module_job(mqtt_job_type_t type, runtime_conn_t *conn, int mod_id, const char *topic) {
+  mqtt_job_t *job;
+  size_t topic_len;
+
+  if (s_reactor == NULL) return;
+
+  topic_len = topic != NULL ? strlen(topic) + 1 : 1;
+  job = malloc(sizeof(mqtt_job_t) + topic_len);
+  if (job == NULL) {
+    printf("Out of memory; dropping mqtt subscription change.\n");
+    return;
+  }
+  job->type = type;
+  job->topic = (char *)(job + 1);
+  if (topic != NULL) memcpy(job->topic, topic, topic_len);
+  else job->topic[0] = '\0';
+  job->msg = NULL;
+  job->msg_len = 0;
+  job->rt_idx = conn->idx;
+  job->mod_id = mod_id;
+
+  mqtt_dispatch_job(job);
+}
+
+/**
+ * Run a job now if called from the event loop thread, or post it to the event loop
+ *
+ * @param job the job; released once run
+ */
+static void mqtt_dispatch_job(mqtt_job_t *job) {
+  if (reactor_in_loop_thread(s_reactor)) {
+    mqtt_run_job(job);
+  } else if (reactor_post(s_reactor, mqtt_run_job, job) != 0) {
+    free(job);
+  }
+}
+
+/**
+ * Process an event (pub/sub/unsub) received from a runtime
+ *
+ * @param conn the runtime connection the event came from
+ * @param event the event
+ */
+void mqtt_process_runtime_event(runtime_conn_t *conn, request_t *event) {
   attr_container_t *payload = (attr_container_t *)event->payload;
-  cJSON *json = NULL, *raw_str = NULL;
-  char *msg_str = NULL;
+  const char *msg_str = NULL;
+  uint32_t msg_len = 0;
 
   if (event->action == COAP_EVENT_SUB) {
-    topic_expr.topic = event->url;
-    printf("Subscribing to MQTT topic '%s'\n", topic_expr.topic);
-    mg_mqtt_subscribe(s_mqtt_mg_conn, &topic_expr, 1, 41);
-    mqtt_pool_requests();
-    mqtt_notify_pubsub_event(EVENT_SUB_START, event->sender, event->url);
+    printf("Subscribing to MQTT topic '%s'\n", event->url);
+    mqtt_post_module_job(MQTT_JOB_SUBSCRIBE, conn, event->sender, event->url);
+    mqtt_notify_pubsub_event(conn, EVENT_SUB_START, event->sender, event->url);
     return;
   }
   if (event->action == COAP_EVENT_UNSUB) {
     printf("Unsubscribing from MQTT topic '%s'\n", event->url);
-    mg_mqtt_unsubscribe(s_mqtt_mg_conn, &event->url, 1, 41);
-    mqtt_pool_requests();
-    mqtt_notify_pubsub_event(EVENT_SUB_STOP, event->sender, event->url);
+    mqtt_post_module_job(MQTT_JOB_UNSUBSCRIBE, conn, event->sender, event->url);
+    mqtt_notify_pubsub_event(conn, EVENT_SUB_STOP, event->sender, event->url);
     return;
   }
   if (event->action == COAP_EVENT_PUB) {
@@ -188,66 +416,88 @@ void mqtt_process_runtime_event(request_t *event) {
       return;
     }
 
-    if ((json = attr2json(payload)) == NULL) {
-      printf("Error getting msg payload as json!\n");
-      msg_str = strndup(event->payload, event->payload_len);
-    } else {
-      raw_str = cJSON_GetObjectItemCaseSensitive(json, "raw_str");
-      if (cJSON_IsString(raw_str) && (raw_str->valuestring != NULL)) {
-        printf("found raw_str\n");
-        msg_str = strdup(raw_str->valuestring);
+    if (event->fmt == FMT_APP_RAW_BINARY) {
+      // published with mqtt_publish_raw(); forwarded as it is
+      msg_str = event->payload;
+      msg_len = event->payload_len;
+    } else if ((msg_str = attr_json_get_raw_str(payload, event->payload_len, &msg_len)) == NULL) {
+      // raw_str attributes are published as they are; other payloads as compact json
+      if (attr2json_text(payload, event->payload_len, &conn->json_buf) == 0) {
+        msg_str = conn->json_buf.data;
+        msg_len = conn->json_buf.len;
       } else {
-        if ((msg_str = cJSON_Print(json)) == NULL) {
-          msg_str = strndup(event->payload, event->payload_len);
-        }
+        printf("Error getting msg payload as json!\n");
+        msg_str = event->payload;
+        msg_len = strnlen(event->payload, event->payload_len);
       }
     }
 
-    if (topic_list_check_and_add(event->url, event->sender) == 1) {
-      mqtt_notify_pubsub_event(EVENT_PUB_START, event->sender, event->url);
+    if (topic_list_check_and_add(&conn->modules, event->url, event->sender) == 1) {
+      mqtt_notify_pubsub_event(conn, EVENT_PUB_START, event->sender, event->url);
     }
 
-    mg_mqtt_publish(s_mqtt_mg_conn, event->url, 65, MG_MQTT_QOS(0), msg_str,
-                    strlen(msg_str));
-    mqtt_pool_requests();
-    if (json != NULL)
-      cJSON_Delete(json);
-    if (msg_str != NULL)
-      free(msg_str);
-
+    mqtt_post_job(MQTT_JOB_PUBLISH, event->url, msg_str, msg_len);
     return;
   }
 }
 
-void mqtt_notify_module_event(char *module_event, int mod_id, char *mod_name) 
+/**
+ * Release the subscriptions of a module (e.g. uninstalled); can be called from any thread
+ *
+ * @param conn the runtime connection of the module
+ * @param mod_id the module id
+ */
+void mqtt_release_module(runtime_conn_t *conn, int mod_id) {
+  mqtt_post_module_job(MQTT_JOB_RELEASE_MODULE, conn, mod_id, NULL);
+}
+
+/**
+ * Publish a runtime start/stop event
+ *
+ * @param conn the runtime connection
+ * @param rt_event EVENT_RT_START or EVENT_RT_STOP
+ */
+void mqtt_notify_runtime_event(runtime_conn_t *conn, char *rt_event)
+{
+  char event_msg[200];
+
+  snprintf(event_msg, sizeof(event_msg), FMTSTR_EVENT_RT_START_JSON,
+           conn->config->uuid, conn->config->uuid, rt_event);
+
+  // start messages go to the topic prefix, as the runtime topic is announced by them
+  if (strcmp(rt_event, EVENT_RT_START) == 0)
+    mqtt_post_job(MQTT_JOB_PUBLISH, g_bt_config.rt_topic_prefix, event_msg, strlen(event_msg));
+  else 
+    mqtt_post_job(MQTT_JOB_PUBLISH, conn->topic, event_msg, strlen(event_msg));
+}
+
+void mqtt_notify_module_event(runtime_conn_t *conn, char *module_event, int mod_id, char *mod_name) 
 {
   char module_id[100], event_msg[200];
 
-  snprintf(module_id, sizeof(module_id), "%s.%s", g_bt_config.rt_uuid, mod_name);
+  snprintf(module_id, sizeof(module_id), "%s.%s", conn->config->uuid, mod_name);
 
   snprintf(event_msg, sizeof(event_msg), FMTSTR_EVENT_MOD_INST_JSON, module_id, mod_name, 
-           g_bt_config.rt_uuid, module_event, mod_name);
+           conn->config->uuid, module_event, mod_name);
 
-  mg_mqtt_publish(s_mqtt_mg_conn, s_rt_topic, 65, MG_MQTT_QOS(0), event_msg, strlen(event_msg));
-  mqtt_pool_requests();
+  mqtt_post_job(MQTT_JOB_PUBLISH, conn->topic, event_msg, strlen(event_msg));
 }
 
-void mqtt_notify_pubsub_event(char *pubsub_event, int mod_id, char *topic) 
+void mqtt_notify_pubsub_event(runtime_conn_t *conn, char *pubsub_event, int mod_id, char *topic) 
 {
   char pubsub_id[200], parent[200], event_msg[200];
 
-  char *mod_name = module_list_get_name_by_id(mod_id);
+  char *mod_name = module_list_get_name_by_id(&conn->modules, mod_id);
   if (mod_name==NULL) {
     printf("Could not find mod_id= %d\n", mod_id);
     return;
   }
 
-  snprintf(parent, sizeof(parent), "%s.%s", g_bt_config.rt_uuid, mod_name);
+  snprintf(parent, sizeof(parent), "%s.%s", conn->config->uuid, mod_name);
   snprintf(pubsub_id, sizeof(pubsub_id), "%s.%s", parent, topic);
 
   snprintf(event_msg, sizeof(event_msg), FMTSTR_EVENT_PUSBSUB_JSON, pubsub_id, topic, 
           parent, pubsub_event, topic);
 
-  mg_mqtt_publish(s_mqtt_mg_conn, s_rt_topic, 65, MG_MQTT_QOS(0), event_msg, strlen(event_msg));
-  mqtt_pool_requests();
-}
\ No newline at end of file
+  mqtt_post_job(MQTT_JOB_PUBLISH, conn->topic, event_msg, strlen(event_msg));
+}
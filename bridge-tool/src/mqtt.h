@@ -11,22 +11,61 @@
 
 #include "mongoose.h"
 #include "runtime_request.h"
+#include "reactor.h"
+#include "runtime_conn.h"
 
 /**
- * Init mqttc connection
+ * Init mqttc connection; can be called again to reconnect
  * 
+ * @param r the reactor that will drive the mqtt connection
  * @param mqtt_mg_conn the mqtt connection
  * @return returns -1 on error, 0 on success
  */
-int mqtt_init(struct mg_connection **mqtt_mg_conn);
+int mqtt_init(reactor_t *r, struct mg_connection **mqtt_mg_conn);
 
 /**
- * Poll mqtt requests
+ * Check if the mqtt connection is up (or being established)
+ * 
+ * @return returns 1 if connected, 0 if not
+ */
+int mqtt_is_connected();
+
+/**
+ * Send a keepalive ping to the mqtt server
+ * 
+ */
+void mqtt_ping();
+
+/**
+ * Request the event loop to send queued mqtt data (non-blocking)
  * 
  */
 void mqtt_pool_requests();
 
-void mqtt_process_runtime_event(request_t *event);
-void mqtt_notify_module_event(char *module_event, int mod_id, char *mod_name);
-void mqtt_notify_pubsub_event(char *pubsub_event, int mod_id, char *topic);
+/**
+ * Process an event (pub/sub/unsub) received from a runtime; can be called from any thread
+ * 
+ * @param conn the runtime connection the event came from
+ * @param event the event
+ */
+void mqtt_process_runtime_event(runtime_conn_t *conn, request_t *event);
+
+/**
+ * Release the subscriptions of a module (e.g. uninstalled); can be called from any thread
+ *
+ * @param conn the runtime connection of the module
+ * @param mod_id the module id
+ */
+void mqtt_release_module(runtime_conn_t *conn, int mod_id);
+
+/**
+ * Publish a runtime start/stop event; can be called from any thread
+ * 
+ * @param conn the runtime connection
+ * @param rt_event EVENT_RT_START or EVENT_RT_STOP
+ */
+void mqtt_notify_runtime_event(runtime_conn_t *conn, char *rt_event);
+
+void mqtt_notify_module_event(runtime_conn_t *conn, char *module_event, int mod_id, char *mod_name);
+void mqtt_notify_pubsub_event(runtime_conn_t *conn, char *pubsub_event, int mod_id, char *topic);
 #endif
\ No newline at end of file
@@ -0,0 +1,528 @@
+/** @file mqtt_outbox.c
+ *  @brief Reliable MQTT publishing
+ *
+ *  QoS 1/2 publishes go through a queue and an in-flight window. The spool file
+ *  is a sequence of records: a publish record (header, topic, message) when a
+ *  message enters the outbox, and a done record (header only) when it is
+ *  acknowledged or dropped. The file is truncated whenever the outbox empties,
+ *  and rewritten with the pending publishes at startup and when it grows past
+ *  SPOOL_COMPACT_SIZE, mostly with records of publishes done.
+ *
+ *  @date July, 2019
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mqtt_outbox.h"
+#include "mqtt_wire.h"
+#include "queue.h"
+
+/* spool record types */
+#define SPOOL_REC_PUBLISH 'P'
+#define SPOOL_REC_DONE 'D'
+
+/* the spool is rewritten past this size, if most of it is publishes done */
+#define SPOOL_COMPACT_SIZE (1024 * 1024)
+
+/* header of spool records, in host byte order */
+typedef struct {
+    uint8_t type;
+    uint8_t qos;
+    uint16_t topic_len;
+    uint32_t msg_len;
+    uint64_t seq;
+} spool_rec_hdr_t;
+
+/* state of a publish */
+typedef enum {
+    MQTT_OUT_QUEUED,     /* waiting for room in the window */
+    MQTT_OUT_WAIT_ACK,   /* sent; waiting for PUBACK (QoS 1) or PUBREC (QoS 2) */
+    MQTT_OUT_WAIT_COMP   /* PUBREL sent; waiting for PUBCOMP (QoS 2) */
+} mqtt_out_state_t;
+
+/* a QoS 1/2 publish; topic and msg are stored right after it, in the same allocation */
+struct mqtt_out_msg {
+    TAILQ_ENTRY(mqtt_out_msg) next;
+    uint64_t seq;
+    uint16_t msg_id;
+    uint8_t qos;
+    uint8_t state;
+    /* sent before with msg_id; sent again with the DUP flag */
+    uint8_t sent;
+    uint32_t msg_len;
+    char *topic;
+    char *msg;
+    /* next in its bucket of the spool index, while the spool is loaded */
+    struct mqtt_out_msg *next_hash;
+};
+
+/* publishes loaded from the spool, hashed by seq, so done records find them at once */
+typedef struct {
+    struct mqtt_out_msg **buckets;
+    uint32_t size;
+    uint32_t count;
+} spool_index_t;
+
+TAILQ_HEAD(mqtt_out_list, mqtt_out_msg);
+
+static struct mqtt_out_list g_inflight = TAILQ_HEAD_INITIALIZER(g_inflight);
+static struct mqtt_out_list g_queued = TAILQ_HEAD_INITIALIZER(g_queued);
+
+static uint32_t g_max_inflight, g_max_queued;
+
+/* publishes waiting for acknowledgement on this connection: g_max_inflight, up to the broker's receive maximum */
+static uint32_t g_window;
+static mqtt_outbox_stats_t g_stats;
+
+/* message ids in use by unacknowledged publishes */
+static uint8_t g_ids_used[65536 / 8];
+static uint16_t g_last_id;
+
+static FILE *g_spool;
+static char g_spool_path[512];
+/* bytes of the spool, and of the records of the publishes pending */
+static uint64_t g_spool_size, g_spool_live;
+static uint64_t g_next_seq = 1;
+
+#define ID_USED(id) (g_ids_used[(id) >> 3] & (1 << ((id) & 7)))
+#define ID_SET(id) (g_ids_used[(id) >> 3] |= (1 << ((id) & 7)))
+#define ID_CLEAR(id) (g_ids_used[(id) >> 3] &= ~(1 << ((id) & 7)))
+
+static struct mqtt_out_msg *mqtt_out_msg_new(const char *topic, uint16_t topic_len, int qos, const char *msg, uint32_t msg_len)
+{
+    struct mqtt_out_msg *m = malloc(sizeof(struct mqtt_out_msg) + topic_len + 1 + msg_len);
+
+    if (m == NULL) return NULL;
+    memset(m, 0, sizeof(struct mqtt_out_msg));
+    m->qos = qos;
+    m->state = MQTT_OUT_QUEUED;
+    m->topic = (char *) (m + 1);
+    memcpy(m->topic, topic, topic_len);
+    m->topic[topic_len] = '\0';
+    m->msg = m->topic + topic_len + 1;
+    memcpy(m->msg, msg, msg_len);
+    m->msg_len = msg_len;
+    return m;
+}
+
+/* stop using the spool after a write error; publishes are still delivered while the bridge runs */
+static void spool_fail(const char *what)
+{
+    perror(what);
+    printf("Disabling the mqtt spool file.\n");
+    fclose(g_spool);
+    g_spool = NULL;
+}
+
+/* bytes of the publish record of a message */
+static uint64_t spool_rec_size(struct mqtt_out_msg *m)
+{
+    return sizeof(spool_rec_hdr_t) + strlen(m->topic) + m->msg_len;
+}
+
+static void spool_write(FILE *f, uint8_t type, struct mqtt_out_msg *m)
+{
+    spool_rec_hdr_t hdr;
+    uint16_t topic_len = type == SPOOL_REC_PUBLISH ? strlen(m->topic) : 0;
+
+    if (f == NULL) return;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = type;
+    hdr.qos = m->qos;
+    hdr.seq = m->seq;
+    if (type == SPOOL_REC_PUBLISH) {
+        hdr.topic_len = topic_len;
+        hdr.msg_len = m->msg_len;
+    }
+
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1
+            || (topic_len > 0 && fwrite(m->topic, topic_len, 1, f) != 1)
+            || (hdr.msg_len > 0 && fwrite(m->msg, hdr.msg_len, 1, f) != 1)
+            || fflush(f) != 0) {
+        if (f == g_spool) spool_fail("mqtt spool write");
+        return;
+    }
+
+    if (f == g_spool) {
+        g_spool_size += sizeof(hdr) + topic_len + hdr.msg_len;
+        if (type == SPOOL_REC_PUBLISH) g_spool_live += sizeof(hdr) + topic_len + hdr.msg_len;
+        else if (g_spool_live >= spool_rec_size(m)) g_spool_live -= spool_rec_size(m);
+    }
+}
+
+/**
+ * Write the pending publishes to a new spool file, and replace the spool with it
+ *
+ * @return returns -1 on error, 0 on success
+ */
+static int spool_rewrite()
+{
+    char tmp_path[sizeof(g_spool_path) + 4];
+    struct mqtt_out_msg *m;
+    FILE *f;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", g_spool_path);
+    if ((f = fopen(tmp_path, "wb")) == NULL) {
+        perror("mqtt spool");
+        return -1;
+    }
+    g_spool_live = 0;
+    TAILQ_FOREACH(m, &g_inflight, next) {
+        spool_write(f, SPOOL_REC_PUBLISH, m);
+        g_spool_live += spool_rec_size(m);
+    }
+    TAILQ_FOREACH(m, &g_queued, next) {
+        spool_write(f, SPOOL_REC_PUBLISH, m);
+        g_spool_live += spool_rec_size(m);
+    }
+    if (fflush(f) != 0 || fclose(f) != 0 || rename(tmp_path, g_spool_path) != 0) {
+        perror("mqtt spool");
+        return -1;
+    }
+    g_spool_size = g_spool_live;
+
+    if (g_spool != NULL) fclose(g_spool);
+    if ((g_spool = fopen(g_spool_path, "ab")) == NULL) {
+        perror("mqtt spool");
+        return -1;
+    }
+    return 0;
+}
+
+/* keep the spool from growing forever: truncate it once nothing is pending, and rewrite it
+   with the pending publishes when mostly made of publishes done (with QoS 1/2 traffic
+   steady, the outbox may never empty) */
+static void spool_trim()
+{
+    if (g_spool == NULL) return;
+
+    if (TAILQ_EMPTY(&g_inflight) && TAILQ_EMPTY(&g_queued)) {
+        if (g_spool_size == 0) return;
+        if (ftruncate(fileno(g_spool), 0) != 0) spool_fail("mqtt spool truncate");
+        g_spool_size = g_spool_live = 0;
+        return;
+    }
+
+    if (g_spool_size >= SPOOL_COMPACT_SIZE && g_spool_size / 2 >= g_spool_live && spool_rewrite() != 0) {
+        printf("Disabling the mqtt spool file.\n");
+        if (g_spool != NULL) fclose(g_spool);
+        g_spool = NULL;
+    }
+}
+
+/* bucket of a seq among size (a power of 2) buckets */
+static uint32_t spool_index_bucket(uint64_t seq, uint32_t size)
+{
+    return (uint32_t) (seq * 0x9E3779B97F4A7C15ULL >> 32) & (size - 1);
+}
+
+/* add a publish loaded to the index, doubling the buckets as it fills */
+static void spool_index_add(spool_index_t *index, struct mqtt_out_msg *m)
+{
+    struct mqtt_out_msg **buckets, *e, *next;
+    uint32_t size = index->size > 0 ? index->size * 2 : 256, i, b;
+
+    if (index->count >= index->size && (buckets = calloc(size, sizeof(*buckets))) != NULL) {
+        for (i = 0; i < index->size; i++) {
+            for (e = index->buckets[i]; e != NULL; e = next) {
+                next = e->next_hash;
+                b = spool_index_bucket(e->seq, size);
+                e->next_hash = buckets[b];
+                buckets[b] = e;
+            }
+        }
+        free(index->buckets);
+        index->buckets = buckets;
+        index->size = size;
+    }
+
+    if (index->size == 0) {
+        /* no memory for the index: done records do not find it, it is sent again */
+        m->next_hash = NULL;
+        return;
+    }
+    b = spool_index_bucket(m->seq, index->size);
+    m->next_hash = index->buckets[b];
+    index->buckets[b] = m;
+    index->count++;
+}
+
+/* remove a publish from the index; returns NULL if not there */
+static struct mqtt_out_msg *spool_index_remove(spool_index_t *index, uint64_t seq)
+{
+    struct mqtt_out_msg **e, *m;
+
+    if (index->size == 0) return NULL;
+    for (e = &index->buckets[spool_index_bucket(seq, index->size)]; (m = *e) != NULL; e = &m->next_hash) {
+        if (m->seq == seq) {
+            *e = m->next_hash;
+            index->count--;
+            return m;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Queue the publishes left in the spool and rewrite it with only those
+ *
+ * @param path the spool file
+ * @return returns -1 on error, 0 on success
+ */
+static int spool_load(const char *path)
+{
+    spool_rec_hdr_t hdr;
+    spool_index_t index = { NULL, 0, 0 };
+    struct mqtt_out_msg *m;
+    char *topic = NULL, *msg = NULL;
+    FILE *f;
+
+    snprintf(g_spool_path, sizeof(g_spool_path), "%s", path);
+    if ((f = fopen(path, "rb")) != NULL) {
+        while (fread(&hdr, sizeof(hdr), 1, f) == 1) {
+            if (hdr.seq >= g_next_seq) g_next_seq = hdr.seq + 1;
+
+            if (hdr.type == SPOOL_REC_DONE) {
+                if ((m = spool_index_remove(&index, hdr.seq)) != NULL) {
+                    TAILQ_REMOVE(&g_queued, m, next);
+                    g_stats.queued--;
+                    free(m);
+                }
+                continue;
+            }
+            if (hdr.type != SPOOL_REC_PUBLISH || hdr.qos < 1 || hdr.qos > 2) break;
+
+            /* a record cut short by a crash ends the spool */
+            topic = malloc(hdr.topic_len + 1);
+            msg = malloc(hdr.msg_len + 1);
+            if (topic == NULL || msg == NULL
+                    || (hdr.topic_len > 0 && fread(topic, hdr.topic_len, 1, f) != 1)
+                    || (hdr.msg_len > 0 && fread(msg, hdr.msg_len, 1, f) != 1))
+                break;
+
+            /* sent again with a new id: not a duplicate for the broker */
+            if ((m = mqtt_out_msg_new(topic, hdr.topic_len, hdr.qos, msg, hdr.msg_len)) != NULL) {
+                m->seq = hdr.seq;
+                TAILQ_INSERT_TAIL(&g_queued, m, next);
+                spool_index_add(&index, m);
+                g_stats.queued++;
+            }
+            free(topic);
+            free(msg);
+            topic = msg = NULL;
+        }
+        free(topic);
+        free(msg);
+        free(index.buckets);
+        fclose(f);
+        if (g_stats.queued > 0) printf("Loaded %u unacknowledged mqtt publishes from '%s'.\n", g_stats.queued, path);
+    }
+
+    /* rewrite the spool with the pending publishes only */
+    return spool_rewrite();
+}
+
+int mqtt_outbox_init(uint32_t max_inflight, uint32_t max_queued, const char *spool_path)
+{
+    g_max_inflight = max_inflight > 0 ? max_inflight : 1;
+    if (g_max_inflight > 65535) g_max_inflight = 65535;
+    g_window = g_max_inflight;
+    g_max_queued = max_queued;
+
+    if (spool_path != NULL && spool_path[0] != '\0') return spool_load(spool_path);
+    return 0;
+}
+
+uint16_t mqtt_outbox_next_id()
+{
+    do {
+        g_last_id++;
+    } while (g_last_id == 0 || ID_USED(g_last_id));
+    return g_last_id;
+}
+
+/* forget a publish not in a list any more, e.g. one the broker does not accept */
+static void mqtt_outbox_drop(struct mqtt_out_msg *m, const char *why)
+{
+    g_stats.dropped++;
+    printf("%s; dropping message to '%s'.\n", why, m->topic);
+    spool_write(g_spool, SPOOL_REC_DONE, m);
+    free(m);
+}
+
+static void mqtt_outbox_send_msg(struct mg_connection *nc, struct mqtt_out_msg *m)
+{
+    if (m->state == MQTT_OUT_WAIT_COMP) {
+        mqtt_wire_pubrel(nc, m->msg_id);
+        return;
+    }
+    mqtt_wire_publish(nc, m->topic, m->msg_id, MG_MQTT_QOS(m->qos) | (m->sent ? MG_MQTT_DUP : 0), m->msg, m->msg_len);
+    m->sent = 1;
+}
+
+/* move queued publishes to the window while there is room */
+static void mqtt_outbox_send_queued(struct mg_connection *nc)
+{
+    struct mqtt_out_msg *m;
+
+    if (nc == NULL) return;
+
+    while (g_stats.inflight < g_window && (m = TAILQ_FIRST(&g_queued)) != NULL) {
+        TAILQ_REMOVE(&g_queued, m, next);
+        g_stats.queued--;
+
+        /* the broker's limits are known once connected */
+        if (!mqtt_wire_publish_fits(m->topic, m->qos, m->msg_len)) {
+            mqtt_outbox_drop(m, "MQTT message larger than the server accepts");
+            continue;
+        }
+        if (m->qos > mqtt_wire_maximum_qos()) m->qos = mqtt_wire_maximum_qos();
+        if (m->qos == 0) {
+            mqtt_wire_publish(nc, m->topic, 0, MG_MQTT_QOS(0), m->msg, m->msg_len);
+            g_stats.acked++;
+            spool_write(g_spool, SPOOL_REC_DONE, m);
+            free(m);
+            continue;
+        }
+
+        /* a new id: the DUP flag would be wrong for it */
+        m->msg_id = mqtt_outbox_next_id();
+        ID_SET(m->msg_id);
+        m->state = MQTT_OUT_WAIT_ACK;
+        m->sent = 0;
+        TAILQ_INSERT_TAIL(&g_inflight, m, next);
+        g_stats.inflight++;
+
+        mqtt_outbox_send_msg(nc, m);
+    }
+}
+
+int mqtt_outbox_publish(struct mg_connection *nc, const char *topic, int qos, const char *msg, uint32_t msg_len)
+{
+    struct mqtt_out_msg *m;
+
+    if (qos <= 0) {
+        if (nc == NULL) return -1;
+        return mqtt_wire_publish(nc, topic, 0, MG_MQTT_QOS(0), msg, msg_len);
+    }
+
+    if ((m = mqtt_out_msg_new(topic, strlen(topic), qos > 2 ? 2 : qos, msg, msg_len)) == NULL) return -1;
+    m->seq = g_next_seq++;
+    spool_write(g_spool, SPOOL_REC_PUBLISH, m);
+
+    TAILQ_INSERT_TAIL(&g_queued, m, next);
+    g_stats.queued++;
+    mqtt_outbox_send_queued(nc);
+
+    /* queue full: drop the oldest publishes not sent yet */
+    while (g_stats.queued > g_max_queued) {
+        m = TAILQ_FIRST(&g_queued);
+        TAILQ_REMOVE(&g_queued, m, next);
+        g_stats.queued--;
+        mqtt_outbox_drop(m, "MQTT outbox full");
+    }
+    spool_trim();
+    return 0;
+}
+
+void mqtt_outbox_connected(struct mg_connection *nc, uint16_t receive_max)
+{
+    struct mqtt_out_list requeue = TAILQ_HEAD_INITIALIZER(requeue);
+    struct mqtt_out_msg *m, *prev, *tmp;
+
+    g_window = receive_max > 0 && receive_max < g_max_inflight ? receive_max : g_max_inflight;
+
+    /*
+     * the window shrank: queue again the last QoS 1 publishes not acknowledged (they get a new id
+     * when sent); QoS 2 publishes keep their id, as the broker may have received them
+     */
+    for (m = TAILQ_LAST(&g_inflight, mqtt_out_list); m != NULL && g_stats.inflight > g_window; m = prev) {
+        prev = TAILQ_PREV(m, mqtt_out_list, next);
+        if (m->qos != 1) continue;
+        TAILQ_REMOVE(&g_inflight, m, next);
+        g_stats.inflight--;
+        ID_CLEAR(m->msg_id);
+        m->state = MQTT_OUT_QUEUED;
+        TAILQ_INSERT_HEAD(&g_queued, m, next);
+        g_stats.queued++;
+    }
+
+    /* publishes the broker does not accept any more are dropped, or queued again with a lower QoS */
+    TAILQ_FOREACH_SAFE(m, &g_inflight, next, tmp) {
+        if (m->state == MQTT_OUT_WAIT_ACK && (!mqtt_wire_publish_fits(m->topic, m->qos, m->msg_len)
+                                              || m->qos > mqtt_wire_maximum_qos())) {
+            TAILQ_REMOVE(&g_inflight, m, next);
+            g_stats.inflight--;
+            ID_CLEAR(m->msg_id);
+            m->state = MQTT_OUT_QUEUED;
+            TAILQ_INSERT_TAIL(&requeue, m, next);
+            continue;
+        }
+        mqtt_outbox_send_msg(nc, m);
+        g_stats.retransmitted++;
+    }
+    while ((m = TAILQ_LAST(&requeue, mqtt_out_list)) != NULL) {
+        TAILQ_REMOVE(&requeue, m, next);
+        TAILQ_INSERT_HEAD(&g_queued, m, next);
+        g_stats.queued++;
+    }
+    mqtt_outbox_send_queued(nc);
+    spool_trim();
+}
+
+void mqtt_outbox_ack(struct mg_connection *nc, int ev, uint16_t msg_id)
+{
+    struct mqtt_out_msg *m;
+
+    if (!ID_USED(msg_id)) return;
+
+    TAILQ_FOREACH(m, &g_inflight, next) {
+        if (m->msg_id == msg_id) break;
+    }
+    if (m == NULL) return;
+
+    if (ev == MG_EV_MQTT_PUBREC) {
+        if (m->qos != 2) return;
+        m->state = MQTT_OUT_WAIT_COMP;
+        mqtt_wire_pubrel(nc, msg_id);
+        return;
+    }
+    if ((ev == MG_EV_MQTT_PUBACK && m->qos != 1) || (ev == MG_EV_MQTT_PUBCOMP && m->state != MQTT_OUT_WAIT_COMP)) return;
+
+    TAILQ_REMOVE(&g_inflight, m, next);
+    g_stats.inflight--;
+    g_stats.acked++;
+    ID_CLEAR(msg_id);
+    spool_write(g_spool, SPOOL_REC_DONE, m);
+    free(m);
+
+    mqtt_outbox_send_queued(nc);
+    spool_trim();
+}
+
+void mqtt_outbox_get_stats(mqtt_outbox_stats_t *stats)
+{
+    *stats = g_stats;
+}
+
+void mqtt_outbox_close()
+{
+    struct mqtt_out_msg *m;
+
+    while ((m = TAILQ_FIRST(&g_inflight)) != NULL) {
+        TAILQ_REMOVE(&g_inflight, m, next);
+        free(m);
+    }
+    while ((m = TAILQ_FIRST(&g_queued)) != NULL) {
+        TAILQ_REMOVE(&g_queued, m, next);
+        free(m);
+    }
+    g_stats.inflight = g_stats.queued = 0;
+    memset(g_ids_used, 0, sizeof(g_ids_used));
+
+    if (g_spool != NULL) fclose(g_spool);
+    g_spool = NULL;
+}
@@ -0,0 +1,98 @@
+ /** @file mqtt_outbox.h
+ *  @brief Definitions for reliable MQTT publishing
+ *
+ *  Definitions for publishing with QoS 1 and 2: message ids are allocated by
+ *  the bridge, at most a window of publishes waits for acknowledgement and the
+ *  others are queued. Unacknowledged publishes are sent again when the broker
+ *  connection is re-established, and can be kept in an append-only spool file
+ *  so they survive a restart of the bridge.
+ *
+ *  Only called from the thread owning the mqtt connection.
+ *
+ *  @date July, 2019
+ */
+#ifndef MQTT_OUTBOX_H_
+#define MQTT_OUTBOX_H_
+
+#include <stdint.h>
+
+#include "mongoose.h"
+
+/**
+ * Outbox counters
+ */
+typedef struct {
+    /* publishes waiting for acknowledgement */
+    uint32_t inflight;
+    /* publishes waiting for room in the window (or for the connection) */
+    uint32_t queued;
+    /* publishes acknowledged by the broker */
+    uint64_t acked;
+    /* publishes sent again after a reconnect */
+    uint64_t retransmitted;
+    /* publishes dropped because the queue was full */
+    uint64_t dropped;
+} mqtt_outbox_stats_t;
+
+/**
+ * Init the outbox; publishes left in the spool file are queued to be sent
+ *
+ * @param max_inflight maximum publishes waiting for acknowledgement
+ * @param max_queued maximum publishes queued; the oldest is dropped when full
+ * @param spool_path spool file; NULL or empty for no spool
+ * @return returns -1 on error, 0 on success
+ */
+int mqtt_outbox_init(uint32_t max_inflight, uint32_t max_queued, const char *spool_path);
+
+/**
+ * Publish a message; QoS 0 messages are dropped if there is no connection
+ *
+ * @param nc the mqtt connection, NULL if not connected (accepted by the broker)
+ * @param topic the topic
+ * @param qos quality of service (0, 1 or 2)
+ * @param msg the message (copied)
+ * @param msg_len length of the message
+ * @return returns -1 if the message was dropped, 0 on success
+ */
+int mqtt_outbox_publish(struct mg_connection *nc, const char *topic, int qos, const char *msg, uint32_t msg_len);
+
+/**
+ * Handle a connection accepted by the broker: send again the unacknowledged publishes, then the queued ones
+ *
+ * The window is limited to the publishes the broker accepts unacknowledged; if
+ * it shrank, the QoS 1 publishes beyond it are queued again.
+ *
+ * @param nc the mqtt connection
+ * @param receive_max publishes the broker accepts unacknowledged (its MQTT 5 Receive Maximum)
+ */
+void mqtt_outbox_connected(struct mg_connection *nc, uint16_t receive_max);
+
+/**
+ * Handle a PUBACK, PUBREC or PUBCOMP
+ *
+ * @param nc the mqtt connection
+ * @param ev MG_EV_MQTT_PUBACK, MG_EV_MQTT_PUBREC or MG_EV_MQTT_PUBCOMP
+ * @param msg_id the message id acknowledged
+ */
+void mqtt_outbox_ack(struct mg_connection *nc, int ev, uint16_t msg_id);
+
+/**
+ * Get a message id for a subscribe or unsubscribe; ids of unacknowledged publishes are skipped
+ *
+ * @return returns the message id
+ */
+uint16_t mqtt_outbox_next_id();
+
+/**
+ * Get outbox counters
+ *
+ * @param stats where to copy the counters to
+ */
+void mqtt_outbox_get_stats(mqtt_outbox_stats_t *stats);
+
+/**
+ * Release the outbox; unacknowledged publishes are left in the spool file
+ */
+void mqtt_outbox_close();
+
+#endif
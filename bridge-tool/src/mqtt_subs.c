@@ -0,0 +1,269 @@
+/** @file mqtt_subs.c
+ *  @brief Broker subscription table
+ *
+ *  Topics are kept in a hash table; each has the list of modules subscribing
+ *  it. Topics whose broker state must change (first module subscribed, last
+ *  module gone) are put in a dirty list, handled by mqtt_subs_flush(). Topics
+ *  are also in a trie (topic_trie.h), to match messages against the filters.
+ *
+ *  @date July, 2019
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mqtt_subs.h"
+#include "mqtt_wire.h"
+#include "topic_trie.h"
+#include "queue.h"
+
+#define MQTT_SUBS_BUCKETS 256
+
+/* a module subscribing a topic */
+struct mqtt_sub_ref {
+    SLIST_ENTRY(mqtt_sub_ref) next;
+    int rt_idx;
+    int mod_id;
+};
+
+/* a topic; kept while subscribed by a module or at the broker */
+struct mqtt_sub {
+    SLIST_ENTRY(mqtt_sub) next;
+    TAILQ_ENTRY(mqtt_sub) dirty_next;
+    SLIST_HEAD(mqtt_sub_refs, mqtt_sub_ref) refs;
+    uint32_t nrefs;
+    uint32_t hash;
+    /* subscribed at the broker */
+    uint8_t subscribed;
+    /* in the dirty list */
+    uint8_t dirty;
+    char topic[];
+};
+
+SLIST_HEAD(mqtt_sub_bucket, mqtt_sub);
+
+static struct mqtt_sub_bucket g_buckets[MQTT_SUBS_BUCKETS];
+static TAILQ_HEAD(mqtt_sub_dirty, mqtt_sub) g_dirty = TAILQ_HEAD_INITIALIZER(g_dirty);
+static topic_trie_t *g_trie;
+
+/* FNV-1a */
+static uint32_t mqtt_subs_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static struct mqtt_sub *mqtt_subs_find(const char *topic, uint32_t hash)
+{
+    struct mqtt_sub *s;
+
+    SLIST_FOREACH(s, &g_buckets[hash % MQTT_SUBS_BUCKETS], next) {
+        if (s->hash == hash && strcmp(s->topic, topic) == 0) return s;
+    }
+    return NULL;
+}
+
+static void mqtt_subs_mark_dirty(struct mqtt_sub *s)
+{
+    if (s->dirty) return;
+    s->dirty = 1;
+    TAILQ_INSERT_TAIL(&g_dirty, s, dirty_next);
+}
+
+static void mqtt_subs_free(struct mqtt_sub *s)
+{
+    struct mqtt_sub_ref *ref;
+
+    SLIST_REMOVE(&g_buckets[s->hash % MQTT_SUBS_BUCKETS], s, mqtt_sub, next);
+    topic_trie_remove(g_trie, s->topic);
+    if (s->dirty) TAILQ_REMOVE(&g_dirty, s, dirty_next);
+    while ((ref = SLIST_FIRST(&s->refs)) != NULL) {
+        SLIST_REMOVE_HEAD(&s->refs, next);
+        free(ref);
+    }
+    free(s);
+}
+
+int mqtt_subs_add(int rt_idx, int mod_id, const char *topic)
+{
+    uint32_t hash = mqtt_subs_hash(topic);
+    struct mqtt_sub *s = mqtt_subs_find(topic, hash);
+    struct mqtt_sub_ref *ref;
+    size_t len;
+
+    if (s == NULL) {
+        if (g_trie == NULL && (g_trie = topic_trie_create()) == NULL) return -1;
+        len = strlen(topic);
+        if ((s = calloc(1, sizeof(struct mqtt_sub) + len + 1)) == NULL) return -1;
+        memcpy(s->topic, topic, len + 1);
+        s->hash = hash;
+        SLIST_INIT(&s->refs);
+        if (topic_trie_insert(g_trie, s->topic, s) != 0) {
+            free(s);
+            return -1;
+        }
+        SLIST_INSERT_HEAD(&g_buckets[hash % MQTT_SUBS_BUCKETS], s, next);
+    }
+
+    SLIST_FOREACH(ref, &s->refs, next) {
+        if (ref->rt_idx == rt_idx && ref->mod_id == mod_id) return 0;
+    }
+
+    if ((ref = malloc(sizeof(struct mqtt_sub_ref))) == NULL) {
+        if (s->nrefs == 0 && !s->subscribed) mqtt_subs_free(s);
+        return -1;
+    }
+    ref->rt_idx = rt_idx;
+    ref->mod_id = mod_id;
+    SLIST_INSERT_HEAD(&s->refs, ref, next);
+
+    if (s->nrefs++ > 0 || s->subscribed) return 0;
+    mqtt_subs_mark_dirty(s);
+    return 1;
+}
+
+/* remove a reference from a topic; returns 1 if it was the last one */
+static int mqtt_subs_unref(struct mqtt_sub *s, struct mqtt_sub_ref *ref)
+{
+    SLIST_REMOVE(&s->refs, ref, mqtt_sub_ref, next);
+    free(ref);
+    if (--s->nrefs > 0) return 0;
+    mqtt_subs_mark_dirty(s);
+    return 1;
+}
+
+int mqtt_subs_del(int rt_idx, int mod_id, const char *topic)
+{
+    struct mqtt_sub *s = mqtt_subs_find(topic, mqtt_subs_hash(topic));
+    struct mqtt_sub_ref *ref;
+
+    if (s == NULL) return -1;
+
+    SLIST_FOREACH(ref, &s->refs, next) {
+        if (ref->rt_idx == rt_idx && ref->mod_id == mod_id) return mqtt_subs_unref(s, ref);
+    }
+    return -1;
+}
+
+int mqtt_subs_del_module(int rt_idx, int mod_id)
+{
+    struct mqtt_sub *s;
+    struct mqtt_sub_ref *ref;
+    int i, n = 0;
+
+    for (i = 0; i < MQTT_SUBS_BUCKETS; i++) {
+        SLIST_FOREACH(s, &g_buckets[i], next) {
+            SLIST_FOREACH(ref, &s->refs, next) {
+                if (ref->rt_idx == rt_idx && ref->mod_id == mod_id) break;
+            }
+            if (ref != NULL) {
+                mqtt_subs_unref(s, ref);
+                n++;
+            }
+        }
+    }
+    return n;
+}
+
+int mqtt_subs_match(const char *topic, size_t topic_len, mqtt_sub_t **subs, int max_subs)
+{
+    int i, n;
+
+    if (g_trie == NULL) return 0;
+
+    /* topics waiting to be unsubscribed are still in the trie */
+    n = topic_trie_match(g_trie, topic, topic_len, (void **)subs, max_subs);
+    for (i = 0; i < n; ) {
+        if (subs[i]->nrefs == 0) subs[i] = subs[--n];
+        else i++;
+    }
+    return n;
+}
+
+const char *mqtt_subs_topic(const mqtt_sub_t *sub)
+{
+    return sub->topic;
+}
+
+int mqtt_subs_has_runtime(const mqtt_sub_t *sub, int rt_idx)
+{
+    struct mqtt_sub_ref *ref;
+
+    SLIST_FOREACH(ref, &sub->refs, next) {
+        if (ref->rt_idx == rt_idx) return 1;
+    }
+    return 0;
+}
+
+void mqtt_subs_resubscribe_all()
+{
+    struct mqtt_sub *s;
+    int i;
+
+    for (i = 0; i < MQTT_SUBS_BUCKETS; i++) {
+        SLIST_FOREACH(s, &g_buckets[i], next) {
+            if (s->nrefs == 0) continue;
+            s->subscribed = 0;
+            mqtt_subs_mark_dirty(s);
+        }
+    }
+}
+
+int mqtt_subs_flush(struct mg_connection *nc, uint16_t (*next_id)())
+{
+    struct mg_mqtt_topic_expression subs[MQTT_SUBS_MAX_BATCH];
+    char *unsubs[MQTT_SUBS_MAX_BATCH];
+    struct mqtt_sub *unsub_entries[MQTT_SUBS_MAX_BATCH];
+    struct mqtt_sub *s;
+    int nsubs = 0, nunsubs = 0, packets = 0, i;
+
+    if (nc == NULL) return 0;
+
+    while ((s = TAILQ_FIRST(&g_dirty)) != NULL) {
+        TAILQ_REMOVE(&g_dirty, s, dirty_next);
+        s->dirty = 0;
+
+        if (s->nrefs > 0 && !s->subscribed) {
+            subs[nsubs].topic = s->topic;
+            subs[nsubs++].qos = 0;
+            s->subscribed = 1;
+        } else if (s->nrefs == 0 && s->subscribed) {
+            /* freed once the packet is built */
+            unsubs[nunsubs] = s->topic;
+            unsub_entries[nunsubs++] = s;
+        } else if (s->nrefs == 0) {
+            mqtt_subs_free(s);
+        }
+
+        if (nsubs == MQTT_SUBS_MAX_BATCH || (TAILQ_EMPTY(&g_dirty) && nsubs > 0)) {
+            mqtt_wire_subscribe(nc, subs, nsubs, next_id());
+            packets++;
+            nsubs = 0;
+        }
+        if (nunsubs == MQTT_SUBS_MAX_BATCH || (TAILQ_EMPTY(&g_dirty) && nunsubs > 0)) {
+            mqtt_wire_unsubscribe(nc, unsubs, nunsubs, next_id());
+            packets++;
+            for (i = 0; i < nunsubs; i++) mqtt_subs_free(unsub_entries[i]);
+            nunsubs = 0;
+        }
+    }
+
+    return packets;
+}
+
+void mqtt_subs_destroy()
+{
+    struct mqtt_sub *s;
+    int i;
+
+    for (i = 0; i < MQTT_SUBS_BUCKETS; i++) {
+        while ((s = SLIST_FIRST(&g_buckets[i])) != NULL) mqtt_subs_free(s);
+    }
+    if (g_trie != NULL) topic_trie_destroy(g_trie);
+    g_trie = NULL;
+}
@@ -0,0 +1,106 @@
+ /** @file mqtt_subs.h
+ *  @brief Definitions for the broker subscription table
+ *
+ *  Definitions for a table of the MQTT topics subscribed by the modules of all
+ *  runtimes. A topic is subscribed at the broker once, when the first module
+ *  subscribes it, and unsubscribed when the last module releases it. Changes
+ *  are batched into multi-topic SUBSCRIBE/UNSUBSCRIBE packets by mqtt_subs_flush().
+ *  Topics can be filters with '+' and '#' wildcards; messages are matched
+ *  against them to find the modules to deliver to.
+ *
+ *  Only called from the thread owning the mqtt connection.
+ *
+ *  @date July, 2019
+ */
+#ifndef MQTT_SUBS_H_
+#define MQTT_SUBS_H_
+
+#include <stdint.h>
+
+#include "mongoose.h"
+
+/* maximum topics in one SUBSCRIBE/UNSUBSCRIBE packet */
+#define MQTT_SUBS_MAX_BATCH 64
+
+/* maximum subscriptions matching a message */
+#define MQTT_SUBS_MAX_MATCH 64
+
+typedef struct mqtt_sub mqtt_sub_t;
+
+/**
+ * Add a module subscription; subscribing twice to the same topic is counted once
+ *
+ * @param rt_idx index of the runtime connection of the module
+ * @param mod_id the module id
+ * @param topic the topic
+ * @return returns 1 if the topic must be subscribed at the broker, 0 if already subscribed, -1 on failure
+ */
+int mqtt_subs_add(int rt_idx, int mod_id, const char *topic);
+
+/**
+ * Remove a module subscription
+ *
+ * @param rt_idx index of the runtime connection of the module
+ * @param mod_id the module id
+ * @param topic the topic
+ * @return returns 1 if the topic must be unsubscribed at the broker, 0 if other modules still use it, -1 if not subscribed
+ */
+int mqtt_subs_del(int rt_idx, int mod_id, const char *topic);
+
+/**
+ * Remove all subscriptions of a module (e.g. when it is uninstalled)
+ *
+ * @param rt_idx index of the runtime connection of the module
+ * @param mod_id the module id
+ * @return returns the number of subscriptions removed
+ */
+int mqtt_subs_del_module(int rt_idx, int mod_id);
+
+/**
+ * Find the subscriptions of modules matching the topic of a message
+ *
+ * @param topic the topic of the message (does not need to be NUL-terminated)
+ * @param topic_len length of the topic
+ * @param subs where to store the subscriptions matching
+ * @param max_subs maximum number of subscriptions stored
+ * @return returns the number of subscriptions stored
+ */
+int mqtt_subs_match(const char *topic, size_t topic_len, mqtt_sub_t **subs, int max_subs);
+
+/**
+ * Get the topic (filter) of a subscription
+ *
+ * @param sub the subscription
+ * @return returns the topic
+ */
+const char *mqtt_subs_topic(const mqtt_sub_t *sub);
+
+/**
+ * Check if a module of a runtime has a subscription
+ *
+ * @param sub the subscription
+ * @param rt_idx index of the runtime connection
+ * @return returns 1 if a module of the runtime has the subscription, 0 if not
+ */
+int mqtt_subs_has_runtime(const mqtt_sub_t *sub, int rt_idx);
+
+/**
+ * Mark all topics to be subscribed again (e.g. after connecting to the broker)
+ */
+void mqtt_subs_resubscribe_all();
+
+/**
+ * Send the pending subscribe and unsubscribe requests, batched
+ *
+ * @param nc the mqtt connection; nothing is sent if NULL
+ * @param next_id function returning the message id of each packet
+ * @return returns the number of packets sent
+ */
+int mqtt_subs_flush(struct mg_connection *nc, uint16_t (*next_id)());
+
+/**
+ * Release the table
+ */
+void mqtt_subs_destroy();
+
+#endif
@@ -0,0 +1,634 @@
+/** @file mqtt_wire.c
+ *  @brief MQTT packets exchanged with the broker
+ *
+ *  MQTT 3.1.1 is left to mongoose. For MQTT 5, packets are encoded here and
+ *  sent with mg_send(), and a mongoose protocol handler decodes the packets
+ *  received into the struct mg_mqtt_message and MG_EV_MQTT_* events mongoose
+ *  gives for MQTT 3.1.1.
+ *
+ *  @date July, 2019
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mqtt_wire.h"
+
+/* control packet types */
+#define MQTT5_CONNECT 1
+#define MQTT5_CONNACK 2
+#define MQTT5_PUBLISH 3
+#define MQTT5_PUBACK 4
+#define MQTT5_PUBREC 5
+#define MQTT5_PUBREL 6
+#define MQTT5_PUBCOMP 7
+#define MQTT5_SUBSCRIBE 8
+#define MQTT5_SUBACK 9
+#define MQTT5_UNSUBSCRIBE 10
+#define MQTT5_UNSUBACK 11
+#define MQTT5_PINGREQ 12
+#define MQTT5_PINGRESP 13
+#define MQTT5_DISCONNECT 14
+
+/* properties used */
+#define MQTT5_PROP_MESSAGE_EXPIRY 0x02
+#define MQTT5_PROP_RECEIVE_MAXIMUM 0x21
+#define MQTT5_PROP_TOPIC_ALIAS_MAXIMUM 0x22
+#define MQTT5_PROP_TOPIC_ALIAS 0x23
+#define MQTT5_PROP_MAXIMUM_QOS 0x24
+#define MQTT5_PROP_MAXIMUM_PACKET_SIZE 0x27
+
+/* CONNECT flags */
+#define MQTT5_CONNECT_CLEAN_START 0x02
+#define MQTT5_CONNECT_WILL 0x04
+#define MQTT5_CONNECT_PASSWORD 0x40
+#define MQTT5_CONNECT_USER_NAME 0x80
+
+/* reason code of a DISCONNECT for a protocol error */
+#define MQTT5_RC_PROTOCOL_ERROR 0x82
+
+#define MQTT_DEFAULT_KEEP_ALIVE 60
+
+/* a topic we assigned an alias to */
+struct mqtt5_alias {
+    uint32_t hash;
+    uint16_t alias;
+    char topic[];
+};
+
+/* properties of a received packet we look at */
+typedef struct {
+    uint16_t receive_max;
+    uint16_t topic_alias_max;
+    uint16_t topic_alias;
+    /* 2 if absent */
+    uint8_t max_qos;
+    /* 0 if absent */
+    uint32_t max_packet_size;
+} mqtt5_props_t;
+
+static mqtt_wire_opts_t g_opts = { MQTT_WIRE_V311, 0, 0 };
+
+/* state of the current MQTT 5 session */
+static struct {
+    uint16_t receive_max;
+
+    /* highest QoS and largest packet the broker accepts (0: no limit) */
+    uint8_t max_qos;
+    uint32_t max_packet_size;
+
+    /* aliases we may use (topic alias maximum of the broker, up to ours) */
+    uint16_t tx_alias_max;
+    uint16_t tx_alias_count;
+
+    /* topics we assigned an alias to, hashed (open addressing, 2 * g_opts.topic_alias_max slots) */
+    struct mqtt5_alias **tx;
+
+    /* topics of the aliases assigned by the broker, indexed by alias (1 to g_opts.topic_alias_max) */
+    char **rx;
+} g_v5;
+
+/* FNV-1a */
+static uint32_t mqtt5_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* forget the aliases of the previous session */
+static void mqtt5_reset()
+{
+    int i;
+
+    if (g_v5.tx != NULL) {
+        for (i = 0; i < 2 * g_opts.topic_alias_max; i++) free(g_v5.tx[i]);
+    }
+    if (g_v5.rx != NULL) {
+        for (i = 0; i <= g_opts.topic_alias_max; i++) free(g_v5.rx[i]);
+    }
+    free(g_v5.tx);
+    free(g_v5.rx);
+    memset(&g_v5, 0, sizeof(g_v5));
+    g_v5.receive_max = 65535;
+    g_v5.max_qos = 2;
+
+    if (g_opts.version == MQTT_WIRE_V5 && g_opts.topic_alias_max > 0) {
+        g_v5.tx = calloc(2 * g_opts.topic_alias_max, sizeof(struct mqtt5_alias *));
+        g_v5.rx = calloc(g_opts.topic_alias_max + 1, sizeof(char *));
+        if (g_v5.tx == NULL || g_v5.rx == NULL) {
+            printf("Could not allocate mqtt topic aliases.\n");
+            free(g_v5.tx);
+            free(g_v5.rx);
+            g_v5.tx = NULL;
+            g_v5.rx = NULL;
+        }
+    }
+}
+
+/**
+ * Get the alias of a topic; a new alias is assigned if there is one left
+ *
+ * @param topic the topic
+ * @param is_new set to 1 if the alias was just assigned (the topic must be sent with it)
+ * @return returns the alias, 0 for none
+ */
+static uint16_t mqtt5_tx_alias(const char *topic, int *is_new)
+{
+    uint32_t nslots = 2 * g_opts.topic_alias_max, hash, i;
+    struct mqtt5_alias *a;
+    size_t len;
+
+    *is_new = 0;
+    if (g_v5.tx == NULL || g_v5.tx_alias_max == 0) return 0;
+
+    hash = mqtt5_hash(topic);
+    for (i = hash % nslots; (a = g_v5.tx[i]) != NULL; i = (i + 1) % nslots) {
+        if (a->hash == hash && strcmp(a->topic, topic) == 0) return a->alias;
+    }
+
+    if (g_v5.tx_alias_count >= g_v5.tx_alias_max) return 0;
+    len = strlen(topic);
+    if ((a = malloc(sizeof(struct mqtt5_alias) + len + 1)) == NULL) return 0;
+    a->hash = hash;
+    a->alias = ++g_v5.tx_alias_count;
+    memcpy(a->topic, topic, len + 1);
+    g_v5.tx[i] = a;
+
+    *is_new = 1;
+    return a->alias;
+}
+
+static void mqtt5_put_u8(struct mbuf *b, uint8_t v)
+{
+    mbuf_append(b, &v, 1);
+}
+
+static void mqtt5_put_u16(struct mbuf *b, uint16_t v)
+{
+    uint8_t buf[2] = { v >> 8, v & 0xff };
+
+    mbuf_append(b, buf, 2);
+}
+
+/* variable byte integer */
+static int mqtt5_encode_varint(uint8_t *buf, uint32_t v)
+{
+    int n = 0;
+
+    do {
+        buf[n] = v & 0x7f;
+        v >>= 7;
+        if (v > 0) buf[n] |= 0x80;
+        n++;
+    } while (v > 0 && n < 4);
+    return n;
+}
+
+static void mqtt5_put_varint(struct mbuf *b, uint32_t v)
+{
+    uint8_t buf[4];
+
+    mbuf_append(b, buf, mqtt5_encode_varint(buf, v));
+}
+
+static void mqtt5_put_str(struct mbuf *b, const char *s, size_t len)
+{
+    mqtt5_put_u16(b, len);
+    mbuf_append(b, s, len);
+}
+
+/* send a packet: fixed header, then body (variable header and payload), then data (more payload) */
+static void mqtt5_send(struct mg_connection *nc, uint8_t first, struct mbuf *body, const void *data, size_t len)
+{
+    uint8_t hdr[5];
+    int n;
+
+    hdr[0] = first;
+    n = mqtt5_encode_varint(hdr + 1, (body != NULL ? body->len : 0) + len);
+    mg_send(nc, hdr, n + 1);
+    if (body != NULL && body->len > 0) mg_send(nc, body->buf, body->len);
+    if (len > 0) mg_send(nc, data, len);
+}
+
+/* send a packet with only a message id (PUBACK, PUBREC, PUBREL, PUBCOMP) */
+static void mqtt5_send_id(struct mg_connection *nc, uint8_t first, uint16_t msg_id)
+{
+    uint8_t buf[4] = { first, 2, msg_id >> 8, msg_id & 0xff };
+
+    mg_send(nc, buf, sizeof(buf));
+}
+
+static int mqtt5_get_varint(const uint8_t **p, const uint8_t *end, uint32_t *v)
+{
+    int shift = 0;
+
+    *v = 0;
+    while (*p < end && shift < 28) {
+        *v |= (uint32_t) (**p & 0x7f) << shift;
+        if ((*(*p)++ & 0x80) == 0) return 0;
+        shift += 7;
+    }
+    return -1;
+}
+
+static int mqtt5_get_u16(const uint8_t **p, const uint8_t *end, uint16_t *v)
+{
+    if (end - *p < 2) return -1;
+    *v = ((*p)[0] << 8) | (*p)[1];
+    *p += 2;
+    return 0;
+}
+
+static int mqtt5_get_str(const uint8_t **p, const uint8_t *end, struct mg_str *s)
+{
+    uint16_t len;
+
+    if (mqtt5_get_u16(p, end, &len) != 0 || end - *p < len) return -1;
+    s->p = (const char *) *p;
+    s->len = len;
+    *p += len;
+    return 0;
+}
+
+/**
+ * Parse the properties of a received packet, keeping the ones we look at
+ *
+ * @param p start of the properties (their length); moved past them
+ * @param end end of the packet
+ * @param props where to store the properties
+ * @return returns -1 if malformed, 0 on success
+ */
+static int mqtt5_get_props(const uint8_t **p, const uint8_t *end, mqtt5_props_t *props)
+{
+    const uint8_t *q;
+    uint32_t len, n;
+    uint16_t v;
+    uint8_t id;
+
+    memset(props, 0, sizeof(mqtt5_props_t));
+    props->max_qos = 2;
+    if (mqtt5_get_varint(p, end, &len) != 0 || (uint32_t) (end - *p) < len) return -1;
+    q = *p;
+    end = *p += len;
+
+    while (q < end) {
+        id = *q++;
+        switch (id) {
+        /* byte */
+        case 0x01: case 0x17: case 0x19: case MQTT5_PROP_MAXIMUM_QOS: case 0x25: case 0x28: case 0x29: case 0x2a:
+            if (q >= end) return -1;
+            if (id == MQTT5_PROP_MAXIMUM_QOS) props->max_qos = *q;
+            q++;
+            break;
+        /* two byte integer */
+        case MQTT5_PROP_RECEIVE_MAXIMUM: case MQTT5_PROP_TOPIC_ALIAS_MAXIMUM: case MQTT5_PROP_TOPIC_ALIAS:
+        case 0x13:
+            if (mqtt5_get_u16(&q, end, &v) != 0) return -1;
+            if (id == MQTT5_PROP_RECEIVE_MAXIMUM) props->receive_max = v;
+            if (id == MQTT5_PROP_TOPIC_ALIAS_MAXIMUM) props->topic_alias_max = v;
+            if (id == MQTT5_PROP_TOPIC_ALIAS) props->topic_alias = v;
+            break;
+        /* four byte integer */
+        case MQTT5_PROP_MESSAGE_EXPIRY: case 0x11: case 0x18: case MQTT5_PROP_MAXIMUM_PACKET_SIZE:
+            if (end - q < 4) return -1;
+            if (id == MQTT5_PROP_MAXIMUM_PACKET_SIZE)
+                props->max_packet_size = ((uint32_t) q[0] << 24) | (q[1] << 16) | (q[2] << 8) | q[3];
+            q += 4;
+            break;
+        /* variable byte integer */
+        case 0x0b:
+            if (mqtt5_get_varint(&q, end, &n) != 0) return -1;
+            break;
+        /* string or binary data */
+        case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1a: case 0x1c: case 0x1f:
+            if (mqtt5_get_u16(&q, end, &v) != 0 || end - q < v) return -1;
+            q += v;
+            break;
+        /* string pair */
+        case 0x26:
+            if (mqtt5_get_u16(&q, end, &v) != 0 || end - q < v) return -1;
+            q += v;
+            if (mqtt5_get_u16(&q, end, &v) != 0 || end - q < v) return -1;
+            q += v;
+            break;
+        default:
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Decode a received packet and deliver it to the connection handler
+ *
+ * @param nc the connection
+ * @param first first byte of the packet (type and flags)
+ * @param p the packet, after the fixed header
+ * @param len length of the packet, after the fixed header
+ * @return returns -1 if malformed, 0 on success
+ */
+static int mqtt5_recv_packet(struct mg_connection *nc, uint8_t first, const uint8_t *p, uint32_t len)
+{
+    const uint8_t *end = p + len;
+    struct mg_mqtt_message mm;
+    mqtt5_props_t props;
+    char *topic;
+    int ev;
+
+    memset(&mm, 0, sizeof(mm));
+    mm.cmd = first >> 4;
+    mm.qos = MG_MQTT_GET_QOS(first);
+    mm.protocol_version = MQTT_WIRE_V5;
+
+    switch (mm.cmd) {
+    case MQTT5_CONNACK:
+        if (len < 2) return -1;
+        mm.connack_ret_code = p[1];
+        p += 2;
+        memset(&props, 0, sizeof(props));
+        props.max_qos = 2;
+        if (p < end && mqtt5_get_props(&p, end, &props) != 0) return -1;
+        if (mm.connack_ret_code == 0) {
+            mqtt5_reset();
+            g_v5.receive_max = props.receive_max > 0 ? props.receive_max : 65535;
+            g_v5.tx_alias_max = props.topic_alias_max < g_opts.topic_alias_max ? props.topic_alias_max : g_opts.topic_alias_max;
+            g_v5.max_qos = props.max_qos < 2 ? props.max_qos : 2;
+            g_v5.max_packet_size = props.max_packet_size;
+        }
+        ev = MG_EV_MQTT_CONNACK;
+        break;
+    case MQTT5_PUBLISH:
+        if (mqtt5_get_str(&p, end, &mm.topic) != 0) return -1;
+        if (mm.qos > 0 && mqtt5_get_u16(&p, end, &mm.message_id) != 0) return -1;
+        if (mqtt5_get_props(&p, end, &props) != 0) return -1;
+
+        if (props.topic_alias > 0) {
+            if (g_v5.rx == NULL || props.topic_alias > g_opts.topic_alias_max) return -1;
+            if (mm.topic.len > 0) {
+                if ((topic = malloc(mm.topic.len + 1)) == NULL) return -1;
+                memcpy(topic, mm.topic.p, mm.topic.len);
+                topic[mm.topic.len] = '\0';
+                free(g_v5.rx[props.topic_alias]);
+                g_v5.rx[props.topic_alias] = topic;
+            } else if ((topic = g_v5.rx[props.topic_alias]) != NULL) {
+                mm.topic = mg_mk_str(topic);
+            } else {
+                return -1;
+            }
+        }
+        mm.payload.p = (const char *) p;
+        mm.payload.len = end - p;
+
+        if (mm.qos == 1) mqtt5_send_id(nc, MQTT5_PUBACK << 4, mm.message_id);
+        if (mm.qos == 2) mqtt5_send_id(nc, MQTT5_PUBREC << 4, mm.message_id);
+        ev = MG_EV_MQTT_PUBLISH;
+        break;
+    case MQTT5_PUBACK:
+    case MQTT5_PUBREC:
+    case MQTT5_PUBREL:
+    case MQTT5_PUBCOMP:
+    case MQTT5_SUBACK:
+    case MQTT5_UNSUBACK:
+        if (mqtt5_get_u16(&p, end, &mm.message_id) != 0) return -1;
+        if (mm.cmd == MQTT5_PUBREL) mqtt5_send_id(nc, (MQTT5_PUBCOMP << 4), mm.message_id);
+        ev = mm.cmd == MQTT5_PUBACK ? MG_EV_MQTT_PUBACK
+            : mm.cmd == MQTT5_PUBREC ? MG_EV_MQTT_PUBREC
+            : mm.cmd == MQTT5_PUBREL ? MG_EV_MQTT_PUBREL
+            : mm.cmd == MQTT5_PUBCOMP ? MG_EV_MQTT_PUBCOMP
+            : mm.cmd == MQTT5_SUBACK ? MG_EV_MQTT_SUBACK : MG_EV_MQTT_UNSUBACK;
+        break;
+    case MQTT5_PINGRESP:
+        ev = MG_EV_MQTT_PINGRESP;
+        break;
+    case MQTT5_DISCONNECT:
+        printf("Disconnected by MQTT server (reason %d).\n", len > 0 ? p[0] : 0);
+        nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        ev = MG_EV_MQTT_DISCONNECT;
+        break;
+    default:
+        return -1;
+    }
+
+    mm.len = len;
+    nc->handler(nc, ev, &mm);
+    return 0;
+}
+
+/* protocol handler of MQTT 5 connections; decodes the packets received */
+static void mqtt5_proto_handler(struct mg_connection *nc, int ev, void *ev_data)
+{
+    struct mbuf *io = &nc->recv_mbuf;
+    uint8_t disconnect[3] = { MQTT5_DISCONNECT << 4, 1, MQTT5_RC_PROTOCOL_ERROR };
+    const uint8_t *p, *end;
+    uint32_t len;
+    int rc;
+
+    nc->handler(nc, ev, ev_data);
+    if (ev != MG_EV_RECV) return;
+
+    while (io->len >= 2 && (nc->flags & MG_F_CLOSE_IMMEDIATELY) == 0) {
+        p = (const uint8_t *) io->buf + 1;
+        end = (const uint8_t *) io->buf + io->len;
+        rc = mqtt5_get_varint(&p, end, &len);
+        if (rc != 0 && io->len < 5) break;  /* length incomplete */
+        if (rc == 0 && len > (uint32_t) (end - p)) break;  /* packet incomplete */
+        if (rc == 0 && mqtt5_recv_packet(nc, io->buf[0], p, len) == 0) {
+            mbuf_remove(io, (p - (const uint8_t *) io->buf) + len);
+            continue;
+        }
+
+        printf("Malformed packet from MQTT server; disconnecting.\n");
+        mg_send(nc, disconnect, sizeof(disconnect));
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+        mbuf_remove(io, io->len);
+        break;
+    }
+}
+
+void mqtt_wire_init(const mqtt_wire_opts_t *opts)
+{
+    mqtt5_reset();
+    g_opts = *opts;
+    if (g_opts.version != MQTT_WIRE_V5) g_opts.version = MQTT_WIRE_V311;
+    if (g_opts.topic_alias_max > MQTT_WIRE_MAX_TOPIC_ALIAS) g_opts.topic_alias_max = MQTT_WIRE_MAX_TOPIC_ALIAS;
+    mqtt5_reset();
+}
+
+void mqtt_wire_connect(struct mg_connection *nc, const char *client_id, struct mg_send_mqtt_handshake_opts opts)
+{
+    struct mbuf body, props;
+    uint8_t flags = opts.flags & (MQTT5_CONNECT_CLEAN_START | 0x38);
+
+    if (g_opts.version != MQTT_WIRE_V5) {
+        mg_set_protocol_mqtt(nc);
+        mg_send_mqtt_handshake_opt(nc, client_id, opts);
+        return;
+    }
+
+    nc->proto_handler = mqtt5_proto_handler;
+    mqtt5_reset();
+
+    if (opts.will_topic != NULL && opts.will_message != NULL) flags |= MQTT5_CONNECT_WILL;
+    if (opts.user_name != NULL) flags |= MQTT5_CONNECT_USER_NAME;
+    if (opts.password != NULL) flags |= MQTT5_CONNECT_PASSWORD;
+    if (opts.keep_alive == 0) opts.keep_alive = MQTT_DEFAULT_KEEP_ALIVE;
+
+    mbuf_init(&body, 64);
+    mbuf_init(&props, 8);
+
+    mqtt5_put_str(&body, "MQTT", 4);
+    mqtt5_put_u8(&body, MQTT_WIRE_V5);
+    mqtt5_put_u8(&body, flags);
+    mqtt5_put_u16(&body, opts.keep_alive);
+    if (g_opts.topic_alias_max > 0) {
+        mqtt5_put_u8(&props, MQTT5_PROP_TOPIC_ALIAS_MAXIMUM);
+        mqtt5_put_u16(&props, g_opts.topic_alias_max);
+    }
+    mqtt5_put_varint(&body, props.len);
+    mbuf_append(&body, props.buf, props.len);
+
+    mqtt5_put_str(&body, client_id, strlen(client_id));
+    if (flags & MQTT5_CONNECT_WILL) {
+        mqtt5_put_varint(&body, 0);
+        mqtt5_put_str(&body, opts.will_topic, strlen(opts.will_topic));
+        mqtt5_put_str(&body, opts.will_message, strlen(opts.will_message));
+    }
+    if (opts.user_name != NULL) mqtt5_put_str(&body, opts.user_name, strlen(opts.user_name));
+    if (opts.password != NULL) mqtt5_put_str(&body, opts.password, strlen(opts.password));
+
+    mqtt5_send(nc, MQTT5_CONNECT << 4, &body, NULL, 0);
+    mbuf_free(&body);
+    mbuf_free(&props);
+}
+
+uint16_t mqtt_wire_receive_maximum()
+{
+    return g_opts.version == MQTT_WIRE_V5 ? g_v5.receive_max : 65535;
+}
+
+int mqtt_wire_maximum_qos()
+{
+    return g_opts.version == MQTT_WIRE_V5 ? g_v5.max_qos : 2;
+}
+
+int mqtt_wire_publish_fits(const char *topic, int qos, size_t len)
+{
+    uint8_t varint[4];
+    size_t size;
+
+    if (g_opts.version != MQTT_WIRE_V5 || g_v5.max_packet_size == 0) return 1;
+
+    /* the topic in full and both properties, as when an alias is assigned */
+    size = 2 + strlen(topic) + (qos > 0 ? 2 : 0) + 1 + (g_opts.message_expiry > 0 ? 5 : 0)
+           + (g_v5.tx_alias_max > 0 ? 3 : 0) + len;
+    if (size > 268435455) return 0;
+    return 1 + mqtt5_encode_varint(varint, size) + size <= g_v5.max_packet_size;
+}
+
+int mqtt_wire_publish(struct mg_connection *nc, const char *topic, uint16_t msg_id, int flags, const void *data, size_t len)
+{
+    struct mbuf body;
+    uint8_t props[10];
+    size_t props_len = 0;
+    uint16_t alias;
+    int is_new;
+
+    if (g_opts.version != MQTT_WIRE_V5) {
+        mg_mqtt_publish(nc, topic, msg_id, flags, data, len);
+        return 0;
+    }
+
+    /* checked before assigning an alias: the broker would not learn it */
+    if (!mqtt_wire_publish_fits(topic, MG_MQTT_GET_QOS(flags), len)) {
+        printf("MQTT message to '%s' larger than the server accepts (%u bytes); dropping it.\n", topic, g_v5.max_packet_size);
+        return -1;
+    }
+
+    if (g_opts.message_expiry > 0) {
+        props[props_len++] = MQTT5_PROP_MESSAGE_EXPIRY;
+        props[props_len++] = g_opts.message_expiry >> 24;
+        props[props_len++] = (g_opts.message_expiry >> 16) & 0xff;
+        props[props_len++] = (g_opts.message_expiry >> 8) & 0xff;
+        props[props_len++] = g_opts.message_expiry & 0xff;
+    }
+    if ((alias = mqtt5_tx_alias(topic, &is_new)) > 0) {
+        props[props_len++] = MQTT5_PROP_TOPIC_ALIAS;
+        props[props_len++] = alias >> 8;
+        props[props_len++] = alias & 0xff;
+    }
+
+    mbuf_init(&body, 32);
+    /* once the broker knows the alias, the topic is sent empty */
+    mqtt5_put_str(&body, topic, alias > 0 && !is_new ? 0 : strlen(topic));
+    if (MG_MQTT_GET_QOS(flags) > 0) mqtt5_put_u16(&body, msg_id);
+    mqtt5_put_varint(&body, props_len);
+    mbuf_append(&body, props, props_len);
+
+    mqtt5_send(nc, (MQTT5_PUBLISH << 4) | (flags & 0x0f), &body, data, len);
+    mbuf_free(&body);
+    return 0;
+}
+
+void mqtt_wire_pubrel(struct mg_connection *nc, uint16_t msg_id)
+{
+    if (g_opts.version != MQTT_WIRE_V5) {
+        mg_mqtt_pubrel(nc, msg_id);
+        return;
+    }
+    mqtt5_send_id(nc, (MQTT5_PUBREL << 4) | 0x02, msg_id);
+}
+
+void mqtt_wire_subscribe(struct mg_connection *nc, const struct mg_mqtt_topic_expression *topics, size_t n, uint16_t msg_id)
+{
+    struct mbuf body;
+    size_t i;
+
+    if (g_opts.version != MQTT_WIRE_V5) {
+        mg_mqtt_subscribe(nc, topics, n, msg_id);
+        return;
+    }
+
+    mbuf_init(&body, 64);
+    mqtt5_put_u16(&body, msg_id);
+    mqtt5_put_varint(&body, 0);
+    for (i = 0; i < n; i++) {
+        mqtt5_put_str(&body, topics[i].topic, strlen(topics[i].topic));
+        mqtt5_put_u8(&body, topics[i].qos);
+    }
+    mqtt5_send(nc, (MQTT5_SUBSCRIBE << 4) | 0x02, &body, NULL, 0);
+    mbuf_free(&body);
+}
+
+void mqtt_wire_unsubscribe(struct mg_connection *nc, char **topics, size_t n, uint16_t msg_id)
+{
+    struct mbuf body;
+    size_t i;
+
+    if (g_opts.version != MQTT_WIRE_V5) {
+        mg_mqtt_unsubscribe(nc, topics, n, msg_id);
+        return;
+    }
+
+    mbuf_init(&body, 64);
+    mqtt5_put_u16(&body, msg_id);
+    mqtt5_put_varint(&body, 0);
+    for (i = 0; i < n; i++) mqtt5_put_str(&body, topics[i], strlen(topics[i]));
+    mqtt5_send(nc, (MQTT5_UNSUBSCRIBE << 4) | 0x02, &body, NULL, 0);
+    mbuf_free(&body);
+}
+
+void mqtt_wire_ping(struct mg_connection *nc)
+{
+    uint8_t buf[2] = { MQTT5_PINGREQ << 4, 0 };
+
+    if (g_opts.version != MQTT_WIRE_V5) {
+        mg_mqtt_ping(nc);
+        return;
+    }
+    mg_send(nc, buf, sizeof(buf));
+}
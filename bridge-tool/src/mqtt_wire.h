@@ -0,0 +1,133 @@
+ /** @file mqtt_wire.h
+ *  @brief Definitions for the MQTT packets exchanged with the broker
+ *
+ *  Definitions for speaking MQTT 3.1.1 (mongoose) or MQTT 5 to the broker
+ *  behind the same calls. With MQTT 5, topics are replaced by topic aliases
+ *  after their first use, publishes can carry a message expiry interval, and
+ *  the broker's Receive Maximum is reported to size the in-flight window. The
+ *  broker's Maximum QoS is reported, and publishes larger than its Maximum
+ *  Packet Size are not sent.
+ *  Received packets are delivered to the connection handler as the usual
+ *  mongoose MG_EV_MQTT_* events, for both versions.
+ *
+ *  Only called from the thread owning the mqtt connection.
+ *
+ *  @date July, 2019
+ */
+#ifndef MQTT_WIRE_H_
+#define MQTT_WIRE_H_
+
+#include <stdint.h>
+
+#include "mongoose.h"
+
+/* protocol versions (protocol level of the CONNECT packet) */
+#define MQTT_WIRE_V311 4
+#define MQTT_WIRE_V5 5
+
+/* largest topic alias maximum accepted */
+#define MQTT_WIRE_MAX_TOPIC_ALIAS 1024
+
+/**
+ * Protocol options
+ */
+typedef struct {
+    /* MQTT_WIRE_V311 or MQTT_WIRE_V5 */
+    int version;
+
+    /* MQTT 5: topic aliases used (if the broker allows them) and accepted; 0 for none */
+    uint16_t topic_alias_max;
+
+    /* MQTT 5: message expiry interval of publishes, in seconds; 0 for none */
+    uint32_t message_expiry;
+} mqtt_wire_opts_t;
+
+/**
+ * Set the protocol options; used by the next mqtt_wire_connect()
+ *
+ * @param opts the options
+ */
+void mqtt_wire_init(const mqtt_wire_opts_t *opts);
+
+/**
+ * Start the MQTT session on a connection to the broker: install the protocol handler and send CONNECT
+ *
+ * @param nc the connection
+ * @param client_id the client id
+ * @param opts will topic and message, user name, password and keep alive
+ */
+void mqtt_wire_connect(struct mg_connection *nc, const char *client_id, struct mg_send_mqtt_handshake_opts opts);
+
+/**
+ * Get how many QoS 1/2 publishes the broker accepts unacknowledged, from the last CONNACK
+ *
+ * @return returns the broker's Receive Maximum (65535 if not limited)
+ */
+uint16_t mqtt_wire_receive_maximum();
+
+/**
+ * Get the highest QoS the broker accepts for publishes, from the last CONNACK
+ *
+ * @return returns the broker's Maximum QoS (2 if not limited)
+ */
+int mqtt_wire_maximum_qos();
+
+/**
+ * Check that a publish is not larger than the broker accepts (its MQTT 5 Maximum Packet Size)
+ *
+ * @param topic the topic
+ * @param qos quality of service
+ * @param len length of the message
+ * @return returns 1 if it can be sent, 0 if too large
+ */
+int mqtt_wire_publish_fits(const char *topic, int qos, size_t len);
+
+/**
+ * Publish a message
+ *
+ * @param nc the connection
+ * @param topic the topic
+ * @param msg_id message id (QoS 1/2)
+ * @param flags MG_MQTT_QOS(), MG_MQTT_DUP and MG_MQTT_RETAIN flags
+ * @param data the message
+ * @param len length of the message
+ * @return returns -1 if the message is larger than the broker accepts (not sent), 0 on success
+ */
+int mqtt_wire_publish(struct mg_connection *nc, const char *topic, uint16_t msg_id, int flags, const void *data, size_t len);
+
+/**
+ * Send a PUBREL (QoS 2)
+ *
+ * @param nc the connection
+ * @param msg_id message id
+ */
+void mqtt_wire_pubrel(struct mg_connection *nc, uint16_t msg_id);
+
+/**
+ * Subscribe to topics
+ *
+ * @param nc the connection
+ * @param topics the topics and their QoS
+ * @param n number of topics
+ * @param msg_id message id
+ */
+void mqtt_wire_subscribe(struct mg_connection *nc, const struct mg_mqtt_topic_expression *topics, size_t n, uint16_t msg_id);
+
+/**
+ * Unsubscribe from topics
+ *
+ * @param nc the connection
+ * @param topics the topics
+ * @param n number of topics
+ * @param msg_id message id
+ */
+void mqtt_wire_unsubscribe(struct mg_connection *nc, char **topics, size_t n, uint16_t msg_id);
+
+/**
+ * Send a PINGREQ
+ *
+ * @param nc the connection
+ */
+void mqtt_wire_ping(struct mg_connection *nc);
+
+#endif
@@ -0,0 +1,144 @@
+/** @file outq.c
+ *  @brief Outbound write queue
+ *
+ *  Queue of frames written to a non-blocking fd with writev(); frames queued
+ *  while the fd is not writable are coalesced into a single writev() call.
+ *
+ *  @date July, 2019
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "outq.h"
+#include "queue.h"
+
+void outq_init(outq_t *q, uint32_t high_watermark, uint32_t low_watermark)
+{
+    SIMPLEQ_INIT(&q->frames);
+    q->queued_bytes = 0;
+    q->high_watermark = high_watermark;
+    q->low_watermark = low_watermark < high_watermark ? low_watermark : high_watermark;
+    q->blocked = 0;
+}
+
+int outq_push(outq_t *q, const char *hdr, uint32_t hdr_len, char *payload, uint32_t payload_len, outq_free_fn_t payload_free)
+{
+    struct outq_frame *frame;
+
+    if (q->blocked || hdr_len > OUTQ_MAX_HDR_LEN) return -1;
+
+    frame = malloc(sizeof(struct outq_frame));
+    if (frame == NULL) return -1;
+
+    memcpy(frame->hdr, hdr, hdr_len);
+    frame->hdr_len = hdr_len;
+    frame->payload = payload;
+    frame->payload_len = payload != NULL ? payload_len : 0;
+    frame->payload_free = payload_free;
+    frame->sent = 0;
+
+    SIMPLEQ_INSERT_TAIL(&q->frames, frame, next);
+    q->queued_bytes += hdr_len + frame->payload_len;
+
+    /* a frame is always accepted if not blocked, even if larger than the watermark */
+    if (q->queued_bytes >= q->high_watermark) q->blocked = 1;
+
+    return 0;
+}
+
+/* release a frame and its payload */
+static void outq_frame_free(struct outq_frame *frame)
+{
+    if (frame->payload != NULL && frame->payload_free != NULL)
+        frame->payload_free(frame->payload);
+    free(frame);
+}
+
+/* write to a non-blocking fd; 0 if it is not writable */
+static int outq_fd_writev(void *arg, const struct iovec *iov, int iovcnt)
+{
+    ssize_t n;
+
+    while ((n = writev(*(int *) arg, iov, iovcnt)) < 0 && errno == EINTR)
+        ;
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    return (int) n;
+}
+
+int outq_flush(outq_t *q, int fd)
+{
+    return outq_flush_to(q, outq_fd_writev, &fd);
+}
+
+int outq_flush_to(outq_t *q, outq_writev_fn_t writev_fn, void *arg)
+{
+    struct iovec iov[OUTQ_MAX_IOV];
+    struct outq_frame *frame;
+    int iovcnt, n;
+    uint32_t len, sent;
+
+    while (!SIMPLEQ_EMPTY(&q->frames)) {
+        /* gather the unsent parts of the queued frames */
+        iovcnt = 0;
+        SIMPLEQ_FOREACH(frame, &q->frames, next) {
+            if (iovcnt + 2 > OUTQ_MAX_IOV) break;
+            if (frame->sent < frame->hdr_len) {
+                iov[iovcnt].iov_base = frame->hdr + frame->sent;
+                iov[iovcnt++].iov_len = frame->hdr_len - frame->sent;
+                if (frame->payload_len > 0) {
+                    iov[iovcnt].iov_base = frame->payload;
+                    iov[iovcnt++].iov_len = frame->payload_len;
+                }
+            } else {
+                iov[iovcnt].iov_base = frame->payload + (frame->sent - frame->hdr_len);
+                iov[iovcnt++].iov_len = frame->payload_len - (frame->sent - frame->hdr_len);
+            }
+        }
+
+        n = writev_fn(arg, iov, iovcnt);
+        if (n < 0) return -1;
+        if (n == 0) return 0;
+
+        q->queued_bytes -= n;
+
+        /* release the frames completely written */
+        while (n > 0 && (frame = SIMPLEQ_FIRST(&q->frames)) != NULL) {
+            len = frame->hdr_len + frame->payload_len;
+            sent = (uint32_t) n < len - frame->sent ? (uint32_t) n : len - frame->sent;
+            frame->sent += sent;
+            n -= sent;
+            if (frame->sent < len) break;
+            SIMPLEQ_REMOVE_HEAD(&q->frames, next);
+            outq_frame_free(frame);
+        }
+
+        if (q->blocked && q->queued_bytes <= q->low_watermark) q->blocked = 0;
+    }
+
+    return 1;
+}
+
+void outq_clear(outq_t *q)
+{
+    struct outq_frame *frame;
+
+    while ((frame = SIMPLEQ_FIRST(&q->frames)) != NULL) {
+        SIMPLEQ_REMOVE_HEAD(&q->frames, next);
+        outq_frame_free(frame);
+    }
+    q->queued_bytes = 0;
+    q->blocked = 0;
+}
+
+int outq_is_blocked(outq_t *q)
+{
+    return q->blocked;
+}
+
+int outq_is_empty(outq_t *q)
+{
+    return SIMPLEQ_EMPTY(&q->frames);
+}
@@ -0,0 +1,131 @@
+ /** @file outq.h
+ *  @brief Definitions for an outbound write queue
+ *
+ *  Definitions for a queue of frames waiting to be written to a non-blocking fd.
+ *  Frames are written with writev(), several at a time, when the fd is writable.
+ *  The queue is not thread-safe; callers serialize access (e.g. with the lock
+ *  of the connection owning the queue).
+ *
+ *  @date July, 2019
+ */
+#ifndef OUTQ_H_
+#define OUTQ_H_
+
+#include <stdint.h>
+#include "queue.h"
+
+/* maximum size of a frame header (copied into the queue) */
+#define OUTQ_MAX_HDR_LEN 16
+
+/* maximum number of iovecs given to one writev() call */
+#define OUTQ_MAX_IOV 64
+
+/**
+ * Function called to release a payload once it was written (or dropped)
+ */
+typedef void (*outq_free_fn_t)(void *payload);
+
+struct iovec;
+
+/**
+ * Function taking queued bytes instead of an fd (e.g. a link layer)
+ *
+ * @param arg user argument given to outq_flush_to()
+ * @param iov the bytes
+ * @param iovcnt number of iovecs
+ * @return returns the number of bytes taken, 0 if none can be taken now, -1 on error
+ */
+typedef int (*outq_writev_fn_t)(void *arg, const struct iovec *iov, int iovcnt);
+
+/**
+ * A queued frame: a small header, copied, and a payload, referenced
+ */
+struct outq_frame {
+    char hdr[OUTQ_MAX_HDR_LEN];
+    uint32_t hdr_len;
+
+    char *payload;
+    uint32_t payload_len;
+    outq_free_fn_t payload_free;
+
+    /* bytes of header+payload already written */
+    uint32_t sent;
+
+    SIMPLEQ_ENTRY(outq_frame) next;
+};
+
+typedef struct {
+    SIMPLEQ_HEAD(outq_frames, outq_frame) frames;
+
+    /* bytes queued (and not yet written) */
+    uint32_t queued_bytes;
+
+    /* above high_watermark, the queue refuses frames until it drains below low_watermark */
+    uint32_t high_watermark;
+    uint32_t low_watermark;
+    int blocked;
+} outq_t;
+
+/**
+ * Init an empty queue
+ *
+ * @param q the queue
+ * @param high_watermark queued bytes above which new frames are refused
+ * @param low_watermark queued bytes below which frames are accepted again
+ */
+void outq_init(outq_t *q, uint32_t high_watermark, uint32_t low_watermark);
+
+/**
+ * Add a frame to the queue; the payload is not copied and belongs to the queue on success
+ *
+ * @param q the queue
+ * @param hdr frame header (at most OUTQ_MAX_HDR_LEN bytes)
+ * @param hdr_len length of the header
+ * @param payload frame payload (may be NULL)
+ * @param payload_len length of the payload
+ * @param payload_free function to release the payload once written; NULL if not needed
+ * @return returns -1 if the queue is over its high watermark (backpressure) or on error, 0 on success
+ */
+int outq_push(outq_t *q, const char *hdr, uint32_t hdr_len, char *payload, uint32_t payload_len, outq_free_fn_t payload_free);
+
+/**
+ * Write as much of the queue as the fd accepts
+ *
+ * @param q the queue
+ * @param fd a non-blocking fd
+ * @return returns -1 on a write error, 0 if data is still queued (fd not writable), 1 if the queue is empty
+ */
+int outq_flush(outq_t *q, int fd);
+
+/**
+ * Give as much of the queue as a function takes
+ *
+ * @param q the queue
+ * @param writev_fn function taking the bytes
+ * @param arg argument passed to writev_fn
+ * @return returns -1 on an error of writev_fn, 0 if data is still queued, 1 if the queue is empty
+ */
+int outq_flush_to(outq_t *q, outq_writev_fn_t writev_fn, void *arg);
+
+/**
+ * Drop all queued frames
+ *
+ * @param q the queue
+ */
+void outq_clear(outq_t *q);
+
+/**
+ * Check if the queue is refusing frames (went over the high watermark and did not yet drain below the low watermark)
+ *
+ * @return returns 1 if blocked, 0 otherwise
+ */
+int outq_is_blocked(outq_t *q);
+
+/**
+ * Check if the queue is empty
+ *
+ * @return returns 1 if empty, 0 otherwise
+ */
+int outq_is_empty(outq_t *q);
+
+#endif
@@ -0,0 +1,544 @@
+/** @file reactor.c
+ *  @brief Bridge event loop
+ *
+ *  Implements a single epoll-based event loop for the bridge. Plain file
+ *  descriptors (e.g. the runtime link) are usually registered edge-triggered
+ *  and drained by their callbacks; timers are timerfds. Mongoose managers
+ *  are driven by watching their sockets (level-triggered, since mongoose
+ *  reads at most one buffer per connection on each poll) and calling
+ *  mg_mgr_poll(mgr, 0) only when one of them is ready or a flush was
+ *  requested. Other threads hand work to a reactor with reactor_post().
+ *
+ *  @date July, 2019
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+
+#include "reactor.h"
+#include "queue.h"
+
+#define REACTOR_MAX_EVENTS 64
+
+/* poll mongoose managers at least this often, for their internal timers */
+#define REACTOR_MG_HOUSEKEEPING_MS 1000
+
+typedef enum {
+    HANDLER_FD, HANDLER_TIMER, HANDLER_MG, HANDLER_JOBS
+} handler_type_t;
+
+struct reactor_mgr;
+
+/**
+ * Entry we generate for each file descriptor watched
+ */
+struct reactor_handler
+{
+    int fd;
+    handler_type_t type;
+    uint32_t events;
+
+    /* set when unregistered; freed at the end of the loop iteration */
+    int dead;
+
+    reactor_fd_cb_t fd_cb;
+    reactor_timer_cb_t timer_cb;
+    int oneshot;
+    void *arg;
+
+    /* for HANDLER_MG: the manager and connection owning the socket */
+    struct reactor_mgr *mgr;
+    struct mg_connection *mg_conn;
+    unsigned int seen;
+
+    SLIST_ENTRY(reactor_handler) next_handler;
+};
+
+/**
+ * Entry we generate for each mongoose manager driven
+ */
+struct reactor_mgr
+{
+    struct mg_mgr *mgr;
+    int poll_pending;
+
+    SLIST_ENTRY(reactor_mgr) next_mgr;
+};
+
+/**
+ * Entry we generate for each job posted from another thread
+ */
+struct reactor_job
+{
+    reactor_job_cb_t cb;
+    void *arg;
+
+    SIMPLEQ_ENTRY(reactor_job) next_job;
+};
+
+struct reactor
+{
+    int epfd;
+    int running;
+    int ret;
+    unsigned int sync_gen;
+    int mg_timer_id;
+    reactor_stats_t stats;
+
+    /* thread running the loop; jobs posted from other threads wake it up through job_fd */
+    pthread_t loop_thread;
+    int loop_thread_set;
+    int job_fd;
+    pthread_mutex_t job_lock;
+    SIMPLEQ_HEAD(simplehead_jobs, reactor_job) jobs;
+
+    SLIST_HEAD(slisthead_handlers, reactor_handler) handlers;
+    SLIST_HEAD(slisthead_mgrs, reactor_mgr) mgrs;
+};
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct reactor_handler *find_handler(reactor_t *r, int fd)
+{
+    struct reactor_handler *h;
+
+    SLIST_FOREACH(h, &r->handlers, next_handler) {
+        if (h->fd == fd && !h->dead) return h;
+    }
+    return NULL;
+}
+
+static struct reactor_handler *new_handler(reactor_t *r, int fd, handler_type_t type, uint32_t events)
+{
+    struct epoll_event ev;
+    struct reactor_handler *h = calloc(1, sizeof(struct reactor_handler));
+
+    if (h == NULL) return NULL;
+
+    h->fd = fd;
+    h->type = type;
+    h->events = events;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = h;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        printf("Error adding fd %d to epoll, errno: 0x%x\n", fd, errno);
+        free(h);
+        return NULL;
+    }
+
+    SLIST_INSERT_HEAD(&r->handlers, h, next_handler);
+    return h;
+}
+
+static void kill_handler(reactor_t *r, struct reactor_handler *h)
+{
+    /* fails harmlessly if the fd was already closed (e.g. by mongoose) */
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, h->fd, NULL);
+    h->dead = 1;
+}
+
+static void sweep_handlers(reactor_t *r)
+{
+    struct reactor_handler *h, *tmp;
+
+    SLIST_FOREACH_SAFE(h, &r->handlers, next_handler, tmp) {
+        if (h->dead) {
+            SLIST_REMOVE(&r->handlers, h, reactor_handler, next_handler);
+            free(h);
+        }
+    }
+}
+
+reactor_t *reactor_create()
+{
+    reactor_t *r = calloc(1, sizeof(reactor_t));
+
+    if (r == NULL) return NULL;
+
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epfd == -1) {
+        printf("Error creating epoll instance, errno: 0x%x\n", errno);
+        free(r);
+        return NULL;
+    }
+    r->mg_timer_id = -1;
+    SLIST_INIT(&r->handlers);
+    SLIST_INIT(&r->mgrs);
+    SIMPLEQ_INIT(&r->jobs);
+    pthread_mutex_init(&r->job_lock, NULL);
+
+    r->job_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->job_fd == -1 || new_handler(r, r->job_fd, HANDLER_JOBS, EPOLLIN | EPOLLET) == NULL) {
+        printf("Error creating reactor job queue, errno: 0x%x\n", errno);
+        if (r->job_fd != -1) close(r->job_fd);
+        close(r->epfd);
+        free(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+void reactor_destroy(reactor_t *r)
+{
+    struct reactor_handler *h;
+    struct reactor_mgr *m;
+    struct reactor_job *job;
+
+    SLIST_FOREACH(h, &r->handlers, next_handler) {
+        if (h->type == HANDLER_TIMER && !h->dead) close(h->fd);
+        h->dead = 1;
+    }
+    sweep_handlers(r);
+
+    while (!SLIST_EMPTY(&r->mgrs)) {
+        m = SLIST_FIRST(&r->mgrs);
+        SLIST_REMOVE_HEAD(&r->mgrs, next_mgr);
+        free(m);
+    }
+
+    while (!SIMPLEQ_EMPTY(&r->jobs)) {
+        job = SIMPLEQ_FIRST(&r->jobs);
+        SIMPLEQ_REMOVE_HEAD(&r->jobs, next_job);
+        free(job);
+    }
+    pthread_mutex_destroy(&r->job_lock);
+
+    close(r->job_fd);
+    close(r->epfd);
+    free(r);
+}
+
+int reactor_add_fd(reactor_t *r, int fd, uint32_t events, reactor_fd_cb_t cb, void *arg)
+{
+    struct reactor_handler *h;
+
+    if (fd < 0 || cb == NULL || find_handler(r, fd) != NULL) return -1;
+
+    if ((h = new_handler(r, fd, HANDLER_FD, events)) == NULL) return -1;
+    h->fd_cb = cb;
+    h->arg = arg;
+
+    return 0;
+}
+
+int reactor_mod_fd(reactor_t *r, int fd, uint32_t events)
+{
+    struct epoll_event ev;
+    struct reactor_handler *h = find_handler(r, fd);
+
+    if (h == NULL) return -1;
+    if (h->events == events) return 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = h;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_MOD, fd, &ev) != 0) return -1;
+    h->events = events;
+
+    return 0;
+}
+
+int reactor_del_fd(reactor_t *r, int fd)
+{
+    struct reactor_handler *h = find_handler(r, fd);
+
+    if (h == NULL) return -1;
+    kill_handler(r, h);
+
+    return 0;
+}
+
+int reactor_add_timer(reactor_t *r, uint32_t first_ms, uint32_t interval_ms, reactor_timer_cb_t cb, void *arg)
+{
+    struct itimerspec its;
+    struct reactor_handler *h;
+    int tfd;
+
+    if (cb == NULL) return -1;
+
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd == -1) {
+        printf("Error creating timer, errno: 0x%x\n", errno);
+        return -1;
+    }
+
+    /* a zero it_value disarms the timer; make sure it fires */
+    if (first_ms == 0) first_ms = 1;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = first_ms / 1000;
+    its.it_value.tv_nsec = (first_ms % 1000) * 1000000;
+    its.it_interval.tv_sec = interval_ms / 1000;
+    its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
+
+    if (timerfd_settime(tfd, 0, &its, NULL) != 0 ||
+        (h = new_handler(r, tfd, HANDLER_TIMER, EPOLLIN | EPOLLET)) == NULL) {
+        close(tfd);
+        return -1;
+    }
+    h->timer_cb = cb;
+    h->oneshot = (interval_ms == 0);
+    h->arg = arg;
+
+    return tfd;
+}
+
+void reactor_del_timer(reactor_t *r, int timer_id)
+{
+    struct reactor_handler *h = find_handler(r, timer_id);
+
+    if (h == NULL || h->type != HANDLER_TIMER) return;
+    kill_handler(r, h);
+    close(timer_id);
+}
+
+/* events we want for a mongoose connection, given its current state */
+static uint32_t mg_conn_events(struct mg_connection *c)
+{
+    uint32_t events = EPOLLIN;
+
+    if (c->send_mbuf.len > 0 || (c->flags & MG_F_CONNECTING)) events |= EPOLLOUT;
+    return events;
+}
+
+/*
+ * Mirror the sockets of a mongoose manager into epoll. Called after every
+ * mg_mgr_poll(), which is where mongoose accepts, connects and closes sockets.
+ * Within a poll, mongoose only frees connections at the very end, so a new
+ * connection never reuses both the fd and the address of one closed in the
+ * same poll.
+ */
+static void sync_mg_mgr(reactor_t *r, struct reactor_mgr *m)
+{
+    struct mg_connection *c;
+    struct reactor_handler *h;
+    unsigned int gen = ++r->sync_gen;
+
+    for (c = mg_next(m->mgr, NULL); c != NULL; c = mg_next(m->mgr, c)) {
+        uint32_t events;
+
+        if (c->sock == -1) continue;
+        events = mg_conn_events(c);
+
+        h = find_handler(r, c->sock);
+        if (h != NULL && (h->type != HANDLER_MG || h->mg_conn != c)) {
+            /* fd was closed and reused behind our back */
+            kill_handler(r, h);
+            h = NULL;
+        }
+        if (h == NULL) {
+            if ((h = new_handler(r, c->sock, HANDLER_MG, events)) == NULL) continue;
+            h->mgr = m;
+            h->mg_conn = c;
+        } else if (h->events != events) {
+            reactor_mod_fd(r, c->sock, events);
+        }
+        h->seen = gen;
+    }
+
+    /* forget sockets mongoose has closed */
+    SLIST_FOREACH(h, &r->handlers, next_handler) {
+        if (h->type == HANDLER_MG && h->mgr == m && !h->dead && h->seen != gen)
+            kill_handler(r, h);
+    }
+}
+
+static void poll_mg_mgrs(reactor_t *r, int all)
+{
+    struct reactor_mgr *m;
+
+    SLIST_FOREACH(m, &r->mgrs, next_mgr) {
+        if (!all && !m->poll_pending) continue;
+        m->poll_pending = 0;
+        mg_mgr_poll(m->mgr, 0);
+        sync_mg_mgr(r, m);
+    }
+}
+
+static void mg_housekeeping(void *arg)
+{
+    poll_mg_mgrs((reactor_t *)arg, 1);
+}
+
+int reactor_add_mg_mgr(reactor_t *r, struct mg_mgr *mgr)
+{
+    struct reactor_mgr *m = calloc(1, sizeof(struct reactor_mgr));
+
+    if (m == NULL) return -1;
+
+    m->mgr = mgr;
+    m->poll_pending = 1;
+    SLIST_INSERT_HEAD(&r->mgrs, m, next_mgr);
+    sync_mg_mgr(r, m);
+
+    if (r->mg_timer_id == -1) {
+        r->mg_timer_id = reactor_add_timer(r, REACTOR_MG_HOUSEKEEPING_MS, REACTOR_MG_HOUSEKEEPING_MS, mg_housekeeping, r);
+    }
+
+    return 0;
+}
+
+void reactor_flush_mg_mgr(reactor_t *r, struct mg_mgr *mgr)
+{
+    struct reactor_mgr *m;
+
+    SLIST_FOREACH(m, &r->mgrs, next_mgr) {
+        if (m->mgr == mgr) {
+            m->poll_pending = 1;
+            return;
+        }
+    }
+}
+
+int reactor_post(reactor_t *r, reactor_job_cb_t cb, void *arg)
+{
+    uint64_t one = 1;
+    struct reactor_job *job = malloc(sizeof(struct reactor_job));
+
+    if (job == NULL) return -1;
+    job->cb = cb;
+    job->arg = arg;
+
+    pthread_mutex_lock(&r->job_lock);
+    SIMPLEQ_INSERT_TAIL(&r->jobs, job, next_job);
+    pthread_mutex_unlock(&r->job_lock);
+
+    /* once queued, the job runs (and owns arg) even if this wakeup is lost: the next one
+       drains the queue */
+    if (write(r->job_fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+        printf("Error waking up reactor, errno: 0x%x\n", errno);
+
+    return 0;
+}
+
+int reactor_in_loop_thread(reactor_t *r)
+{
+    return !r->loop_thread_set || pthread_equal(r->loop_thread, pthread_self());
+}
+
+static void run_jobs(reactor_t *r)
+{
+    struct simplehead_jobs jobs;
+    struct reactor_job *job;
+    uint64_t count;
+
+    while (read(r->job_fd, &count, sizeof(count)) == sizeof(count));
+
+    /* take the whole queue, so jobs may post further jobs */
+    pthread_mutex_lock(&r->job_lock);
+    SIMPLEQ_FIRST(&jobs) = SIMPLEQ_FIRST(&r->jobs);
+    SIMPLEQ_INIT(&r->jobs);
+    pthread_mutex_unlock(&r->job_lock);
+
+    while (SIMPLEQ_FIRST(&jobs) != NULL) {
+        job = SIMPLEQ_FIRST(&jobs);
+        SIMPLEQ_FIRST(&jobs) = SIMPLEQ_NEXT(job, next_job);
+        job->cb(job->arg);
+        free(job);
+    }
+}
+
+int reactor_run_once(reactor_t *r, int timeout_ms)
+{
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    struct reactor_mgr *m;
+    uint64_t start, elapsed;
+    int n, i;
+
+    /* flushes requested outside of a dispatch must not wait for an event */
+    SLIST_FOREACH(m, &r->mgrs, next_mgr) {
+        if (m->poll_pending) timeout_ms = 0;
+    }
+
+    n = epoll_wait(r->epfd, events, REACTOR_MAX_EVENTS, timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR) return 0;
+        printf("Error in epoll_wait, errno: 0x%x\n", errno);
+        return -1;
+    }
+
+    start = now_us();
+
+    for (i = 0; i < n; i++) {
+        struct reactor_handler *h = events[i].data.ptr;
+
+        if (h->dead) continue;
+
+        switch (h->type) {
+        case HANDLER_FD:
+            h->fd_cb(h->fd, events[i].events, h->arg);
+            break;
+        case HANDLER_TIMER: {
+            uint64_t expirations;
+            if (read(h->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) break;
+            h->timer_cb(h->arg);
+            if (h->oneshot && !h->dead) reactor_del_timer(r, h->fd);
+            break;
+        }
+        case HANDLER_MG:
+            h->mgr->poll_pending = 1;
+            break;
+        case HANDLER_JOBS:
+            run_jobs(r);
+            break;
+        }
+    }
+
+    /* poll mongoose managers with ready sockets or pending output */
+    poll_mg_mgrs(r, 0);
+
+    sweep_handlers(r);
+
+    elapsed = now_us() - start;
+    r->stats.iterations++;
+    r->stats.events += n;
+    r->stats.total_latency_us += elapsed;
+    if (elapsed > r->stats.max_latency_us) r->stats.max_latency_us = elapsed;
+
+    return n;
+}
+
+int reactor_run(reactor_t *r)
+{
+    r->running = 1;
+    r->ret = 0;
+    r->loop_thread = pthread_self();
+    r->loop_thread_set = 1;
+
+    while (r->running) {
+        if (reactor_run_once(r, -1) < 0) return -1;
+    }
+
+    return r->ret;
+}
+
+void reactor_stop(reactor_t *r, int ret)
+{
+    uint64_t one = 1;
+
+    r->ret = ret;
+    r->running = 0;
+
+    /* wake up the loop, in case we are called from another thread */
+    if (write(r->job_fd, &one, sizeof(one)) != sizeof(one)) return;
+}
+
+void reactor_get_stats(reactor_t *r, reactor_stats_t *stats)
+{
+    memcpy(stats, &r->stats, sizeof(reactor_stats_t));
+}
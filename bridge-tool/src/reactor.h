@@ -0,0 +1,176 @@
+/** @file reactor.h
+ *  @brief Definitions for the bridge event loop
+ *
+ *  A small epoll-based reactor that owns the file descriptors of the bridge
+ *  (runtime link, timers) and drives the mongoose managers (MQTT, HTTP)
+ *  without dedicated polling threads.
+ *
+ *  @date July, 2019
+ */
+#ifndef REACTOR_H_
+#define REACTOR_H_
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include "mongoose.h"
+
+typedef struct reactor reactor_t;
+
+/**
+ * Callback invoked when a file descriptor is ready
+ *
+ * @param fd the file descriptor
+ * @param events epoll events reported (EPOLLIN, EPOLLOUT, ...)
+ * @param arg user argument given at registration
+ */
+typedef void (*reactor_fd_cb_t)(int fd, uint32_t events, void *arg);
+
+/**
+ * Callback invoked when a timer expires
+ *
+ * @param arg user argument given at registration
+ */
+typedef void (*reactor_timer_cb_t)(void *arg);
+
+/**
+ * Job posted to a reactor from another thread
+ *
+ * @param arg user argument given when posting
+ */
+typedef void (*reactor_job_cb_t)(void *arg);
+
+/**
+ * Loop statistics; latency is measured from epoll_wait() return to the end of dispatch
+ */
+typedef struct {
+    uint64_t iterations;
+    uint64_t events;
+    uint64_t total_latency_us;
+    uint32_t max_latency_us;
+} reactor_stats_t;
+
+/**
+ * Create a reactor
+ *
+ * @return returns the reactor, NULL on error
+ */
+reactor_t *reactor_create();
+
+/**
+ * Destroy a reactor and release its resources (registered fds are not closed)
+ *
+ * @param r the reactor
+ */
+void reactor_destroy(reactor_t *r);
+
+/**
+ * Register a file descriptor
+ *
+ * @param r the reactor
+ * @param fd the file descriptor (should be non-blocking if EPOLLET is used)
+ * @param events epoll events to wait for (e.g. EPOLLIN | EPOLLET)
+ * @param cb callback called when the fd is ready
+ * @param arg argument passed to the callback
+ * @return returns -1 on error, 0 on success
+ */
+int reactor_add_fd(reactor_t *r, int fd, uint32_t events, reactor_fd_cb_t cb, void *arg);
+
+/**
+ * Change the events of a registered file descriptor
+ *
+ * @return returns -1 on error, 0 on success
+ */
+int reactor_mod_fd(reactor_t *r, int fd, uint32_t events);
+
+/**
+ * Unregister a file descriptor; safe to call from within a callback
+ *
+ * @return returns -1 on error, 0 on success
+ */
+int reactor_del_fd(reactor_t *r, int fd);
+
+/**
+ * Add a timer (backed by a timerfd)
+ *
+ * @param r the reactor
+ * @param first_ms time to first expiration, in milliseconds
+ * @param interval_ms period after the first expiration; 0 for a one-shot timer
+ * @param cb callback called on expiration
+ * @param arg argument passed to the callback
+ * @return returns the timer id (>= 0) on success, -1 on error
+ */
+int reactor_add_timer(reactor_t *r, uint32_t first_ms, uint32_t interval_ms, reactor_timer_cb_t cb, void *arg);
+
+/**
+ * Cancel a timer
+ *
+ * @param r the reactor
+ * @param timer_id the id returned by reactor_add_timer()
+ */
+void reactor_del_timer(reactor_t *r, int timer_id);
+
+/**
+ * Let the reactor drive a mongoose manager; its sockets are watched by the
+ * reactor and mg_mgr_poll(mgr, 0) is called only when they are ready
+ *
+ * @return returns -1 on error, 0 on success
+ */
+int reactor_add_mg_mgr(reactor_t *r, struct mg_mgr *mgr);
+
+/**
+ * Request a (non-blocking) poll of a mongoose manager at the end of the
+ * current loop iteration, e.g. to flush data queued with mg_mqtt_publish()
+ */
+void reactor_flush_mg_mgr(reactor_t *r, struct mg_mgr *mgr);
+
+/**
+ * Run the event loop until reactor_stop() is called
+ *
+ * @return returns the value given to reactor_stop()
+ */
+int reactor_run(reactor_t *r);
+
+/**
+ * Run one iteration of the event loop
+ *
+ * @param r the reactor
+ * @param timeout_ms maximum time to wait for events (-1 waits forever)
+ * @return returns -1 on error, the number of events dispatched otherwise
+ */
+int reactor_run_once(reactor_t *r, int timeout_ms);
+
+/**
+ * Stop the event loop; safe to call from any thread
+ *
+ * @param r the reactor
+ * @param ret value returned by reactor_run()
+ */
+void reactor_stop(reactor_t *r, int ret);
+
+/**
+ * Run a function in the reactor thread; safe to call from any thread
+ *
+ * @param r the reactor
+ * @param cb function to call from the event loop
+ * @param arg argument passed to the function
+ * @return returns -1 if the job could not be queued (arg is left to the caller), 0 once
+ * queued (the job will run)
+ */
+int reactor_post(reactor_t *r, reactor_job_cb_t cb, void *arg);
+
+/**
+ * Check if the caller is running in the reactor thread
+ *
+ * @return returns 1 if the caller is the thread running the event loop (or if the loop was not started), 0 otherwise
+ */
+int reactor_in_loop_thread(reactor_t *r);
+
+/**
+ * Get loop statistics
+ *
+ * @param r the reactor
+ * @param stats where to copy the statistics to
+ */
+void reactor_get_stats(reactor_t *r, reactor_stats_t *stats);
+
+#endif
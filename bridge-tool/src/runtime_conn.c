@@ -25,6 +25,7 @@
 #include <netinet/in.h>
 #include <termios.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdint.h>
 
 #include "coap_ext.h"
@@ -38,26 +39,82 @@
 #include "mqtt.h"
 #include "http_mqtt_req.h"
 #include "runtime_request.h"
+#include "reactor.h"
+#include "imrt_link.h"
+#include "module_hash.h"
+#include "link_compress.h"
+#include "bufpool.h"
 
 #include "app_manager_export.h" /* for Module_WASM_App */
 #include "host_link.h" /* for REQUEST_PACKET */
 
-static int g_runtime_conn_fd; /* may be tcp or uart */
+#define RECONNECT_INTERVAL_MS 1000
+
+/* worker thread serving a subset (shard) of the runtime connections */
+typedef struct {
+    pthread_t thread;
+    reactor_t *reactor;
+
+    /* buffer for reads from the runtimes of this worker */
+    char *recv_buf;
+    uint32_t recv_buf_size;
+} rt_worker_t;
+
+static runtime_conn_t *g_runtime_conns;
+static int g_runtime_conn_count;
+
+static rt_worker_t *g_workers;
+static int g_worker_count;
+
+static reactor_t *g_main_reactor; /* mqtt and http event loop */
+
+static int g_runtimes_alive; /* runtimes we are still trying to (re)connect to */
 
 //static uint32_t g_timeout_ms = DEFAULT_TIMEOUT_MS;
 
 #define SA struct sockaddr
 
-unsigned char leading[2] = { 0x12, 0x34 };
+static void runtime_conn_on_event(int fd, uint32_t events, void *arg);
+static int rt_conn_inflight_take(runtime_conn_t *conn, int mid, rt_inflight_t *entry);
+static void rt_conn_inflight_complete_all(runtime_conn_t *conn);
+static void rt_conn_inflight_sweep_timer(void *arg);
+static uint64_t rt_conn_now_ms();
 
-extern unsigned char leading[2];
+/* take frames of the output queue into the window of the reliable link layer */
+static int rt_conn_arq_writev(void *arg, const struct iovec *iov, int iovcnt)
+{
+    link_arq_t *arq = (link_arq_t *) arg;
+    uint32_t n = 0, taken;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        taken = link_arq_send(arq, iov[i].iov_base, iov[i].iov_len);
+        n += taken;
+        if (taken < iov[i].iov_len) break;
+    }
+    return (int) n;
+}
+
+/* write frames of the reliable link layer to the uart */
+static int rt_conn_arq_write(void *arg, const char *buf, uint32_t len)
+{
+    runtime_conn_t *conn = (runtime_conn_t *) arg;
+    ssize_t n;
 
-static int g_mid; // request message id, to check incoming responses (mids should match)
-static op_type g_req_op_type=NONE; // are we waiting for an install request
+    while ((n = write(conn->fd, buf, len)) < 0 && errno == EINTR)
+        ;
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    return (int) n;
+}
 
-/* lock for request/response data access */
-static pthread_mutex_t mutex_request = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t cond_pending;
+/* write the queued frames, through the reliable link layer if there is one; called with conn->lock held */
+static int runtime_conn_flush(runtime_conn_t *conn)
+{
+    if (conn->arq == NULL) return outq_flush(&conn->outq, conn->fd);
+
+    if (outq_flush_to(&conn->outq, rt_conn_arq_writev, conn->arq) < 0) return -1;
+    return link_arq_flush(conn->arq, rt_conn_now_ms());
+}
 
 bool tcp_init(const char *address, uint16_t port, int *fd)
 {
@@ -176,176 +233,550 @@ bool udp_send(const char *address, int port, const char *buf, int len)
     return true;
 }
 
-bool host_tool_send_data(const char *buf, unsigned int len)
+bool host_tool_send_data(runtime_conn_t *conn, uint16_t msg_type, char *buf, unsigned int len, outq_free_fn_t buf_free)
 {
-    int cnt = 0;
-    ssize_t ret;
+    char hdr[IMRT_LINK_HDR_LEN + LINK_COMPRESS_HDR_LEN];
+    uint16_t msg_type_n = htons(msg_type);
+    uint32_t len_n = htonl(len), zlen = 0;
+    char *zbuf = NULL;
+    bool was_empty;
+    int ret;
+
+    /* compressed if the runtime reads compressed messages, and it is smaller; the original
+       type and length go in the header */
+    if (conn->config->compress_threshold > 0 && len >= conn->config->compress_threshold && len > LINK_COMPRESS_HDR_LEN
+            && __atomic_load_n(&conn->compress_peer, __ATOMIC_RELAXED) && (zbuf = bufpool_alloc(len)) != NULL) {
+        if ((zlen = link_compress(buf, len, zbuf, len - LINK_COMPRESS_HDR_LEN)) == 0) {
+            bufpool_free(zbuf);
+            zbuf = NULL;
+        }
+    }
+
+    /* leading bytes, message type, payload length */
+    memcpy(hdr, leading, sizeof(leading));
+    memcpy(hdr + 2, &msg_type_n, sizeof(msg_type_n));
+    memcpy(hdr + 4, &len_n, sizeof(len_n));
+
+    pthread_mutex_lock(&conn->lock);
 
-    if (g_runtime_conn_fd == -1 || buf == NULL || len <= 0) {
+    if (conn->fd == -1) {
+        pthread_mutex_unlock(&conn->lock);
+        if (zbuf != NULL) bufpool_free(zbuf);
+        return false;
+    }
+
+    /* the connection may have been reopened since */
+    if (zbuf != NULL && !conn->compress_peer) {
+        bufpool_free(zbuf);
+        zbuf = NULL;
+    }
+
+    was_empty = outq_is_empty(&conn->outq);
+    if (zbuf != NULL) {
+        /* the original type and length follow the header */
+        memcpy(hdr + IMRT_LINK_HDR_LEN, hdr + 2, LINK_COMPRESS_HDR_LEN);
+        msg_type_n = htons(LINK_COMPRESSED_PACKET);
+        len_n = htonl(LINK_COMPRESS_HDR_LEN + zlen);
+        memcpy(hdr + 2, &msg_type_n, sizeof(msg_type_n));
+        memcpy(hdr + 4, &len_n, sizeof(len_n));
+        ret = outq_push(&conn->outq, hdr, sizeof(hdr), zbuf, zlen, bufpool_free);
+    } else {
+        ret = outq_push(&conn->outq, hdr, IMRT_LINK_HDR_LEN, buf, len, buf_free);
+    }
+    if (ret != 0) {
+        printf("Runtime %s output queue full (%u bytes).\n", conn->config->uuid, conn->outq.queued_bytes);
+        pthread_mutex_unlock(&conn->lock);
+        if (zbuf != NULL) bufpool_free(zbuf);
         return false;
     }
+    if (zbuf != NULL && buf_free != NULL) buf_free(buf);
+
+    /* try to write right away; otherwise the owner thread flushes when the fd is writable */
+    if (was_empty && runtime_conn_flush(conn) < 0) {
+        /* the owner thread sees the shutdown and closes the connection */
+        shutdown(conn->fd, SHUT_RDWR);
+    }
 
-    resend: ret = write(g_runtime_conn_fd, buf, len);
+    pthread_mutex_unlock(&conn->lock);
+    return true;
+}
+
+int runtime_conn_is_write_blocked(runtime_conn_t *conn)
+{
+    int blocked;
 
-    if (ret == -1) {
-        if (errno == ECONNRESET) {
-            close(g_runtime_conn_fd);
+    pthread_mutex_lock(&conn->lock);
+    blocked = outq_is_blocked(&conn->outq);
+    pthread_mutex_unlock(&conn->lock);
+
+    return blocked;
+}
+
+/* connect to a runtime; called from the owner thread */
+static int runtime_conn_connect(runtime_conn_t *conn)
+{
+    bt_runtime_config_t *config = conn->config;
+    link_arq_t *arq = NULL;
+    int fd;
+
+    if (config->connection_mode == CONNECTION_MODE_TCP) {
+        if (!tcp_init(config->address, config->port, &fd))
+            return -1;
+    } else if (config->connection_mode == CONNECTION_MODE_UART) {
+        if (!uart_init(config->uart_dev, config->uart_baudrate, &fd))
+            return -1;
+    } else return -1;
+
+    /* the frames of the link layer are only sent once the runtime acknowledged its reset */
+    if (config->link_window > 0) {
+        if ((arq = malloc(sizeof(link_arq_t))) == NULL
+            || link_arq_init(arq, config->link_window, config->link_mtu,
+                             link_arq_rto(config->uart_baudrate, config->link_window, config->link_mtu), rt_conn_arq_write, conn) != 0) {
+            free(arq);
+            close(fd);
+            return -1;
         }
+    }
 
-        // repeat sending if the outbuffer is full
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            if (++cnt > 10) {
-                close(g_runtime_conn_fd);
-                return false;
-            }
-            sleep(1);
-            goto resend;
+    /* the fd is edge-triggered; reads are drained until EAGAIN and EPOLLOUT
+       reports when queued writes can resume, without re-arming the fd */
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    if (reactor_add_fd(conn->reactor, fd, EPOLLIN | EPOLLOUT | EPOLLET, runtime_conn_on_event, conn) != 0) {
+        free(arq);
+        close(fd);
+        return -1;
+    }
+
+    /* aliases of the previous connection are forgotten before anything is sent on this one */
+    pthread_mutex_lock(&conn->alias_lock);
+    topic_alias_reset(&conn->aliases);
+    pthread_mutex_lock(&conn->lock);
+    conn->fd = fd;
+    conn->arq = arq;
+    module_hash_set_clear(&conn->module_hashes); /* until the runtime reports them */
+    conn->chunked_installs = 0;
+    conn->chunk_resume_hash = 0;
+    conn->compress_peer = 0;
+    pthread_mutex_unlock(&conn->lock);
+    pthread_mutex_unlock(&conn->alias_lock);
+
+    /* tell the runtime aliases are understood; it does the same */
+    rt_req_request_payload(conn, TOPIC_ALIAS_HELLO_URL, COAP_EVENT_PUB, 0, NULL, 0, NULL, NULL);
+    /* and that compressed messages are read (see link_compress.h) */
+    rt_req_request_payload(conn, LINK_COMPRESS_HELLO_URL, COAP_EVENT_PUB, FMT_APP_RAW_BINARY, LINK_COMPRESS_CODEC, strlen(LINK_COMPRESS_CODEC), NULL, NULL);
+
+    /* interrupted installs wait for the runtime to report the binary it was receiving */
+    if (!SLIST_EMPTY(&conn->parked_installs)) conn->parked_deadline_ms = rt_conn_now_ms() + RT_INSTALL_RESUME_WAIT_MS;
+
+    printf("Connected to runtime %s.\n", config->uuid);
+    mqtt_notify_runtime_event(conn, EVENT_RT_START);
+    return 0;
+}
+
+/* reconnect the runtimes of a worker; also does the first connection */
+static void runtime_conn_reconnect_timer(void *arg)
+{
+    rt_worker_t *worker = (rt_worker_t *) arg;
+    runtime_conn_t *conn;
+    int i;
+
+    for (i = 0; i < g_runtime_conn_count; i++) {
+        conn = &g_runtime_conns[i];
+        if (conn->reactor != worker->reactor || conn->fd != -1) continue;
+        if (conn->reconnect_count > g_bt_config.rt_reconnect_attempts) continue;
+
+        if (runtime_conn_connect(conn) == 0) {
+            conn->reconnect_count = 0;
+        } else if (++conn->reconnect_count > g_bt_config.rt_reconnect_attempts) {
+            printf("Error: too many reconnection attempts to runtime %s.\n", conn->config->uuid);
+            rt_req_install_resume(conn, false);
+            if (__sync_sub_and_fetch(&g_runtimes_alive, 1) == 0)
+                reactor_stop(g_main_reactor, -1);
         }
     }
+}
 
-    return (ret == len);
+/* send the frames of the reliable link layers due (not acknowledged in time, or waiting for the reset) */
+static void rt_conn_arq_timer(void *arg)
+{
+    rt_worker_t *worker = (rt_worker_t *) arg;
+    runtime_conn_t *conn;
+    int i, n;
+
+    for (i = 0; i < g_runtime_conn_count; i++) {
+        conn = &g_runtime_conns[i];
+        if (conn->reactor != worker->reactor || conn->arq == NULL) continue;
+
+        pthread_mutex_lock(&conn->lock);
+        n = conn->arq != NULL ? runtime_conn_flush(conn) : 0;
+        pthread_mutex_unlock(&conn->lock);
+        if (n < 0) runtime_conn_close(conn);
+    }
 }
 
-#define SET_RECV_PHASE(ctx, new_phase) {ctx->phase = new_phase; ctx->size_in_phase = 0;}
+static void *runtime_conn_worker(void *arg)
+{
+    rt_worker_t *worker = (rt_worker_t *) arg;
 
-/*
- * input:    1 byte from remote
- * output:   parse result
- * return:   -1 invalid sync byte
- *           1 byte added to buffer, waiting more for complete packet
- *           0 completed packet
- *           2 in receiving payload
- */
-int on_imrt_link_byte_arrive(unsigned char ch, imrt_link_recv_context_t *ctx)
+    reactor_run(worker->reactor);
+    return NULL;
+}
+
+int runtime_conn_init(reactor_t *main_reactor)
 {
-    if (ctx->phase == Phase_Non_Start) {
-        if (ctx->message.payload) {
-            free(ctx->message.payload);
-            ctx->message.payload = NULL;
-            ctx->message.payload_size = 0;
-        }
+    runtime_conn_t *conn;
+    int i, j, reliable_links = 0;
+
+    g_main_reactor = main_reactor;
+    g_runtime_conn_count = g_bt_config.rt_count;
+    g_worker_count = g_bt_config.rt_worker_threads;
+    g_runtimes_alive = g_runtime_conn_count;
+
+    g_runtime_conns = calloc(g_runtime_conn_count, sizeof(runtime_conn_t));
+    g_workers = calloc(g_worker_count, sizeof(rt_worker_t));
+    if (g_runtime_conns == NULL || g_workers == NULL) return -1;
+
+    for (i = 0; i < g_worker_count; i++) {
+        if ((g_workers[i].reactor = reactor_create()) == NULL) return -1;
+        g_workers[i].recv_buf_size = g_bt_config.rt_recv_buffer_size;
+        if ((g_workers[i].recv_buf = malloc(g_workers[i].recv_buf_size)) == NULL) return -1;
+    }
 
-        if (leading[0] == ch) {
-            ctx->phase = Phase_Leading;
-        } else {
+    /* shard the runtimes across workers */
+    for (i = 0; i < g_runtime_conn_count; i++) {
+        conn = &g_runtime_conns[i];
+        conn->idx = i;
+        conn->config = &g_bt_config.runtimes[i];
+        snprintf(conn->topic, sizeof(conn->topic), "%s/%s", g_bt_config.rt_topic_prefix, conn->config->uuid);
+        conn->fd = -1;
+        conn->reactor = g_workers[i % g_worker_count].reactor;
+        module_list_init(&conn->modules);
+        outq_init(&conn->outq, g_bt_config.rt_outq_high_watermark, g_bt_config.rt_outq_low_watermark);
+        pthread_mutex_init(&conn->lock, NULL);
+        topic_alias_init(&conn->aliases);
+        pthread_mutex_init(&conn->alias_lock, NULL);
+        module_hash_set_init(&conn->module_hashes);
+        SLIST_INIT(&conn->parked_installs);
+        if (conn->config->link_window > 0) reliable_links++;
+        for (j = 0; j < RT_INFLIGHT_BUCKETS; j++) SLIST_INIT(&conn->inflight_buckets[j]);
+    }
+
+    for (i = 0; i < g_worker_count; i++) {
+        if (reactor_add_timer(g_workers[i].reactor, 0, RECONNECT_INTERVAL_MS, runtime_conn_reconnect_timer, &g_workers[i]) < 0)
             return -1;
-        }
-    } else if (ctx->phase == Phase_Leading) {
-        if (leading[1] == ch) {
-            SET_RECV_PHASE(ctx, Phase_Type);
-        } else {
-            ctx->phase = Phase_Non_Start;
+        if (reactor_add_timer(g_workers[i].reactor, RT_INFLIGHT_SWEEP_MS, RT_INFLIGHT_SWEEP_MS, rt_conn_inflight_sweep_timer, &g_workers[i]) < 0)
+            return -1;
+        if (reliable_links > 0 && reactor_add_timer(g_workers[i].reactor, LINK_ARQ_TICK_MS, LINK_ARQ_TICK_MS, rt_conn_arq_timer, &g_workers[i]) < 0)
             return -1;
+        if (pthread_create(&g_workers[i].thread, NULL, runtime_conn_worker, &g_workers[i]) != 0) {
+            printf("Could not create worker thread.\n");
+            return -1;
+        }
+    }
+
+    printf("Serving %d runtime(s) with %d worker thread(s).\n", g_runtime_conn_count, g_worker_count);
+    return 0;
+}
+
+int runtime_conn_count()
+{
+    return g_runtime_conn_count;
+}
+
+runtime_conn_t *runtime_conn_get(int idx)
+{
+    if (idx < 0 || idx >= g_runtime_conn_count) return NULL;
+    return &g_runtime_conns[idx];
+}
+
+runtime_conn_t *runtime_conn_get_by_uuid(const char *uuid, int uuid_len)
+{
+    int i;
+
+    for (i = 0; i < g_runtime_conn_count; i++) {
+        const char *rt_uuid = g_runtime_conns[i].config->uuid;
+        if (strlen(rt_uuid) == uuid_len && strncmp(rt_uuid, uuid, uuid_len) == 0)
+            return &g_runtime_conns[i];
+    }
+    return NULL;
+}
+
+int runtime_conn_is_connected(runtime_conn_t *conn)
+{
+    return conn->fd != -1;
+}
+
+void runtime_conn_close(runtime_conn_t *conn)
+{
+    pthread_mutex_lock(&conn->lock);
+    if (conn->fd == -1) {
+        pthread_mutex_unlock(&conn->lock);
+        return;
+    }
+
+    reactor_del_fd(conn->reactor, conn->fd);
+    close(conn->fd);
+    conn->fd = -1;
+    outq_clear(&conn->outq);
+    imrt_link_recv_ctx_reset(&conn->recv_ctx);
+    if (conn->arq != NULL) {
+        link_arq_destroy(conn->arq);
+        free(conn->arq);
+        conn->arq = NULL;
+    }
+    pthread_mutex_unlock(&conn->lock);
+
+    /* no response will arrive for the requests in flight */
+    rt_conn_inflight_complete_all(conn);
+
+    printf("Runtime %s connection closed.\n", conn->config->uuid);
+    mqtt_notify_runtime_event(conn, EVENT_RT_STOP);
+}
+
+static void runtime_conn_close_job(void *arg)
+{
+    runtime_conn_close((runtime_conn_t *) arg);
+    rt_req_install_resume((runtime_conn_t *) arg, false);
+}
+
+static void runtime_conn_stop_worker_job(void *arg)
+{
+    rt_worker_t *worker = (rt_worker_t *) arg;
+
+    reactor_stop(worker->reactor, 0);
+}
+
+void runtime_conn_destroy()
+{
+    int i;
+
+    /* jobs run in order: close the connections, then stop the loop */
+    for (i = 0; i < g_runtime_conn_count; i++) {
+        reactor_post(g_runtime_conns[i].reactor, runtime_conn_close_job, &g_runtime_conns[i]);
+    }
+
+    for (i = 0; i < g_worker_count; i++) {
+        reactor_post(g_workers[i].reactor, runtime_conn_stop_worker_job, &g_workers[i]);
+    }
+
+    for (i = 0; i < g_worker_count; i++) {
+        pthread_join(g_workers[i].thread, NULL);
+        reactor_destroy(g_workers[i].reactor);
+        free(g_workers[i].recv_buf);
+    }
+
+    for (i = 0; i < g_runtime_conn_count; i++) {
+        attr_json_buf_free(&g_runtime_conns[i].json_buf);
+        topic_alias_reset(&g_runtime_conns[i].aliases);
+        module_list_destroy(&g_runtime_conns[i].modules);
+        module_hash_set_destroy(&g_runtime_conns[i].module_hashes);
+    }
+}
+
+/* handle a complete message received from the runtime; called from the owner thread */
+static void runtime_conn_handle_message(imrt_link_message_t *message, void *arg)
+{
+    runtime_conn_t *conn = (runtime_conn_t *) arg;
+
+    if (message->message_type == LINK_COMPRESSED_PACKET) {
+        imrt_link_message_t original;
+        uint32_t size;
+
+        if (message->payload_size < LINK_COMPRESS_HDR_LEN) return;
+        memcpy(&original.message_type, message->payload, 2);
+        memcpy(&size, message->payload + 2, 4);
+        original.message_type = ntohs(original.message_type);
+        original.payload_size = ntohl(size);
+
+        if (original.message_type == LINK_COMPRESSED_PACKET || original.payload_size == 0 || original.payload_size > IMRT_LINK_MAX_PAYLOAD
+                || (original.payload = bufpool_alloc(original.payload_size)) == NULL) {
+            printf("Dropping compressed message from runtime %s.\n", conn->config->uuid);
+            return;
         }
-    } else if (ctx->phase == Phase_Type) {
-        unsigned char *p = (unsigned char *) &ctx->message.message_type;
-        p[ctx->size_in_phase++] = ch;
+        if (link_decompress(message->payload + LINK_COMPRESS_HDR_LEN, message->payload_size - LINK_COMPRESS_HDR_LEN,
+                            original.payload, original.payload_size) == 0)
+            runtime_conn_handle_message(&original, arg);
+        else
+            printf("Malformed compressed message from runtime %s.\n", conn->config->uuid);
+        bufpool_free(original.payload);
+        return;
+    }
+
+    if (message->message_type == RESPONSE_PACKET) {
+        response_t response[1] = { 0 };
+        rt_inflight_t entry;
+        int mod_id;
+        char mod_name[50];
+        int ret;
 
-        if (ctx->size_in_phase == sizeof(ctx->message.message_type)) {
-            ctx->message.message_type = ntohs(ctx->message.message_type);
-            SET_RECV_PHASE(ctx, Phase_Size);
+        if (parse_response_from_imrtlink(message, response) == NULL) {
+            printf("Error parsing response from runtime %s.\n", conn->config->uuid);
+            return;
         }
-    } else if (ctx->phase == Phase_Size) {
-        unsigned char * p = (unsigned char *) &ctx->message.payload_size;
-        p[ctx->size_in_phase++] = ch;
 
-        if (ctx->size_in_phase == sizeof(ctx->message.payload_size)) {
-            ctx->message.payload_size = ntohl(ctx->message.payload_size);
-            SET_RECV_PHASE(ctx, Phase_Payload);
+        ret = response->status;
 
-            if (ctx->message.payload) {
-                free(ctx->message.payload);
-                ctx->message.payload = NULL;
-            }
+        if (rt_conn_inflight_take(conn, response->mid, &entry) != 0) {
+            //ignore invalid response (e.g. to a request that timed out)
+            printf("Unexpected response from runtime %s (mid %u)!\n", conn->config->uuid, response->mid);
+            output_response(response);
+            return;
+        }
 
-            /* no payload */
-            if (ctx->message.payload_size == 0) {
-                SET_RECV_PHASE(ctx, Phase_Non_Start);
-                return 0;
+        if (ret == CREATED_2_01 || ret == DELETED_2_02 || ret == CONTENT_2_05) {
+            if (entry.req_op_type == INSTALL) {
+                install_response_get_module_id_and_name(response, &mod_id, mod_name, sizeof(mod_name));
+                module_list_add(&conn->modules, mod_id, mod_name);
+                mqtt_notify_module_event(conn, EVENT_MOD_INST, mod_id, mod_name);
+            } else if (entry.req_op_type == UNINSTALL) {
+                install_response_get_module_id_and_name(response, &mod_id, mod_name, 0);
+                module_list_del_by_id(&conn->modules, mod_id);
+                mqtt_release_module(conn, mod_id);
+                mqtt_notify_module_event(conn, EVENT_MOD_UNINST, mod_id, mod_name);
             }
+        }
 
-            if (ctx->message.payload_size > 1024 * 1024) {
-                SET_RECV_PHASE(ctx, Phase_Non_Start);
-                return -1;
-            }
+        if (entry.cb != NULL) entry.cb(conn, response, entry.arg);
+
+    } else if (message->message_type == REQUEST_PACKET) {
+        request_t event[1] = { 0 };
+
+        const char *url;
+        int ret;
 
-            ctx->message.payload = (char *) malloc(ctx->message.payload_size);
-            SET_RECV_PHASE(ctx, Phase_Payload);
+        if (parse_event_from_imrtlink(message, event) == NULL) {
+            printf("Error parsing event from runtime %s.\n", conn->config->uuid);
+            return;
         }
-    } else if (ctx->phase == Phase_Payload) {
-        ctx->message.payload[ctx->size_in_phase++] = ch;
 
-        if (ctx->size_in_phase == ctx->message.payload_size) {
-            SET_RECV_PHASE(ctx, Phase_Non_Start);
-            return 0;
+        /* the ids defined by the runtime are only changed by this thread; a hello also resets the ones we defined */
+        pthread_mutex_lock(&conn->alias_lock);
+        ret = topic_alias_decode(&conn->aliases, event->url, &url);
+        pthread_mutex_unlock(&conn->alias_lock);
+        if (ret == TOPIC_ALIAS_HELLO) {
+            /* the runtime restarted its end of the link; its progress report follows */
+            if (!SLIST_EMPTY(&conn->parked_installs)) conn->parked_deadline_ms = rt_conn_now_ms() + RT_INSTALL_RESUME_WAIT_MS;
+            return;
+        }
+        if (ret == TOPIC_ALIAS_ERROR) {
+            printf("Unknown topic alias from runtime %s.\n", conn->config->uuid);
+            return;
+        }
+        event->url = (char *) url;
+
+        /* the module binaries the runtime holds, reported after each hello */
+        if (strcmp(event->url, MODULE_HASH_REPORT_URL) == 0) {
+            pthread_mutex_lock(&conn->lock);
+            ret = module_hash_set_load(&conn->module_hashes, event->payload, event->payload_len);
+            pthread_mutex_unlock(&conn->lock);
+            if (ret < 0) printf("Invalid module cache report from runtime %s.\n", conn->config->uuid);
+            return;
         }
 
-        return 2;
-    }
+        /* the runtime reads compressed messages */
+        if (strcmp(event->url, LINK_COMPRESS_HELLO_URL) == 0) {
+            pthread_mutex_lock(&conn->lock);
+            conn->compress_peer = event->payload_len == strlen(LINK_COMPRESS_CODEC)
+                                  && memcmp(event->payload, LINK_COMPRESS_CODEC, event->payload_len) == 0;
+            pthread_mutex_unlock(&conn->lock);
+            return;
+        }
 
-    return 1;
+        /* the binary the runtime was receiving in chunks, reported after each hello; interrupted installs resume */
+        if (strcmp(event->url, MODULE_CHUNK_PROGRESS_URL) == 0) {
+            char hash[MODULE_HASH_HEX_LEN + 1], progress[MODULE_HASH_HEX_LEN + 12] = { 0 };
+            uint32_t offset;
+
+            if (event->payload_len > 0 && event->payload_len < (int) sizeof(progress)) memcpy(progress, event->payload, event->payload_len);
+            pthread_mutex_lock(&conn->lock);
+            conn->chunked_installs = 1;
+            if (sscanf(progress, MODULE_CHUNK_PROGRESS_SCAN, hash, &offset) == 2 && module_hash_parse(hash, &conn->chunk_resume_hash) == 0)
+                conn->chunk_resume_offset = offset;
+            else
+                conn->chunk_resume_hash = 0;
+            pthread_mutex_unlock(&conn->lock);
+
+            rt_req_install_resume(conn, true);
+            return;
+        }
+
+        mqtt_process_runtime_event(conn, event);
+    } else {
+        printf("received  type:%d\n", message->message_type);
+    }
 }
 
-int runtime_conn_init(int *runtime_conn_fd)
+/* handle frames of the reliable link layer read into the worker buffer; the stream received in
+   order is parsed as if read from the fd. Called from the owner thread */
+static void runtime_conn_arq_input(runtime_conn_t *conn, rt_worker_t *worker, int n)
 {
-    if (g_bt_config.rt_connection_mode == CONNECTION_MODE_TCP) {
-        int fd;
-        if (!tcp_init(g_bt_config.rt_address, g_bt_config.rt_port, &fd))
-            return -1;
-        g_runtime_conn_fd = *runtime_conn_fd = fd;
-        return 0;
-    } else if (g_bt_config.rt_connection_mode == CONNECTION_MODE_UART) {
-        int fd;
-        if (!uart_init(g_bt_config.rt_uart_dev, g_bt_config.rt_uart_baudrate, &fd))
-            return -1;
-        g_runtime_conn_fd = *runtime_conn_fd = fd;
-        return 0;
+    uint32_t len;
+    int ret;
+
+    pthread_mutex_lock(&conn->lock);
+    link_arq_input(conn->arq, worker->recv_buf, n, rt_conn_now_ms());
+    ret = link_arq_peer_reset(conn->arq) ? 1 : runtime_conn_flush(conn);
+    pthread_mutex_unlock(&conn->lock);
+
+    if (ret != 0) {
+        /* the runtime restarted: the connection starts over, as if it had closed */
+        if (ret > 0) printf("Runtime %s restarted.\n", conn->config->uuid);
+        runtime_conn_close(conn);
+        return;
     }
 
-    return pthread_cond_init(&cond_pending, NULL);
-}
+    for (;;) {
+        pthread_mutex_lock(&conn->lock);
+        len = conn->arq != NULL ? link_arq_read(conn->arq, worker->recv_buf, worker->recv_buf_size) : 0;
+        pthread_mutex_unlock(&conn->lock);
+        if (len == 0) break;
 
-void runtime_conn_close()
-{
-    close(g_runtime_conn_fd);
+        imrt_link_parse(&conn->recv_ctx, worker->recv_buf, len, runtime_conn_handle_message, conn);
+    }
 }
 
-/*
- return value:
- < 0: not complete message
- REPLY_TYPE_EVENT: event(request)
- REPLY_TYPE_RESPONSE: response
- */
-int process_rcvd_data(const char *buf, int len,
-        imrt_link_recv_context_t *ctx)
+/* flush queued writes and drain a runtime connection; called by the reactor when the fd is ready */
+static void runtime_conn_on_event(int fd, uint32_t events, void *arg)
 {
-    int result = -1;
-    const char *pos = buf;
+    runtime_conn_t *conn = (runtime_conn_t *) arg;
+    rt_worker_t *worker = &g_workers[conn->idx % g_worker_count]; /* see runtime_conn_init() */
+    int n;
+
+    if (events & EPOLLOUT) {
+        pthread_mutex_lock(&conn->lock);
+        n = runtime_conn_flush(conn);
+        pthread_mutex_unlock(&conn->lock);
+        if (n < 0) {
+            runtime_conn_close(conn);
+            return;
+        }
+    }
+
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return;
+
+    while (conn->fd != -1) {
+        n = read(conn->fd, worker->recv_buf, worker->recv_buf_size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            runtime_conn_close(conn);
+            return;
+        }
 
 #if DEBUG
-    int i = 0;
-    for (; i < len; i++) {
-        printf(" 0x%02x", buf[i]);
-    }
-    printf("\n");
+        for (int i = 0; i < n; i++) printf(" 0x%02x", worker->recv_buf[i]);
+        printf("\n");
 #endif
 
-    while (len-- > 0) {
-        result = on_imrt_link_byte_arrive((unsigned char) *pos++, ctx);
-        switch (result) {
-        case 0: {
-            imrt_link_message_t *message = &ctx->message;
-            if (message->message_type == RESPONSE_PACKET)
-                return REPLY_TYPE_RESPONSE;
-            if (message->message_type == REQUEST_PACKET)
-                return REPLY_TYPE_EVENT;
-            break;
-        }
-        default:
-            break;
+        if (conn->arq != NULL) {
+            runtime_conn_arq_input(conn, worker, n);
+            continue;
         }
+
+        /* all messages in the buffer are handled; a partial one stays in recv_ctx */
+        imrt_link_parse(&conn->recv_ctx, worker->recv_buf, n, runtime_conn_handle_message, conn);
     }
-    return -1;
 }
 
 response_t *parse_response_from_imrtlink(imrt_link_message_t *message, response_t *response)
@@ -443,56 +874,160 @@ void output_response(response_t *obj)
     output(header, obj->payload, obj->fmt, obj->payload_len);
 }
 
-/**
- * Return the mid and and op_type of a pending (to which we have not received a response) request
- * 
- */
-void get_pending_request_info(int *mid, int*op_type)
+/* current monotonic time in milliseconds */
+static uint64_t rt_conn_now_ms()
 {
-    *mid = g_mid;
-    *op_type = g_req_op_type;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-/**
- * Called by runtime_request when a request is sent, indicating that we are waiting for 
- * the respective response
- * 
- */
-void rt_conn_request_sent(op_type request_type, int mid) {
-    
-    pthread_mutex_lock(&mutex_request);
+/* in-flight hash bucket of a mid */
+#define INFLIGHT_BUCKET(conn, mid) (&(conn)->inflight_buckets[(uint32_t) (mid) & (RT_INFLIGHT_BUCKETS - 1)])
 
-    g_mid = mid; 
-    g_req_op_type = request_type;
+/* find an in-flight request by mid; caller holds conn->lock */
+static rt_inflight_t *rt_conn_inflight_find(runtime_conn_t *conn, int mid)
+{
+    rt_inflight_t *entry;
+
+    SLIST_FOREACH(entry, INFLIGHT_BUCKET(conn, mid), next) {
+        if (entry->mid == mid) return entry;
+    }
+    return NULL;
+}
 
-    pthread_mutex_unlock(&mutex_request);
+/* remove an in-flight request from the table; caller holds conn->lock */
+static void rt_conn_inflight_remove(runtime_conn_t *conn, rt_inflight_t *entry)
+{
+    SLIST_REMOVE(INFLIGHT_BUCKET(conn, entry->mid), entry, rt_inflight, next);
+    entry->in_use = 0;
+    conn->inflight_count--;
 }
 
 /**
- * Indicate that we have no pending request
- * 
+ * Take the in-flight request with the given mid out of the table
+ *
+ * @param conn the runtime connection
+ * @param mid the message id of the response
+ * @param entry where to copy the request to
+ * @return 0 if found, -1 if no request with this mid is waiting
  */
-void rt_conn_response_received() {
-    // ready to receive another request
-    pthread_mutex_lock(&mutex_request);
+static int rt_conn_inflight_take(runtime_conn_t *conn, int mid, rt_inflight_t *entry)
+{
+    rt_inflight_t *e;
 
-    g_req_op_type=NONE;
-    pthread_cond_signal(&cond_pending);
+    pthread_mutex_lock(&conn->lock);
+    if ((e = rt_conn_inflight_find(conn, mid)) == NULL) {
+        pthread_mutex_unlock(&conn->lock);
+        return -1;
+    }
+    *entry = *e;
+    rt_conn_inflight_remove(conn, e);
+    pthread_mutex_unlock(&conn->lock);
 
-    pthread_mutex_unlock(&mutex_request);
+    return 0;
 }
 
-/**
- * Waits for a response from the runtime 
- * 
- */
-void rt_conn_wait_pending_response() 
+/* complete the in-flight requests past their deadline (or all of them) with a NULL response */
+static void rt_conn_inflight_expire(runtime_conn_t *conn, int all)
 {
-    pthread_mutex_lock(&mutex_request);
- 
-    while (g_req_op_type!=NONE) 
-        pthread_cond_wait(&cond_pending, &mutex_request);
+    rt_inflight_t expired[RT_MAX_INFLIGHT];
+    uint64_t now = rt_conn_now_ms();
+    int i, n = 0;
+
+    pthread_mutex_lock(&conn->lock);
+    for (i = 0; i < RT_MAX_INFLIGHT && conn->inflight_count > 0; i++) {
+        if (!conn->inflight[i].in_use) continue;
+        if (!all && conn->inflight[i].deadline_ms > now) continue;
+        expired[n++] = conn->inflight[i];
+        rt_conn_inflight_remove(conn, &conn->inflight[i]);
+    }
+    pthread_mutex_unlock(&conn->lock);
+
+    /* callbacks are called without the lock, as they may send new requests */
+    for (i = 0; i < n; i++) {
+        if (!all) printf("Timeout waiting for response from runtime %s (mid %u).\n", conn->config->uuid, expired[i].mid);
+        if (expired[i].cb != NULL) expired[i].cb(conn, NULL, expired[i].arg);
+    }
+}
 
-    pthread_mutex_unlock(&mutex_request);
+static void rt_conn_inflight_complete_all(runtime_conn_t *conn)
+{
+    rt_conn_inflight_expire(conn, 1);
 }
 
+/* restart the interrupted installs of a runtime that did not report the binary it was receiving in time */
+static void rt_conn_parked_expire(runtime_conn_t *conn, uint64_t now)
+{
+    if (conn->parked_deadline_ms == 0 || now < conn->parked_deadline_ms) return;
+    conn->parked_deadline_ms = 0;
+    if (conn->fd == -1 || SLIST_EMPTY(&conn->parked_installs)) return;
+
+    printf("No install progress reported by runtime %s; restarting interrupted installs.\n", conn->config->uuid);
+    pthread_mutex_lock(&conn->lock);
+    conn->chunk_resume_hash = 0;
+    pthread_mutex_unlock(&conn->lock);
+    rt_req_install_resume(conn, true);
+}
+
+/* reclaim timed out requests and interrupted installs of the runtimes of a worker (inflight_count is checked under the lock) */
+static void rt_conn_inflight_sweep_timer(void *arg)
+{
+    rt_worker_t *worker = (rt_worker_t *) arg;
+    uint64_t now = rt_conn_now_ms();
+    int i;
+
+    for (i = 0; i < g_runtime_conn_count; i++) {
+        if (g_runtime_conns[i].reactor != worker->reactor) continue;
+        rt_conn_inflight_expire(&g_runtime_conns[i], 0);
+        rt_conn_parked_expire(&g_runtime_conns[i], now);
+    }
+}
+
+int rt_conn_request_sent(runtime_conn_t *conn, op_type request_type, int mid, uint32_t timeout_ms, rt_response_cb_t cb, void *arg)
+{
+    rt_inflight_t *entry = NULL;
+    int i;
+
+    pthread_mutex_lock(&conn->lock);
+
+    if (rt_conn_inflight_find(conn, mid) != NULL) {
+        pthread_mutex_unlock(&conn->lock);
+        return -2;
+    }
+
+    for (i = 0; i < RT_MAX_INFLIGHT; i++) {
+        if (!conn->inflight[i].in_use) {
+            entry = &conn->inflight[i];
+            break;
+        }
+    }
+    if (entry == NULL) {
+        pthread_mutex_unlock(&conn->lock);
+        return -1;
+    }
+
+    entry->in_use = 1;
+    entry->mid = mid;
+    entry->req_op_type = request_type;
+    entry->deadline_ms = rt_conn_now_ms() + timeout_ms;
+    entry->cb = cb;
+    entry->arg = arg;
+    SLIST_INSERT_HEAD(INFLIGHT_BUCKET(conn, mid), entry, next);
+    conn->inflight_count++;
+
+    pthread_mutex_unlock(&conn->lock);
+    return 0;
+}
+
+int rt_conn_request_cancel(runtime_conn_t *conn, int mid)
+{
+    rt_inflight_t *entry;
+
+    pthread_mutex_lock(&conn->lock);
+    if ((entry = rt_conn_inflight_find(conn, mid)) != NULL)
+        rt_conn_inflight_remove(conn, entry);
+    pthread_mutex_unlock(&conn->lock);
+    return entry != NULL;
+}
@@ -14,10 +14,20 @@
  * limitations under the License.
  */
 #include <stdint.h>
+#include <pthread.h>
 #include "shared_utils.h"
 #include "attr_container.h"
 #include "mongoose.h"
 #include "runtime_request.h"
+#include "reactor.h"
+#include "module_list.h"
+#include "config.h"
+#include "outq.h"
+#include "topic_alias.h"
+#include "module_cache.h"
+#include "imrt_link.h"
+#include "link_arq.h"
+#include "attr_json.h"
 
 #ifndef RUNTIME_CONN_H_
 #define RUNTIME_CONN_H_
@@ -26,7 +36,6 @@
 extern "C" {
 #endif
 
-#define BUF_SIZE 1024
 #define TIMEOUT_EXIT_CODE -2
 #define URL_MAX_LEN 256
 #define DEFAULT_TIMEOUT_MS 5000
@@ -42,48 +51,122 @@ typedef enum REPLY_PACKET_TYPE {
     REPLY_TYPE_EVENT = 0, REPLY_TYPE_RESPONSE = 1
 } REPLY_PACKET_TYPE;
 
-/* IMRT link message between host and WAMR */
-typedef struct {
-    unsigned short message_type;
-    unsigned long payload_size;
-    char *payload;
-} imrt_link_message_t;
+/* requests waiting for a response, per runtime */
+#define RT_MAX_INFLIGHT 64
+#define RT_INFLIGHT_BUCKETS 16 /* power of 2 */
 
-/* The receive phase of IMRT link message */
-typedef enum {
-    Phase_Non_Start, Phase_Leading, Phase_Type, Phase_Size, Phase_Payload
-} recv_phase_t;
+/* period of the check for requests without response */
+#define RT_INFLIGHT_SWEEP_MS 100
 
-/* The receive context of IMRT link message */
-typedef struct {
-    recv_phase_t phase;
-    int size_in_phase;
-    imrt_link_message_t message;
-} imrt_link_recv_context_t;
+/* time the runtime has to report the binary it was receiving, once connected or after its
+   hello; interrupted installs are restarted from the beginning after it */
+#define RT_INSTALL_RESUME_WAIT_MS DEFAULT_TIMEOUT_MS
+
+/* A request sent to a runtime, waiting for its response */
+typedef struct rt_inflight {
+    int in_use;
+
+    /* request message id; the response has the same mid */
+    int mid;
+    op_type req_op_type;
+
+    /* monotonic time (ms) after which the request is considered lost */
+    uint64_t deadline_ms;
+
+    /* called with the response, or NULL on timeout or if the connection is closed */
+    rt_response_cb_t cb;
+    void *arg;
+
+    SLIST_ENTRY(rt_inflight) next;
+} rt_inflight_t;
+
+/* A connection to one runtime; owned by the worker thread whose reactor watches it */
+typedef struct runtime_conn {
+    /* index in the runtime table */
+    int idx;
+
+    /* connection settings (uuid, address, ...) */
+    bt_runtime_config_t *config;
+
+    /* runtime topic, to where events are sent: <prefix>/<uuid> */
+    char topic[2 * STR_MAXLEN];
+
+    /* may be tcp or uart; -1 if not connected */
+    int fd;
+    uint32_t reconnect_count;
+
+    /* reactor of the worker thread owning this connection */
+    reactor_t *reactor;
+
+    imrt_link_recv_context_t recv_ctx;
+
+    /* modules installed in the runtime; only accessed by the owner thread */
+    module_list_t modules;
+
+    /* json text of the last event published; only accessed by the owner thread */
+    attr_json_buf_t json_buf;
+
+    /* frames waiting for the fd to be writable; protected by lock */
+    outq_t outq;
+
+    /* reliable link layer of a uart link (see link_arq.h), taking the frames of outq; NULL if
+       not enabled (link-window); protected by lock, and only set or released by the owner thread */
+    link_arq_t *arq;
+
+    /* lock for writes to the fd, the in-flight table and module_hashes */
+    pthread_mutex_t lock;
+
+    /* hashes of the module binaries the runtime holds (see module_hash.h) */
+    module_hash_set_t module_hashes;
+
+    /* the runtime receives binaries in chunks, and the binary it was receiving, with
+       the bytes received (see module_hash.h); protected by lock */
+    int chunked_installs;
+    uint64_t chunk_resume_hash;
+    uint32_t chunk_resume_offset;
+
+    /* the runtime reads compressed messages (see link_compress.h); protected by lock */
+    int compress_peer;
+
+    /* installs interrupted by the connection closing, resumed once the runtime reports
+       the binary it was receiving, or restarted at parked_deadline_ms (0 while not connected);
+       only accessed by the owner thread */
+    SLIST_HEAD(rt_install_list, rt_install) parked_installs;
+    uint64_t parked_deadline_ms;
+
+    /* topic aliases of the link; alias_lock is held from aliasing a url until the
+       request is queued, so aliases reach the runtime in the order they are defined */
+    topic_alias_t aliases;
+    pthread_mutex_t alias_lock;
+
+    /* requests waiting for a response, hashed by mid; lock is held to access them */
+    rt_inflight_t inflight[RT_MAX_INFLIGHT];
+    SLIST_HEAD(rt_inflight_bucket, rt_inflight) inflight_buckets[RT_INFLIGHT_BUCKETS];
+    int inflight_count;
+} runtime_conn_t;
 
 /**
- * @brief Send data to WAMR.
+ * @brief Send an IMRT link message to WAMR; never blocks: the message is
+ * queued and written when the connection is writable. Can be called from any thread.
  *
- * @param fd the connection fd to WAMR
- * @param buf the buffer that contains content to be sent
- * @param len size of the buffer to be sent
+ * @param conn the connection to WAMR
+ * @param msg_type the IMRT link message type
+ * @param buf the payload; owned by the connection on success
+ * @param len size of the payload
+ * @param buf_free function to release the payload once sent (NULL if not needed)
  *
- * @return true if success, false if fail
+ * @return true if success, false if fail (not connected, or outbound queue
+ * over its high watermark; see runtime_conn_is_write_blocked())
  */
-bool host_tool_send_data(const char *buf, unsigned int len);
+bool host_tool_send_data(runtime_conn_t *conn, uint16_t msg_type, char *buf, unsigned int len, outq_free_fn_t buf_free);
 
 /**
- * @brief Handle one byte of IMRT link message
- *
- * @param ch the one byte from WAMR to be handled
- * @param ctx the receive context
+ * @brief Check if the outbound queue of a connection is refusing messages
+ * (over the high watermark until it drains below the low watermark)
  *
- * @return -1 invalid sync byte
- *          1 byte added to buffer, waiting more for complete packet
- *          0 completed packet
- *          2 in receiving payload
+ * @return 1 if blocked, 0 if not
  */
-int on_imrt_link_byte_arrive(unsigned char ch, imrt_link_recv_context_t *ctx);
+int runtime_conn_is_write_blocked(runtime_conn_t *conn);
 
 /**
  * @brief Initialize TCP connection with remote server.
@@ -137,80 +220,101 @@ int parse_baudrate(int baud);
 bool udp_send(const char *address, int port, const char *buf, int len);
 
 /**
- * @brief Init connetion to runtime
+ * @brief Create the runtime connections listed in the configuration and start
+ * the worker threads that serve them
+ *
+ * @param main_reactor the reactor of the main thread (mqtt and http)
  *
+ * @return 0 if success, -1 if fail
  */
-int runtime_conn_init();
+int runtime_conn_init(reactor_t *main_reactor);
 
 /**
- * @brief Close connetion to runtime
+ * @brief Get the number of runtimes served
  *
  */
-void runtime_conn_close();
+int runtime_conn_count();
 
 /**
- * @brief Process data received from runtime
+ * @brief Get a runtime connection by index
  *
+ * @return the connection, NULL if the index is invalid
  */
-int process_rcvd_data(const char *buf, int len, imrt_link_recv_context_t *ctx);
+runtime_conn_t *runtime_conn_get(int idx);
 
 /**
- * @brief Parse data received from runtime
+ * @brief Get a runtime connection by runtime uuid
  *
+ * @return the connection, NULL if not found
  */
-response_t *parse_response_from_imrtlink(imrt_link_message_t *message, response_t *response);
+runtime_conn_t *runtime_conn_get_by_uuid(const char *uuid, int uuid_len);
 
 /**
- * @brief Parse event data received from runtime
+ * @brief Check if the connection to a runtime is up
  *
+ * @return 1 if connected, 0 if not
  */
-request_t *parse_event_from_imrtlink(imrt_link_message_t *message, request_t *request);
+int runtime_conn_is_connected(runtime_conn_t *conn);
 
 /**
- * @brief Output a response received from the runtime
+ * @brief Close connetion to a runtime; must be called from the owner thread
  *
  */
-void output_response(response_t *obj);
+void runtime_conn_close(runtime_conn_t *conn);
 
 /**
- * @brief Output a payload received from the runtime
+ * @brief Close all runtime connections and stop the worker threads
  *
  */
-void output(const char *header, attr_container_t *payload, int foramt,int payload_len);
+void runtime_conn_destroy();
+
+/**
+ * @brief Parse data received from runtime
+ *
+ */
+response_t *parse_response_from_imrtlink(imrt_link_message_t *message, response_t *response);
 
 /**
- * Return the mid and and op_type of a pending (to which we have not received a response) request
- * 
+ * @brief Parse event data received from runtime
+ *
  */
-void get_pending_request_info(int *mid, int*op_type);
+request_t *parse_event_from_imrtlink(imrt_link_message_t *message, request_t *request);
 
 /**
- * Called by runtime_request when a request is sent, indicating that we are waiting for 
- * the respective response
- * 
- * @return returns 1 is a response is pending, 0 if not
+ * @brief Output a response received from the runtime
+ *
  */
-void rt_conn_request_sent(op_type request_type, int mid);
+void output_response(response_t *obj);
 
 /**
- * Checks if a response from the runtime is pending; do not start requests if a response is pending
- * NOTE: rt_conn_response_pending() only has **one** calling thread
- * 
- * @return returns 1 is a response is pending, 0 if not
+ * @brief Output a payload received from the runtime
+ *
  */
-int rt_conn_response_pending();
+void output(const char *header, attr_container_t *payload, int foramt,int payload_len);
 
 /**
- * Waits for a response from the runtime 
- * 
+ * Called by runtime_request before a request is sent, to wait for the respective
+ * response; several requests can be waiting at once. cb is called from the
+ * thread owning the connection, without conn->lock held.
+ *
+ * @param conn the connection the request is sent to
+ * @param request_type the request operation
+ * @param mid the request message id
+ * @param timeout_ms time to wait for the response
+ * @param cb called with the response (or NULL on timeout/close); may be NULL
+ * @param arg argument passed to cb
+ *
+ * @return 0 if success, -1 if too many requests are waiting, -2 if mid is already in use
  */
-void rt_conn_wait_pending_response();
+int rt_conn_request_sent(runtime_conn_t *conn, op_type request_type, int mid, uint32_t timeout_ms, rt_response_cb_t cb, void *arg);
 
 /**
- * Indicate that we have no pending request
- * 
+ * Stop waiting for the response of a request (e.g. if it could not be sent); its callback is not called
+ *
+ * @return 1 if the request was waiting, 0 if it was completed already (e.g. the connection
+ * closed): its callback was or is being called
  */
-void rt_conn_response_received();
+int rt_conn_request_cancel(runtime_conn_t *conn, int mid);
 
 /**
  * @brief Get id and name from a runtime response obj
@@ -26,20 +26,208 @@
 #include "runtime_request.h"
 #include "runtime_conn.h"
 #include "coap_ext.h"
-
-extern unsigned char leading[2];
+#include "bufpool.h"
+#include "module_cache.h"
+#include "module_hash.h"
+#include "aot.h"
 
 #define url_remain_space (sizeof(url) - strlen(url))
 
+static int rt_req_send(runtime_conn_t *conn, request_t *request, op_type request_type, bool is_install_wasm_bytecode_app, rt_response_cb_t cb, void *arg);
+
+/* an install of a module file, waiting for its response */
+typedef struct rt_install {
+    module_cache_entry_t *entry;
+    /* install url, without the hash */
+    char url[URL_MAX_LEN];
+    bool is_wasm_bytecode_app;
+    /* sent with the hash of the binary only */
+    bool hash_only;
+    /* the binary was sent again after the runtime no longer held it */
+    bool resent;
+    /* chunk waiting for its acknowledgement, if the binary is sent in chunks */
+    uint32_t chunk_offset;
+    uint32_t chunk_len;
+    /* bytecode file installed if the runtime refuses the AoT image in entry; NULL if entry is not an AoT image */
+    char *bytecode_file;
+    rt_response_cb_t cb;
+    void *arg;
+
+    /* in the list of interrupted installs of the connection */
+    SLIST_ENTRY(rt_install) next;
+} rt_install_t;
+
+static void rt_req_install_response(runtime_conn_t *conn, response_t *response, void *arg);
+static void rt_req_install_chunk_response(runtime_conn_t *conn, response_t *response, void *arg);
+
+/* send an install of a module file, with the binary or only its hash */
+static int rt_req_install_send(runtime_conn_t *conn, rt_install_t *install, bool hash_only)
+{
+    request_t request[1] = { 0 };
+    char url[URL_MAX_LEN + sizeof(MODULE_HASH_URL_KEY) + MODULE_HASH_HEX_LEN];
+
+    install->hash_only = hash_only;
+    if (hash_only) {
+        snprintf(url, sizeof(url), "%s%s", install->url, MODULE_HASH_URL_KEY);
+        module_hash_format(install->entry->hash, url + strlen(url));
+        init_request(request, url, COAP_PUT, FMT_APP_RAW_BINARY, NULL, 0);
+    } else {
+        init_request(request, install->url, COAP_PUT, FMT_APP_RAW_BINARY, (void *) install->entry->data, install->entry->size);
+    }
+
+    return rt_req_send(conn, request, INSTALL, install->is_wasm_bytecode_app, rt_req_install_response, install);
+}
+
+/* send the chunk of the binary at chunk_offset; chunks are read from the file mapping as they are sent */
+static int rt_req_install_send_chunk(runtime_conn_t *conn, rt_install_t *install)
+{
+    request_t request[1] = { 0 };
+    char url[URL_MAX_LEN], hash[MODULE_HASH_HEX_LEN + 1];
+    uint32_t n = install->entry->size - install->chunk_offset;
+
+    if (n > g_bt_config.rt_install_chunk_size) n = g_bt_config.rt_install_chunk_size;
+    install->chunk_len = n;
+
+    module_hash_format(install->entry->hash, hash);
+    snprintf(url, sizeof(url), MODULE_CHUNK_URL_FMT, hash, install->entry->size, install->chunk_offset);
+    init_request(request, url, COAP_PUT, FMT_APP_RAW_BINARY, (void *) (install->entry->data + install->chunk_offset), n);
+
+    return rt_req_send(conn, request, REQUEST, false, rt_req_install_chunk_response, install);
+}
+
+/* send the binary of an install: only its hash if the runtime holds it already (e.g. same
+   module, or another name), in chunks if larger than one and the runtime accepts them
+   (from where an interrupted transfer stopped), or whole */
+static int rt_req_install_transfer(runtime_conn_t *conn, rt_install_t *install)
+{
+    module_cache_entry_t *entry = install->entry;
+    bool hash_only, chunked;
+
+    pthread_mutex_lock(&conn->lock);
+    hash_only = module_hash_set_has(&conn->module_hashes, entry->hash);
+    chunked = conn->chunked_installs && g_bt_config.rt_install_chunk_size > 0 && entry->size > g_bt_config.rt_install_chunk_size;
+    install->chunk_offset = 0;
+    if (chunked && conn->chunk_resume_hash == entry->hash && conn->chunk_resume_offset <= entry->size) {
+        /* the transfer resumes once */
+        install->chunk_offset = conn->chunk_resume_offset;
+        conn->chunk_resume_hash = 0;
+    }
+    pthread_mutex_unlock(&conn->lock);
+
+    if (hash_only || (chunked && install->chunk_offset == entry->size)) return rt_req_install_send(conn, install, true);
+    if (!chunked) return rt_req_install_send(conn, install, false);
+    return rt_req_install_send_chunk(conn, install);
+}
+
+static void rt_req_install_done(runtime_conn_t *conn, rt_install_t *install, response_t *response)
+{
+    if (install->cb != NULL) install->cb(conn, response, install->arg);
+    module_cache_release(install->entry);
+    free(install->bytecode_file);
+    free(install);
+}
+
+/* track the binaries held by the runtime; send the binary if the runtime no longer holds it */
+static void rt_req_install_response(runtime_conn_t *conn, response_t *response, void *arg)
+{
+    rt_install_t *install = (rt_install_t *) arg;
+    uint64_t hash = install->entry->hash;
+
+    if (response != NULL && install->hash_only && !install->resent && response->status == NOT_FOUND_4_04) {
+        pthread_mutex_lock(&conn->lock);
+        module_hash_set_del(&conn->module_hashes, hash);
+        if (conn->chunk_resume_hash == hash) conn->chunk_resume_hash = 0;
+        pthread_mutex_unlock(&conn->lock);
+
+        install->resent = true;
+        if (rt_req_install_transfer(conn, install) == 0) return;
+    } else if (response != NULL && install->bytecode_file != NULL && response->status >= BAD_REQUEST_4_00) {
+        /* the runtime could not load the AoT image; install the bytecode instead */
+        module_cache_entry_t *entry = module_cache_get(install->bytecode_file);
+
+        printf("AoT image refused (status %d); installing %s.\n", response->status, install->bytecode_file);
+        free(install->bytecode_file);
+        install->bytecode_file = NULL;
+        if (entry != NULL) {
+            module_cache_release(install->entry);
+            install->entry = entry;
+            if (rt_req_install_transfer(conn, install) == 0) return;
+        }
+    } else if (response != NULL && response->status == CREATED_2_01) {
+        pthread_mutex_lock(&conn->lock);
+        module_hash_set_add(&conn->module_hashes, hash);
+        pthread_mutex_unlock(&conn->lock);
+    }
+
+    rt_req_install_done(conn, install, response);
+}
+
+/* send the next chunk once the runtime acknowledged one, and the install (by hash) after the last one */
+static void rt_req_install_chunk_response(runtime_conn_t *conn, response_t *response, void *arg)
+{
+    rt_install_t *install = (rt_install_t *) arg;
+    bool closed;
+
+    if (response == NULL) {
+        pthread_mutex_lock(&conn->lock);
+        closed = conn->fd == -1;
+        pthread_mutex_unlock(&conn->lock);
+
+        if (closed) {
+            /* resumed by rt_req_install_resume() once reconnected */
+            printf("Install interrupted at %u of %u bytes; resuming after reconnecting to runtime %s.\n",
+                   install->chunk_offset, install->entry->size, conn->config->uuid);
+            SLIST_INSERT_HEAD(&conn->parked_installs, install, next);
+            return;
+        }
+    } else if (response->status == CHANGED_2_04) {
+        install->chunk_offset += install->chunk_len;
+        if (install->chunk_offset < install->entry->size) {
+            if (rt_req_install_send_chunk(conn, install) == 0) return;
+        } else if (rt_req_install_send(conn, install, true) == 0) {
+            return;
+        }
+        response = NULL;
+    } else if (response->status == PRECONDITION_FAILED_4_12 && install->chunk_offset > 0) {
+        /* the runtime no longer has the previous chunks */
+        install->chunk_offset = 0;
+        if (rt_req_install_send_chunk(conn, install) == 0) return;
+    } else {
+        printf("Chunk of install refused by runtime %s (status %d).\n", conn->config->uuid, response->status);
+    }
+
+    rt_req_install_done(conn, install, response);
+}
+
+void rt_req_install_resume(runtime_conn_t *conn, bool resume)
+{
+    struct rt_install_list parked = conn->parked_installs;
+    rt_install_t *install;
+
+    /* installs interrupted again are parked again */
+    SLIST_INIT(&conn->parked_installs);
+    conn->parked_deadline_ms = 0;
+
+    while ((install = SLIST_FIRST(&parked)) != NULL) {
+        SLIST_REMOVE_HEAD(&parked, next);
+        if (resume && rt_req_install_transfer(conn, install) == 0) continue;
+        rt_req_install_done(conn, install, NULL);
+    }
+}
+
 /*return:
  0: success
  others: fail*/
-int rt_req_install(char *filename, char *app_file_buf, int app_size, char *name, char *module_type, int heap_size, int timers, int watchdog_interval)
+int rt_req_install(runtime_conn_t *conn, char *filename, char *app_file_buf, int app_size, char *name, char *module_type, int heap_size, int timers, int watchdog_interval, rt_response_cb_t cb, void *arg)
 {
     request_t request[1] = { 0 };
     char url[URL_MAX_LEN] = { 0 };
     int ret = -1;
     bool is_wasm_bytecode_app;
+    module_cache_entry_t *entry = NULL;
+    rt_install_t *install;
+    char aot_file[URL_MAX_LEN];
+    char *bytecode_file = NULL;
 
     snprintf(url, sizeof(url) - 1, "/applet?name=%s", name);
 
@@ -61,8 +249,30 @@ int rt_req_install(char *filename, char *app_file_buf, int app_size, char *name,
 
     /*TODO: permissions to access JLF resource: AUDIO LOCATION SENSOR VISION platform.SERVICE */
 
-    if (app_file_buf == NULL && filename != NULL) { 
-        app_file_buf = read_file_to_buffer(filename, &app_size);
+    /* runtimes with an AoT target get the AoT image of wasm files, once compiled (see aot.h) */
+    if (app_file_buf == NULL && filename != NULL && g_bt_config.rt_aot_compiler[0] != '\0'
+            && conn->config->aot_target[0] != '\0' && (module_type == NULL || strcmp(module_type, "wasm") == 0)
+            && aot_image_path(filename, conn->config->aot_target, aot_file, sizeof(aot_file)) == 0) {
+        if (aot_image_is_current(filename, aot_file)) {
+            bytecode_file = filename;
+            filename = aot_file;
+        } else {
+            /* bytecode until the image is ready */
+            aot_compile(g_bt_config.rt_aot_compiler, filename, conn->config->aot_target);
+        }
+    }
+
+    /* module files are mapped once, and kept mapped (see module_cache.h) */
+    if (app_file_buf == NULL && filename != NULL) {
+        if ((entry = module_cache_get(filename)) == NULL && bytecode_file != NULL) {
+            filename = bytecode_file;
+            bytecode_file = NULL;
+            entry = module_cache_get(filename);
+        }
+        if (entry != NULL) {
+            app_file_buf = (char *) entry->data;
+            app_size = entry->size;
+        }
     }
 
     if (app_file_buf == NULL || app_size <= 0) {
@@ -70,26 +280,47 @@ int rt_req_install(char *filename, char *app_file_buf, int app_size, char *name,
         return -1;
     }
 
-    //printf ("Installing size=%d \n", app_size);
-    init_request(request, url, COAP_PUT, FMT_APP_RAW_BINARY, app_file_buf, app_size);
-    request->mid = gen_random_id();
-
+    /* AoT images go in the same message as bytecode; the app manager tells them apart by their magic */
     if ((module_type == NULL || strcmp(module_type, "wasm") == 0)
-            && get_package_type(app_file_buf, app_size) == Wasm_Module_Bytecode)
+            && (get_package_type(app_file_buf, app_size) == Wasm_Module_Bytecode
+                || get_package_type(app_file_buf, app_size) == Wasm_Module_AoT))
         is_wasm_bytecode_app = true;
     else
         is_wasm_bytecode_app = false;
 
-    rt_conn_request_sent(INSTALL, request->mid); // indicate a request
+    if (entry == NULL) {
+        //printf ("Installing size=%d \n", app_size);
+        init_request(request, url, COAP_PUT, FMT_APP_RAW_BINARY, app_file_buf, app_size);
+        ret = rt_req_send(conn, request, INSTALL, is_wasm_bytecode_app, cb, arg);
+        free(app_file_buf);
+        return ret;
+    }
 
-    ret = send_request(request, is_wasm_bytecode_app);
+    if ((install = calloc(1, sizeof(rt_install_t))) == NULL) {
+        module_cache_release(entry);
+        return -1;
+    }
+    install->entry = entry;
+    strncpy(install->url, url, sizeof(install->url) - 1);
+    install->is_wasm_bytecode_app = is_wasm_bytecode_app;
+    install->cb = cb;
+    install->arg = arg;
+    if (bytecode_file != NULL && (install->bytecode_file = strdup(bytecode_file)) == NULL) {
+        module_cache_release(entry);
+        free(install);
+        return -1;
+    }
 
-    free(app_file_buf);
+    if ((ret = rt_req_install_transfer(conn, install)) != 0) {
+        module_cache_release(entry);
+        free(install->bytecode_file);
+        free(install);
+    }
 
     return ret;
 }
 
-int rt_req_uninstall(char *name, char *module_type)
+int rt_req_uninstall(runtime_conn_t *conn, char *name, char *module_type, rt_response_cb_t cb, void *arg)
 {
     request_t request[1] = { 0 };
     char url[URL_MAX_LEN] = { 0 };
@@ -104,16 +335,13 @@ int rt_req_uninstall(char *name, char *module_type)
     init_request(request, url, COAP_DELETE,
     FMT_ATTR_CONTAINER,
     NULL, 0);
-    request->mid = gen_random_id();
 
-    rt_conn_request_sent(UNINSTALL, request->mid); // indicate a request
-
-    ret = send_request(request, false);
+    ret = rt_req_send(conn, request, UNINSTALL, false, cb, arg);
 
     return ret;
 }
 
-int rt_req_query(char *name)
+int rt_req_query(runtime_conn_t *conn, char *name, rt_response_cb_t cb, void *arg)
 {
     request_t request[1] = { 0 };
     int ret = -1;
@@ -127,18 +355,14 @@ int rt_req_query(char *name)
     init_request(request, url, COAP_GET,
     FMT_ATTR_CONTAINER,
     NULL, 0);
-    request->mid = gen_random_id();
 
-    rt_conn_request_sent(QUERY, request->mid); // indicate a request 
-
-    ret = send_request(request, false);
+    ret = rt_req_send(conn, request, QUERY, false, cb, arg);
 
     return ret;
 }
 
-int rt_req_request(char *url, int action, cJSON *json)
+int rt_req_request(runtime_conn_t *conn, char *url, int action, cJSON *json, rt_response_cb_t cb, void *arg)
 {
-    request_t request[1] = { 0 };
     attr_container_t *payload = NULL;
     int ret = -1, payload_len = 0;
 
@@ -149,13 +373,7 @@ int rt_req_request(char *url, int action, cJSON *json)
         payload_len = attr_container_get_serialize_length(payload);
     }
 
-    init_request(request, (char *)url, action,
-    FMT_ATTR_CONTAINER, payload, payload_len);
-    request->mid = gen_random_id();
-
-    rt_conn_request_sent(REQUEST, request->mid); // indicate a request 
-
-    ret = send_request(request, false);
+    ret = rt_req_request_payload(conn, url, action, FMT_ATTR_CONTAINER, payload, payload_len, cb, arg);
 
     if (payload != NULL)
         attr_container_destroy(payload);
@@ -163,11 +381,26 @@ int rt_req_request(char *url, int action, cJSON *json)
     fail: return ret;
 }
 
+int rt_req_request_payload(runtime_conn_t *conn, char *url, int action, int fmt, void *payload, int payload_len, rt_response_cb_t cb, void *arg)
+{
+    request_t request[1] = { 0 };
+
+    init_request(request, (char *)url, action,
+    fmt, payload, payload != NULL ? payload_len : 0);
+
+    if (cb != NULL)
+        return rt_req_send(conn, request, REQUEST, false, cb, arg);
+
+    /* no one waits for a response (e.g. events) */
+    request->mid = gen_random_id();
+    return send_request(conn, request, false);
+}
+
 /*
  TODO: currently only support 1 url.
  how to handle multiple responses and set process's exit code?
  */
-int rt_req_subscribe(char *urls)
+int rt_req_subscribe(runtime_conn_t *conn, char *urls, rt_response_cb_t cb, void *arg)
 {
     request_t request[1] = { 0 };
     int ret = -1;
@@ -177,11 +410,8 @@ int rt_req_subscribe(char *urls)
     init_request(request, url, COAP_PUT,
     FMT_ATTR_CONTAINER,
     NULL, 0);
-    request->mid = gen_random_id();
-    
-    rt_conn_request_sent(REGISTER, request->mid); // indicate a request 
 
-    ret = send_request(request, false); 
+    ret = rt_req_send(conn, request, REGISTER, false, cb, arg);
 
     return ret;
 }
@@ -189,7 +419,7 @@ int rt_req_subscribe(char *urls)
 /*
  TODO: currently only support 1 url.
  */
-int rt_req_unsubscribe(char *urls)
+int rt_req_unsubscribe(runtime_conn_t *conn, char *urls, rt_response_cb_t cb, void *arg)
 {
     request_t request[1] = { 0 };
     int ret = -1;
@@ -198,11 +428,8 @@ int rt_req_unsubscribe(char *urls)
     init_request(request, url, COAP_DELETE,
     FMT_ATTR_CONTAINER,
     NULL, 0);
-    request->mid = gen_random_id();
-
-    rt_conn_request_sent(UNREGISTER, request->mid); // indicate a request
 
-    ret = send_request(request, false);
+    ret = rt_req_send(conn, request, UNREGISTER, false, cb, arg);
 
 
     return ret;
@@ -215,41 +442,118 @@ void output_event(request_t *obj)
     output(header, obj->payload, obj->fmt, obj->payload_len);
 }
 
-/* -1 fail, 0 success */
-int send_request(request_t *request, bool is_install_wasm_bytecode_app)
+/* request packet layout, as in pack_request() */
+#define REQUEST_PACKET_VER 1
+#define REQUEST_PACKET_FIX_PART_LEN 18
+
+/**
+ * Same as pack_request(), but packs into a buffer from the buffer pool
+ *
+ * @param request the request to pack
+ * @param size the size of the packet
+ * @return returns the packet (release with bufpool_free()), NULL on error
+ */
+static char *send_request_pack(request_t *request, int *size)
 {
-    char *req_p;
-    int req_size, req_size_n, ret = -1;
-    uint16_t msg_type = REQUEST_PACKET;
+    int url_len = strlen(request->url) + 1;
+    int len = REQUEST_PACKET_FIX_PART_LEN + url_len + request->payload_len;
+    char *packet;
+    uint16_t u16;
+    uint32_t u32;
+
+    if ((packet = bufpool_alloc(len)) == NULL) {
+        printf("Buffer pool limit reached; cannot send request of %d bytes.\n", len);
+        return NULL;
+    }
 
-    if (is_install_wasm_bytecode_app)
-        msg_type = INSTALL_WASM_BYTECODE_APP;
+    packet[0] = REQUEST_PACKET_VER;
+    packet[1] = request->action;
 
-    if ((req_p = pack_request(request, &req_size)) == NULL)
-        return -1;
+    u16 = htons(request->fmt);
+    memcpy(packet + 2, &u16, 2);
+
+    u32 = htonl(request->mid);
+    memcpy(packet + 4, &u32, 4);
+
+    u32 = htonl(request->sender);
+    memcpy(packet + 8, &u32, 4);
+
+    u16 = htons(url_len);
+    memcpy(packet + 12, &u16, 2);
+
+    u32 = htonl(request->payload_len);
+    memcpy(packet + 14, &u32, 4);
+
+    memcpy(packet + REQUEST_PACKET_FIX_PART_LEN, request->url, url_len);
+    if (request->payload_len > 0)
+        memcpy(packet + REQUEST_PACKET_FIX_PART_LEN + url_len, request->payload, request->payload_len);
+
+    *size = len;
+    return packet;
+}
+
+/**
+ * Send a request and wait (asynchronously) for its response
+ *
+ * @param conn the runtime connection
+ * @param request the request; its mid is assigned here
+ * @param request_type the request operation
+ * @param is_install_wasm_bytecode_app true when installing a wasm bytecode app
+ * @param cb called with the response (see rt_conn_request_sent()); not called if -1 is returned
+ * @param arg argument passed to cb
+ * @return returns -1 on error (arg is left to the caller), 0 on success (cb is called)
+ */
+static int rt_req_send(runtime_conn_t *conn, request_t *request, op_type request_type, bool is_install_wasm_bytecode_app, rt_response_cb_t cb, void *arg)
+{
+    int ret;
 
-    /* leading bytes */
-    if (!host_tool_send_data(leading, sizeof(leading)))
-        goto ret;
+    /* pick another mid if this one is waiting for a response already */
+    do {
+        request->mid = gen_random_id();
+        ret = rt_conn_request_sent(conn, request_type, request->mid, DEFAULT_TIMEOUT_MS, cb, arg);
+    } while (ret == -2);
 
-    /* message type */
-    msg_type = htons(msg_type);
-    if (!host_tool_send_data((char *) &msg_type, sizeof(msg_type)))
-        goto ret;
+    if (ret != 0) {
+        printf("Too many requests waiting for runtime %s.\n", conn->config->uuid);
+        return -1;
+    }
 
-    /* payload length */
-    req_size_n = htonl(req_size);
-    if (!host_tool_send_data((char *) &req_size_n,
-            sizeof(req_size_n)))
-        goto ret;
+    /* if the connection closed meanwhile, cb was called (with NULL) and owns arg */
+    if (send_request(conn, request, is_install_wasm_bytecode_app) != 0
+        && rt_conn_request_cancel(conn, request->mid))
+        return -1;
+
+    return 0;
+}
 
-    /* payload */
-    if (!host_tool_send_data(req_p, req_size))
-        goto ret;
+/* -1 fail, 0 success */
+int send_request(runtime_conn_t *conn, request_t *request, bool is_install_wasm_bytecode_app)
+{
+    char *req_p;
+    int req_size;
+    uint16_t msg_type = REQUEST_PACKET;
+    char alias_buf[TOPIC_ALIAS_URL_BUF_SIZE];
+    char *url = request->url;
+    int ret = 0;
 
-    ret = 0;
+    if (is_install_wasm_bytecode_app)
+        msg_type = INSTALL_WASM_BYTECODE_APP;
 
-    ret: free_req_resp_packet(req_p);
+    /* events are sent with a topic alias once the runtime knows it */
+    pthread_mutex_lock(&conn->alias_lock);
+    if (msg_type == REQUEST_PACKET && request->action == COAP_EVENT_PUB)
+        request->url = (char *) topic_alias_encode(&conn->aliases, request->url, alias_buf);
+
+    if ((req_p = send_request_pack(request, &req_size)) == NULL) {
+        ret = -1;
+    } else if (!host_tool_send_data(conn, msg_type, req_p, req_size, bufpool_free)) {
+        /* the frame is queued and written in one writev() with its header */
+        bufpool_free(req_p);
+        ret = -1;
+    }
+    if (ret != 0 && request->url != url)
+        topic_alias_unsent(&conn->aliases, url);
+    pthread_mutex_unlock(&conn->alias_lock);
 
     return ret;
 }
@@ -3,23 +3,41 @@
 
 #include "app_manager_export.h" /* for Module_WASM_App */
 #include "cJSON.h"
+#include "attr_container.h"
+
+struct runtime_conn;
 
 typedef enum {
     NONE, INSTALL, UNINSTALL, QUERY, REQUEST, REGISTER, UNREGISTER
 } op_type;
 
+/**
+ * Callback invoked with the response to a request
+ *
+ * @param conn the runtime connection the request was sent to
+ * @param response the response; NULL if the request timed out or the connection was closed
+ * @param arg user argument given with the request
+ */
+typedef void (*rt_response_cb_t)(struct runtime_conn *conn, response_t *response, void *arg);
+
 /* Package Type */
 typedef enum {
     Wasm_Module_Bytecode = 0, Wasm_Module_AoT, Package_Type_Unknown = 0xFFFF
 } PackageType;
 
-int rt_req_install(char *filename, char *app_file_buf, int app_size, char *name, char *module_type, int heap_size, int timers, int watchdog_interval);
-int rt_req_uninstall(char *name, char *module_type);
-int rt_req_query(char *name);
-int rt_req_request(char *url, int action, cJSON *json);
-int rt_req_subscribe(char *urls);
-int rt_req_unsubscribe(char *urls);
-int send_request(request_t *request, bool is_install_wasm_bytecode_app);
+/* requests call cb with the response; cb is not called if the request fails (returns -1) */
+int rt_req_install(struct runtime_conn *conn, char *filename, char *app_file_buf, int app_size, char *name, char *module_type, int heap_size, int timers, int watchdog_interval, rt_response_cb_t cb, void *arg);
+int rt_req_uninstall(struct runtime_conn *conn, char *name, char *module_type, rt_response_cb_t cb, void *arg);
+int rt_req_query(struct runtime_conn *conn, char *name, rt_response_cb_t cb, void *arg);
+/* events (e.g. COAP_EVENT_PUB) get no response; the request is only tracked if cb is not NULL */
+int rt_req_request(struct runtime_conn *conn, char *url, int action, cJSON *json, rt_response_cb_t cb, void *arg);
+/* same as rt_req_request(), with the payload already in its format (FMT_ATTR_CONTAINER, e.g. from json_text2attr(), or FMT_APP_RAW_BINARY); it is copied */
+int rt_req_request_payload(struct runtime_conn *conn, char *url, int action, int fmt, void *payload, int payload_len, rt_response_cb_t cb, void *arg);
+int rt_req_subscribe(struct runtime_conn *conn, char *urls, rt_response_cb_t cb, void *arg);
+int rt_req_unsubscribe(struct runtime_conn *conn, char *urls, rt_response_cb_t cb, void *arg);
+int send_request(struct runtime_conn *conn, request_t *request, bool is_install_wasm_bytecode_app);
+/* resume the installs interrupted by the connection closing (sent in chunks; see module_hash.h), or complete them with a NULL response if resume is false */
+void rt_req_install_resume(struct runtime_conn *conn, bool resume);
 
 PackageType get_package_type(const char *buf, int size);
 
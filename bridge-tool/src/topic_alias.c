@@ -0,0 +1,136 @@
+/** @file topic_alias.c
+ *  @brief Topic aliases on the runtime link
+ *
+ *  @date July, 2019
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "topic_alias.h"
+
+#define TOPIC_ALIAS_TX_SLOTS (2 * TOPIC_ALIAS_MAX)
+
+/* a url we assigned an id to */
+struct topic_alias_entry {
+    uint32_t hash;
+    uint16_t id;
+    /* the definition was sent */
+    uint8_t defined;
+    char url[];
+};
+
+/* FNV-1a */
+static uint32_t topic_alias_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void topic_alias_init(topic_alias_t *ta)
+{
+    memset(ta, 0, sizeof(topic_alias_t));
+}
+
+void topic_alias_reset(topic_alias_t *ta)
+{
+    int i;
+
+    for (i = 0; i < TOPIC_ALIAS_TX_SLOTS; i++) free(ta->tx[i]);
+    for (i = 0; i < TOPIC_ALIAS_MAX; i++) free(ta->rx[i]);
+    topic_alias_init(ta);
+}
+
+/* find the entry of a url we assigned an id to; if not found, i is the free slot for it */
+static struct topic_alias_entry *topic_alias_find(topic_alias_t *ta, const char *url, uint32_t *i)
+{
+    uint32_t hash = topic_alias_hash(url);
+    struct topic_alias_entry *e;
+
+    for (*i = hash % TOPIC_ALIAS_TX_SLOTS; (e = ta->tx[*i]) != NULL; *i = (*i + 1) % TOPIC_ALIAS_TX_SLOTS) {
+        if (e->hash == hash && strcmp(e->url, url) == 0) return e;
+    }
+    return NULL;
+}
+
+const char *topic_alias_encode(topic_alias_t *ta, const char *url, char *buf)
+{
+    uint32_t i;
+    size_t len;
+    struct topic_alias_entry *e;
+
+    if (!ta->tx_enabled) return url;
+
+    len = strlen(url);
+    if (len < TOPIC_ALIAS_MIN_URL_LEN || url[0] == TOPIC_ALIAS_MARK) return url;
+
+    if ((e = topic_alias_find(ta, url, &i)) != NULL) {
+        if (e->defined) {
+            snprintf(buf, TOPIC_ALIAS_URL_BUF_SIZE, "%c%u", TOPIC_ALIAS_MARK, e->id);
+        } else {
+            snprintf(buf, TOPIC_ALIAS_URL_BUF_SIZE, "%c%u=%s", TOPIC_ALIAS_MARK, e->id, url);
+            e->defined = 1;
+        }
+        return buf;
+    }
+
+    /* new url: define an alias, if there is one left and the definition fits */
+    if (ta->tx_count + 1 >= TOPIC_ALIAS_MAX || len + 7 > TOPIC_ALIAS_URL_BUF_SIZE) return url;
+    if ((e = malloc(sizeof(struct topic_alias_entry) + len + 1)) == NULL) return url;
+    e->hash = topic_alias_hash(url);
+    e->id = ++ta->tx_count;
+    e->defined = 1;
+    memcpy(e->url, url, len + 1);
+    ta->tx[i] = e;
+
+    snprintf(buf, TOPIC_ALIAS_URL_BUF_SIZE, "%c%u=%s", TOPIC_ALIAS_MARK, e->id, url);
+    return buf;
+}
+
+void topic_alias_unsent(topic_alias_t *ta, const char *url)
+{
+    struct topic_alias_entry *e;
+    uint32_t i;
+
+    if ((e = topic_alias_find(ta, url, &i)) != NULL) e->defined = 0;
+}
+
+int topic_alias_decode(topic_alias_t *ta, const char *wire_url, const char **url)
+{
+    const char *p = wire_url + 1;
+    unsigned long id;
+    char *end, *copy;
+    size_t len;
+
+    *url = wire_url;
+    if (wire_url[0] != TOPIC_ALIAS_MARK) return TOPIC_ALIAS_NONE;
+
+    if (wire_url[1] == '\0') {
+        /* the peer (re)started: its ids and the ones we assigned are forgotten */
+        topic_alias_reset(ta);
+        ta->tx_enabled = 1;
+        return TOPIC_ALIAS_HELLO;
+    }
+
+    if (*p < '0' || *p > '9') return TOPIC_ALIAS_ERROR;
+    id = strtoul(p, &end, 10);
+    if (id == 0 || id >= TOPIC_ALIAS_MAX) return TOPIC_ALIAS_ERROR;
+
+    if (*end == '=') {
+        len = strlen(end + 1);
+        if ((copy = malloc(len + 1)) == NULL) return TOPIC_ALIAS_ERROR;
+        memcpy(copy, end + 1, len + 1);
+        free(ta->rx[id]);
+        ta->rx[id] = copy;
+    } else if (*end != '\0' || ta->rx[id] == NULL) {
+        return TOPIC_ALIAS_ERROR;
+    }
+
+    *url = ta->rx[id];
+    return TOPIC_ALIAS_RESOLVED;
+}
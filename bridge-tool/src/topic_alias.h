@@ -0,0 +1,109 @@
+ /** @file topic_alias.h
+ *  @brief Definitions for topic aliases on the runtime link
+ *
+ *  Definitions for replacing the url of request packets by a small integer id
+ *  after its first use. Each side of the link assigns ids to the urls it sends
+ *  and keeps the ids assigned by its peer. An aliased url starts with
+ *  TOPIC_ALIAS_MARK, followed by the id in decimal, and, the first time the id
+ *  is used, by '=' and the url:
+ *
+ *  "\x01" "12=realm/s/scene/pose" (defines and uses alias 12)
+ *  "\x01" "12"                    (uses alias 12)
+ *
+ *  After (re)connecting, each side sends a request with url
+ *  TOPIC_ALIAS_HELLO_URL; urls are only aliased after the peer sent it. Both
+ *  the bridge and the runtime use this file; it only depends on libc.
+ *
+ *  Not thread-safe; callers serialize access to a table.
+ *
+ *  @date July, 2019
+ */
+#ifndef TOPIC_ALIAS_H_
+#define TOPIC_ALIAS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* first byte of an aliased url */
+#define TOPIC_ALIAS_MARK '\x01'
+
+/* url of the request announcing aliases are understood (and resetting the peer tables) */
+#define TOPIC_ALIAS_HELLO_URL "\x01"
+
+/* ids go from 1 to TOPIC_ALIAS_MAX - 1; urls sent after that are not aliased */
+#define TOPIC_ALIAS_MAX 1024
+
+/* shorter urls are not aliased */
+#define TOPIC_ALIAS_MIN_URL_LEN 8
+
+/* size of the buffer given to topic_alias_encode(); longer urls are not aliased */
+#define TOPIC_ALIAS_URL_BUF_SIZE 256
+
+/* values returned by topic_alias_decode() */
+#define TOPIC_ALIAS_ERROR -1
+#define TOPIC_ALIAS_NONE 0
+#define TOPIC_ALIAS_RESOLVED 1
+#define TOPIC_ALIAS_HELLO 2
+
+struct topic_alias_entry;
+
+/**
+ * Alias tables of one side of a link
+ */
+typedef struct {
+    /* urls we sent, hashed (open addressing, at most half full) */
+    struct topic_alias_entry *tx[2 * TOPIC_ALIAS_MAX];
+    uint16_t tx_count;
+
+    /* the peer understands aliases (it sent a hello) */
+    int tx_enabled;
+
+    /* urls of the ids assigned by the peer */
+    char *rx[TOPIC_ALIAS_MAX];
+} topic_alias_t;
+
+/**
+ * Init the tables; aliases are not sent until the peer sends a hello
+ *
+ * @param ta the tables
+ */
+void topic_alias_init(topic_alias_t *ta);
+
+/**
+ * Forget all aliases, e.g. when the link (re)connects; aliases are not sent until the peer sends a hello
+ *
+ * @param ta the tables
+ */
+void topic_alias_reset(topic_alias_t *ta);
+
+/**
+ * Get the url to send in place of a url
+ *
+ * @param ta the tables
+ * @param url the url
+ * @param buf buffer of TOPIC_ALIAS_URL_BUF_SIZE bytes where the aliased url is written
+ * @return returns buf with the aliased url, or url if it is sent as it is
+ */
+const char *topic_alias_encode(topic_alias_t *ta, const char *url, char *buf);
+
+/**
+ * Handle a url aliased by topic_alias_encode() that could not be sent: its alias is defined again the next time
+ *
+ * @param ta the tables
+ * @param url the url (not the aliased one)
+ */
+void topic_alias_unsent(topic_alias_t *ta, const char *url);
+
+/**
+ * Resolve a url received
+ *
+ * @param ta the tables
+ * @param wire_url the url received
+ * @param url where to store the url resolved (valid until the next hello or reset)
+ * @return returns TOPIC_ALIAS_NONE if wire_url is not aliased (url is wire_url), TOPIC_ALIAS_RESOLVED if it
+ * was, TOPIC_ALIAS_HELLO for a hello (the tables were reset, and aliases can now be sent), TOPIC_ALIAS_ERROR
+ * if it is malformed or has an unknown id
+ */
+int topic_alias_decode(topic_alias_t *ta, const char *wire_url, const char **url);
+
+#endif
@@ -0,0 +1,186 @@
+/** @file topic_trie.c
+ *  @brief Trie of MQTT topic filters
+ *
+ *  Each node is a level of a filter; its children are in a list, except the
+ *  wildcard children, kept apart so matching does not look for them.
+ *
+ *  @date July, 2019
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "topic_trie.h"
+#include "queue.h"
+
+struct topic_trie_node {
+    SLIST_ENTRY(topic_trie_node) next;
+    SLIST_HEAD(topic_trie_children, topic_trie_node) children;
+    struct topic_trie_node *parent;
+    /* '+' and '#' children */
+    struct topic_trie_node *plus;
+    struct topic_trie_node *hash;
+    /* value of the filter ending at this node; NULL if none does */
+    void *value;
+    size_t len;
+    char level[];
+};
+
+static struct topic_trie_node *topic_trie_node_new(struct topic_trie_node *parent, const char *level, size_t len)
+{
+    struct topic_trie_node *node = calloc(1, sizeof(struct topic_trie_node) + len + 1);
+
+    if (node == NULL) return NULL;
+    SLIST_INIT(&node->children);
+    node->parent = parent;
+    node->len = len;
+    memcpy(node->level, level, len);
+    return node;
+}
+
+static int topic_trie_node_is_empty(struct topic_trie_node *node)
+{
+    return node->value == NULL && node->plus == NULL && node->hash == NULL && SLIST_EMPTY(&node->children);
+}
+
+/* find the child of a node for a level of a filter; created if create is set */
+static struct topic_trie_node *topic_trie_child(struct topic_trie_node *node, const char *level, size_t len, int create)
+{
+    struct topic_trie_node **wildcard = NULL, *child;
+
+    if (len == 1 && level[0] == '+') wildcard = &node->plus;
+    else if (len == 1 && level[0] == '#') wildcard = &node->hash;
+
+    if (wildcard != NULL) {
+        if (*wildcard == NULL && create) *wildcard = topic_trie_node_new(node, level, len);
+        return *wildcard;
+    }
+
+    SLIST_FOREACH(child, &node->children, next) {
+        if (child->len == len && memcmp(child->level, level, len) == 0) return child;
+    }
+    if (!create || (child = topic_trie_node_new(node, level, len)) == NULL) return NULL;
+    SLIST_INSERT_HEAD(&node->children, child, next);
+    return child;
+}
+
+/* find the node where a filter ends; missing levels are created if create is set */
+static struct topic_trie_node *topic_trie_find(topic_trie_t *trie, const char *filter, int create)
+{
+    struct topic_trie_node *node = trie;
+    const char *end;
+
+    for (;;) {
+        end = strchr(filter, '/');
+        if (end == NULL) end = filter + strlen(filter);
+        if ((node = topic_trie_child(node, filter, end - filter, create)) == NULL) return NULL;
+        if (*end == '\0') return node;
+        filter = end + 1;
+    }
+}
+
+/* unlink a node from its parent and release it */
+static void topic_trie_node_free(struct topic_trie_node *node)
+{
+    struct topic_trie_node *parent = node->parent;
+
+    if (parent->plus == node) parent->plus = NULL;
+    else if (parent->hash == node) parent->hash = NULL;
+    else SLIST_REMOVE(&parent->children, node, topic_trie_node, next);
+    free(node);
+}
+
+topic_trie_t *topic_trie_create()
+{
+    return topic_trie_node_new(NULL, "", 0);
+}
+
+int topic_trie_insert(topic_trie_t *trie, const char *filter, void *value)
+{
+    struct topic_trie_node *node = topic_trie_find(trie, filter, 1);
+
+    if (node == NULL) return -1;
+    node->value = value;
+    return 0;
+}
+
+void *topic_trie_remove(topic_trie_t *trie, const char *filter)
+{
+    struct topic_trie_node *node = topic_trie_find(trie, filter, 0), *parent;
+    void *value;
+
+    if (node == NULL) return NULL;
+    value = node->value;
+    node->value = NULL;
+
+    /* release the levels no other filter uses */
+    while (node != trie && topic_trie_node_is_empty(node)) {
+        parent = node->parent;
+        topic_trie_node_free(node);
+        node = parent;
+    }
+    return value;
+}
+
+/* the values of the filters below node matching the topic levels from level to end */
+static int topic_trie_match_level(struct topic_trie_node *node, const char *level, const char *end, int wildcards,
+                                  void **values, int max_values, int n)
+{
+    const char *level_end = memchr(level, '/', end - level);
+    struct topic_trie_node *child, *next[2];
+    int i, nnext = 0;
+
+    if (level_end == NULL) level_end = end;
+
+    /* '#' matches the levels left */
+    if (wildcards && node->hash != NULL && node->hash->value != NULL && n < max_values)
+        values[n++] = node->hash->value;
+
+    SLIST_FOREACH(child, &node->children, next) {
+        if (child->len == (size_t)(level_end - level) && memcmp(child->level, level, child->len) == 0) {
+            next[nnext++] = child;
+            break;
+        }
+    }
+    if (wildcards && node->plus != NULL) next[nnext++] = node->plus;
+
+    for (i = 0; i < nnext; i++) {
+        child = next[i];
+        if (level_end == end) {
+            /* '#' also matches the parent level ("a/#" matches "a") */
+            if (child->value != NULL && n < max_values) values[n++] = child->value;
+            if (child->hash != NULL && child->hash->value != NULL && n < max_values) values[n++] = child->hash->value;
+        } else {
+            n = topic_trie_match_level(child, level_end + 1, end, 1, values, max_values, n);
+        }
+    }
+    return n;
+}
+
+int topic_trie_match(topic_trie_t *trie, const char *topic, size_t topic_len, void **values, int max_values)
+{
+    /* wildcards in the first level do not match topics starting with '$' */
+    int wildcards = topic_len == 0 || topic[0] != '$';
+
+    return topic_trie_match_level(trie, topic, topic + topic_len, wildcards, values, max_values, 0);
+}
+
+void topic_trie_destroy(topic_trie_t *trie)
+{
+    struct topic_trie_node *node = trie, *child;
+
+    /* release the nodes bottom up, without recursion */
+    while (node != NULL) {
+        if (node->plus != NULL) child = node->plus;
+        else if (node->hash != NULL) child = node->hash;
+        else child = SLIST_FIRST(&node->children);
+
+        if (child != NULL) {
+            node = child;
+            continue;
+        }
+        child = node;
+        node = node->parent;
+        if (node != NULL) topic_trie_node_free(child);
+        else free(child);
+    }
+}
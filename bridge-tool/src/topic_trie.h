@@ -0,0 +1,63 @@
+ /** @file topic_trie.h
+ *  @brief Definitions for a trie of MQTT topic filters
+ *
+ *  Definitions for a trie keyed by the levels of MQTT topic filters, with
+ *  support for the single-level ('+') and multi-level ('#') wildcards. Each
+ *  filter holds a value; matching a topic returns the values of all filters
+ *  matching it, walking only the branches that can match.
+ *
+ *  @date July, 2019
+ */
+#ifndef TOPIC_TRIE_H_
+#define TOPIC_TRIE_H_
+
+#include <stddef.h>
+
+typedef struct topic_trie_node topic_trie_t;
+
+/**
+ * Create an empty trie
+ *
+ * @return returns the trie, NULL if no memory is available
+ */
+topic_trie_t *topic_trie_create();
+
+/**
+ * Add a filter; the value of a filter already in the trie is replaced
+ *
+ * @param trie the trie
+ * @param filter the topic filter
+ * @param value the value of the filter (not NULL)
+ * @return returns -1 on error, 0 on success
+ */
+int topic_trie_insert(topic_trie_t *trie, const char *filter, void *value);
+
+/**
+ * Remove a filter
+ *
+ * @param trie the trie
+ * @param filter the topic filter
+ * @return returns the value of the filter, NULL if not in the trie
+ */
+void *topic_trie_remove(topic_trie_t *trie, const char *filter);
+
+/**
+ * Find the filters matching a topic; topics starting with '$' are not matched by wildcards in the first level
+ *
+ * @param trie the trie
+ * @param topic the topic (does not need to be NUL-terminated)
+ * @param topic_len length of the topic
+ * @param values where to store the values of the filters matching
+ * @param max_values maximum number of values stored
+ * @return returns the number of values stored
+ */
+int topic_trie_match(topic_trie_t *trie, const char *topic, size_t topic_len, void **values, int max_values);
+
+/**
+ * Release the trie (not the values)
+ *
+ * @param trie the trie
+ */
+void topic_trie_destroy(topic_trie_t *trie);
+
+#endif
@@ -7,11 +7,14 @@
  *       curl --data "name=saved-file-name" --data @./file-to-upload.wasm http://localhost:8021/upload
  *
  *  NOTES: saved-file-name is appended with ".wasm"; files are saved to the
- *  upload folder in config.ini
+ *  upload folder in config.ini. If an AoT compiler is configured ([runtime]
+ *  aot-compiler), saved files are compiled for the AoT targets of the
+ *  runtimes (aot-target in [runtime] and [runtime:<uuid>]; see aot.h)
  *
  *  @author Nuno Pereira
  *  @date July, 2019
  */
+#include "aot.h"
 #include "ini.h"
 #include "mongoose.h"
 #include <stdio.h>
@@ -25,14 +28,39 @@ static struct mg_serve_http_opts s_http_server_opts;
 static const char g_config_file_path[] = "config.ini";
 
 #define STR_MAXLEN 100
+#define MAX_AOT_TARGETS 8
 
 struct {
   char http_port[STR_MAXLEN];
   char http_enable_directory_listing[STR_MAXLEN];
 
   char upload_folder[STR_MAXLEN];
+
+  char aot_compiler[STR_MAXLEN];
+  char aot_targets[MAX_AOT_TARGETS][STR_MAXLEN];
+  uint32_t aot_target_count;
 } g_config;
 
+/* add an AoT target, if new */
+static void add_aot_target(const char *target) {
+  uint32_t i;
+
+  if (target[0] == '\0')
+    return;
+  for (i = 0; i < g_config.aot_target_count; i++) {
+    if (strcmp(g_config.aot_targets[i], target) == 0)
+      return;
+  }
+  if (g_config.aot_target_count >= MAX_AOT_TARGETS) {
+    printf("Too many AoT targets (max %d); ignoring %s\n", MAX_AOT_TARGETS,
+           target);
+    return;
+  }
+  strncpy(g_config.aot_targets[g_config.aot_target_count++], target,
+          STR_MAXLEN - 1);
+  printf("aot_target = %s\n", target);
+}
+
 static int conf_handler(void *user, const char *section, const char *name,
                         const char *value) {
   if (user != NULL)
@@ -49,6 +77,13 @@ static int conf_handler(void *user, const char *section, const char *name,
   } else if (MATCH("http-upload", "upload-folder")) {
     strncpy(g_config.upload_folder, value, sizeof(g_config.upload_folder));
     printf("upload_folder= %s\n", g_config.upload_folder);
+  } else if (MATCH("runtime", "aot-compiler")) {
+    strncpy(g_config.aot_compiler, value, sizeof(g_config.aot_compiler) - 1);
+    printf("aot_compiler = %s\n", g_config.aot_compiler);
+  } else if ((strcmp(section, "runtime") == 0 ||
+              strncmp(section, "runtime:", strlen("runtime:")) == 0) &&
+             strcmp(name, "aot-target") == 0) {
+    add_aot_target(value);
   } else {
     return 0; /* unknown section/name, error */
   }
@@ -69,7 +104,7 @@ static void file_upload(struct mg_connection *nc, struct http_message *hm) {
                            "1234567890_-.@";
   FILE *fp;
   int ret;
-  char arg_name[100] = {0}, filename[200] = {0};
+  char arg_name[100] = {0}, filename[200] = {0}, tmp_filename[210] = {0};
   uint32_t file_len = 0;
 
   ret = mg_get_http_var(&hm->body, "name", arg_name, sizeof(arg_name) - 1);
@@ -94,10 +129,35 @@ static void file_upload(struct mg_connection *nc, struct http_message *hm) {
 
   printf("http_upload: %s; len:%u\n", filename, file_len);
 
-  fp = fopen(filename, "w");
-  fwrite(file_buf, 1, file_len, fp);
+  /* written aside and renamed over the file: a module being installed from
+     the old file (mapped by the bridge) is left intact, and the new inode
+     tells the bridge the file changed */
+  snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+  fp = fopen(tmp_filename, "w");
+  if (fp == NULL || fwrite(file_buf, 1, file_len, fp) != file_len) {
+    printf("http_upload: error writing %s\n", tmp_filename);
+    if (fp != NULL) {
+      fclose(fp);
+      remove(tmp_filename);
+    }
+    mg_printf(nc, "%s",
+              "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n");
+    return;
+  }
+  if (fclose(fp) != 0 || rename(tmp_filename, filename) != 0) {
+    printf("http_upload: error saving %s\n", filename);
+    remove(tmp_filename);
+    mg_printf(nc, "%s",
+              "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n");
+    return;
+  }
 
-  fclose(fp);
+  /* compiled in the background; the bridge installs bytecode until done */
+  if (g_config.aot_compiler[0] != '\0') {
+    uint32_t i;
+    for (i = 0; i < g_config.aot_target_count; i++)
+      aot_compile(g_config.aot_compiler, filename, g_config.aot_targets[i]);
+  }
 
   mg_printf(nc, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
 
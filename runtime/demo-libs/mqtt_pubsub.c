@@ -20,6 +20,11 @@ bool mqtt_publish(const char *url, int fmt, void *payload, int payload_len)
     return true;
 }
 
+bool mqtt_publish_raw(const char *topic, const void *data, int len)
+{
+    return mqtt_publish(topic, FMT_APP_RAW_BINARY, (void *)data, len);
+}
+
 bool mqtt_subscribe(const char * topic, request_handler_f handler)
 {
     const char arena_suffix[] = "/arena/";
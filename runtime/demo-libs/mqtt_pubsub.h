@@ -36,9 +36,23 @@ typedef void (*request_handler_f)(request_t *request);
 bool mqtt_publish(const char *url, int fmt, void *payload,
         int payload_len);
 
+/**
+ * @brief Publish bytes to mqtt as they are (e.g. a string or a binary blob),
+ * without wrapping them in an attribute container.
+ *
+ * @param topic topic
+ * @param data bytes to publish
+ * @param len number of bytes
+ *
+ * @return true if success, false otherwise
+ */
+bool mqtt_publish_raw(const char *topic, const void *data, int len);
+
 
 /**
- * @brief Subscribe an mqtt topic.
+ * @brief Subscribe an mqtt topic. Messages that are a json object are given to
+ * the handler as an attribute container (fmt FMT_ATTR_CONTAINER); other
+ * messages as the bytes received (fmt FMT_APP_RAW_BINARY).
  *
  * @param topic topic 
  * @param handler callback function to handle the event.
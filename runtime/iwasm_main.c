@@ -3,6 +3,7 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <arpa/inet.h>
 #else
 #include <termios.h>
@@ -19,6 +20,12 @@
 #include <signal.h>
 #include <unistd.h>
 #include <strings.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <stddef.h>
+#include <semaphore.h>
 
 #include "runtime_lib.h"
 #include "runtime_timer.h"
@@ -32,8 +39,55 @@
 #include "attr_container.h"
 #include "module_wasm_app.h"
 #include "wasm_export.h"
+#include "host_link.h"
+#include "coap_ext.h"
+#include "topic_alias.h"
+#include "module_hash.h"
+#include "module_store.h"
+#include "runtime_heap.h"
+#include "link_compress.h"
+#include "link_arq.h"
 #define MAX 2048
 
+/* link message header: leading bytes (0x12 0x34), type (2 bytes), payload size (4 bytes) */
+#define LINK_HDR_LEN 8
+
+/* request packet: version, action, fmt, mid, sender, url length, payload length */
+#define REQUEST_PACKET_FIX_PART_LEN 18
+
+/* response packet: version, status, fmt, mid, receiver, payload length */
+#define RESPONSE_PACKET_FIX_PART_LEN 16
+
+/* larger request packets are passed through without resolving aliases (or
+   keeping the module binary installed, if larger than the module store) */
+#define LINK_MAX_REQUEST (64 * 1024)
+
+/* larger module binaries are not received in chunks (see module_hash.h) */
+#define LINK_MAX_CHUNKED_MODULE (16 * 1024 * 1024)
+
+/* larger compressed messages are passed through (see link_compress.h) */
+#define LINK_MAX_COMPRESSED (1024 * 1024)
+
+/* default size of the buffer of bytes read from the host; larger frames are streamed */
+#define LINK_RX_DEFAULT_BUF (64 * 1024)
+
+/* bytes given to the app manager per call */
+#define LINK_MAX_CALLBACK 0xffff
+
+/* default bound of the bytes queued for the host, and the threads counted apart in it */
+#define LINK_TXQ_DEFAULT_BOUND (256 * 1024)
+#define LINK_TXQ_MAX_PRODUCERS 32
+
+/* frames written by one writev() */
+#define LINK_TXQ_MAX_BATCH 64
+
+/* hosts served at once in server mode, and their requests waiting for a response */
+#define LINK_MAX_CONNS 8
+#define LINK_MAX_ROUTES 256
+
+/* a host of the server mode not reading for this long is disconnected */
+#define LINK_CONN_WRITE_TIMEOUT_MS 5000
+
 #ifndef CONNECTION_UART
 #define SA struct sockaddr
 static char *host_address = "127.0.0.1";
@@ -41,6 +95,7 @@ static int port = 8888;
 #else
 static char *uart_device = "/dev/ttyS2";
 static int baudrate = B115200;
+static int link_baud = 115200;
 #endif
 
 extern void * thread_timer_check(void *);
@@ -54,15 +109,1390 @@ int sockfd = -1;
 static pthread_mutex_t sock_lock = PTHREAD_MUTEX_INITIALIZER;
 #else
 int uartfd = -1;
+
+/* bytes written to the link while the window of the link layer is full */
+typedef struct link_arq_pending {
+    struct link_arq_pending *next;
+    uint32 len;
+    uint32 off;
+    char data[1];
+} link_arq_pending_t;
+
+/* reliable link layer (see link_arq.h); 0 frames disables it. link_arq_lock protects the
+   link layer and the bytes pending; it is taken by the writer thread inside
+   link_txq.write_lock, and is not held while handling bytes read, so writes never wait
+   for the host to acknowledge frames */
+static uint8 link_window = 0;
+static link_arq_t link_arq;
+static pthread_mutex_t link_arq_lock = PTHREAD_MUTEX_INITIALIZER;
+static link_arq_pending_t *link_arq_pending, **link_arq_pending_tail = &link_arq_pending;
+#endif
+
+/* a link message being received or sent; request packets are buffered whole
+   (to replace their url), other messages are passed through as they arrive,
+   unless buffer_all is set (to compress them) */
+typedef struct {
+    unsigned char hdr[LINK_HDR_LEN];
+    int hdr_len;
+    uint32 payload_size;
+    uint32 payload_len;
+    bool buffer_all;
+    bool buffered;
+    char *buf;
+    uint32 buf_size;
+} link_frame_t;
+
+typedef void (*link_frame_bytes_cb)(const char *bytes, uint32 len);
+typedef void (*link_frame_request_cb)(char *frame, uint32 len);
+
+/* bytes read from the host, parsed where they were read: whole frames are handled in
+   place; a frame still arriving is moved to the front of the buffer when the space after
+   it runs low, so frames are never split. Frames larger than the buffer are streamed
+   through the rx_frame of the connection. Only accessed by the thread reading the link */
+typedef struct {
+    char *buf;
+    uint32 size;
+    /* next byte to parse, and end of the bytes read */
+    uint32 head;
+    uint32 tail;
+} link_rx_buf_t;
+
+/* a thread queuing frames for the host (an applet, the app manager, the link reader) */
+typedef struct link_txq_producer {
+    /* threads using it: one, or the threads past the table for the first one */
+    int in_use;
+    /* bytes queued and not yet written */
+    uint32 queued;
+    uint32 sent;
+    /* frames refused: queue over its bound, or the thread over its share */
+    uint32 dropped;
+} link_txq_producer_t;
+
+/* a frame waiting for the writer thread */
+typedef struct link_txq_node {
+    struct link_txq_node *next;
+    link_txq_producer_t *producer;
+    struct link_conn *conn;
+    /* generation of the connection when queued; frames of a previous connection are dropped */
+    uint32 generation;
+    uint32 len;
+    /* bytes written */
+    uint32 off;
+    char data[1];
+} link_txq_node_t;
+
+/* a response of the link layer, waiting for the end of the frame being sent */
+typedef struct link_reply {
+    struct link_reply *next;
+    char packet[LINK_HDR_LEN + RESPONSE_PACKET_FIX_PART_LEN];
+} link_reply_t;
+
+/* an event a host registered for (server mode) */
+typedef struct link_sub {
+    struct link_sub *next;
+    char event[1];
+} link_sub_t;
+
+/* a connection to a host: the only one in client and uart modes, one of up to
+   LINK_MAX_CONNS in server mode */
+typedef struct link_conn {
+    /* -1 if not connected (server mode) */
+    int fd;
+    /* bumped when the connection is reset or lost, with link_lock and link_txq.write_lock
+       held; connected is protected by link_txq.write_lock */
+    uint32 generation;
+    bool connected;
+
+    /* server mode, protected by link_txq.write_lock: frames the host has not read yet, in
+       order; once its fd is full, tx_blocked is set (EPOLLOUT is watched) and tx_blocked_ms
+       is when the host last read */
+    struct link_txq_node *tx_pending;
+    struct link_txq_node **tx_pending_tail;
+    bool tx_blocked;
+    uint64_t tx_blocked_ms;
+
+    /* only accessed by the thread reading the link */
+    link_rx_buf_t rx_buf;
+    link_frame_t rx_frame;
+
+    /* protected by link_lock: frames are sent to open connections; topic aliases, the host
+       reads compressed messages, its events (none: all events), and the rest of the frame
+       passed through is dropped */
+    bool open;
+    topic_alias_t aliases;
+    bool compress_peer;
+    link_sub_t *subs;
+    bool tx_refused;
+} link_conn_t;
+
+/* a request of a host, given to the app manager with a mid unique among the hosts (server
+   mode); its response goes back to the host, with the host's mid */
+typedef struct {
+    bool in_use;
+    uint32 mid;
+    uint32 host_mid;
+    /* NULL for requests of the link layer, whose response is dropped */
+    link_conn_t *conn;
+    uint32 generation;
+} link_route_t;
+
+/* messages of this size or larger are compressed, once the host reads compressed messages (see link_compress.h) */
+#ifdef CONNECTION_UART
+static uint32 link_compress_threshold = LINK_COMPRESS_DEFAULT_THRESHOLD;
+#else
+static uint32 link_compress_threshold = 0;
+#endif
+
+/* connections to hosts (several in server mode); the lock protects their state as noted,
+   the outgoing frame, the replies and the routes of requests */
+static link_conn_t link_conns[LINK_MAX_CONNS];
+static int link_nconns = 1;
+static bool link_multi;
+static pthread_mutex_t link_lock = PTHREAD_MUTEX_INITIALIZER;
+static link_frame_t link_tx_frame;
+static link_reply_t *link_replies, **link_replies_tail = &link_replies;
+static link_route_t link_routes[LINK_MAX_ROUTES];
+static uint32 link_next_mid;
+static uint32 link_rx_buf_size = LINK_RX_DEFAULT_BUF;
+
+/* the connection whose bytes are being handled, by the thread reading the links */
+static link_conn_t *link_rx_conn = &link_conns[0];
+
+/* frames for the host, written by the writer thread so that threads sending never wait on
+   the link: a lock-free multi-producer queue (producers swap the tail; only the writer
+   takes from the head), bounded in bytes. Past half the bound, each thread is held to its
+   share. write_lock is held while writing, and to change the generation or the state of
+   a connection (link_reset(), link_down()), which signals changed */
+static struct {
+    link_txq_node_t *head;
+    link_txq_node_t *tail;
+    link_txq_node_t stub;
+    uint32 bound;
+    uint32 queued;
+    uint32 overflows;
+    uint32 unfair;
+    int writer_idle;
+    sem_t wake;
+    pthread_key_t self;
+    pthread_mutex_t write_lock;
+    pthread_cond_t changed;
+    link_txq_producer_t producers[LINK_TXQ_MAX_PRODUCERS];
+} link_txq = { .bound = LINK_TXQ_DEFAULT_BOUND, .write_lock = PTHREAD_MUTEX_INITIALIZER,
+               .changed = PTHREAD_COND_INITIALIZER };
+
+/* the module binary received in chunks; only accessed by the thread reading the link, and
+   kept across reconnections, so the host resumes its transfer */
+static struct {
+    uint64_t hash;
+    uint32 size;
+    uint32 received;
+    char *data;
+} link_chunks;
+
+static int link_fd_write(link_conn_t *conn, const struct iovec *iov, int iovcnt);
+#ifndef CONNECTION_UART
+static void link_conn_flush(link_conn_t *conn);
+#endif
+
+static uint64_t link_now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* fields of link messages are in network byte order, and not aligned */
+static uint16 link_get16(const void *p)
+{
+    uint16 v;
+
+    memcpy(&v, p, sizeof(v));
+    return ntohs(v);
+}
+
+static uint32 link_get32(const void *p)
+{
+    uint32 v;
+
+    memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+static void link_put16(void *p, uint16 v)
+{
+    v = htons(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static void link_put32(void *p, uint32 v)
+{
+    v = htonl(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+/**
+ * Check if a message is handled whole (requests, to replace their url, and compressed
+ * messages), rather than passed through as it arrives
+ *
+ * @param type the message type
+ * @param payload_size size of the payload
+ * @param buffer_all set to handle all messages whole (up to LINK_MAX_REQUEST)
+ * @return returns true if the message is handled whole
+ */
+static bool link_frame_whole(uint16 type, uint32 payload_size, bool buffer_all)
+{
+    return ((buffer_all || type == REQUEST_PACKET || type == INSTALL_WASM_BYTECODE_APP)
+            && payload_size <= LINK_MAX_REQUEST)
+           || (type == INSTALL_WASM_BYTECODE_APP && payload_size <= module_store_capacity())
+           || (type == LINK_COMPRESSED_PACKET && payload_size <= LINK_MAX_COMPRESSED);
+}
+
+/**
+ * Feed bytes of the link to a frame
+ *
+ * @param f the frame
+ * @param data the bytes
+ * @param len number of bytes
+ * @param on_bytes called with the bytes of messages passed through
+ * @param on_request called with each complete request packet (header included)
+ */
+static void link_frame_feed(link_frame_t *f, const char *data, uint32 len,
+                            link_frame_bytes_cb on_bytes, link_frame_request_cb on_request)
+{
+    uint32 n;
+    uint16 type;
+    char *buf;
+
+    while (len > 0) {
+        if (f->hdr_len < LINK_HDR_LEN) {
+            f->hdr[f->hdr_len++] = (unsigned char) *data++;
+            len--;
+
+            /* look for the leading bytes */
+            if (f->hdr_len == 1 && f->hdr[0] != 0x12)
+                f->hdr_len = 0;
+            else if (f->hdr_len == 2 && f->hdr[1] != 0x34)
+                f->hdr_len = f->hdr[1] == 0x12 ? 1 : 0;
+            if (f->hdr_len < LINK_HDR_LEN)
+                continue;
+
+            type = link_get16(f->hdr + 2);
+            f->payload_size = link_get32(f->hdr + 4);
+            f->payload_len = 0;
+            f->buffered = link_frame_whole(type, f->payload_size, f->buffer_all);
+
+            if (f->buffered && f->buf_size < LINK_HDR_LEN + f->payload_size) {
+                if ((buf = realloc(f->buf, LINK_HDR_LEN + f->payload_size)) != NULL) {
+                    f->buf = buf;
+                    f->buf_size = LINK_HDR_LEN + f->payload_size;
+                } else
+                    f->buffered = false;
+            }
+
+            if (f->buffered)
+                memcpy(f->buf, f->hdr, LINK_HDR_LEN);
+            else
+                on_bytes((char *) f->hdr, LINK_HDR_LEN);
+        } else {
+            n = f->payload_size - f->payload_len;
+            if (n > len)
+                n = len;
+            if (f->buffered)
+                memcpy(f->buf + LINK_HDR_LEN + f->payload_len, data, n);
+            else
+                on_bytes(data, n);
+            f->payload_len += n;
+            data += n;
+            len -= n;
+        }
+
+        if (f->hdr_len == LINK_HDR_LEN && f->payload_len == f->payload_size) {
+            if (f->buffered)
+                on_request(f->buf, LINK_HDR_LEN + f->payload_size);
+            f->hdr_len = 0;
+        }
+    }
+}
+
+static void link_frame_reset(link_frame_t *f)
+{
+    f->hdr_len = 0;
+}
+
+/**
+ * Get the url of a request packet
+ *
+ * @param frame the request packet, header included
+ * @param len length of the packet
+ * @return returns the url, NULL if malformed
+ */
+static char *link_request_url(char *frame, uint32 len)
+{
+    char *request = frame + LINK_HDR_LEN;
+    uint16 url_len;
+
+    if (len < LINK_HDR_LEN + REQUEST_PACKET_FIX_PART_LEN)
+        return NULL;
+    url_len = link_get16(request + 12);
+    if (url_len == 0 || LINK_HDR_LEN + REQUEST_PACKET_FIX_PART_LEN + url_len > len
+        || request[REQUEST_PACKET_FIX_PART_LEN + url_len - 1] != '\0')
+        return NULL;
+    return request + REQUEST_PACKET_FIX_PART_LEN;
+}
+
+/**
+ * Split a request packet with a new url in iovecs: header, fixed part, url and payload
+ *
+ * @param frame the request packet, header included; its header and fixed part are updated
+ * @param len length of the packet
+ * @param url the new url
+ * @param iov where to store the 3 iovecs
+ */
+static void link_request_set_url(char *frame, uint32 len, const char *url, struct iovec *iov)
+{
+    char *request = frame + LINK_HDR_LEN;
+    uint16 old_url_len = link_get16(request + 12);
+    uint16 url_len = strlen(url) + 1;
+    uint32 payload_len = len - LINK_HDR_LEN - REQUEST_PACKET_FIX_PART_LEN - old_url_len;
+
+    link_put32(frame + 4, REQUEST_PACKET_FIX_PART_LEN + url_len + payload_len);
+    link_put16(request + 12, url_len);
+
+    iov[0].iov_base = frame;
+    iov[0].iov_len = LINK_HDR_LEN + REQUEST_PACKET_FIX_PART_LEN;
+    iov[1].iov_base = (void *) url;
+    iov[1].iov_len = url_len;
+    iov[2].iov_base = request + REQUEST_PACKET_FIX_PART_LEN + old_url_len;
+    iov[2].iov_len = payload_len;
+}
+
+static void link_txq_enqueue(link_txq_node_t *n)
+{
+    link_txq_node_t *prev;
+
+    __atomic_store_n(&n->next, NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&link_txq.tail, n, __ATOMIC_ACQ_REL);
+    /* until this store, the writer sees the queue end at prev */
+    __atomic_store_n(&prev->next, n, __ATOMIC_SEQ_CST);
+}
+
+/* take the oldest frame queued; only called by the writer thread */
+static link_txq_node_t *link_txq_dequeue()
+{
+    link_txq_node_t *head = link_txq.head;
+    link_txq_node_t *next = __atomic_load_n(&head->next, __ATOMIC_SEQ_CST);
+
+    if (head == &link_txq.stub) {
+        if (next == NULL)
+            return NULL;
+        link_txq.head = head = next;
+        next = __atomic_load_n(&head->next, __ATOMIC_SEQ_CST);
+    }
+    if (next != NULL) {
+        link_txq.head = next;
+        return head;
+    }
+
+    /* head is the last frame: a producer may be adding one after it */
+    if (head != __atomic_load_n(&link_txq.tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    link_txq_enqueue(&link_txq.stub);
+    if ((next = __atomic_load_n(&head->next, __ATOMIC_SEQ_CST)) != NULL) {
+        link_txq.head = next;
+        return head;
+    }
+    return NULL;
+}
+
+static void link_txq_producer_release(void *producer)
+{
+    __atomic_sub_fetch(&((link_txq_producer_t *) producer)->in_use, 1, __ATOMIC_RELEASE);
+}
+
+/* get the producer of the calling thread; threads past the table share the first one,
+   whose counters are only updated atomically, as those of the others */
+static link_txq_producer_t *link_txq_producer()
+{
+    link_txq_producer_t *p = pthread_getspecific(link_txq.self);
+    int i, unused;
+
+    if (p != NULL)
+        return p;
+
+    for (i = 1; i < LINK_TXQ_MAX_PRODUCERS; i++) {
+        unused = 0;
+        if (__atomic_compare_exchange_n(&link_txq.producers[i].in_use, &unused, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            p = &link_txq.producers[i];
+            break;
+        }
+    }
+    if (p == NULL) {
+        p = &link_txq.producers[0];
+        __atomic_add_fetch(&p->in_use, 1, __ATOMIC_ACQ_REL);
+    }
+    pthread_setspecific(link_txq.self, p);
+    return p;
+}
+
+/**
+ * Queue bytes for a host; never blocks
+ *
+ * @param conn the connection to the host
+ * @param iov the bytes, copied
+ * @param iovcnt number of iovecs
+ * @param force queue them even over the bound (the rest of a frame partly queued)
+ * @return returns the number of bytes queued, -1 if refused
+ */
+static int link_txq_push(link_conn_t *conn, const struct iovec *iov, int iovcnt, bool force)
+{
+    link_txq_producer_t *p = link_txq_producer();
+    link_txq_node_t *n;
+    uint32 len = 0, queued, active;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    queued = __atomic_load_n(&link_txq.queued, __ATOMIC_RELAXED);
+    if (!force && queued + len > link_txq.bound) {
+        __atomic_add_fetch(&link_txq.overflows, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&p->dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    /* so that one thread sending a burst does not starve the others */
+    if (!force && queued + len > link_txq.bound / 2) {
+        for (i = 0, active = 1; i < LINK_TXQ_MAX_PRODUCERS; i++)
+            if (&link_txq.producers[i] != p && __atomic_load_n(&link_txq.producers[i].queued, __ATOMIC_RELAXED) > 0)
+                active++;
+        if (__atomic_load_n(&p->queued, __ATOMIC_RELAXED) + len > link_txq.bound / active) {
+            __atomic_add_fetch(&link_txq.unfair, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&p->dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+    }
+
+    if ((n = malloc(offsetof(link_txq_node_t, data) + len)) == NULL) {
+        __atomic_add_fetch(&link_txq.overflows, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&p->dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    for (i = 0, len = 0; i < iovcnt; len += iov[i].iov_len, i++)
+        memcpy(n->data + len, iov[i].iov_base, iov[i].iov_len);
+    n->producer = p;
+    n->conn = conn;
+    /* the generation only changes with link_lock held, as when frames are queued */
+    n->generation = conn->generation;
+    n->len = len;
+    n->off = 0;
+
+    __atomic_add_fetch(&link_txq.queued, len, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&p->queued, len, __ATOMIC_RELAXED);
+    link_txq_enqueue(n);
+
+    if (__atomic_exchange_n(&link_txq.writer_idle, 0, __ATOMIC_SEQ_CST))
+        sem_post(&link_txq.wake);
+    return len;
+}
+
+/* queue a frame for a host, if the queue is not over its bound */
+static int link_write(link_conn_t *conn, const struct iovec *iov, int iovcnt)
+{
+    return link_txq_push(conn, iov, iovcnt, false);
+}
+
+/* write the frames of a batch for the connection (client and uart modes), of its current
+   generation. Those of a connection down are dropped: it gets a new generation once reset.
+   If a write fails, the writer waits (without write_lock) for the connection to be lost, or
+   retries after a while */
+static void link_txq_write_conn(link_conn_t *conn, link_txq_node_t **batch, int count)
+{
+    struct iovec iov[LINK_TXQ_MAX_BATCH];
+    struct timespec retry_at;
+    link_txq_node_t *n;
+    int i, iovcnt, ret;
+    uint32 written, generation;
+
+    pthread_mutex_lock(&link_txq.write_lock);
+    for (;;) {
+        for (i = 0, iovcnt = 0; i < count; i++) {
+            n = batch[i];
+            if (n->conn == conn && n->generation == conn->generation && n->off < n->len) {
+                iov[iovcnt].iov_base = n->data + n->off;
+                iov[iovcnt].iov_len = n->len - n->off;
+                iovcnt++;
+            }
+        }
+        if (iovcnt == 0 || !conn->connected)
+            break;
+
+        ret = link_fd_write(conn, iov, iovcnt);
+        if (ret > 0) {
+            for (i = 0, written = ret; i < count && written > 0; i++) {
+                n = batch[i];
+                if (n->conn != conn || n->generation != conn->generation || n->off == n->len)
+                    continue;
+                if (written < n->len - n->off) {
+                    n->off += written;
+                    break;
+                }
+                written -= n->len - n->off;
+                n->off = n->len;
+            }
+            continue;
+        }
+        if (ret < 0 && errno == EINTR)
+            continue;
+
+        /* the connection failing (or being replaced) */
+        generation = conn->generation;
+        clock_gettime(CLOCK_REALTIME, &retry_at);
+        retry_at.tv_sec += 1;
+        while (conn->generation == generation
+               && pthread_cond_timedwait(&link_txq.changed, &link_txq.write_lock, &retry_at) == 0)
+            ;
+    }
+    pthread_mutex_unlock(&link_txq.write_lock);
+}
+
+/* release a frame once written, or dropped */
+static void link_txq_done(link_txq_node_t *n)
+{
+    __atomic_sub_fetch(&link_txq.queued, n->len, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&n->producer->queued, n->len, __ATOMIC_RELAXED);
+    if (n->off == n->len)
+        __atomic_add_fetch(&n->producer->sent, 1, __ATOMIC_RELAXED);
+    free(n);
+}
+
+/* drop the frames a host has not read; write_lock is held */
+static void link_txq_drop_pending(link_conn_t *conn)
+{
+    link_txq_node_t *n;
+
+    while ((n = conn->tx_pending) != NULL) {
+        conn->tx_pending = n->next;
+        link_txq_done(n);
+    }
+    conn->tx_pending_tail = &conn->tx_pending;
+    conn->tx_blocked = false;
+}
+
+#ifndef CONNECTION_UART
+/* give the frames of a batch to their connections (server mode), behind the frames their
+   hosts have not read yet, and write them as far as the fds take them: the writer never
+   waits for a host. The frames taken are set to NULL in the batch */
+static void link_txq_write_multi(link_txq_node_t **batch, int count)
+{
+    link_conn_t *conn;
+    int i;
+
+    pthread_mutex_lock(&link_txq.write_lock);
+    for (i = 0; i < count; i++) {
+        conn = batch[i]->conn;
+        if (!conn->connected || batch[i]->generation != conn->generation)
+            continue;
+        batch[i]->next = NULL;
+        *conn->tx_pending_tail = batch[i];
+        conn->tx_pending_tail = &batch[i]->next;
+        batch[i] = NULL;
+    }
+    for (i = 0; i < link_nconns; i++)
+        if (link_conns[i].tx_pending != NULL && !link_conns[i].tx_blocked)
+            link_conn_flush(&link_conns[i]);
+    pthread_mutex_unlock(&link_txq.write_lock);
+}
 #endif
 
+/* write a batch of frames, connection by connection */
+static void link_txq_write(link_txq_node_t **batch, int count)
+{
+    int i, j;
+
+#ifndef CONNECTION_UART
+    if (link_multi) {
+        link_txq_write_multi(batch, count);
+        return;
+    }
+#endif
+
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < i && batch[j]->conn != batch[i]->conn; j++)
+            ;
+        if (j == i)
+            link_txq_write_conn(batch[i]->conn, batch, count);
+    }
+}
+
+/* thread writing the frames queued for the hosts, several per writev() */
+static void *link_txq_writer(void *arg)
+{
+    link_txq_node_t *batch[LINK_TXQ_MAX_BATCH];
+    uint32 reported = 0, dropped;
+    time_t reported_at = 0;
+    int count, i;
+
+    for (;;) {
+        if ((batch[0] = link_txq_dequeue()) == NULL) {
+            /* producers wake the writer once they find it idle */
+            __atomic_store_n(&link_txq.writer_idle, 1, __ATOMIC_SEQ_CST);
+            if ((batch[0] = link_txq_dequeue()) == NULL) {
+                sem_wait(&link_txq.wake);
+                continue;
+            }
+            __atomic_store_n(&link_txq.writer_idle, 0, __ATOMIC_SEQ_CST);
+        }
+        for (count = 1; count < LINK_TXQ_MAX_BATCH && (batch[count] = link_txq_dequeue()) != NULL; count++)
+            ;
+
+        link_txq_write(batch, count);
+
+        /* the frames not left to a connection */
+        for (i = 0; i < count; i++)
+            if (batch[i] != NULL)
+                link_txq_done(batch[i]);
+
+        dropped = __atomic_load_n(&link_txq.overflows, __ATOMIC_RELAXED) + __atomic_load_n(&link_txq.unfair, __ATOMIC_RELAXED);
+        if (dropped != reported && time(NULL) != reported_at) {
+            printf("Send queue: %u messages dropped (%u over the bound, %u over a thread's share).\n", dropped,
+                   __atomic_load_n(&link_txq.overflows, __ATOMIC_RELAXED), __atomic_load_n(&link_txq.unfair, __ATOMIC_RELAXED));
+            reported = dropped;
+            reported_at = time(NULL);
+        }
+    }
+
+    return NULL;
+}
+
+static bool link_txq_init()
+{
+    link_txq.head = link_txq.tail = &link_txq.stub;
+    return sem_init(&link_txq.wake, 0, 0) == 0
+           && pthread_key_create(&link_txq.self, link_txq_producer_release) == 0;
+}
+
+/* give a request of the connection being read a mid unique among the hosts, to route its
+   response back (server mode) */
+static void link_route_request(char *frame)
+{
+    link_route_t *route;
+
+    pthread_mutex_lock(&link_lock);
+    link_next_mid++;
+    route = &link_routes[link_next_mid % LINK_MAX_ROUTES];
+    route->in_use = true;
+    route->mid = link_next_mid;
+    route->host_mid = link_get32(frame + LINK_HDR_LEN + 4);
+    route->conn = link_rx_conn;
+    route->generation = link_rx_conn->generation;
+    link_put32(frame + LINK_HDR_LEN + 4, link_next_mid);
+    pthread_mutex_unlock(&link_lock);
+}
+
+/**
+ * Find the host a response is for, and give it the mid of the host; link_lock is held
+ *
+ * @param frame the response packet, header included
+ * @param len length of the packet
+ * @return returns the connection to the host, NULL if it is gone (or the request was
+ * not from a host)
+ */
+static link_conn_t *link_route_response(char *frame, uint32 len)
+{
+    link_route_t *route;
+    uint32 mid;
+
+    if (len < LINK_HDR_LEN + 8)
+        return NULL;
+    mid = link_get32(frame + LINK_HDR_LEN + 4);
+    route = &link_routes[mid % LINK_MAX_ROUTES];
+    if (!route->in_use || route->mid != mid) {
+        printf("Dropping response to an unknown request.\n");
+        return NULL;
+    }
+
+    route->in_use = false;
+    if (route->conn == NULL || route->conn->generation != route->generation)
+        return NULL;
+    link_put32(frame + LINK_HDR_LEN + 4, route->host_mid);
+    return route->conn;
+}
+
+/* find an event registered by a host; link_lock is held */
+static link_sub_t **link_sub_find(link_conn_t *conn, const char *event)
+{
+    link_sub_t **sub = &conn->subs;
+
+    while (*sub != NULL && strcmp((*sub)->event, event) != 0)
+        sub = &(*sub)->next;
+    return sub;
+}
+
+/* count the connections other than conn registered for an event; link_lock is held */
+static int link_sub_count(link_conn_t *conn, const char *event)
+{
+    int i, count = 0;
+
+    for (i = 0; i < link_nconns; i++)
+        if (&link_conns[i] != conn && link_conns[i].open && *link_sub_find(&link_conns[i], event) != NULL)
+            count++;
+    return count;
+}
+
+/* give bytes of the link to the app manager, in pieces it accepts */
+static void link_rx_bytes(const char *bytes, uint32 len)
+{
+    uint32 n;
+
+    while (len > 0) {
+        n = len > LINK_MAX_CALLBACK ? LINK_MAX_CALLBACK : len;
+        aee_host_msg_callback((void *) bytes, n);
+        bytes += n;
+        len -= n;
+    }
+}
+
+static void link_tx_request(char *frame, uint32 len);
+
+/* send the replies queued while a frame was being sent, to the hosts of their requests */
+static void link_flush_replies()
+{
+    link_reply_t *r;
+
+    while (link_tx_frame.hdr_len == 0 && (r = link_replies) != NULL) {
+        if ((link_replies = r->next) == NULL)
+            link_replies_tail = &link_replies;
+        link_tx_request(r->packet, sizeof(r->packet));
+        free(r);
+    }
+}
+
+/* answer a request packet with an empty response, from the link layer */
+static void link_reply(const char *request, uint8 status)
+{
+    link_reply_t *r;
+
+    if ((r = calloc(1, sizeof(link_reply_t))) == NULL)
+        return;
+    r->packet[0] = 0x12;
+    r->packet[1] = 0x34;
+    link_put16(r->packet + 2, RESPONSE_PACKET);
+    link_put32(r->packet + 4, RESPONSE_PACKET_FIX_PART_LEN);
+    r->packet[LINK_HDR_LEN] = 1; /* version */
+    r->packet[LINK_HDR_LEN + 1] = status;
+    memcpy(r->packet + LINK_HDR_LEN + 4, request + 4, 4); /* mid */
+    memcpy(r->packet + LINK_HDR_LEN + 8, request + 8, 4); /* sender of the request */
+
+    /* the app manager may be in the middle of sending a frame */
+    pthread_mutex_lock(&link_lock);
+    *link_replies_tail = r;
+    link_replies_tail = &r->next;
+    link_flush_replies();
+    pthread_mutex_unlock(&link_lock);
+}
+
+static void link_chunks_drop()
+{
+    free(link_chunks.data);
+    memset(&link_chunks, 0, sizeof(link_chunks));
+}
+
+/* receive a chunk of a module binary, and acknowledge it */
+static void link_rx_chunk(char *frame, uint32 len, const char *url)
+{
+    char *request = frame + LINK_HDR_LEN;
+    uint16 url_len = link_get16(request + 12);
+    uint32 n = len - LINK_HDR_LEN - REQUEST_PACKET_FIX_PART_LEN - url_len, size, offset;
+    char hex[MODULE_HASH_HEX_LEN + 1];
+    uint64_t hash;
+
+    if (sscanf(url, MODULE_CHUNK_URL_SCAN, hex, &size, &offset) != 3 || module_hash_parse(hex, &hash) != 0
+        || size == 0 || size > LINK_MAX_CHUNKED_MODULE || offset > size || n > size - offset) {
+        link_reply(request, BAD_REQUEST_4_00);
+        return;
+    }
+
+    /* a transfer starts at offset 0, replacing the previous one */
+    if (offset == 0) {
+        link_chunks_drop();
+        if ((link_chunks.data = malloc(size)) == NULL) {
+            link_reply(request, REQUEST_ENTITY_TOO_LARGE_4_13);
+            return;
+        }
+        link_chunks.hash = hash;
+        link_chunks.size = size;
+    } else if (link_chunks.data == NULL || link_chunks.hash != hash || link_chunks.size != size
+               || link_chunks.received != offset) {
+        link_reply(request, PRECONDITION_FAILED_4_12);
+        return;
+    }
+
+    memcpy(link_chunks.data + offset, request + REQUEST_PACKET_FIX_PART_LEN + url_len, n);
+    link_chunks.received += n;
+
+    if (link_chunks.received == size && module_hash(link_chunks.data, size) != hash) {
+        printf("Module binary received in chunks does not match its hash.\n");
+        link_chunks_drop();
+        link_reply(request, NOT_ACCEPTABLE_4_06);
+        return;
+    }
+    link_reply(request, CHANGED_2_04);
+}
+
+/* keep the binary of an install, or install a binary kept (or received in chunks) if the
+   request only has its hash */
+static void link_rx_install(char *frame, uint32 len, const char *url)
+{
+    char *request = frame + LINK_HDR_LEN;
+    uint16 url_len = link_get16(request + 12);
+    uint32 payload_len = len - LINK_HDR_LEN - REQUEST_PACKET_FIX_PART_LEN - url_len, size;
+    const char *key = strstr(url, MODULE_HASH_URL_KEY), *data;
+    uint64_t hash;
+
+    if (payload_len > 0) {
+        if (payload_len <= module_store_capacity())
+            module_store_add(module_hash(request + REQUEST_PACKET_FIX_PART_LEN + url_len, payload_len),
+                             request + REQUEST_PACKET_FIX_PART_LEN + url_len, payload_len);
+        link_rx_bytes(frame, len);
+        return;
+    }
+
+    if (key == NULL || module_hash_parse(key + strlen(MODULE_HASH_URL_KEY), &hash) != 0) {
+        link_rx_bytes(frame, len);
+        return;
+    }
+
+    if ((data = module_store_get(hash, &size)) == NULL) {
+        if (link_chunks.data == NULL || link_chunks.hash != hash || link_chunks.received != link_chunks.size) {
+            /* the host sends the binary again */
+            link_reply(request, NOT_FOUND_4_04);
+            return;
+        }
+        data = link_chunks.data;
+        size = link_chunks.size;
+    }
+
+    link_put32(frame + 4, REQUEST_PACKET_FIX_PART_LEN + url_len + size);
+    link_put32(request + 14, size);
+    link_rx_bytes(frame, len);
+    link_rx_bytes(data, size);
+
+    if (data == link_chunks.data) {
+        module_store_add(hash, data, size);
+        link_chunks_drop();
+    }
+}
+
+static void link_rx_request(char *frame, uint32 len);
+
+/**
+ * Track the events a host registers for (server mode); the app manager registers the
+ * hosts once, so only the first registration and the last unregistration reach it
+ *
+ * @param request the request packet (header excluded)
+ * @param url the url of the request (/event/<event>)
+ * @param add set for a registration, clear for an unregistration
+ * @return returns true if the request was answered, false if it is for the app manager
+ */
+static bool link_rx_subscribe(const char *request, const char *url, bool add)
+{
+    const char *event = url + strlen("/event/");
+    link_conn_t *conn = link_rx_conn;
+    link_sub_t **found, *sub;
+    int others;
+
+    while (*event == '/')
+        event++;
+
+    pthread_mutex_lock(&link_lock);
+    others = link_sub_count(conn, event);
+    found = link_sub_find(conn, event);
+    if (add && *found == NULL && (sub = malloc(offsetof(link_sub_t, event) + strlen(event) + 1)) != NULL) {
+        strcpy(sub->event, event);
+        sub->next = NULL;
+        *found = sub;
+    } else if (!add && (sub = *found) != NULL) {
+        *found = sub->next;
+        free(sub);
+    }
+    pthread_mutex_unlock(&link_lock);
+
+    if (others == 0)
+        return false;
+    link_reply(request, add ? CREATED_2_01 : DELETED_2_02);
+    return true;
+}
+
+/* unregister an event no host is registered for anymore (server mode) */
+static void link_rx_unsubscribe(const char *event)
+{
+    char frame[LINK_HDR_LEN + REQUEST_PACKET_FIX_PART_LEN + TOPIC_ALIAS_URL_BUF_SIZE] = { 0 };
+    uint16 url_len = snprintf(frame + LINK_HDR_LEN + REQUEST_PACKET_FIX_PART_LEN, TOPIC_ALIAS_URL_BUF_SIZE,
+                              "/event/%s", event) + 1;
+    link_route_t *route;
+
+    if (url_len > TOPIC_ALIAS_URL_BUF_SIZE)
+        return;
+
+    frame[0] = 0x12;
+    frame[1] = 0x34;
+    link_put16(frame + 2, REQUEST_PACKET);
+    link_put32(frame + 4, REQUEST_PACKET_FIX_PART_LEN + url_len);
+    frame[LINK_HDR_LEN] = 1; /* version */
+    frame[LINK_HDR_LEN + 1] = COAP_DELETE;
+    link_put16(frame + LINK_HDR_LEN + 12, url_len);
+
+    /* its response is dropped */
+    pthread_mutex_lock(&link_lock);
+    link_next_mid++;
+    route = &link_routes[link_next_mid % LINK_MAX_ROUTES];
+    memset(route, 0, sizeof(*route));
+    route->in_use = true;
+    route->mid = link_next_mid;
+    link_put32(frame + LINK_HDR_LEN + 4, link_next_mid);
+    pthread_mutex_unlock(&link_lock);
+
+    link_rx_bytes(frame, LINK_HDR_LEN + REQUEST_PACKET_FIX_PART_LEN + url_len);
+}
+
+/* decompress a message received, and handle it as if received as it is */
+static void link_rx_compressed(char *frame, uint32 len)
+{
+    char *payload = frame + LINK_HDR_LEN, *buf;
+    uint16 type;
+    uint32 size;
+
+    if (len < LINK_HDR_LEN + LINK_COMPRESS_HDR_LEN)
+        return;
+    type = link_get16(payload);
+    size = link_get32(payload + 2);
+    if (type == LINK_COMPRESSED_PACKET || size == 0 || size > LINK_MAX_CHUNKED_MODULE
+        || (buf = malloc(LINK_HDR_LEN + size)) == NULL) {
+        printf("Dropping compressed message.\n");
+        return;
+    }
+
+    if (link_decompress(payload + LINK_COMPRESS_HDR_LEN, len - LINK_HDR_LEN - LINK_COMPRESS_HDR_LEN,
+                        buf + LINK_HDR_LEN, size) != 0) {
+        printf("Dropping malformed compressed message.\n");
+    } else {
+        memcpy(buf, frame, 2);
+        link_put16(buf + 2, type);
+        link_put32(buf + 4, size);
+        if (type == REQUEST_PACKET || type == INSTALL_WASM_BYTECODE_APP)
+            link_rx_request(buf, LINK_HDR_LEN + size);
+        else
+            link_rx_bytes(buf, LINK_HDR_LEN + size);
+    }
+    free(buf);
+}
+
+/* resolve the url of a request packet received, and give it to the app manager */
+static void link_rx_request(char *frame, uint32 len)
+{
+    char *wire_url, *payload;
+    const char *url;
+    struct iovec iov[3];
+    int ret, i;
+
+    if (link_get16(frame + 2) == LINK_COMPRESSED_PACKET) {
+        link_rx_compressed(frame, len);
+        return;
+    }
+
+    /* hosts may use the same mids; events get no response */
+    if (link_multi && len >= LINK_HDR_LEN + 8 && (uint8) frame[LINK_HDR_LEN + 1] != COAP_EVENT_PUB)
+        link_route_request(frame);
+
+    if ((wire_url = link_request_url(frame, len)) == NULL) {
+        link_rx_bytes(frame, len);
+        return;
+    }
+
+    if ((uint8) frame[LINK_HDR_LEN + 1] == COAP_PUT && strncmp(wire_url, MODULE_CHUNK_URL "?", strlen(MODULE_CHUNK_URL "?")) == 0) {
+        link_rx_chunk(frame, len, wire_url);
+        return;
+    }
+
+    /* installs are not aliased */
+    if (link_get16(frame + 2) == INSTALL_WASM_BYTECODE_APP
+        || ((uint8) frame[LINK_HDR_LEN + 1] == COAP_PUT && strncmp(wire_url, "/applet", 7) == 0)) {
+        link_rx_install(frame, len, wire_url);
+        return;
+    }
+
+    pthread_mutex_lock(&link_lock);
+    ret = topic_alias_decode(&link_rx_conn->aliases, wire_url, &url);
+    pthread_mutex_unlock(&link_lock);
+
+    /* the host reads compressed messages */
+    if ((ret == TOPIC_ALIAS_NONE || ret == TOPIC_ALIAS_RESOLVED)
+        && (uint8) frame[LINK_HDR_LEN + 1] == COAP_EVENT_PUB && strcmp(url, LINK_COMPRESS_HELLO_URL) == 0) {
+        payload = wire_url + link_get16(frame + LINK_HDR_LEN + 12);
+        pthread_mutex_lock(&link_lock);
+        link_rx_conn->compress_peer = frame + len - payload == strlen(LINK_COMPRESS_CODEC)
+                                      && memcmp(payload, LINK_COMPRESS_CODEC, strlen(LINK_COMPRESS_CODEC)) == 0;
+        pthread_mutex_unlock(&link_lock);
+        return;
+    }
+
+    if (link_multi && (ret == TOPIC_ALIAS_NONE || ret == TOPIC_ALIAS_RESOLVED)
+        && ((uint8) frame[LINK_HDR_LEN + 1] == COAP_PUT || (uint8) frame[LINK_HDR_LEN + 1] == COAP_DELETE)
+        && strncmp(url, "/event/", strlen("/event/")) == 0
+        && link_rx_subscribe(frame + LINK_HDR_LEN, url, (uint8) frame[LINK_HDR_LEN + 1] == COAP_PUT))
+        return;
+
+    if (ret == TOPIC_ALIAS_NONE) {
+        link_rx_bytes(frame, len);
+    } else if (ret == TOPIC_ALIAS_RESOLVED) {
+        /* the rx aliases are only changed by this thread */
+        link_request_set_url(frame, len, url, iov);
+        for (i = 0; i < 3; i++)
+            link_rx_bytes(iov[i].iov_base, iov[i].iov_len);
+    } else if (ret == TOPIC_ALIAS_ERROR) {
+        printf("Dropping request with unknown topic alias.\n");
+    }
+}
+
+/* allocate the receive buffer of a connection */
+static bool link_rx_buf_init(link_rx_buf_t *b)
+{
+    if (b->buf == NULL && (b->buf = malloc(link_rx_buf_size)) == NULL)
+        return false;
+    b->size = link_rx_buf_size;
+    b->head = b->tail = 0;
+    return true;
+}
+
+/* make room for a frame larger than the buffer, so it is given whole to the app manager */
+static bool link_rx_buf_grow(link_rx_buf_t *b, uint32 size)
+{
+    char *buf;
+
+    if (size > LINK_HDR_LEN + LINK_MAX_CHUNKED_MODULE)
+        return false;
+
+    memmove(b->buf, b->buf + b->head, b->tail - b->head);
+    b->tail -= b->head;
+    b->head = 0;
+    if ((buf = realloc(b->buf, size)) == NULL)
+        return false;
+    b->buf = buf;
+    b->size = size;
+    return true;
+}
+
+/**
+ * Get where to read bytes from a host: the space after the bytes not yet parsed
+ *
+ * @param conn the connection to the host
+ * @param len where to store the size of the space (never 0)
+ * @return returns the space
+ */
+static char *link_rx_space(link_conn_t *conn, uint32 *len)
+{
+    link_rx_buf_t *b = &conn->rx_buf;
+    char *buf;
+
+    if (b->head == b->tail) {
+        b->head = b->tail = 0;
+        /* back to its size after a large frame */
+        if (b->size > link_rx_buf_size && (buf = realloc(b->buf, link_rx_buf_size)) != NULL) {
+            b->buf = buf;
+            b->size = link_rx_buf_size;
+        }
+    } else if (b->head > 0 && b->size - b->tail < b->size / 2) {
+        /* the frame arriving (not larger than the buffer) may not fit after it */
+        memmove(b->buf, b->buf + b->head, b->tail - b->head);
+        b->tail -= b->head;
+        b->head = 0;
+    }
+
+    *len = b->size - b->tail;
+    return b->buf + b->tail;
+}
+
+/* handle bytes read from a host, in the space given by link_rx_space() */
+static void link_rx_received(link_conn_t *conn, uint32 len)
+{
+    link_rx_buf_t *b = &conn->rx_buf;
+    link_frame_t *f = &conn->rx_frame;
+    char *p, *sync;
+    uint32 avail, payload_size;
+    uint16 type;
+
+    link_rx_conn = conn;
+    b->tail += len;
+
+    while (b->head < b->tail) {
+        p = b->buf + b->head;
+        avail = b->tail - b->head;
+
+        /* the rest of a frame larger than the buffer */
+        if (f->hdr_len == LINK_HDR_LEN) {
+            len = f->payload_size - f->payload_len;
+            if (len > avail)
+                len = avail;
+            link_frame_feed(f, p, len, link_rx_bytes, link_rx_request);
+            b->head += len;
+            continue;
+        }
+
+        /* look for the leading bytes */
+        if ((uint8) p[0] != 0x12 || (avail > 1 && (uint8) p[1] != 0x34)) {
+            sync = memchr(p + 1, 0x12, avail - 1);
+            b->head = sync != NULL ? sync - b->buf : b->tail;
+            continue;
+        }
+        if (avail < LINK_HDR_LEN)
+            break;
+
+        type = link_get16(p + 2);
+        payload_size = link_get32(p + 4);
+        if (payload_size <= avail - LINK_HDR_LEN) {
+            /* with several hosts, all requests are routed */
+            if (link_frame_whole(type, payload_size, false)
+                || (link_multi && (type == REQUEST_PACKET || type == INSTALL_WASM_BYTECODE_APP)))
+                link_rx_request(p, LINK_HDR_LEN + payload_size);
+            else
+                link_rx_bytes(p, LINK_HDR_LEN + payload_size);
+            b->head += LINK_HDR_LEN + payload_size;
+        } else if (payload_size > b->size - LINK_HDR_LEN
+                   /* the frames of several hosts must not interleave */
+                   && !(link_multi && link_rx_buf_grow(b, LINK_HDR_LEN + payload_size))) {
+            link_frame_feed(f, p, LINK_HDR_LEN, link_rx_bytes, link_rx_request);
+            b->head += LINK_HDR_LEN;
+        } else {
+            /* wait for the rest of the frame */
+            break;
+        }
+    }
+}
+
+/* send bytes of a frame passed through to the hosts; once its header is queued, the rest of
+   the frame is queued too, and if it was refused, the rest is dropped too */
+static void link_tx_bytes(const char *bytes, uint32 len)
+{
+    struct iovec iov = { (void *) bytes, len };
+    link_conn_t *conn;
+    int i;
+
+    for (i = 0; i < link_nconns; i++) {
+        conn = &link_conns[i];
+        if (!conn->open)
+            continue;
+        if (bytes == (char *) link_tx_frame.hdr)
+            conn->tx_refused = link_txq_push(conn, &iov, 1, false) < 0;
+        else if (!conn->tx_refused)
+            link_txq_push(conn, &iov, 1, true);
+    }
+}
+
+/* send a frame to a host, compressed if the host reads compressed messages and it is smaller */
+static int link_write_frame(link_conn_t *conn, const struct iovec *iov, int iovcnt)
+{
+    uint32 len = 0, zlen = 0, n;
+    char *frame = NULL, *z = NULL;
+    struct iovec ziov;
+    int ret, i;
+
+    for (i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    if (conn->compress_peer && link_compress_threshold > 0 && len - LINK_HDR_LEN >= link_compress_threshold
+        && len - LINK_HDR_LEN > LINK_COMPRESS_HDR_LEN
+        && (frame = malloc(len)) != NULL && (z = malloc(len)) != NULL) {
+        for (i = 0, n = 0; i < iovcnt; n += iov[i].iov_len, i++)
+            memcpy(frame + n, iov[i].iov_base, iov[i].iov_len);
+        zlen = link_compress(frame + LINK_HDR_LEN, len - LINK_HDR_LEN, z + LINK_HDR_LEN + LINK_COMPRESS_HDR_LEN,
+                             len - LINK_HDR_LEN - LINK_COMPRESS_HDR_LEN);
+    }
+
+    if (zlen == 0) {
+        ret = link_write(conn, iov, iovcnt);
+    } else {
+        /* the original type and size follow the header */
+        memcpy(z, frame, 2);
+        link_put16(z + 2, LINK_COMPRESSED_PACKET);
+        link_put32(z + 4, LINK_COMPRESS_HDR_LEN + zlen);
+        memcpy(z + LINK_HDR_LEN, frame + 2, LINK_COMPRESS_HDR_LEN);
+        ziov.iov_base = z;
+        ziov.iov_len = LINK_HDR_LEN + LINK_COMPRESS_HDR_LEN + zlen;
+        ret = link_write(conn, &ziov, 1);
+    }
+    free(frame);
+    free(z);
+    return ret;
+}
+
+/* send a frame buffered whole to a host; the url of request packets is replaced by its alias */
+static void link_tx_conn(link_conn_t *conn, char *frame, uint32 len)
+{
+    char *url = link_get16(frame + 2) == REQUEST_PACKET ? link_request_url(frame, len) : NULL;
+    char buf[TOPIC_ALIAS_URL_BUF_SIZE];
+    const char *wire_url;
+    struct iovec iov[3];
+    uint32 size;
+    uint16 url_len;
+
+    /* only events published by the modules are aliased */
+    if (url == NULL || (uint8) frame[LINK_HDR_LEN + 1] != COAP_EVENT_PUB
+        || (wire_url = topic_alias_encode(&conn->aliases, url, buf)) == url) {
+        iov[0].iov_base = frame;
+        iov[0].iov_len = len;
+        link_write_frame(conn, iov, 1);
+        return;
+    }
+
+    /* the frame is kept as it is, for the other hosts */
+    size = link_get32(frame + 4);
+    url_len = link_get16(frame + LINK_HDR_LEN + 12);
+    link_request_set_url(frame, len, wire_url, iov);
+    if (link_write_frame(conn, iov, 3) <= 0)
+        topic_alias_unsent(&conn->aliases, url);
+    link_put32(frame + 4, size);
+    link_put16(frame + LINK_HDR_LEN + 12, url_len);
+}
+
+/* send a frame buffered whole to the hosts: a response to the host of the request, an
+   event to the hosts registered for it (or for no event), other messages to all */
+static void link_tx_request(char *frame, uint32 len)
+{
+    const char *event = NULL;
+    link_conn_t *conn;
+    int i;
+
+    if (!link_multi) {
+        link_tx_conn(&link_conns[0], frame, len);
+        return;
+    }
+
+    if (link_get16(frame + 2) == RESPONSE_PACKET) {
+        if ((conn = link_route_response(frame, len)) != NULL && conn->open)
+            link_tx_conn(conn, frame, len);
+        return;
+    }
+
+    if (link_get16(frame + 2) == REQUEST_PACKET && (uint8) frame[LINK_HDR_LEN + 1] == COAP_EVENT_PUB
+        && (event = link_request_url(frame, len)) != NULL) {
+        while (*event == '/')
+            event++;
+    }
+
+    for (i = 0; i < link_nconns; i++) {
+        conn = &link_conns[i];
+        if (conn->open && (event == NULL || conn->subs == NULL || *link_sub_find(conn, event) != NULL))
+            link_tx_conn(conn, frame, len);
+    }
+}
+
+/* send bytes from the app manager to the hosts; frames are reassembled to alias their urls,
+   and all of them to route them with several hosts */
+static int link_send(const char *buf, int size)
+{
+    pthread_mutex_lock(&link_lock);
+    link_tx_frame.buffer_all = link_multi || (link_conns[0].compress_peer && link_compress_threshold > 0);
+    link_frame_feed(&link_tx_frame, buf, size, link_tx_bytes, link_tx_request);
+    link_flush_replies();
+    pthread_mutex_unlock(&link_lock);
+
+    return size;
+}
+
+/* send a request packet of the link layer to a host (an event: no response is expected) */
+static void link_write_event(link_conn_t *conn, const char *url, const char *payload, uint32 payload_len)
+{
+    char hdr[LINK_HDR_LEN + REQUEST_PACKET_FIX_PART_LEN] = { 0 };
+    uint16 url_len = strlen(url) + 1;
+    struct iovec iov[3] = { { hdr, sizeof(hdr) }, { (void *) url, url_len }, { (void *) payload, payload_len } };
+
+    hdr[0] = 0x12;
+    hdr[1] = 0x34;
+    link_put16(hdr + 2, REQUEST_PACKET);
+    link_put32(hdr + 4, REQUEST_PACKET_FIX_PART_LEN + url_len + payload_len);
+    hdr[LINK_HDR_LEN] = 1; /* version */
+    hdr[LINK_HDR_LEN + 1] = COAP_EVENT_PUB;
+    link_put16(hdr + LINK_HDR_LEN + 12, url_len);
+    link_put32(hdr + LINK_HDR_LEN + 14, payload_len);
+
+    link_write(conn, iov, payload_len > 0 ? 3 : 2);
+}
+
+/* forget the state of a link after (re)connecting, tell the host aliases are understood,
+   and report the module binaries kept and the one being received in chunks */
+static void link_reset(link_conn_t *conn)
+{
+    uint32 report_len = 0, progress_len = 0;
+    char *report = module_store_report(&report_len);
+    char progress[MODULE_HASH_HEX_LEN + 12], hex[MODULE_HASH_HEX_LEN + 1];
+    link_reply_t *r;
+
+    if (link_chunks.data != NULL) {
+        module_hash_format(link_chunks.hash, hex);
+        progress_len = snprintf(progress, sizeof(progress), MODULE_CHUNK_PROGRESS_FMT, hex, link_chunks.received);
+    }
+
+    link_frame_reset(&conn->rx_frame);
+    conn->rx_buf.head = conn->rx_buf.tail = 0;
+
+    pthread_mutex_lock(&link_lock);
+    /* with several hosts, the others keep their frame and replies */
+    if (!link_multi) {
+        link_frame_reset(&link_tx_frame);
+        while ((r = link_replies) != NULL) {
+            link_replies = r->next;
+            free(r);
+        }
+        link_replies_tail = &link_replies;
+    }
+    /* the writer drops the frames queued for the previous connection */
+    pthread_mutex_lock(&link_txq.write_lock);
+    conn->generation++;
+    conn->connected = true;
+    pthread_cond_broadcast(&link_txq.changed);
+    pthread_mutex_unlock(&link_txq.write_lock);
+    conn->open = true;
+    topic_alias_reset(&conn->aliases);
+    conn->compress_peer = false;
+    /* the host gets the frames from the next one */
+    conn->tx_refused = link_tx_frame.hdr_len > 0;
+
+    link_write_event(conn, TOPIC_ALIAS_HELLO_URL, NULL, 0);
+    if (report != NULL)
+        link_write_event(conn, MODULE_HASH_REPORT_URL, report, report_len);
+    link_write_event(conn, MODULE_CHUNK_PROGRESS_URL, progress, progress_len);
+    link_write_event(conn, LINK_COMPRESS_HELLO_URL, LINK_COMPRESS_CODEC, strlen(LINK_COMPRESS_CODEC));
+    pthread_mutex_unlock(&link_lock);
+
+    free(report);
+}
+
+/* stop writing to a host until the link is reset, once the connection is lost; the frames
+   queued for it are dropped */
+static void link_down(link_conn_t *conn)
+{
+    pthread_mutex_lock(&link_lock);
+    if (link_multi)
+        conn->open = false;
+    pthread_mutex_lock(&link_txq.write_lock);
+    conn->generation++;
+    conn->connected = false;
+    link_txq_drop_pending(conn);
+    pthread_cond_broadcast(&link_txq.changed);
+    pthread_mutex_unlock(&link_txq.write_lock);
+    pthread_mutex_unlock(&link_lock);
+}
+
 #ifndef CONNECTION_UART
 static bool server_mode = false;
 
 // Function designed for chat between client and server.
 void* func(void* arg)
 {
-    char buff[MAX];
+    char *buff;
+    uint32 len;
     int n;
     struct sockaddr_in servaddr;
 
@@ -90,21 +1520,21 @@ void* func(void* arg)
         } else {
             printf("connected to the server..\n");
         }
+        link_reset(&link_conns[0]);
 
         // infinite loop for chat
         for (;;) {
-            bzero(buff, MAX);
-
-            // read the message from client and copy it in buffer
-            n = read(sockfd, buff, sizeof(buff));
-            // print buffer which contains the client contents
-            //fprintf(stderr, "recieved %d bytes from host: %s", n, buff);
+            // read as much as the buffer takes, parsed where it lands
+            buff = link_rx_space(&link_conns[0], &len);
+            n = read(sockfd, buff, len);
 
             // socket disconnected
-            if (n <= 0)
+            if (n <= 0) {
+                link_down(&link_conns[0]);
                 break;
+            }
 
-            aee_host_msg_callback(buff, n);
+            link_rx_received(&link_conns[0], n);
         }
     }
 
@@ -117,7 +1547,88 @@ static bool host_init()
     return true;
 }
 
-int host_send(void * ctx, const char *buf, int size)
+/* epoll of the server mode */
+static int link_epfd = -1;
+
+/* watch a host's fd for room to write, or stop */
+static void link_conn_watch_out(link_conn_t *conn, bool out)
+{
+    struct epoll_event ev;
+
+    ev.events = out ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.ptr = conn;
+    epoll_ctl(link_epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+/* write the frames a host has not read yet, as far as its fd (non-blocking) takes them;
+   write_lock is held. Once the fd is full, the server's epoll reports when it has room */
+static void link_conn_flush(link_conn_t *conn)
+{
+    struct iovec iov[LINK_TXQ_MAX_BATCH];
+    link_txq_node_t *n;
+    int iovcnt, ret;
+    uint32 written;
+
+    while (conn->tx_pending != NULL) {
+        for (n = conn->tx_pending, iovcnt = 0; n != NULL && iovcnt < LINK_TXQ_MAX_BATCH; n = n->next, iovcnt++) {
+            iov[iovcnt].iov_base = n->data + n->off;
+            iov[iovcnt].iov_len = n->len - n->off;
+        }
+
+        if ((ret = writev(conn->fd, iov, iovcnt)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                if (!conn->tx_blocked) {
+                    conn->tx_blocked = true;
+                    conn->tx_blocked_ms = link_now_ms();
+                    link_conn_watch_out(conn, true);
+                }
+                return;
+            }
+            /* the reader gets the error too, and closes the connection */
+            shutdown(conn->fd, SHUT_RDWR);
+            link_txq_drop_pending(conn);
+            return;
+        }
+
+        for (written = ret; (n = conn->tx_pending) != NULL && written >= n->len - n->off; ) {
+            written -= n->len - n->off;
+            n->off = n->len;
+            conn->tx_pending = n->next;
+            link_txq_done(n);
+        }
+        if (n != NULL)
+            n->off += written;
+        if (conn->tx_blocked)
+            conn->tx_blocked_ms = link_now_ms();
+    }
+
+    conn->tx_pending_tail = &conn->tx_pending;
+    if (conn->tx_blocked) {
+        conn->tx_blocked = false;
+        link_conn_watch_out(conn, false);
+    }
+}
+
+/* disconnect the hosts not reading for LINK_CONN_WRITE_TIMEOUT_MS */
+static void link_conn_check_blocked()
+{
+    uint64_t now = link_now_ms();
+    int i;
+
+    pthread_mutex_lock(&link_txq.write_lock);
+    for (i = 0; i < link_nconns; i++) {
+        if (link_conns[i].tx_blocked && now - link_conns[i].tx_blocked_ms >= LINK_CONN_WRITE_TIMEOUT_MS) {
+            printf("Host not reading, disconnecting it.\n");
+            shutdown(link_conns[i].fd, SHUT_RDWR);
+            link_txq_drop_pending(&link_conns[i]);
+        }
+    }
+    pthread_mutex_unlock(&link_txq.write_lock);
+}
+
+static int link_fd_write(link_conn_t *conn, const struct iovec *iov, int iovcnt)
 {
     int ret;
 
@@ -127,7 +1638,7 @@ int host_send(void * ctx, const char *buf, int size)
             return 0;
         }
 
-        ret = write(sockfd, buf, size);
+        ret = writev(sockfd, iov, iovcnt);
 
         pthread_mutex_unlock(&sock_lock);
         return ret;
@@ -136,10 +1647,21 @@ int host_send(void * ctx, const char *buf, int size)
     return -1;
 }
 
+int host_send(void * ctx, const char *buf, int size)
+{
+    return link_send(buf, size);
+}
+
 void host_destroy()
 {
-    if (server_mode)
+    int i;
+
+    if (server_mode) {
         close(listenfd);
+        for (i = 0; i < link_nconns; i++)
+            if (link_conns[i].fd >= 0)
+                shutdown(link_conns[i].fd, SHUT_RDWR);
+    }
 
     pthread_mutex_lock(&sock_lock);
     close(sockfd);
@@ -152,12 +1674,62 @@ host_interface interface = {
     .destroy = host_destroy
 };
 
+/* take a host connected in server mode, if there is room for it */
+static link_conn_t *link_conn_accept(int fd)
+{
+    link_conn_t *conn;
+    int i;
+
+    for (i = 0; i < link_nconns; i++) {
+        conn = &link_conns[i];
+        if (conn->fd == -1) {
+            if (!link_rx_buf_init(&conn->rx_buf))
+                return NULL;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+            conn->fd = fd;
+            return conn;
+        }
+    }
+    return NULL;
+}
+
+/* close the connection to a host of the server mode; the events only it registered for are unregistered */
+static void link_conn_close(link_conn_t *conn)
+{
+    link_sub_t *subs, *sub;
+    int others;
+
+    /* no more frames are queued for it, nor written to its fd */
+    link_down(conn);
+    close(conn->fd);
+    conn->fd = -1;
+
+    pthread_mutex_lock(&link_lock);
+    subs = conn->subs;
+    conn->subs = NULL;
+    pthread_mutex_unlock(&link_lock);
+
+    while ((sub = subs) != NULL) {
+        subs = sub->next;
+        pthread_mutex_lock(&link_lock);
+        others = link_sub_count(conn, sub->event);
+        pthread_mutex_unlock(&link_lock);
+        if (others == 0)
+            link_rx_unsubscribe(sub->event);
+        free(sub);
+    }
+}
+
+/* serve several hosts: a bridge, a standby bridge, a monitoring client... */
 void* func_server_mode(void* arg)
 {
     int clilent;
     struct sockaddr_in serv_addr, cli_addr;
-    int n;
-    char buff[MAX];
+    struct epoll_event ev, events[LINK_MAX_CONNS + 1];
+    link_conn_t *conn;
+    int n, fd, epfd, nevents, i;
+    char *buff;
+    uint32 len;
 
     struct sigaction sa;
     sa.sa_handler = SIG_IGN;
@@ -184,41 +1756,67 @@ void* func_server_mode(void* arg)
         exit(1);
     }
 
-    listen(listenfd, 5);
+    listen(listenfd, SOMAXCONN);
     clilent = sizeof(cli_addr);
 
-    while (1) {
-        pthread_mutex_lock(&sock_lock);
-
-        sockfd = accept(listenfd, (struct sockaddr *) &cli_addr, &clilent);
-
-        pthread_mutex_unlock(&sock_lock);
-
-        if (sockfd < 0) {
-            perror("ERROR on accept");
-            exit(1);
-        }
+    if ((epfd = link_epfd = epoll_create1(0)) < 0) {
+        perror("ERROR creating epoll");
+        exit(1);
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
 
-        printf("connection established!\n");
+    while (1) {
+        /* woken up now and then to disconnect hosts not reading */
+        nevents = epoll_wait(epfd, events, LINK_MAX_CONNS + 1, LINK_CONN_WRITE_TIMEOUT_MS / 5);
+        link_conn_check_blocked();
+
+        for (i = 0; i < nevents; i++) {
+            /* a new host */
+            if ((conn = events[i].data.ptr) == NULL) {
+                if ((fd = accept(listenfd, (struct sockaddr *) &cli_addr, &clilent)) < 0) {
+                    perror("ERROR on accept");
+                    continue;
+                }
+                if ((conn = link_conn_accept(fd)) == NULL) {
+                    printf("Too many hosts connected, refusing one.\n");
+                    close(fd);
+                    continue;
+                }
+                ev.events = EPOLLIN;
+                ev.data.ptr = conn;
+                epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+
+                printf("connection established!\n");
+                link_reset(conn);
+                continue;
+            }
 
-        for (;;) {
-            bzero(buff, MAX);
+            /* room to write the frames the host has not read */
+            if (events[i].events & EPOLLOUT) {
+                pthread_mutex_lock(&link_txq.write_lock);
+                if (conn->tx_blocked)
+                    link_conn_flush(conn);
+                pthread_mutex_unlock(&link_txq.write_lock);
+                if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                    continue;
+            }
 
-            // read the message from client and copy it in buffer
-            n = read(sockfd, buff, sizeof(buff));
+            // read as much as the buffer takes, parsed where it lands
+            buff = link_rx_space(conn, &len);
+            n = read(conn->fd, buff, len);
+            if (n < 0 && (errno == EAGAIN || errno == EINTR))
+                continue;
 
             // socket disconnected
             if (n <= 0) {
-                pthread_mutex_lock(&sock_lock);
-                close(sockfd);
-                sockfd = -1;
-                pthread_mutex_unlock(&sock_lock);
-
-                sleep(1);
-                break;
+                printf("connection closed.\n");
+                link_conn_close(conn);
+                continue;
             }
 
-            aee_host_msg_callback(buff, n);
+            link_rx_received(conn, n);
         }
     }
 }
@@ -298,40 +1896,181 @@ static bool uart_init(const char *device, int baudrate, int *fd)
     return true;
 }
 
+/* write frames of the link layer to the uart */
+static int link_arq_uart_write(void *arg, const char *buf, uint32_t len)
+{
+    int n;
+
+    while ((n = write(uartfd, buf, len)) < 0 && errno == EINTR)
+        ;
+    return n;
+}
+
+/* move the bytes pending into the window, and send the frames due; link_arq_lock is held */
+static void link_arq_pump()
+{
+    link_arq_pending_t *p;
+
+    while ((p = link_arq_pending) != NULL) {
+        p->off += link_arq_send(&link_arq, p->data + p->off, p->len - p->off);
+        if (p->off < p->len)
+            break;
+        if ((link_arq_pending = p->next) == NULL)
+            link_arq_pending_tail = &link_arq_pending;
+        free(p);
+    }
+
+    if (link_arq_flush(&link_arq, link_now_ms()) < 0)
+        printf("Write to uart failed.\n");
+}
+
+/* drop the bytes pending; link_arq_lock is held */
+static void link_arq_drop_pending()
+{
+    link_arq_pending_t *p;
+
+    while ((p = link_arq_pending) != NULL) {
+        link_arq_pending = p->next;
+        free(p);
+    }
+    link_arq_pending_tail = &link_arq_pending;
+}
+
+/* handle bytes read from the uart by the link layer; the stream received is read into the receive buffer */
+static void link_arq_recv(const char *buf, int len)
+{
+    char *stream;
+    uint32 size;
+    uint32_t n;
+    int reset;
+
+    pthread_mutex_lock(&link_arq_lock);
+    link_arq_input(&link_arq, buf, len, link_now_ms());
+    /* the host restarted: what it did not acknowledge is lost */
+    if ((reset = link_arq_peer_reset(&link_arq)))
+        link_arq_drop_pending();
+    link_arq_pump();
+    pthread_mutex_unlock(&link_arq_lock);
+
+    if (reset) {
+        printf("Host link restarted.\n");
+        link_reset(&link_conns[0]);
+    }
+
+    for (;;) {
+        stream = link_rx_space(&link_conns[0], &size);
+        pthread_mutex_lock(&link_arq_lock);
+        n = link_arq_read(&link_arq, stream, size);
+        pthread_mutex_unlock(&link_arq_lock);
+        if (n == 0)
+            break;
+        link_rx_received(&link_conns[0], n);
+    }
+}
+
 static void *func_uart_mode(void *arg)
 {
     int n;
-    char buff[MAX];
+    uint32_t wait_ms;
+    uint32 len;
+    char frames[MAX], *buff;
+    struct pollfd pfd;
 
     if (!uart_init(uart_device, baudrate, &uartfd)) {
         printf("open uart fail! %s\n", uart_device);
         return NULL;
     }
 
+    if (link_window > 0
+        && link_arq_init(&link_arq, link_window, LINK_ARQ_DEFAULT_MTU,
+                         link_arq_rto(link_baud, link_window, LINK_ARQ_DEFAULT_MTU),
+                         link_arq_uart_write, NULL) != 0) {
+        printf("Invalid reliable link window: %d\n", link_window);
+        link_window = 0;
+    }
+
+    link_reset(&link_conns[0]);
+
+    pfd.fd = uartfd;
+    pfd.events = POLLIN;
+
     for (;;) {
-        bzero(buff, MAX);
+        /* frames of the link layer are read aside; the stream, as much as the buffer takes */
+        if (link_window > 0) {
+            buff = frames;
+            len = sizeof(frames);
+        } else {
+            buff = link_rx_space(&link_conns[0], &len);
+        }
+
+        /* frames not acknowledged are sent again on timeout */
+        if (link_window > 0) {
+            pthread_mutex_lock(&link_arq_lock);
+            link_arq_pump();
+            wait_ms = link_arq_timeout(&link_arq, link_now_ms());
+            pthread_mutex_unlock(&link_arq_lock);
+
+            if (poll(&pfd, 1, wait_ms > 100 ? 100 : (int) wait_ms) <= 0)
+                continue;
+        }
 
-        n = read(uartfd, buff, sizeof(buff));
+        n = read(uartfd, buff, len);
 
         if (n <= 0) {
+            link_down(&link_conns[0]);
             close(uartfd);
             uartfd = -1;
             break;
         }
 
-        aee_host_msg_callback(buff, n);
+        if (link_window > 0)
+            link_arq_recv(buff, n);
+        else
+            link_rx_received(&link_conns[0], n);
     }
 
     return NULL;
 }
 
-static int uart_send(void * ctx, const char *buf, int size)
+static int link_fd_write(link_conn_t *conn, const struct iovec *iov, int iovcnt)
 {
-    int ret;
+    link_arq_pending_t *p;
+    uint32 len = 0, taken;
+    int i;
+
+    if (link_window == 0)
+        return writev(uartfd, iov, iovcnt);
+
+    /* the bytes the window does not take are kept in order, and sent as it frees */
+    pthread_mutex_lock(&link_arq_lock);
+    for (i = 0; i < iovcnt; i++) {
+        taken = 0;
+        if (link_arq_pending == NULL)
+            taken = link_arq_send(&link_arq, iov[i].iov_base, iov[i].iov_len);
+
+        if (taken < iov[i].iov_len) {
+            if ((p = malloc(offsetof(link_arq_pending_t, data) + iov[i].iov_len - taken)) == NULL) {
+                printf("Out of memory, dropping link bytes.\n");
+                break;
+            }
+            p->next = NULL;
+            p->len = iov[i].iov_len - taken;
+            p->off = 0;
+            memcpy(p->data, (char *) iov[i].iov_base + taken, p->len);
+            *link_arq_pending_tail = p;
+            link_arq_pending_tail = &p->next;
+        }
+        len += iov[i].iov_len;
+    }
+    link_arq_pump();
+    pthread_mutex_unlock(&link_arq_lock);
 
-    ret = write(uartfd, buf, size);
+    return len;
+}
 
-    return ret;
+static int uart_send(void * ctx, const char *buf, int size)
+{
+    return link_send(buf, size);
 }
 
 static void uart_destroy()
@@ -343,7 +2082,10 @@ static host_interface interface = { .send = uart_send, .destroy = uart_destroy }
 
 #endif
 
-static char global_heap_buf[512 * 1024] = { 0 };
+/* the heap all modules are allocated from */
+static uint32 heap_size = RUNTIME_HEAP_DEFAULT_SIZE;
+static uint64_t heap_limit;
+static runtime_heap_pages_t heap_pages = RUNTIME_HEAP_PAGES_NORMAL;
 
 static void showUsage()
 {
@@ -353,6 +2095,8 @@ static void showUsage()
      printf("\tsimple -s|--server_mode -p|--port <Port>\n");
      printf("where\n");
      printf("\t<Port> represents the port that would be listened on and the default is 8888\n");
+     printf("\tup to %d hosts are served at once; responses go back to the host that sent the request,\n", LINK_MAX_CONNS);
+     printf("\tand events to the hosts registered for them\n");
      printf("\nWork as TCP client mode:\n");
      printf("\tsimple -a|--host_address <Host Address> -p|--port <Port>\n");
      printf("where\n");
@@ -364,7 +2108,25 @@ static void showUsage()
      printf("where\n");
      printf("\t<Uart Device> represents the UART device name and the default is /dev/ttyS2\n");
      printf("\t<Baudrate> represents the UART device baudrate and the default is 115200\n");
+     printf("\t-r|--reliable <Frames> sends over a link layer with CRC-checked frames, acknowledged\n");
+     printf("\t\tand sent again if lost, up to <Frames> at once (at most %d); the host must enable it\n", LINK_ARQ_MAX_WINDOW);
+     printf("\t\ttoo (link-window), and the default is 0 (disabled)\n");
 #endif
+     printf("\nOptions:\n");
+     printf("\t-m|--module-cache <Bytes> bytes of module binaries kept to be installed again without\n");
+     printf("\t\tbeing sent by the host; 0 keeps none, and the default is %d\n", MODULE_STORE_DEFAULT_CAPACITY);
+     printf("\t-z|--compress <Bytes> messages of this size or larger are compressed, if the host reads them;\n");
+     printf("\t\t0 disables, and the default is %u\n", link_compress_threshold);
+     printf("\t-q|--send-queue <Bytes> bytes of messages to the host queued while the link is busy; past\n");
+     printf("\t\thalf of it, each thread is held to its share, and the default is %d\n", LINK_TXQ_DEFAULT_BOUND);
+     printf("\t-H|--heap <Bytes> size of the heap modules are allocated from (at least %d); it grows in\n", RUNTIME_HEAP_MIN_SIZE);
+     printf("\t\tfurther pools when full, and the default is %d\n", RUNTIME_HEAP_DEFAULT_SIZE);
+     printf("\t-M|--heap-limit <Bytes> bytes the heap grows to at most; 0 for no limit (the default)\n");
+     printf("\t-g|--huge-pages <none|thp|hugetlb> pages backing the heap: normal pages (the default),\n");
+     printf("\t\ttransparent huge pages, or huge pages reserved by the system (vm.nr_hugepages)\n");
+     printf("\t-l|--link-buffer <Bytes> size of the buffer of bytes read from the host (at least %d); larger\n", MAX);
+     printf("\t\tmessages are handled as they arrive (in server mode, it grows to hold them), and the\n");
+     printf("\t\tdefault is %d\n", LINK_RX_DEFAULT_BUF);
 }
 
 static bool parse_args(int argc, char *argv[])
@@ -381,12 +2143,20 @@ static bool parse_args(int argc, char *argv[])
 #else
             { "uart",           required_argument, NULL, 'u' },
             { "baudrate",       required_argument, NULL, 'b' },
+            { "reliable",       required_argument, NULL, 'r' },
 #endif
+            { "module-cache",   required_argument, NULL, 'm' },
+            { "compress",       required_argument, NULL, 'z' },
+            { "link-buffer",    required_argument, NULL, 'l' },
+            { "send-queue",     required_argument, NULL, 'q' },
+            { "heap",           required_argument, NULL, 'H' },
+            { "heap-limit",     required_argument, NULL, 'M' },
+            { "huge-pages",     required_argument, NULL, 'g' },
             { "help",           required_argument, NULL, 'h' },
             { 0, 0, 0, 0 } 
         };
 
-        c = getopt_long(argc, argv, "sa:p:u:b:h", longOpts, &optIndex);
+        c = getopt_long(argc, argv, "sa:p:u:b:r:m:z:l:q:H:M:g:h", longOpts, &optIndex);
         if (c == -1)
             break;
 
@@ -410,9 +2180,67 @@ static bool parse_args(int argc, char *argv[])
                 break;
             case 'b':
                 baudrate = parse_baudrate(atoi(optarg));
+                link_baud = atoi(optarg);
                 printf("uart baudrate: %s\n", optarg);
                 break;
+            case 'r':
+                if (atoi(optarg) < 0 || atoi(optarg) > LINK_ARQ_MAX_WINDOW) {
+                    printf("Invalid reliable link window: %s\n", optarg);
+                    return false;
+                }
+                link_window = atoi(optarg);
+                printf("reliable link window: %s frames\n", optarg);
+                break;
 #endif
+            case 'm':
+                module_store_init(atoi(optarg));
+                printf("module cache: %s bytes\n", optarg);
+                break;
+            case 'z':
+                link_compress_threshold = atoi(optarg);
+                printf("compress threshold: %s bytes\n", optarg);
+                break;
+            case 'l':
+                if (atoi(optarg) < MAX) {
+                    printf("Invalid link buffer size: %s\n", optarg);
+                    return false;
+                }
+                link_rx_buf_size = atoi(optarg);
+                printf("link buffer: %s bytes\n", optarg);
+                break;
+            case 'q':
+                if (atoi(optarg) <= 0) {
+                    printf("Invalid send queue size: %s\n", optarg);
+                    return false;
+                }
+                link_txq.bound = atoi(optarg);
+                printf("send queue: %s bytes\n", optarg);
+                break;
+            case 'H':
+                if (atoi(optarg) < RUNTIME_HEAP_MIN_SIZE) {
+                    printf("Invalid heap size: %s\n", optarg);
+                    return false;
+                }
+                heap_size = atoi(optarg);
+                printf("heap: %s bytes\n", optarg);
+                break;
+            case 'M':
+                heap_limit = strtoull(optarg, NULL, 0);
+                printf("heap limit: %s bytes\n", optarg);
+                break;
+            case 'g':
+                if (strcmp(optarg, "none") == 0)
+                    heap_pages = RUNTIME_HEAP_PAGES_NORMAL;
+                else if (strcmp(optarg, "thp") == 0)
+                    heap_pages = RUNTIME_HEAP_PAGES_THP;
+                else if (strcmp(optarg, "hugetlb") == 0)
+                    heap_pages = RUNTIME_HEAP_PAGES_HUGETLB;
+                else {
+                    printf("Invalid huge pages: %s\n", optarg);
+                    return false;
+                }
+                printf("huge pages: %s\n", optarg);
+                break;
             case 'h':
                 showUsage();
                 return false;
@@ -429,13 +2257,24 @@ static bool parse_args(int argc, char *argv[])
 int iwasm_main(int argc, char *argv[])
 {
     korp_thread tid;
+    int i;
 
     if (!parse_args(argc, argv))
         return -1;
 
-    if (bh_memory_init_with_pool(global_heap_buf, sizeof(global_heap_buf))
-            != 0) {
+    if (heap_limit > 0 && heap_limit < heap_size) {
+        printf("Heap limit below the heap size.\n");
+        return -1;
+    }
+
+    if (!runtime_heap_init(heap_size, heap_limit, heap_pages)) {
+        printf("Map global heap failed.\n");
+        return -1;
+    }
+
+    if (bh_memory_init_with_allocator(runtime_heap_malloc, runtime_heap_free) != 0) {
         printf("Init global heap failed.\n");
+        runtime_heap_destroy();
         return -1;
     }
 
@@ -453,6 +2292,31 @@ int iwasm_main(int argc, char *argv[])
     // timer manager
     init_wasm_timer();
 
+#ifndef CONNECTION_UART
+    if (server_mode) {
+        link_multi = true;
+        link_nconns = LINK_MAX_CONNS;
+    }
+#endif
+    for (i = 0; i < link_nconns; i++) {
+        link_conns[i].fd = -1;
+        link_conns[i].tx_pending_tail = &link_conns[i].tx_pending;
+        topic_alias_init(&link_conns[i].aliases);
+    }
+
+    /* the connection of the client and uart modes; the hosts of the server mode get theirs once connected */
+    if (!link_multi && !link_rx_buf_init(&link_conns[0].rx_buf)) {
+        printf("Allocate link buffer failed.\n");
+        goto fail1;
+    }
+    link_conns[0].open = !link_multi;
+
+    if (!link_txq_init()) {
+        printf("Init send queue failed.\n");
+        goto fail1;
+    }
+    vm_thread_create(&tid, link_txq_writer, NULL, BH_APPLET_PRESERVED_STACK_SIZE);
+
 #ifndef CONNECTION_UART
     if (server_mode)
         vm_thread_create(&tid, func_server_mode, NULL,
@@ -467,5 +2331,7 @@ int iwasm_main(int argc, char *argv[])
     app_manager_startup(&interface);
 
     fail1: bh_memory_destroy();
+    runtime_heap_report();
+    runtime_heap_destroy();
     return -1;
 }
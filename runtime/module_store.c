@@ -0,0 +1,105 @@
+/** @file module_store.c
+ *  @brief Module binaries kept by the runtime
+ *
+ *  Binaries are kept in a list, most recently used first.
+ *
+ *  @date July, 2019
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "module_store.h"
+#include "module_hash.h"
+
+struct module_blob {
+    struct module_blob *next;
+    uint64_t hash;
+    uint32_t size;
+    char data[];
+};
+
+static struct module_blob *blobs;
+static uint32_t blobs_size, capacity = MODULE_STORE_DEFAULT_CAPACITY;
+
+void module_store_init(uint32_t bytes)
+{
+    capacity = bytes;
+}
+
+uint32_t module_store_capacity()
+{
+    return capacity;
+}
+
+/* find a binary and move it to the front of the list */
+static struct module_blob *module_store_find(uint64_t hash)
+{
+    struct module_blob **p, *b;
+
+    for (p = &blobs; (b = *p) != NULL; p = &b->next) {
+        if (b->hash == hash) {
+            *p = b->next;
+            b->next = blobs;
+            blobs = b;
+            return b;
+        }
+    }
+    return NULL;
+}
+
+void module_store_add(uint64_t hash, const char *data, uint32_t size)
+{
+    struct module_blob **p, *b;
+
+    if (size > capacity || module_store_find(hash) != NULL)
+        return;
+
+    /* drop the least recently used binaries (at the end of the list) until it fits */
+    while (blobs_size + size > capacity) {
+        for (p = &blobs; (*p)->next != NULL; p = &(*p)->next)
+            ;
+        blobs_size -= (*p)->size;
+        free(*p);
+        *p = NULL;
+    }
+
+    if ((b = malloc(sizeof(struct module_blob) + size)) == NULL)
+        return;
+    b->hash = hash;
+    b->size = size;
+    memcpy(b->data, data, size);
+    b->next = blobs;
+    blobs = b;
+    blobs_size += size;
+}
+
+const char *module_store_get(uint64_t hash, uint32_t *size)
+{
+    struct module_blob *b = module_store_find(hash);
+
+    if (b == NULL)
+        return NULL;
+    *size = b->size;
+    return b->data;
+}
+
+char *module_store_report(uint32_t *size)
+{
+    struct module_blob *b;
+    uint32_t n = 0;
+    char *report, *p;
+
+    for (b = blobs; b != NULL; b = b->next)
+        n++;
+    if (n == 0 || (report = malloc(n * (MODULE_HASH_HEX_LEN + 1))) == NULL)
+        return NULL;
+
+    for (b = blobs, p = report; b != NULL; b = b->next) {
+        module_hash_format(b->hash, p);
+        p[MODULE_HASH_HEX_LEN] = ',';
+        p += MODULE_HASH_HEX_LEN + 1;
+    }
+    /* no ',' after the last one */
+    *size = n * (MODULE_HASH_HEX_LEN + 1) - 1;
+    return report;
+}
@@ -0,0 +1,60 @@
+ /** @file module_store.h
+ *  @brief Definitions for the module binaries kept by the runtime
+ *
+ *  Definitions for keeping the module binaries installed, by hash (see
+ *  module_hash.h), so the host can install them again without sending them.
+ *  The least recently used binaries are dropped beyond the capacity.
+ *
+ *  Only called from the thread reading the host link.
+ *
+ *  @date July, 2019
+ */
+#ifndef MODULE_STORE_H_
+#define MODULE_STORE_H_
+
+#include <stdint.h>
+
+/* default bytes of binaries kept */
+#define MODULE_STORE_DEFAULT_CAPACITY (1024 * 1024)
+
+/**
+ * Set the bytes of binaries kept; 0 keeps none
+ *
+ * @param capacity the capacity
+ */
+void module_store_init(uint32_t capacity);
+
+/**
+ * Get the bytes of binaries kept
+ *
+ * @return returns the capacity
+ */
+uint32_t module_store_capacity();
+
+/**
+ * Keep a binary (copied), dropping the least recently used ones if needed
+ *
+ * @param hash hash of the binary
+ * @param data the binary
+ * @param size size of the binary
+ */
+void module_store_add(uint64_t hash, const char *data, uint32_t size);
+
+/**
+ * Get a binary kept
+ *
+ * @param hash hash of the binary
+ * @param size where to store the size of the binary
+ * @return returns the binary (valid until the next module_store_add()), NULL if not kept
+ */
+const char *module_store_get(uint64_t hash, uint32_t *size);
+
+/**
+ * Write the hashes of the binaries kept, as in a MODULE_HASH_REPORT_URL payload
+ *
+ * @param size where to store the length of the report
+ * @return returns the report (release with free()), NULL if no binaries are kept or on error
+ */
+char *module_store_report(uint32_t *size);
+
+#endif
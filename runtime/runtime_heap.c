@@ -0,0 +1,223 @@
+/** @file runtime_heap.c
+ *  @brief Heap of the runtime
+ *
+ *  Each pool is managed by an allocator of the runtime's mem-alloc library;
+ *  allocations are tried in the pools in the order they were mapped. A block
+ *  starts with its size, to keep track of the bytes in use.
+ *
+ *  @date July, 2019
+ */
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "runtime_heap.h"
+#include "mem_alloc.h"
+
+/* size of huge pages (x86, arm64 with 4K pages) */
+#define RUNTIME_HEAP_HUGEPAGE (2 * 1024 * 1024)
+
+/* bytes of a pool taken by its allocator */
+#define RUNTIME_HEAP_POOL_OVERHEAD (16 * 1024)
+
+/* largest pool, so sizes fit the allocator (and 32-bit builds) */
+#define RUNTIME_HEAP_MAX_POOL_SIZE (1024 * 1024 * 1024)
+
+typedef union {
+    uint32_t size;
+    /* blocks stay 8-byte aligned */
+    uint64_t align;
+} heap_block_t;
+
+struct heap_pool {
+    char *base;
+    size_t size;
+    mem_allocator_t allocator;
+};
+
+static struct heap_pool pools[RUNTIME_HEAP_MAX_POOLS];
+static int npools;
+static runtime_heap_pages_t heap_pages;
+static uint64_t heap_limit, in_use, peak, mapped, report_at;
+static uint32_t failed;
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t heap_round(size_t size, size_t page)
+{
+    return (size + page - 1) / page * page;
+}
+
+/* map memory for a pool; size is rounded to the pages used */
+static char *heap_map(size_t *size)
+{
+    size_t len;
+    char *p, *aligned;
+
+#ifdef MAP_HUGETLB
+    if (heap_pages == RUNTIME_HEAP_PAGES_HUGETLB) {
+        len = heap_round(*size, RUNTIME_HEAP_HUGEPAGE);
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            *size = len;
+            return p;
+        }
+        printf("Not enough huge pages for the runtime heap, using normal pages.\n");
+    }
+#endif
+
+#ifdef MADV_HUGEPAGE
+    if (heap_pages == RUNTIME_HEAP_PAGES_THP) {
+        /* aligned to huge pages, so all of it can be backed by them */
+        len = heap_round(*size, RUNTIME_HEAP_HUGEPAGE);
+        p = mmap(NULL, len + RUNTIME_HEAP_HUGEPAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+        aligned = (char *) heap_round((uintptr_t) p, RUNTIME_HEAP_HUGEPAGE);
+        if (aligned > p)
+            munmap(p, aligned - p);
+        munmap(aligned + len, p + RUNTIME_HEAP_HUGEPAGE - aligned);
+        madvise(aligned, len, MADV_HUGEPAGE);
+        *size = len;
+        return aligned;
+    }
+#endif
+
+    len = heap_round(*size, sysconf(_SC_PAGESIZE));
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    *size = len;
+    return p;
+}
+
+/* print the usage; heap_lock is held */
+static void heap_report()
+{
+    printf("Runtime heap: %llu bytes in use, high-water mark %llu bytes, %llu bytes in %d pools",
+           (unsigned long long) in_use, (unsigned long long) peak, (unsigned long long) mapped, npools);
+    if (failed > 0)
+        printf(", %u allocations failed", failed);
+    printf(".\n");
+}
+
+/**
+ * Map a pool; heap_lock is held (or the heap is being initialized)
+ *
+ * @param size bytes of the pool, made larger to fit needed, smaller to fit the limit
+ * @param needed bytes the pool must have room for
+ * @return returns the pool, NULL if it could not be mapped
+ */
+static struct heap_pool *heap_grow(size_t size, size_t needed)
+{
+    struct heap_pool *pool = &pools[npools];
+
+    if (npools == RUNTIME_HEAP_MAX_POOLS || needed > RUNTIME_HEAP_MAX_POOL_SIZE - RUNTIME_HEAP_POOL_OVERHEAD)
+        return NULL;
+    if (size > RUNTIME_HEAP_MAX_POOL_SIZE)
+        size = RUNTIME_HEAP_MAX_POOL_SIZE;
+    if (size < needed + RUNTIME_HEAP_POOL_OVERHEAD)
+        size = needed + RUNTIME_HEAP_POOL_OVERHEAD;
+    if (heap_limit > 0 && mapped + size > heap_limit) {
+        if (mapped + needed + RUNTIME_HEAP_POOL_OVERHEAD > heap_limit)
+            return NULL;
+        size = heap_limit - mapped;
+    }
+
+    if ((pool->base = heap_map(&size)) == NULL)
+        return NULL;
+    if ((pool->allocator = mem_allocator_create(pool->base, size)) == NULL) {
+        munmap(pool->base, size);
+        return NULL;
+    }
+    pool->size = size;
+    mapped += size;
+    npools++;
+    return pool;
+}
+
+bool runtime_heap_init(uint32_t size, uint64_t limit, runtime_heap_pages_t pages)
+{
+    heap_pages = pages;
+    heap_limit = limit;
+    if (heap_grow(size < RUNTIME_HEAP_MIN_SIZE ? RUNTIME_HEAP_MIN_SIZE : size, 0) == NULL)
+        return false;
+    report_at = mapped / 2;
+    return true;
+}
+
+void runtime_heap_destroy()
+{
+    pthread_mutex_lock(&heap_lock);
+    while (npools > 0) {
+        npools--;
+        mem_allocator_destroy(pools[npools].allocator);
+        munmap(pools[npools].base, pools[npools].size);
+    }
+    mapped = 0;
+    pthread_mutex_unlock(&heap_lock);
+}
+
+void *runtime_heap_malloc(unsigned int size)
+{
+    heap_block_t *b = NULL;
+    struct heap_pool *pool;
+    bool grown = false;
+    int i;
+
+    pthread_mutex_lock(&heap_lock);
+    if (size <= RUNTIME_HEAP_MAX_POOL_SIZE) {
+        for (i = 0; i < npools && b == NULL; i++)
+            b = mem_allocator_malloc(pools[i].allocator, sizeof(heap_block_t) + size);
+        if (b == NULL && npools > 0
+            && (pool = heap_grow(pools[npools - 1].size * 2, sizeof(heap_block_t) + size)) != NULL) {
+            b = mem_allocator_malloc(pool->allocator, sizeof(heap_block_t) + size);
+            grown = true;
+        }
+    }
+
+    if (b == NULL) {
+        failed++;
+        printf("Runtime heap full, %u bytes not allocated.\n", size);
+        pthread_mutex_unlock(&heap_lock);
+        return NULL;
+    }
+
+    b->size = size;
+    in_use += size;
+    if (in_use > peak)
+        peak = in_use;
+    /* when the heap grows, and each time the high-water mark passes another quarter of it */
+    if (grown || peak >= report_at) {
+        heap_report();
+        report_at = peak + mapped / 4;
+    }
+    pthread_mutex_unlock(&heap_lock);
+    return b + 1;
+}
+
+void runtime_heap_free(void *ptr)
+{
+    heap_block_t *b = (heap_block_t *) ptr - 1;
+    int i;
+
+    if (ptr == NULL)
+        return;
+
+    pthread_mutex_lock(&heap_lock);
+    for (i = 0; i < npools; i++) {
+        if ((char *) b >= pools[i].base && (char *) b < pools[i].base + pools[i].size) {
+            in_use -= b->size;
+            mem_allocator_free(pools[i].allocator, b);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+void runtime_heap_report()
+{
+    pthread_mutex_lock(&heap_lock);
+    heap_report();
+    pthread_mutex_unlock(&heap_lock);
+}
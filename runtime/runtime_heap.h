@@ -0,0 +1,73 @@
+ /** @file runtime_heap.h
+ *  @brief Definitions for the heap of the runtime
+ *
+ *  Definitions for the heap the modules (linear memories, app heaps) and the
+ *  runtime's messages are allocated from. It starts as one pool of mapped
+ *  memory, optionally backed by huge pages, and maps further pools (each twice
+ *  the size of the previous one) when it runs out, up to an optional limit.
+ *  Pages of a pool are only backed by memory once used.
+ *
+ *  The high-water mark is reported as it grows.
+ *
+ *  @date July, 2019
+ */
+#ifndef RUNTIME_HEAP_H_
+#define RUNTIME_HEAP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* default bytes of the first pool */
+#define RUNTIME_HEAP_DEFAULT_SIZE (512 * 1024)
+
+/* smallest pool */
+#define RUNTIME_HEAP_MIN_SIZE (64 * 1024)
+
+/* pools mapped at most */
+#define RUNTIME_HEAP_MAX_POOLS 16
+
+/* pages backing the pools */
+typedef enum {
+    RUNTIME_HEAP_PAGES_NORMAL = 0,
+    /* transparent huge pages, where the kernel has them */
+    RUNTIME_HEAP_PAGES_THP,
+    /* huge pages reserved by the system (vm.nr_hugepages); normal pages if there are not enough */
+    RUNTIME_HEAP_PAGES_HUGETLB
+} runtime_heap_pages_t;
+
+/**
+ * Map the first pool of the heap
+ *
+ * @param size bytes of the first pool (at least RUNTIME_HEAP_MIN_SIZE)
+ * @param limit bytes mapped at most, once grown (the last pool is rounded up to pages); 0 for no limit
+ * @param pages pages backing the pools
+ * @return returns true on success
+ */
+bool runtime_heap_init(uint32_t size, uint64_t limit, runtime_heap_pages_t pages);
+
+/**
+ * Unmap the pools of the heap
+ */
+void runtime_heap_destroy();
+
+/**
+ * Allocate from the heap, mapping a pool if none has room
+ *
+ * @param size bytes to allocate
+ * @return returns the memory, NULL if the heap is full
+ */
+void *runtime_heap_malloc(unsigned int size);
+
+/**
+ * Release memory allocated from the heap
+ *
+ * @param ptr the memory (may be NULL)
+ */
+void runtime_heap_free(void *ptr);
+
+/**
+ * Print the usage of the heap
+ */
+void runtime_heap_report();
+
+#endif
@@ -3,20 +3,24 @@
 
 void mqtt_evt_handler(request_t *request)
 {
-    char *msg;
     attr_container_t *payload;
 
     printf("### event handler for 'alert/overheat' called\n");
 
-    if (request->payload += NULL || request->fmt != FMT_ATTR_CONTAINER) return;
+    if (request->payload == NULL) return;
+
+    // if messages sent to the topic are *not json*, they are delivered as the bytes received
+    if (request->fmt == FMT_APP_RAW_BINARY) {
+        printf("got %d bytes: %.*s\n", request->payload_len, request->payload_len, (char *) request->payload);
+        return;
+    }
+
+    if (request->fmt != FMT_ATTR_CONTAINER) return;
     payload = (attr_container_t *) request->payload;
 
     // print contents of payload with arbritary attributes
     // attr_container_dump(payload);
 
-    // if messages sent to the topic are *not json*, they are delivered inside an attribute "raw_str"
-    msg = attr_container_get_as_string(payload, "raw_str");
-
     // if messages sent to the topic *are* json, they are accessed according to the object attributes
     // e.g. for a json message:
     //      { "x": 5, "y": 10 }, 
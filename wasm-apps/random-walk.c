@@ -18,12 +18,8 @@ float x=0, z=1;
 void timer1_update(user_timer_t timer)
 {
     char str_x[20], str_y[20], str_z[20];
-    attr_container_t *msg;
     char str_msg[STR_MAX_LEN];    
 
-    // use an attribute container to send a json formatted message
-    msg = attr_container_create("msg"); // "msg" is the attribute container tag; not forwarded to mqtt
-
     x += (((double)rand() / (double)RAND_MAX) - 0.5) / 2.0;
     z += (((double)rand() / (double)RAND_MAX) - 0.5) / 2.0; 
 
@@ -32,13 +28,8 @@ void timer1_update(user_timer_t timer)
     gcvt(z, 5, str_z); 
     snprintf(str_msg, STR_MAX_LEN, MSG_FORMAT_STR, obj_name, str_x, str_z);
 
-    // publish message
-    attr_container_set_string(&msg, "raw_str", str_msg);     
-
-    mqtt_publish(topic, FMT_ATTR_CONTAINER, msg,
-            attr_container_get_serialize_length(msg));
-
-    attr_container_destroy(msg);
+    // publish message; the string is forwarded to mqtt as it is
+    mqtt_publish_raw(topic, str_msg, strlen(str_msg));
 }
 
 void start_timer()